@@ -0,0 +1,228 @@
+#!/bin/bash
+
+# ft_irc Hostname Lookup Tester
+# Runs the server against a stub nameserver (a few lines of python3) and
+# checks a full lookup round-trip, PTR then forward-confirming A, and that
+# registration goes ahead without a hostname when the nameserver is silent.
+
+# Color codes for output
+RED='\033[0;31m'
+GREEN='\033[0;32m'
+YELLOW='\033[1;33m'
+BLUE='\033[0;34m'
+NC='\033[0m' # No Color
+
+# Test configuration
+SERVER_HOST="127.0.0.1"
+SERVER_PORT="6667"
+DNS_PORT="5353"
+SERVER_PASSWORD="testpass"
+STUB_HOSTNAME="stub.ircserv.test"
+LOOKUP_TIMEOUT_MS=1000
+SERVER_BIN="$(pwd)/ircserv"
+WORK_DIR=""
+
+# Test results tracking
+TOTAL_TESTS=0
+PASSED_TESTS=0
+FAILED_TESTS=0
+
+# Function to print colored output
+print_status() {
+    local status=$1
+    local message=$2
+    case $status in
+        "PASS")
+            echo -e "${GREEN}[PASS]${NC} $message"
+            ((PASSED_TESTS++))
+            ((TOTAL_TESTS++))
+            ;;
+        "FAIL")
+            echo -e "${RED}[FAIL]${NC} $message"
+            ((FAILED_TESTS++))
+            ((TOTAL_TESTS++))
+            ;;
+        "INFO")
+            echo -e "${BLUE}[INFO]${NC} $message"
+            ;;
+    esac
+}
+
+# Function to check a condition and report it
+check() {
+    local message=$1
+    shift
+    if "$@"; then
+        print_status "PASS" "$message"
+    else
+        print_status "FAIL" "$message"
+    fi
+}
+
+# Function to start the stub nameserver. $1: "answer" maps 127.0.0.1 to
+# STUB_HOSTNAME and back, "silent" logs queries and never replies
+start_stub() {
+    python3 - "$1" "$DNS_PORT" "$STUB_HOSTNAME" "$WORK_DIR/queries.log" <<'EOF' &
+import socket, struct, sys
+mode, port, hostname, log_path = sys.argv[1], int(sys.argv[2]), sys.argv[3], sys.argv[4]
+sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+sock.bind(('127.0.0.1', port))
+log = open(log_path, 'a')
+
+def encode(name):
+    return b''.join(bytes([len(label)]) + label.encode() for label in name.split('.')) + b'\0'
+
+while True:
+    query, peer = sock.recvfrom(512)
+    offset, labels = 12, []
+    while query[offset]:
+        labels.append(query[offset + 1:offset + 1 + query[offset]].decode())
+        offset += 1 + query[offset]
+    qtype = struct.unpack('>H', query[offset + 1:offset + 3])[0]
+    log.write('%s %d\n' % ('.'.join(labels), qtype))
+    log.flush()
+    if mode == 'silent':
+        continue
+    answer = b''
+    if qtype == 12:
+        answer = b'\xc0\x0c' + struct.pack('>HHIH', 12, 1, 60, len(encode(hostname))) + encode(hostname)
+    elif qtype == 1:
+        answer = b'\xc0\x0c' + struct.pack('>HHIH', 1, 1, 60, 4) + socket.inet_aton('127.0.0.1')
+    flags = 0x8180 if answer else 0x8183
+    header = struct.pack('>HHHHHH', struct.unpack('>H', query[:2])[0], flags, 1, 1 if answer else 0, 0, 0)
+    sock.sendto(header + query[12:offset + 5] + answer, peer)
+EOF
+    STUB_PID=$!
+    sleep 0.5
+}
+
+# Function to start the server with the stub as its nameserver
+start_server() {
+    (cd "$WORK_DIR" && IRCSERV_RESOLVER=127.0.0.1:$DNS_PORT IRCSERV_RESOLVER_TIMEOUT=$LOOKUP_TIMEOUT_MS \
+        exec "$SERVER_BIN" $SERVER_PORT $SERVER_PASSWORD > server.log 2>&1) &
+    SERVER_PID=$!
+    sleep 1
+    if ! kill -0 $SERVER_PID 2>/dev/null; then
+        print_status "FAIL" "Server failed to start!"
+        cat "$WORK_DIR/server.log"
+        exit 1
+    fi
+}
+
+stop_all() {
+    for pid in $SERVER_PID $STUB_PID; do
+        kill $pid 2>/dev/null
+        wait $pid 2>/dev/null
+    done
+    SERVER_PID=""
+    STUB_PID=""
+}
+
+# Appends lines from fd 3 to file $2 up to the first one containing $1
+read_until() {
+    timeout 5 bash -c 'while IFS= read -r line; do echo "$line"; case $line in *"$0"*) exit 0;; esac; done' "$1" <&3 >> "$2"
+}
+
+# Registers "$1", logging to "$2", and asks WHOIS about itself once welcomed.
+# Prints the milliseconds the welcome took
+register() {
+    local nick=$1
+    local log=$2
+    local start end
+    start=$(date +%s%N)
+    exec 3<>/dev/tcp/$SERVER_HOST/$SERVER_PORT
+    printf 'PASS %s\r\nNICK %s\r\nUSER %s 0 * :Lookup Test\r\n' "$SERVER_PASSWORD" "$nick" "$nick" >&3
+    read_until "001 $nick " "$log"
+    end=$(date +%s%N)
+    printf 'WHOIS %s\r\n' "$nick" >&3
+    read_until "318 $nick " "$log"
+    exec 3>&-
+    echo $(( (end - start) / 1000000 ))
+}
+
+test_round_trip() {
+    echo -e "\n${YELLOW}=== Testing Lookup Round-Trip ===${NC}"
+    start_stub answer
+    start_server
+    register dnsuser dns_found.log > /dev/null
+
+    check "Client is told its hostname was found" grep -q "Found your hostname" dns_found.log
+    check "WHOIS shows the confirmed hostname" grep -q "311 dnsuser dnsuser dnsuser $STUB_HOSTNAME" dns_found.log
+    check "Stub saw the PTR query" grep -q "^1.0.0.127.in-addr.arpa 12$" "$WORK_DIR/queries.log"
+    check "Stub saw the forward-confirming A query" grep -q "^$STUB_HOSTNAME 1$" "$WORK_DIR/queries.log"
+    stop_all
+}
+
+test_timeout() {
+    echo -e "\n${YELLOW}=== Testing Lookup Timeout ===${NC}"
+    rm -f "$WORK_DIR/queries.log"
+    start_stub silent
+    start_server
+    local elapsed
+    elapsed=$(register slowuser dns_timeout.log)
+    print_status "INFO" "Registration took ${elapsed} ms with a ${LOOKUP_TIMEOUT_MS} ms lookup timeout"
+
+    check "Stub saw the query it left unanswered" grep -q "^1.0.0.127.in-addr.arpa 12$" "$WORK_DIR/queries.log"
+    check "Client is told the lookup failed" grep -q "Couldn't look up your hostname" dns_timeout.log
+    check "Client still registers" grep -q "001 slowuser " dns_timeout.log
+    check "WHOIS shows the address as hostname" grep -q "311 slowuser slowuser slowuser 127.0.0.1" dns_timeout.log
+    check "Registration waited for the timeout" test "$elapsed" -ge $((LOOKUP_TIMEOUT_MS - 100))
+    check "Registration did not wait much longer" test "$elapsed" -lt $((LOOKUP_TIMEOUT_MS + 1500))
+    stop_all
+}
+
+# Function to show test summary
+show_summary() {
+    echo -e "\n${YELLOW}=== Test Summary ===${NC}"
+    echo -e "Total tests: $TOTAL_TESTS"
+    echo -e "${GREEN}Passed: $PASSED_TESTS${NC}"
+    echo -e "${RED}Failed: $FAILED_TESTS${NC}"
+    if [ $FAILED_TESTS -eq 0 ]; then
+        exit 0
+    fi
+    exit 1
+}
+
+# Cleanup function
+cleanup() {
+    stop_all
+    [ -n "$WORK_DIR" ] && rm -rf "$WORK_DIR"
+    rm -f dns_*.log
+}
+
+main() {
+    echo -e "${BLUE}ft_irc Hostname Lookup Tester${NC}"
+    echo -e "${BLUE}=============================${NC}"
+    trap cleanup EXIT INT TERM
+    if ! command -v python3 &> /dev/null; then
+        print_status "FAIL" "python3 is required for the stub nameserver but not installed"
+        exit 1
+    fi
+    if [ ! -x "$SERVER_BIN" ]; then
+        print_status "FAIL" "IRC server executable './ircserv' not found!"
+        exit 1
+    fi
+    WORK_DIR=$(mktemp -d)
+
+    test_round_trip
+    test_timeout
+    show_summary
+}
+
+if [ "$1" = "--help" ] || [ "$1" = "-h" ]; then
+    echo "Usage: $0 [port] [dns_port]"
+    echo "Default ports: 6667 and 5353"
+    echo ""
+    echo "Run from the directory holding the 'ircserv' executable."
+    exit 0
+fi
+
+if [ ! -z "$1" ]; then
+    SERVER_PORT="$1"
+fi
+
+if [ ! -z "$2" ]; then
+    DNS_PORT="$2"
+fi
+
+main
@@ -0,0 +1,218 @@
+#!/bin/bash
+
+# ft_irc Server Link Tester
+# Starts two servers, a.net and b.net, with a link block for each other and
+# a user on each side in the same channel. An operator on b.net connects
+# them, the burst must introduce each user and its channel membership to
+# the other side, and SQUIT must take the remote user away again.
+
+# Color codes for output
+RED='\033[0;31m'
+GREEN='\033[0;32m'
+YELLOW='\033[1;33m'
+BLUE='\033[0;34m'
+NC='\033[0m' # No Color
+
+# Test configuration
+SERVER_HOST="127.0.0.1"
+PORT_A="6667"
+PORT_B="6668"
+SERVER_PASSWORD="testpass"
+OPER_PASSWORD="operpass"
+TEST_CHANNEL="#linktest"
+SERVER_BIN="$(pwd)/ircserv"
+WORK_DIR=""
+PIDS=""
+
+# Test results tracking
+TOTAL_TESTS=0
+PASSED_TESTS=0
+FAILED_TESTS=0
+
+# Function to print colored output
+print_status() {
+    local status=$1
+    local message=$2
+    case $status in
+        "PASS")
+            echo -e "${GREEN}[PASS]${NC} $message"
+            ((PASSED_TESTS++))
+            ((TOTAL_TESTS++))
+            ;;
+        "FAIL")
+            echo -e "${RED}[FAIL]${NC} $message"
+            ((FAILED_TESTS++))
+            ((TOTAL_TESTS++))
+            ;;
+        "INFO")
+            echo -e "${BLUE}[INFO]${NC} $message"
+            ;;
+    esac
+}
+
+# Function to check a condition and report it
+check() {
+    local message=$1
+    shift
+    if "$@"; then
+        print_status "PASS" "$message"
+    else
+        print_status "FAIL" "$message"
+    fi
+}
+
+# Starts one server in its own directory.
+# $1: name, $2: port, $3: link block line for the peer
+start_server() {
+    local name=$1
+    local port=$2
+    local dir="$WORK_DIR/$name"
+    mkdir -p "$dir"
+    echo "$3" > "$dir/ircserv.links"
+    echo "linkop $OPER_HASH" > "$dir/ircserv.opers"
+    (cd "$dir" && IRCSERV_NAME=$name IRCSERV_RESOLVER=off exec "$SERVER_BIN" $port $SERVER_PASSWORD > server.log 2>&1) &
+    PIDS="$PIDS $!"
+    sleep 1
+    if ! kill -0 $! 2>/dev/null; then
+        print_status "FAIL" "Server $name failed to start!"
+        cat "$dir/server.log"
+        exit 1
+    fi
+    print_status "INFO" "Server $name started on port $port"
+}
+
+# Opens a client on fd $1 to port $2, registers nick $3 and copies
+# everything the server sends to link_$3.log in the background
+connect_client() {
+    local fd=$1
+    local port=$2
+    local nick=$3
+    eval "exec $fd<>/dev/tcp/$SERVER_HOST/$port"
+    printf 'PASS %s\r\nNICK %s\r\nUSER %s 0 * :Link Test\r\n' "$SERVER_PASSWORD" "$nick" "$nick" >&$fd
+    cat <&$fd >> "link_$nick.log" &
+    PIDS="$PIDS $!"
+}
+
+# Sends line $2 to the client on fd $1
+send_line() {
+    printf '%s\r\n' "$2" >&$1
+}
+
+# Waits up to 5 seconds for file $1 to hold a line matching $2
+wait_for() {
+    local tries=50
+    while [ $tries -gt 0 ]; do
+        grep -q -- "$2" "$1" 2>/dev/null && return 0
+        sleep 0.1
+        ((tries--))
+    done
+    return 1
+}
+
+setup() {
+    echo -e "\n${YELLOW}=== Starting Two Servers ===${NC}"
+    OPER_HASH=$(echo "$OPER_PASSWORD" | "$SERVER_BIN" --hash-password)
+    # Each side sends its own password and expects the other's
+    start_server a.net $PORT_A "b.net $SERVER_HOST $PORT_B a-to-b b-to-a"
+    start_server b.net $PORT_B "a.net $SERVER_HOST $PORT_A b-to-a a-to-b"
+
+    connect_client 3 $PORT_A alice
+    connect_client 4 $PORT_B bob
+    connect_client 5 $PORT_B linkop
+    send_line 3 "JOIN $TEST_CHANNEL"
+    send_line 4 "JOIN $TEST_CHANNEL"
+    wait_for link_alice.log "366 alice $TEST_CHANNEL"
+    wait_for link_bob.log "366 bob $TEST_CHANNEL"
+}
+
+test_burst() {
+    echo -e "\n${YELLOW}=== Testing Link Burst ===${NC}"
+    send_line 5 "OPER linkop $OPER_PASSWORD"
+    check "Operator is accepted on b.net" wait_for link_linkop.log "381 linkop"
+    send_line 5 "CONNECT a.net"
+
+    check "alice sees bob join through the burst" wait_for link_alice.log ":bob!.* JOIN $TEST_CHANNEL"
+    check "bob sees alice join through the burst" wait_for link_bob.log ":alice!.* JOIN $TEST_CHANNEL"
+
+    send_line 3 "LINKS"
+    check "LINKS on a.net lists b.net" wait_for link_alice.log "364 alice b.net a.net"
+
+    send_line 3 "PRIVMSG $TEST_CHANNEL :hello from a.net"
+    check "Channel message crosses the link" wait_for link_bob.log "PRIVMSG $TEST_CHANNEL :hello from a.net"
+    send_line 4 "PRIVMSG alice :hello from b.net"
+    check "Private message crosses the link" wait_for link_alice.log "PRIVMSG alice :hello from b.net"
+}
+
+test_squit() {
+    echo -e "\n${YELLOW}=== Testing SQUIT ===${NC}"
+    send_line 5 "SQUIT a.net :link test done"
+
+    # Netsplit quits name both servers, as in the old ircd style
+    check "alice sees bob quit with the split servers" wait_for link_alice.log ":bob!.* QUIT :a.net b.net"
+    check "bob sees alice quit with the split servers" wait_for link_bob.log ":alice!.* QUIT :b.net a.net"
+
+    send_line 3 "WHOIS bob"
+    check "bob is gone from a.net" wait_for link_alice.log "401 alice bob"
+    send_line 3 "LINKS"
+    sleep 0.5
+    # Only the LINKS reply from before the split names b.net
+    check "LINKS on a.net no longer lists b.net" test "$(grep -c '364 alice b.net' link_alice.log)" -eq 1
+}
+
+# Function to show test summary
+show_summary() {
+    echo -e "\n${YELLOW}=== Test Summary ===${NC}"
+    echo -e "Total tests: $TOTAL_TESTS"
+    echo -e "${GREEN}Passed: $PASSED_TESTS${NC}"
+    echo -e "${RED}Failed: $FAILED_TESTS${NC}"
+    if [ $FAILED_TESTS -eq 0 ]; then
+        exit 0
+    fi
+    exit 1
+}
+
+# Cleanup function
+cleanup() {
+    exec 3>&- 4>&- 5>&-
+    for pid in $PIDS; do
+        kill $pid 2>/dev/null
+        wait $pid 2>/dev/null
+    done
+    [ -n "$WORK_DIR" ] && rm -rf "$WORK_DIR"
+    rm -f link_*.log
+}
+
+main() {
+    echo -e "${BLUE}ft_irc Server Link Tester${NC}"
+    echo -e "${BLUE}=========================${NC}"
+    trap cleanup EXIT INT TERM
+    if [ ! -x "$SERVER_BIN" ]; then
+        print_status "FAIL" "IRC server executable './ircserv' not found!"
+        exit 1
+    fi
+    rm -f link_*.log
+    WORK_DIR=$(mktemp -d)
+
+    setup
+    test_burst
+    test_squit
+    show_summary
+}
+
+if [ "$1" = "--help" ] || [ "$1" = "-h" ]; then
+    echo "Usage: $0 [port_a] [port_b]"
+    echo "Default ports: 6667 and 6668"
+    echo ""
+    echo "Run from the directory holding the 'ircserv' executable."
+    exit 0
+fi
+
+if [ ! -z "$1" ]; then
+    PORT_A="$1"
+fi
+
+if [ ! -z "$2" ]; then
+    PORT_B="$2"
+fi
+
+main
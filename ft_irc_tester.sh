@@ -536,6 +536,489 @@ test_error_conditions() {
     rm -f error_test1.log error_test2.log
 }
 
+# Function to test comma-separated PRIVMSG/NOTICE targets
+test_multi_target_messages() {
+    echo -e "\n${YELLOW}=== Testing Multi-Target Messages ===${NC}"
+
+    print_status "INFO" "Testing PRIVMSG to several channels sharing a member..."
+
+    # First client sits in both channels
+    {
+        echo "PASS $SERVER_PASSWORD"
+        echo "NICK targetuser1"
+        echo "USER targetuser1 0 * :Target User One"
+        sleep 2
+        echo "JOIN #target1,#target2"
+        sleep 8
+    } | timeout 20 nc $SERVER_HOST $SERVER_PORT > target_test1.log 2>&1 &
+
+    CLIENT1_PID=$!
+    sleep 1
+
+    # Second client messages both channels and the first client at once
+    {
+        echo "PASS $SERVER_PASSWORD"
+        echo "NICK targetuser2"
+        echo "USER targetuser2 0 * :Target User Two"
+        sleep 2
+        echo "JOIN #target1,#target2"
+        sleep 3
+        echo "PRIVMSG #target1,#target2,targetuser1 :Message to many targets"
+        echo "NOTICE #target1,targetuser1 :Notice to many targets"
+        sleep 2
+    } | timeout 20 nc $SERVER_HOST $SERVER_PORT > target_test2.log 2>&1 &
+
+    CLIENT2_PID=$!
+
+    wait $CLIENT1_PID $CLIENT2_PID
+
+    # Every target was reached, but the first client got each message once
+    if [ "$(grep -c 'Message to many targets' target_test1.log)" -eq 1 ]; then
+        print_status "PASS" "Multi-target PRIVMSG is delivered once per recipient"
+    else
+        print_status "FAIL" "Multi-target PRIVMSG should reach each recipient exactly once"
+        grep "targets" target_test1.log 2>/dev/null
+    fi
+
+    if [ "$(grep -c 'NOTICE #target1 :Notice to many targets' target_test1.log)" -eq 1 ]; then
+        print_status "PASS" "Multi-target NOTICE is delivered once per recipient"
+    else
+        print_status "FAIL" "Multi-target NOTICE should reach each recipient exactly once"
+    fi
+
+    rm -f target_test1.log target_test2.log
+}
+
+# Function to test channel history replay
+test_chat_history() {
+    echo -e "\n${YELLOW}=== Testing CHATHISTORY ===${NC}"
+
+    print_status "INFO" "Testing replay of messages sent before joining..."
+
+    # First client talks, then stays so the channel and its history live on
+    {
+        echo "PASS $SERVER_PASSWORD"
+        echo "NICK histuser1"
+        echo "USER histuser1 0 * :History User One"
+        sleep 2
+        echo "JOIN #history"
+        echo "PRIVMSG #history :History line one"
+        echo "PRIVMSG #history :History line two"
+        sleep 10
+    } | timeout 20 nc $SERVER_HOST $SERVER_PORT > history_test1.log 2>&1 &
+
+    CLIENT1_PID=$!
+    sleep 4
+
+    # Second client joins afterwards and asks for the latest two events, then ten
+    {
+        echo "PASS $SERVER_PASSWORD"
+        echo "NICK histuser2"
+        echo "USER histuser2 0 * :History User Two"
+        sleep 2
+        echo "JOIN #history"
+        echo "CHATHISTORY LATEST #history * 2"
+        sleep 1
+        echo "CHATHISTORY LATEST #history * 10"
+        sleep 2
+    } | timeout 20 nc $SERVER_HOST $SERVER_PORT > history_test2.log 2>&1
+
+    wait $CLIENT1_PID
+
+    if grep -q "PRIVMSG #history :History line one" history_test2.log; then
+        print_status "PASS" "CHATHISTORY replays earlier channel messages"
+    else
+        print_status "FAIL" "CHATHISTORY should replay earlier channel messages"
+    fi
+
+    # Its own JOIN is the newest event, so a limit of 2 only reaches line two
+    if [ "$(grep -c 'History line one' history_test2.log)" -eq 1 ] \
+        && [ "$(grep -c 'History line two' history_test2.log)" -eq 2 ]; then
+        print_status "PASS" "CHATHISTORY LATEST honours its limit"
+    else
+        print_status "FAIL" "CHATHISTORY LATEST should return only the newest messages up to its limit"
+    fi
+
+    rm -f history_test1.log history_test2.log
+}
+
+# Function to test IRCv3 capability negotiation and tags
+test_capabilities() {
+    echo -e "\n${YELLOW}=== Testing CAP Negotiation ===${NC}"
+
+    print_status "INFO" "Testing CAP LS/REQ/END and server-time tags..."
+
+    # First client negotiates before registering and ends it late
+    {
+        echo "CAP LS 302"
+        echo "CAP REQ :message-tags server-time"
+        echo "PASS $SERVER_PASSWORD"
+        echo "NICK capuser1"
+        echo "USER capuser1 0 * :Cap User One"
+        sleep 4
+        echo "CAP LIST"
+        echo "CAP END"
+        sleep 1
+        echo "JOIN #captest"
+        sleep 4
+        echo "PRIVMSG #captest :Untagged for a plain client"
+        sleep 2
+    } | timeout 20 nc $SERVER_HOST $SERVER_PORT > cap_test1.log 2>&1 &
+
+    CLIENT1_PID=$!
+    sleep 1
+
+    # Second client never asks for anything
+    {
+        echo "PASS $SERVER_PASSWORD"
+        echo "NICK capuser2"
+        echo "USER capuser2 0 * :Cap User Two"
+        sleep 2
+        echo "JOIN #captest"
+        sleep 5
+        echo "PRIVMSG #captest :Tagged for a capable client"
+        sleep 3
+    } | timeout 20 nc $SERVER_HOST $SERVER_PORT > cap_test2.log 2>&1 &
+
+    CLIENT2_PID=$!
+
+    wait $CLIENT1_PID $CLIENT2_PID
+
+    if grep -q "CAP \* LS :.*server-time" cap_test1.log && grep -q "CAP \* ACK :message-tags server-time" cap_test1.log; then
+        print_status "PASS" "CAP LS offers server-time and CAP REQ is acknowledged"
+    else
+        print_status "FAIL" "CAP LS should offer server-time and CAP REQ should be acknowledged"
+    fi
+
+    # Registration waits for CAP END, so the CAP LIST reply comes first
+    local list_line welcome_line
+    list_line=$(grep -n "CAP capuser1 LIST" cap_test1.log | head -1 | cut -d: -f1)
+    welcome_line=$(grep -n "001 capuser1" cap_test1.log | head -1 | cut -d: -f1)
+    if [ -n "$list_line" ] && [ -n "$welcome_line" ] && [ "$list_line" -lt "$welcome_line" ]; then
+        print_status "PASS" "Registration waits for CAP END"
+    else
+        print_status "FAIL" "Registration should wait for CAP END"
+    fi
+
+    if grep -q "^@time=[^ ]* :capuser2!.* PRIVMSG #captest :Tagged for a capable client" cap_test1.log \
+        && grep -q "^:capuser1!.* PRIVMSG #captest :Untagged for a plain client" cap_test2.log; then
+        print_status "PASS" "Messages carry tags only for clients that asked for them"
+    else
+        print_status "FAIL" "Messages should carry server-time tags only for clients that asked for them"
+    fi
+
+    rm -f cap_test1.log cap_test2.log
+}
+
+# Function to test JOIN of several channels at once
+test_multi_join() {
+    echo -e "\n${YELLOW}=== Testing Multi-Channel JOIN ===${NC}"
+
+    print_status "INFO" "Testing JOIN with channel and key lists..."
+
+    # First client creates a keyed channel
+    {
+        echo "PASS $SERVER_PASSWORD"
+        echo "NICK joinuser1"
+        echo "USER joinuser1 0 * :Join User One"
+        sleep 2
+        echo "JOIN #joinkey"
+        echo "MODE #joinkey +k secret"
+        sleep 8
+    } | timeout 20 nc $SERVER_HOST $SERVER_PORT > join_test1.log 2>&1 &
+
+    CLIENT1_PID=$!
+    sleep 1
+
+    # Second client joins it among others; keys pair up with channels by position
+    {
+        echo "PASS $SERVER_PASSWORD"
+        echo "NICK joinuser2"
+        echo "USER joinuser2 0 * :Join User Two"
+        sleep 4
+        echo "JOIN #joinkey,#join1,#join2 secret"
+        sleep 1
+        echo "JOIN #join3,badname,#join4"
+        sleep 2
+    } | timeout 20 nc $SERVER_HOST $SERVER_PORT > join_test2.log 2>&1 &
+
+    CLIENT2_PID=$!
+
+    wait $CLIENT1_PID $CLIENT2_PID
+
+    if [ "$(grep -c '366 joinuser2 #join' join_test2.log)" -eq 5 ]; then
+        print_status "PASS" "JOIN of several channels joins each of them"
+    else
+        print_status "FAIL" "JOIN of several channels should join each of them"
+    fi
+
+    if grep -q "^:joinuser2!.* JOIN #joinkey" join_test1.log; then
+        print_status "PASS" "Keys in a JOIN list go to their channels"
+    else
+        print_status "FAIL" "The key in a JOIN list should open its keyed channel"
+    fi
+
+    if grep -q "403 joinuser2 badname" join_test2.log && grep -q "366 joinuser2 #join4" join_test2.log; then
+        print_status "PASS" "A bad name in a JOIN list does not stop the rest"
+    else
+        print_status "FAIL" "A bad name in a JOIN list should be rejected without stopping the rest"
+    fi
+
+    rm -f join_test1.log join_test2.log
+}
+
+# Function to test WHO and LIST
+test_who_list() {
+    echo -e "\n${YELLOW}=== Testing WHO and LIST ===${NC}"
+
+    print_status "INFO" "Testing WHO by channel and mask, and LIST filters..."
+
+    # First client holds a channel with a topic
+    {
+        echo "PASS $SERVER_PASSWORD"
+        echo "NICK whouser1"
+        echo "USER whouser1 0 * :Who User One"
+        sleep 2
+        echo "JOIN #whotest"
+        echo "TOPIC #whotest :Listed topic"
+        sleep 8
+    } | timeout 20 nc $SERVER_HOST $SERVER_PORT > who_test1.log 2>&1 &
+
+    CLIENT1_PID=$!
+    sleep 1
+
+    # Second client asks about it from outside the channel
+    {
+        echo "PASS $SERVER_PASSWORD"
+        echo "NICK whouser2"
+        echo "USER whouser2 0 * :Who User Two"
+        sleep 4
+        echo "WHO #whotest"
+        echo "WHO who*1"
+        sleep 1
+        echo "LIST"
+        sleep 1
+        echo "LIST >5"
+        echo "LIST <5"
+        sleep 2
+    } | timeout 20 nc $SERVER_HOST $SERVER_PORT > who_test2.log 2>&1 &
+
+    CLIENT2_PID=$!
+
+    wait $CLIENT1_PID $CLIENT2_PID
+
+    if grep -q "352 whouser2 #whotest whouser1 .* whouser1 H@ :0 Who User One" who_test2.log \
+        && [ "$(grep -c '352 whouser2 \* whouser1 ' who_test2.log)" -eq 1 ] \
+        && [ "$(grep -c '315 whouser2 ' who_test2.log)" -eq 2 ]; then
+        print_status "PASS" "WHO answers by channel and by mask"
+    else
+        print_status "FAIL" "WHO should answer by channel and by mask"
+    fi
+
+    # LIST, LIST >5 and LIST <5: only the first and last show the channel
+    if [ "$(grep -c '322 whouser2 #whotest 1 :Listed topic' who_test2.log)" -eq 2 ]; then
+        print_status "PASS" "LIST shows channels and applies member count filters"
+    else
+        print_status "FAIL" "LIST should show channels and apply member count filters"
+    fi
+
+    if [ "$(grep -c '321 whouser2 ' who_test2.log)" -eq 3 ] && [ "$(grep -c '323 whouser2 ' who_test2.log)" -eq 3 ]; then
+        print_status "PASS" "Every LIST is ended, even one sent while another streams"
+    else
+        print_status "FAIL" "Every LIST should be ended with 323"
+    fi
+
+    rm -f who_test1.log who_test2.log
+}
+
+# Function to test ban and exception lists
+test_ban_lists() {
+    echo -e "\n${YELLOW}=== Testing Ban Lists ===${NC}"
+
+    print_status "INFO" "Testing +b and +e masks on JOIN and PRIVMSG..."
+
+    # Channel operator bans banuser* once a member is in, with an exception
+    {
+        echo "PASS $SERVER_PASSWORD"
+        echo "NICK banop"
+        echo "USER banop 0 * :Ban Operator"
+        sleep 2
+        echo "JOIN #bantest"
+        sleep 4
+        echo "MODE #bantest +b banuser*!*@*"
+        echo "MODE #bantest +e banuser2!*@*"
+        echo "MODE #bantest b"
+        sleep 10
+    } | timeout 25 nc $SERVER_HOST $SERVER_PORT > ban_test_op.log 2>&1 &
+
+    OP_PID=$!
+    sleep 1
+
+    # Member who was in before the ban and then tries to speak
+    {
+        echo "PASS $SERVER_PASSWORD"
+        echo "NICK banuserq"
+        echo "USER banuserq 0 * :Ban User Quiet"
+        sleep 2
+        echo "JOIN #bantest"
+        sleep 6
+        echo "PRIVMSG #bantest :Banned member speaking"
+        sleep 2
+    } | timeout 20 nc $SERVER_HOST $SERVER_PORT > ban_test_q.log 2>&1 &
+
+    QUIET_PID=$!
+    sleep 6
+
+    # Two newcomers matching the ban, one of them excepted
+    for i in 1 2; do
+        {
+            echo "PASS $SERVER_PASSWORD"
+            echo "NICK banuser$i"
+            echo "USER banuser$i 0 * :Ban User $i"
+            sleep 2
+            echo "JOIN #bantest"
+            sleep 3
+        } | timeout 15 nc $SERVER_HOST $SERVER_PORT > ban_test_$i.log 2>&1 &
+
+        BAN_PIDS[$i]=$!
+    done
+
+    wait $OP_PID $QUIET_PID ${BAN_PIDS[1]} ${BAN_PIDS[2]}
+
+    if grep -q "367 banop #bantest banuser\*!\*@\* banop" ban_test_op.log && grep -q "368 banop #bantest" ban_test_op.log; then
+        print_status "PASS" "MODE b lists the ban list"
+    else
+        print_status "FAIL" "MODE b should list the ban list"
+    fi
+
+    if grep -q "474 banuser1 #bantest" ban_test_1.log && ! grep -q "366 banuser1 #bantest" ban_test_1.log; then
+        print_status "PASS" "A banned user cannot join"
+    else
+        print_status "FAIL" "A banned user should not be able to join"
+    fi
+
+    if grep -q "366 banuser2 #bantest" ban_test_2.log; then
+        print_status "PASS" "A ban exception lets a banned user join"
+    else
+        print_status "FAIL" "A ban exception should let a banned user join"
+    fi
+
+    if grep -q "404 banuserq #bantest" ban_test_q.log && ! grep -q "Banned member speaking" ban_test_op.log; then
+        print_status "PASS" "A banned member cannot speak"
+    else
+        print_status "FAIL" "A banned member should not be able to speak"
+    fi
+
+    rm -f ban_test_op.log ban_test_q.log ban_test_1.log ban_test_2.log
+}
+
+# Function to test MONITOR notifications
+test_monitor() {
+    echo -e "\n${YELLOW}=== Testing MONITOR ===${NC}"
+
+    print_status "INFO" "Testing online/offline notifications..."
+
+    # Watcher adds a nick that is not connected yet
+    {
+        echo "PASS $SERVER_PASSWORD"
+        echo "NICK watcher"
+        echo "USER watcher 0 * :Watcher"
+        sleep 2
+        echo "MONITOR + monitored"
+        sleep 9
+        echo "MONITOR L"
+        sleep 2
+    } | timeout 20 nc $SERVER_HOST $SERVER_PORT > monitor_test1.log 2>&1 &
+
+    WATCHER_PID=$!
+    sleep 4
+
+    # The watched nick comes online, then leaves
+    {
+        echo "PASS $SERVER_PASSWORD"
+        echo "NICK monitored"
+        echo "USER monitored 0 * :Monitored"
+        sleep 5
+        echo "QUIT :Going offline"
+        sleep 1
+    } | timeout 15 nc $SERVER_HOST $SERVER_PORT > monitor_test2.log 2>&1
+
+    wait $WATCHER_PID
+
+    if grep -q "730 watcher :monitored!" monitor_test1.log; then
+        print_status "PASS" "MONITOR reports a watched nick coming online"
+    else
+        print_status "FAIL" "MONITOR should report a watched nick coming online"
+    fi
+
+    # Once when added while absent, once when it quits
+    if [ "$(grep -c '731 watcher :monitored' monitor_test1.log)" -eq 2 ]; then
+        print_status "PASS" "MONITOR reports a watched nick being offline"
+    else
+        print_status "FAIL" "MONITOR should report a watched nick being offline"
+    fi
+
+    if grep -q "732 watcher :monitored" monitor_test1.log && grep -q "733 watcher" monitor_test1.log; then
+        print_status "PASS" "MONITOR L lists the watched nicks"
+    else
+        print_status "FAIL" "MONITOR L should list the watched nicks"
+    fi
+
+    rm -f monitor_test1.log monitor_test2.log
+}
+
+# Function to test NICK and QUIT fan-out to shared channels
+test_nick_quit_fanout() {
+    echo -e "\n${YELLOW}=== Testing NICK and QUIT Fan-Out ===${NC}"
+
+    print_status "INFO" "Testing NICK and QUIT seen once across shared channels..."
+
+    # Observer shares three channels with the second client
+    {
+        echo "PASS $SERVER_PASSWORD"
+        echo "NICK fanuser1"
+        echo "USER fanuser1 0 * :Fan User One"
+        sleep 2
+        echo "JOIN #fan1,#fan2,#fan3"
+        sleep 9
+    } | timeout 20 nc $SERVER_HOST $SERVER_PORT > fanout_test1.log 2>&1 &
+
+    CLIENT1_PID=$!
+    sleep 1
+
+    # Second client renames itself, then quits
+    {
+        echo "PASS $SERVER_PASSWORD"
+        echo "NICK fanuser2"
+        echo "USER fanuser2 0 * :Fan User Two"
+        sleep 2
+        echo "JOIN #fan1,#fan2,#fan3"
+        sleep 3
+        echo "NICK fanrenamed"
+        sleep 1
+        echo "QUIT :Fan-out done"
+        sleep 1
+    } | timeout 20 nc $SERVER_HOST $SERVER_PORT > fanout_test2.log 2>&1 &
+
+    CLIENT2_PID=$!
+
+    wait $CLIENT1_PID $CLIENT2_PID
+
+    if [ "$(grep -c '^:fanuser2!.* NICK fanrenamed' fanout_test1.log)" -eq 1 ]; then
+        print_status "PASS" "NICK change is seen once by a user sharing several channels"
+    else
+        print_status "FAIL" "NICK change should be seen exactly once by a user sharing several channels"
+    fi
+
+    if [ "$(grep -c '^:fanrenamed!.* QUIT :Fan-out done' fanout_test1.log)" -eq 1 ]; then
+        print_status "PASS" "QUIT is seen once by a user sharing several channels"
+    else
+        print_status "FAIL" "QUIT should be seen exactly once by a user sharing several channels"
+    fi
+
+    rm -f fanout_test1.log fanout_test2.log
+}
+
 # Function to compile and check the project
 test_compilation() {
     echo -e "\n${YELLOW}=== Testing Compilation ===${NC}"
@@ -634,7 +1117,15 @@ main() {
     test_partial_data
     test_multiple_clients
     test_error_conditions
-    
+    test_multi_target_messages
+    test_chat_history
+    test_capabilities
+    test_multi_join
+    test_who_list
+    test_ban_lists
+    test_monitor
+    test_nick_quit_fanout
+
     # Show summary
     show_summary
 }
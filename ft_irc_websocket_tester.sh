@@ -0,0 +1,223 @@
+#!/bin/bash
+
+# ft_irc WebSocket Tester
+# Checks the WebSocket listener: the upgrade handshake, registration over
+# text frames, a fragmented message with a ping in between, and the close
+# handshake. Frames are written with bash's /dev/tcp, so only bash, xxd and
+# timeout are needed.
+
+# Color codes for output
+RED='\033[0;31m'
+GREEN='\033[0;32m'
+YELLOW='\033[1;33m'
+BLUE='\033[0;34m'
+NC='\033[0m' # No Color
+
+# Test configuration
+SERVER_HOST="127.0.0.1"
+SERVER_PORT="6667"
+WEBSOCKET_PORT="8067"
+SERVER_PASSWORD="testpass"
+SERVER_BIN="$(pwd)/ircserv"
+WORK_DIR=""
+
+# Test results tracking
+TOTAL_TESTS=0
+PASSED_TESTS=0
+FAILED_TESTS=0
+
+# Function to print colored output
+print_status() {
+    local status=$1
+    local message=$2
+    case $status in
+        "PASS")
+            echo -e "${GREEN}[PASS]${NC} $message"
+            ((PASSED_TESTS++))
+            ((TOTAL_TESTS++))
+            ;;
+        "FAIL")
+            echo -e "${RED}[FAIL]${NC} $message"
+            ((FAILED_TESTS++))
+            ((TOTAL_TESTS++))
+            ;;
+        "INFO")
+            echo -e "${BLUE}[INFO]${NC} $message"
+            ;;
+    esac
+}
+
+# Function to check a condition and report it
+check() {
+    local message=$1
+    shift
+    if "$@"; then
+        print_status "PASS" "$message"
+    else
+        print_status "FAIL" "$message"
+    fi
+}
+
+# Function to start the server with a WebSocket port in its config file
+start_server() {
+    if [ ! -x "$SERVER_BIN" ]; then
+        print_status "FAIL" "IRC server executable './ircserv' not found!"
+        exit 1
+    fi
+    WORK_DIR=$(mktemp -d)
+    echo "websocket = $WEBSOCKET_PORT" > "$WORK_DIR/ircserv.conf"
+    (cd "$WORK_DIR" && IRCSERV_RESOLVER=off exec "$SERVER_BIN" $SERVER_PORT $SERVER_PASSWORD > server.log 2>&1) &
+    SERVER_PID=$!
+    sleep 1
+    if ! kill -0 $SERVER_PID 2>/dev/null; then
+        print_status "FAIL" "Server failed to start!"
+        cat "$WORK_DIR/server.log"
+        exit 1
+    fi
+    print_status "INFO" "Server started (PID: $SERVER_PID), WebSocket port $WEBSOCKET_PORT"
+}
+
+# Writes one masked client frame to fd 3. The mask key is zero, which is
+# valid and leaves the payload as is. Payloads stay under 126 bytes.
+# $1: first byte (FIN bit and opcode), $2: payload
+send_frame() {
+    local first=$1
+    local payload=$2
+    local header
+    header=$(printf '\\x%02x\\x%02x\\x00\\x00\\x00\\x00' "$first" $((0x80 | ${#payload})))
+    printf "$header%s" "$payload" >&3
+}
+
+# Same, without the mask bit the spec requires from clients
+send_unmasked_frame() {
+    local first=$1
+    local payload=$2
+    local header
+    header=$(printf '\\x%02x\\x%02x' "$first" ${#payload})
+    printf "$header%s" "$payload" >&3
+}
+
+# Appends what the server sent within $2 seconds to file $1
+read_reply() {
+    timeout "$2" cat <&3 >> "$1"
+}
+
+# Whether file $1 holds the bytes given in hex as $2
+contains_hex() {
+    xxd -p "$1" | tr -d '\n' | grep -q "$2"
+}
+
+test_handshake() {
+    echo -e "\n${YELLOW}=== Testing WebSocket Handshake ===${NC}"
+    exec 3<>/dev/tcp/$SERVER_HOST/$WEBSOCKET_PORT
+    printf 'GET / HTTP/1.1\r\nHost: localhost\r\nUpgrade: websocket\r\nConnection: Upgrade\r\nSec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\nSec-WebSocket-Version: 13\r\n\r\n' >&3
+    read_reply ws_handshake.log 1
+
+    check "Server answers the upgrade with 101" grep -q "^HTTP/1.1 101" ws_handshake.log
+    # The accept key of the RFC 6455 example request
+    check "Sec-WebSocket-Accept matches the key" grep -q "Sec-WebSocket-Accept: s3pPLMBiTxaQ9kYGzzhZRbK+xOo=" ws_handshake.log
+}
+
+test_registration() {
+    echo -e "\n${YELLOW}=== Testing Registration over Text Frames ===${NC}"
+    send_frame 0x81 "PASS $SERVER_PASSWORD"
+    send_frame 0x81 "NICK wsuser"
+    send_frame 0x81 "USER wsuser 0 * :WebSocket User"
+    read_reply ws_register.log 1
+
+    check "Welcome arrives in a text frame" grep -aq "001 wsuser" ws_register.log
+    # Each message is one IRC line without CR LF
+    check "Frames carry no CR LF" bash -c "! grep -aq \$'\r' ws_register.log"
+}
+
+test_fragments() {
+    echo -e "\n${YELLOW}=== Testing Fragmented and Control Frames ===${NC}"
+    # "PING fragmented" split over a text frame and a continuation, with a
+    # ping control frame between the two
+    send_frame 0x01 "PING frag"
+    send_frame 0x89 "ctl"
+    send_frame 0x80 "mented"
+    read_reply ws_fragments.log 1
+
+    # Pong frame: FIN + opcode 0xA, length 3, "ctl"
+    check "Ping between fragments is answered with a pong" contains_hex ws_fragments.log "8a0363746c"
+    check "Fragments are joined into one message" grep -aq "PONG.*fragmented" ws_fragments.log
+}
+
+test_close() {
+    echo -e "\n${YELLOW}=== Testing Close Handshake ===${NC}"
+    # Close with status 1000
+    send_frame 0x88 $'\x03\xe8'
+    read_reply ws_close.log 1
+
+    check "Close frame is answered with a close frame" contains_hex ws_close.log "8802"
+    exec 3>&-
+
+    print_status "INFO" "Sending an unmasked frame on a new connection..."
+    exec 3<>/dev/tcp/$SERVER_HOST/$WEBSOCKET_PORT
+    printf 'GET / HTTP/1.1\r\nHost: localhost\r\nUpgrade: websocket\r\nConnection: Upgrade\r\nSec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\nSec-WebSocket-Version: 13\r\n\r\n' >&3
+    send_unmasked_frame 0x81 "NICK bad"
+    read_reply ws_unmasked.log 1
+    exec 3>&-
+
+    # Close status 1002, protocol error
+    check "Unmasked client frame is refused with status 1002" contains_hex ws_unmasked.log "880203ea"
+}
+
+# Function to show test summary
+show_summary() {
+    echo -e "\n${YELLOW}=== Test Summary ===${NC}"
+    echo -e "Total tests: $TOTAL_TESTS"
+    echo -e "${GREEN}Passed: $PASSED_TESTS${NC}"
+    echo -e "${RED}Failed: $FAILED_TESTS${NC}"
+    if [ $FAILED_TESTS -eq 0 ]; then
+        exit 0
+    fi
+    exit 1
+}
+
+# Cleanup function
+cleanup() {
+    if [ ! -z "$SERVER_PID" ]; then
+        kill $SERVER_PID 2>/dev/null
+        wait $SERVER_PID 2>/dev/null
+    fi
+    [ -n "$WORK_DIR" ] && rm -rf "$WORK_DIR"
+    rm -f ws_*.log
+}
+
+main() {
+    echo -e "${BLUE}ft_irc WebSocket Tester${NC}"
+    echo -e "${BLUE}=======================${NC}"
+    trap cleanup EXIT INT TERM
+    if ! command -v xxd &> /dev/null; then
+        print_status "FAIL" "xxd is required but not installed"
+        exit 1
+    fi
+    rm -f ws_*.log
+
+    start_server
+    test_handshake
+    test_registration
+    test_fragments
+    test_close
+    show_summary
+}
+
+if [ "$1" = "--help" ] || [ "$1" = "-h" ]; then
+    echo "Usage: $0 [port] [websocket_port]"
+    echo "Default ports: 6667 and 8067"
+    echo ""
+    echo "Run from the directory holding the 'ircserv' executable."
+    exit 0
+fi
+
+if [ ! -z "$1" ]; then
+    SERVER_PORT="$1"
+fi
+
+if [ ! -z "$2" ]; then
+    WEBSOCKET_PORT="$2"
+fi
+
+main
@@ -0,0 +1,71 @@
+#ifndef ACCOUNTS_HPP
+#define ACCOUNTS_HPP
+
+#include <string> // For std::string
+#include <vector> // For std::vector
+#include <deque> // For std::deque
+#include <pthread.h> // For pthread_t, pthread_mutex_t, pthread_cond_t
+
+// User accounts for SASL PLAIN and operator credentials for OPER, each kept
+// in a text file of "name hash" lines. Hashes are scrypt in PHC form, $scrypt$ln=<log2 N>,r=<r>,p=<p>$<salt>$<key>
+// (base64), and are meant to be slow and memory-hard. Checking one must
+// never stall the event loop, so checks are queued to a fixed set of worker
+// threads; each finished check is signalled on an eventfd that the event
+// loop polls, and collected from there.
+class Accounts {
+    public:
+        struct Result {
+            int client_fd;
+            unsigned long serial;  // As passed to submit(), to spot stale results
+            std::string account;
+            bool oper;             // An OPER check, not a SASL login
+            bool valid;
+        };
+
+    private:
+        struct Job {
+            int client_fd;
+            unsigned long serial;
+            std::string account;
+            std::string password;
+            bool oper;             // Checked against the operator file
+        };
+
+        std::string path;
+        std::string oper_path;
+        size_t worker_count;
+        size_t queue_limit;        // Checks allowed to wait for a worker
+        std::vector<pthread_t> workers;
+        pthread_mutex_t lock;      // Guards jobs, results and stopping
+        pthread_cond_t wakeup;
+        std::deque<Job> jobs;
+        std::deque<Result> results;
+        bool stopping;
+        int event_fd;
+
+        static void* workerMain(void* self);
+        void work();
+        static std::string findHash(const std::string& file, const std::string& account);
+
+    public:
+        Accounts(const std::string& file_path, const std::string& oper_file_path, size_t workers, size_t max_queued);
+        ~Accounts();
+
+        bool start();
+        void stop();
+        int getFd() const { return event_fd; }
+        bool isEnabled() const { return event_fd >= 0; }
+
+        // Queues a check against the accounts file, or the operator file for OPER;
+        // false when too many are already waiting
+        bool submit(int client_fd, unsigned long serial, const std::string& account, const std::string& password, bool oper = false);
+        void collect();            // Clears the eventfd after it became readable
+        bool nextResult(Result& result);
+
+        static std::string hashPassword(const std::string& password);
+        static bool verifyPassword(const std::string& password, const std::string& hash);
+        static bool isValidName(const std::string& account);
+        static bool decodeBase64(const std::string& text, std::string& decoded);
+};
+
+#endif
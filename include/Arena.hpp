@@ -0,0 +1,83 @@
+#ifndef ARENA_HPP
+#define ARENA_HPP
+
+#include <cstddef> // For size_t, ptrdiff_t
+#include <new> // For placement new
+#include <string> // For std::basic_string
+#include <vector> // For std::vector
+
+// Bump allocator for data that does not outlive the current loop tick,
+// such as the pieces a received line is split into while it is parsed.
+// Allocating is a pointer increment, freeing does nothing, and
+// Server::finishTick() rewinds the whole arena at once. Chunks are kept
+// across ticks up to KEPT_CHUNKS, so steady traffic never returns to the
+// global allocator. Like NodePool, it belongs to the event-loop thread.
+class TickArena {
+    private:
+        static const size_t CHUNK_SIZE = 64 * 1024;
+        static const size_t KEPT_CHUNKS = 16; // Chunks kept by reset(), a burst frees the rest
+
+        std::vector<char*> chunks;
+        std::vector<char*> oversized; // Allocations larger than a chunk, freed by reset()
+        size_t current; // Chunk being carved, equal to chunks.size() while there is none
+        size_t used;    // Bytes taken from it
+
+        TickArena();
+        ~TickArena();
+        TickArena(const TickArena&);
+        TickArena& operator=(const TickArena&);
+
+    public:
+        static TickArena& instance();
+
+        void* allocate(size_t size);
+        void reset();
+};
+
+// Standard (C++98) allocator drawing from the TickArena. Containers using
+// it must be locals that are gone before the end of the tick.
+template <typename T>
+class ArenaAllocator {
+    public:
+        typedef T value_type;
+        typedef T* pointer;
+        typedef const T* const_pointer;
+        typedef T& reference;
+        typedef const T& const_reference;
+        typedef size_t size_type;
+        typedef ptrdiff_t difference_type;
+
+        template <typename U>
+        struct rebind {
+            typedef ArenaAllocator<U> other;
+        };
+
+        ArenaAllocator() {}
+        ArenaAllocator(const ArenaAllocator&) {}
+        template <typename U>
+        ArenaAllocator(const ArenaAllocator<U>&) {}
+        ~ArenaAllocator() {}
+
+        pointer address(reference value) const { return &value; }
+        const_pointer address(const_reference value) const { return &value; }
+        size_type max_size() const { return static_cast<size_type>(-1) / sizeof(T); }
+
+        pointer allocate(size_type n, const void* = 0) {
+            return static_cast<pointer>(TickArena::instance().allocate(n * sizeof(T)));
+        }
+        void deallocate(pointer, size_type) {} // Reclaimed by TickArena::reset()
+
+        void construct(pointer ptr, const T& value) { new (static_cast<void*>(ptr)) T(value); }
+        void destroy(pointer ptr) { ptr->~T(); }
+};
+
+template <typename T, typename U>
+bool operator==(const ArenaAllocator<T>&, const ArenaAllocator<U>&) { return true; }
+
+template <typename T, typename U>
+bool operator!=(const ArenaAllocator<T>&, const ArenaAllocator<U>&) { return false; }
+
+// Scratch string for the current tick
+typedef std::basic_string<char, std::char_traits<char>, ArenaAllocator<char> > ArenaString;
+
+#endif
@@ -0,0 +1,88 @@
+#ifndef CAPTURE_HPP
+#define CAPTURE_HPP
+
+#include <string> // For std::string
+#include <vector> // For std::vector
+#include <map> // For std::map
+#include <stdint.h> // For uint64_t
+#include <pthread.h> // For pthread_t, pthread_mutex_t, pthread_cond_t
+
+// Records every line received from every connection into a compact binary
+// capture file, for replaying production traffic against a test server
+// (see ircreplay). Records are appended to a memory buffer on the input path
+// and handed to a writer thread once per loop tick, so a slow disk never
+// stalls the loop. If the writer falls more than BACKLOG_LIMIT bytes behind,
+// whole ticks of records are dropped instead.
+//
+// File layout: the magic "IRCCAP1\n", then records of
+//   type (1 byte) | microseconds since the previous record (varint)
+//   | connection id (varint) | payload length (varint) | payload
+// where type is one of:
+//   'S' segment start, payload is the absolute CLOCK_MONOTONIC time in
+//       microseconds (8 bytes, big endian); each process writing to the
+//       file starts one. Its connection id is 1 when the process took over
+//       from a live upgrade and keeps the previous segment's ids, else 0
+//   'O' connection opened, payload is the peer address
+//   'L' line received, payload is the line without CR LF
+//   'C' connection closed, no payload
+// Connection ids are unique within a segment and its continuations. Credentials in PASS, OPER
+// and AUTHENTICATE are replaced by "*".
+class Capture {
+    public:
+        struct Record {
+            char type;
+            uint64_t time_us;      // Since the first record of the file
+            unsigned long connection; // Unique across the whole file
+            std::string payload;
+        };
+
+    private:
+        static const size_t BACKLOG_LIMIT = 16 * 1024 * 1024; // Bytes waiting for the writer
+
+        int fd;
+        std::string buffer;        // Records of the current tick
+        std::map<int, unsigned long> connections; // Client fd -> connection id
+        unsigned long next_id;
+        uint64_t last_us;
+
+        pthread_t writer;
+        bool writer_running;       // Without a thread, flush() writes on the loop
+        pthread_mutex_t lock;      // Guards backlog, writing and stopping
+        pthread_cond_t wakeup;     // Backlog to write, or stopping
+        pthread_cond_t idle;       // The writer has caught up
+        std::string backlog;       // Handed to the writer, not written yet
+        bool writing;              // The writer holds a batch outside the lock
+        bool stopping;
+        unsigned long dropped;     // Ticks lost to a full backlog
+
+        void putRecord(char type, unsigned long connection, const std::string& payload);
+        static void* writerMain(void* self);
+        void writeOut();
+        void writeAll(const std::string& data);
+        void stopWriter(bool discard);
+
+    public:
+        Capture();
+        ~Capture();
+
+        bool open(const std::string& path, bool continued);
+        bool isEnabled() const { return fd >= 0; }
+        unsigned long idOf(int client_fd) const; // 0 if not captured
+        void resume(int client_fd, unsigned long id); // Connection carried over by an upgrade
+        void resumeClosed(unsigned long id); // Connection the previous process closed during an upgrade
+        void detach(); // Stops recording; the file belongs to the new process after an upgrade
+
+        void opened(int client_fd, const std::string& address);
+        void line(int client_fd, const std::string& line);
+        void closed(int client_fd);
+        void flush();              // Hands this tick's records to the writer
+        void drain();              // Blocks until everything recorded is in the file
+
+        static std::string redact(const std::string& line);
+        static uint64_t nowUs();
+
+        // Reads a whole capture file, for the replay tool
+        static bool load(const std::string& path, std::vector<Record>& records, std::string& error);
+};
+
+#endif
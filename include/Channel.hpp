@@ -4,23 +4,36 @@
 #include <string>
 #include <vector>
 #include <set>
+#include <map>
 #include <sstream>
+#include <ctime>
+#include "PoolAllocator.hpp"
+#include "MaskList.hpp"
 
 class Client;
 
 class Channel {
+    public:
+        // Membership sets draw their tree nodes from a shared pool
+        typedef std::set<int, std::less<int>, PoolAllocator<int> > FdSet;
+
     private:
         std::string name;
         std::string topic;
+        time_t topic_time;         // When the topic was last set, 0 if never
         std::string key;           // Channel password (mode +k)
-        std::set<int> clients;     // Client file descriptors in this channel
-        std::set<int> operators;   // Operator client file descriptors
+        FdSet clients;             // Client file descriptors in this channel (negative ids for remote users)
+        FdSet operators;           // Operator client file descriptors
         bool invite_only;          // Mode +i
         bool topic_restricted;     // Mode +t (only operators can change topic)
         bool has_key;              // Mode +k
         bool has_user_limit;       // Mode +l
         size_t user_limit;         // Maximum users allowed
-        std::set<int> invited_clients;  // Clients invited to invite-only channel
+        bool permanent;            // Mode +P (kept and snapshotted while empty)
+        FdSet invited_clients;  // Clients invited to invite-only channel
+        MaskList bans;             // Mode +b
+        MaskList exceptions;       // Mode +e (overrides +b)
+        MaskList invite_exceptions; // Mode +I (overrides +i)
 
     public:
         Channel(); // Default constructor for std::map
@@ -30,6 +43,7 @@ class Channel {
         // Getters
         const std::string& getName() const { return name; }
         const std::string& getTopic() const { return topic; }
+        time_t getTopicTime() const { return topic_time; }
         const std::string& getKey() const { return key; }
         bool isInviteOnly() const { return invite_only; }
         bool isTopicRestricted() const { return topic_restricted; }
@@ -37,37 +51,54 @@ class Channel {
         bool hasUserLimit() const { return has_user_limit; }
         size_t getUserLimit() const { return user_limit; }
         size_t getUserCount() const { return clients.size(); }
+        bool isPermanent() const { return permanent; }
         
         // Client management
         bool hasClient(int client_fd) const;
         bool addClient(int client_fd);
+        bool insertClient(int client_fd);
         bool removeClient(int client_fd);
-        const std::set<int>& getClients() const { return clients; }
+        const FdSet& getClients() const { return clients; }
         
         // Operator management
         bool isOperator(int client_fd) const;
         void addOperator(int client_fd);
         void removeOperator(int client_fd);
-        const std::set<int>& getOperators() const { return operators; }
+        const FdSet& getOperators() const { return operators; }
         
         // Channel modes
-        void setTopic(const std::string& new_topic);
+        void setTopic(const std::string& new_topic, time_t set_time = 0);
         void setInviteOnly(bool invite_only);
         void setTopicRestricted(bool restricted);
         void setKey(const std::string& new_key);
         void removeKey();
         void setUserLimit(size_t limit);
         void removeUserLimit();
+        void setPermanent(bool permanent_mode);
         
         // Invite management
         void inviteClient(int client_fd);
         bool isInvited(int client_fd) const;
         void removeInvite(int client_fd);
+        const FdSet& getInvited() const { return invited_clients; }
+
+        // Ban, exception and invite-exception lists
+        MaskList& getBans() { return bans; }
+        MaskList& getExceptions() { return exceptions; }
+        MaskList& getInviteExceptions() { return invite_exceptions; }
+        const MaskList& getBans() const { return bans; }
+        const MaskList& getExceptions() const { return exceptions; }
+        const MaskList& getInviteExceptions() const { return invite_exceptions; }
+        bool isBanned(const std::string& client_mask, const std::string& host) const;
         
         // Utility
-        bool canJoin(int client_fd, const std::string& provided_key = "") const;
+        bool canJoin(int client_fd, const std::string& provided_key = "", bool invite_exempt = false) const;
         std::string getModeString() const;
         bool isEmpty() const { return clients.empty(); }
 };
 
+// Channel name -> Channel object, with Channels living in pooled map nodes
+typedef std::map<std::string, Channel, std::less<std::string>,
+                 PoolAllocator<std::pair<const std::string, Channel> > > ChannelMap;
+
 #endif
\ No newline at end of file
@@ -3,28 +3,64 @@
 
 #include <string> // For std::string
 #include <set> // For std::set
+#include <vector> // For std::vector
+#include <openssl/ssl.h> // For SSL
+#include "InternedString.hpp"
+#include "PoolAllocator.hpp"
+#include "WebSocket.hpp"
+
+class Channel;
+
+// Progress of an AUTHENTICATE exchange
+enum SaslState {
+    SASL_NONE,
+    SASL_STARTED,   // Mechanism accepted, collecting the payload
+    SASL_VERIFYING  // Credentials are being checked by a worker
+};
 
 class Client {
     public:
         int fd;
         std::string nickname;
-        std::string username;
-        std::string realname;
-        std::string hostname;
+        InternedString username;
+        InternedString realname;
+        InternedString hostname; // Resolved name, or the address when there is none
+        InternedString address;  // Numeric peer address, empty for remote users
         bool authenticated;
         bool registered;
-        std::string buffer;
-        std::set<std::string> channels;
+        unsigned int caps;      // Negotiated IRCv3 capabilities (CAP_* bits)
+        bool cap_negotiating;   // Registration is held until CAP END
+        bool resolving_host;    // Registration is held until the hostname lookup ends
+        bool server_operator;   // Authenticated with OPER
+        std::string account;    // SASL account, empty if not logged in
+        SaslState sasl_state;   // Registration is held while credentials are verified
+        std::string sasl_payload; // AUTHENTICATE chunks received so far
+        SSL* tls;               // TLS session, NULL for plaintext clients
+        bool tls_handshaking;   // Nothing is read until the handshake completes
+        bool tls_want_write;    // The handshake is waiting for POLLOUT
+        WebSocketState websocket; // WS_NONE unless accepted on a WebSocket listener
+        bool websocket_text;    // Lines go out in text frames rather than binary ones
+        bool websocket_fragmented; // A data message is being received in fragments
+        bool websocket_message_text; // ...and it was started as a text message
+        int link_fd;            // Remote users: server link they are reached through, -1 for local clients
+        InternedString server;  // Remote users: name of the server they are connected to
+        unsigned long fanout_epoch; // Last common-channel fan-out that reached this client
+        std::vector<Channel*> channels; // Channels it is in, ordered by name
+        std::set<std::string> monitoring; // Casemapped nicknames on its MONITOR list
 
         Client();
         ~Client();
 
         // Channel management
         bool isFullyRegistered() const;
-        void joinChannel(const std::string& channel_name);
-        void leaveChannel(const std::string& channel_name);
-        bool isInChannel(const std::string& channel_name) const;
-        const std::set<std::string>& getChannels() const;
+        bool isRemote() const;
+        std::string getPrefix() const; // nick!user@host
+        void joinChannel(Channel* channel);
+        void leaveChannel(Channel* channel);
+        const std::vector<Channel*>& getChannels() const;
 };
 
+// Clients in connection order, each living in a pooled node
+typedef PooledVector<Client> ClientList;
+
 #endif
\ No newline at end of file
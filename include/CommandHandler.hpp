@@ -2,31 +2,78 @@
 #define COMMANDHANDLER_HPP
 
 #include <string>
+#include <vector>
+#include <set>
 #include "IRCMessage.hpp"
+#include "History.hpp"
 
 class Server; // Forward declaration
+class Client;
+class Channel;
+class MaskList;
 
 class CommandHandler {
 private:
     Server* server; // Reference to the server instance
+    unsigned long batch_counter; // Source of IRCv3 batch reference tags
+
+    static const size_t MAX_TARGETS = 20; // Comma-separated targets accepted by PRIVMSG/NOTICE
+    static const size_t HISTORY_JOIN_REPLAY = 0; // Scrollback lines replayed on JOIN, 0 to disable
+    static const size_t CHATHISTORY_MAX_LIMIT = 100; // Most events one CHATHISTORY request returns
+    static const size_t MAX_LIST_ENTRIES = 500; // Most entries in one +b/+e/+I list
+    static const size_t SASL_CHUNK_SIZE = 400;     // AUTHENTICATE payload chunk length
+    static const size_t SASL_PAYLOAD_LIMIT = 1200; // Longest base64 payload accepted
+
+    bool requireServerOperator(int client_index);
+
+    // Shared delivery path for PRIVMSG and NOTICE
+    void relayMessage(int client_index, const IRCMessage& msg, const std::string& command);
+    void sendWhoReply(int client_index, const std::string& channel_name, const Client& target, bool is_operator);
+    MaskList& maskListFor(Channel& channel, char mode);
+    void sendMaskList(int client_index, Channel& channel, char mode);
+    void sendHistory(int client_index, const std::string& channel_name, const std::vector<History::Event>& events);
+    void sendMonitorStatus(int client_index, const std::vector<std::string>& nicknames);
 
 public:
     CommandHandler(Server* srv);
     ~CommandHandler();
 
+    // Registers the client once nothing holds registration back any more
+    void completeRegistration(int client_index);
+    // Disconnects local clients the deny list now covers, after it was reloaded
+    void dropDeniedClients();
+
     // IRC command handlers
     void handleIRCMessage(int client_index, const IRCMessage& msg);
     void handlePass(int client_index, const IRCMessage& msg);
     void handleNick(int client_index, const IRCMessage& msg);
     void handleUser(int client_index, const IRCMessage& msg);
+    void handleCap(int client_index, const IRCMessage& msg);
+    void handleAuthenticate(int client_index, const IRCMessage& msg);
     void handlePing(int client_index, const IRCMessage& msg);
     void handleQuit(int client_index, const IRCMessage& msg);
     void handleWhois(int client_index, const IRCMessage& msg);
+    void handleChathistory(int client_index, const IRCMessage& msg);
+    void handleWho(int client_index, const IRCMessage& msg);
+    void handleList(int client_index, const IRCMessage& msg);
+    void handleMonitor(int client_index, const IRCMessage& msg);
+
+    // Server operator commands
+    void handleOper(int client_index, const IRCMessage& msg);
+    void handleKline(int client_index, const IRCMessage& msg, bool adding);
+    void handleDline(int client_index, const IRCMessage& msg, bool adding);
+
+    // Server links
+    void handleServer(int client_index, const IRCMessage& msg);
+    void handleConnect(int client_index, const IRCMessage& msg);
+    void handleSquit(int client_index, const IRCMessage& msg);
+    void handleLinks(int client_index, const IRCMessage& msg);
     
     // Channel-related command handlers
     void handleJoin(int client_index, const IRCMessage& msg);
     void handlePart(int client_index, const IRCMessage& msg);
     void handlePrivmsg(int client_index, const IRCMessage& msg);
+    void handleNotice(int client_index, const IRCMessage& msg);
     void handleKick(int client_index, const IRCMessage& msg);
     void handleInvite(int client_index, const IRCMessage& msg);
     void handleTopic(int client_index, const IRCMessage& msg);
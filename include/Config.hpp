@@ -0,0 +1,86 @@
+#ifndef CONFIG_HPP
+#define CONFIG_HPP
+
+#include <string> // For std::string
+#include <set> // For std::set
+#include <map> // For std::map
+#include <pthread.h> // For pthread_t
+#include "DenyList.hpp"
+#include "SocketProfile.hpp"
+
+// Settings from the configuration file, "key = value" lines:
+//   password = <server password, overrides the command line>
+//   max_clients = <local connections accepted at once>
+//   throttle_connections = <connections per source...>
+//   throttle_window = <...within this many seconds>
+//   listen = <extra plaintext port>, once per port
+//   websocket = <plaintext WebSocket port>, once per port
+//   tcp_nodelay = on|off, defer_accept = <seconds>, receive_buffer = <bytes>,
+//   send_buffer = <bytes>, keepalive_idle|keepalive_interval = <seconds>,
+//   keepalive_count = <probes>, user_timeout = <milliseconds>,
+//   notsent_lowat = <bytes>: the socket profile of every listener
+//   <port>.<socket setting> = <value>: override for the listener on that port
+// Keys left out keep their defaults. The deny list file is read along with
+// it, so both change together on a reload.
+struct Config {
+    std::string password;          // Empty to keep the command line password
+    size_t max_clients;
+    unsigned int throttle_connections;
+    int throttle_window;
+    std::set<int> listen_ports;
+    std::set<int> websocket_ports;
+    SocketProfile socket_profile;
+    std::map<int, SocketProfile> port_profiles; // Port -> settings overriding socket_profile there
+    DenyList deny_list;
+    unsigned long deny_revision;   // Revision of the running deny list when the reload started
+
+    Config(size_t default_max_clients, unsigned int default_throttle_connections, int default_throttle_window,
+           const std::string& deny_file);
+
+    // Missing files leave the defaults; any invalid line fails the whole file
+    static bool load(const std::string& path, Config& config, std::string& error);
+};
+
+// Re-reads the configuration when SIGHUP arrives. The signal is blocked and
+// read from a signalfd by the event loop. The file is then read and
+// validated on a helper thread, so slow storage never stalls the loop, and
+// the finished result is signalled on an eventfd; the loop swaps it in
+// whole between two ticks.
+class ConfigLoader {
+    private:
+        std::string path;
+        Config defaults;
+        int signal_fd;
+        int event_fd;
+        pthread_t thread;
+        bool requested;            // SIGHUP arrived, no reload started for it yet
+        bool running;
+        bool finished;             // The thread is done and its result not taken
+        Config* result;            // Owned by the thread while it runs
+        std::string error;
+
+        static void* threadMain(void* self);
+        void load();
+
+    public:
+        ConfigLoader(const std::string& file_path, const Config& default_config);
+        ~ConfigLoader();
+
+        // Must run before any thread is created, so no thread takes SIGHUP itself
+        static void blockSignal();
+
+        bool start();
+        bool isEnabled() const { return signal_fd >= 0; }
+        int getSignalFd() const { return signal_fd; }
+        int getEventFd() const { return event_fd; }
+
+        void receiveSignal();      // Drains the signalfd and notes the request
+        void collect();            // Clears the eventfd after it became readable
+        // Starts a requested reload unless one is still running
+        void startRequested(unsigned long running_deny_revision);
+        bool hasResult() const { return finished; }
+        // The finished reload: true with the new configuration, false with an error
+        bool takeResult(Config& config, std::string& reload_error);
+};
+
+#endif
@@ -0,0 +1,41 @@
+#ifndef CONNECTIONTHROTTLE_HPP
+#define CONNECTIONTHROTTLE_HPP
+
+#include <vector> // For std::vector
+#include <ctime> // For time_t
+#include <stdint.h> // For uint64_t
+#include <sys/socket.h> // For sockaddr_storage
+
+// Fixed-size open-addressing table counting recent connections per source.
+// IPv4 peers are keyed by address, IPv6 peers by their /64 subnet.
+class ConnectionThrottle {
+    private:
+        struct Entry {
+            uint64_t key;
+            time_t window_start;
+            unsigned int count;   // 0 means the slot is free
+        };
+
+        static const size_t TABLE_SIZE = 4096;  // Must be a power of two
+        static const size_t MAX_PROBES = 8;     // Slots inspected before evicting
+
+        std::vector<Entry> table;
+        unsigned int max_connections;  // Allowed per source within one window
+        time_t window;                 // Window length in seconds
+
+        static size_t hashKey(uint64_t key);
+
+    public:
+        ConnectionThrottle(unsigned int max_per_window, time_t window_seconds);
+        ~ConnectionThrottle();
+
+        static uint64_t keyFor(const struct sockaddr_storage& addr);
+
+        // New limits apply to the current windows as well
+        void setLimits(unsigned int max_per_window, time_t window_seconds);
+
+        // Records a connection attempt, returns false if the source is over its limit
+        bool allow(uint64_t key, time_t now);
+};
+
+#endif
@@ -0,0 +1,74 @@
+#ifndef DENYLIST_HPP
+#define DENYLIST_HPP
+
+#include <string> // For std::string
+#include <vector> // For std::vector
+#include <ctime> // For time_t
+#include <stdint.h> // For uint32_t
+#include <sys/socket.h> // For sockaddr_storage
+#include "MaskList.hpp"
+
+// Server-wide deny lists managed by IRC operators:
+//   - D-lines ban an IP address or CIDR range and are checked right after
+//     accept(), before anything is allocated for the connection
+//   - K-lines ban a user@host mask and are checked at registration
+// Both are persisted to a text file, one line per entry:
+//   DLINE <cidr> <setter> <set time> :<reason>
+//   KLINE <user@host> <setter> <set time> :<reason>
+class DenyList {
+    public:
+        struct Line {
+            std::string mask;
+            std::string setter;
+            time_t set_time;
+            std::string reason;
+        };
+
+    private:
+        // Binary trie over 128-bit addresses, IPv4 mapped into ::ffff:0:0/96.
+        // Nodes live in one vector; index 0 is the root and also means "no child".
+        struct Node {
+            uint32_t child[2];
+            bool terminal;       // A D-line covers everything below this node
+        };
+
+        std::vector<Node> trie;
+        std::vector<Line> dlines;
+        std::vector<Line> klines;
+        MaskList kline_masks;    // Matcher for klines, as *!user@host
+        std::string path;
+        unsigned long revision;  // Bumped on every change made through the server
+
+        static bool parseCidr(const std::string& cidr, unsigned char address[16], unsigned int& prefix_length);
+        static bool sameRange(const std::string& first, const std::string& second);
+        void insertPrefix(const unsigned char address[16], unsigned int prefix_length);
+        bool containsAddress(const unsigned char address[16]) const;
+        void rebuildTrie();
+        bool insertDline(const Line& line);
+        bool insertKline(const Line& line);
+        bool save();
+
+    public:
+        DenyList(const std::string& file_path);
+        ~DenyList();
+
+        void load();
+
+        bool addDline(const std::string& cidr, const std::string& setter, time_t set_time, const std::string& reason);
+        bool removeDline(const std::string& cidr);
+        bool addKline(const std::string& mask, const std::string& setter, time_t set_time, const std::string& reason);
+        bool removeKline(const std::string& mask);
+
+        bool isDenied(const struct sockaddr_storage& addr) const;
+        bool isDenied(const std::string& host) const; // Printable address, as in Client::address
+        bool isKlined(const std::string& client_mask, const std::string& host) const;
+
+        static bool isValidCidr(const std::string& cidr);
+        // Printable IPv4/IPv6 address to 128 bits, IPv4 mapped into ::ffff:0:0/96
+        static bool parseAddress(const std::string& text, unsigned char address[16]);
+        const std::vector<Line>& getDlines() const { return dlines; }
+        const std::vector<Line>& getKlines() const { return klines; }
+        unsigned long getRevision() const { return revision; }
+};
+
+#endif
@@ -0,0 +1,62 @@
+#ifndef HISTORY_HPP
+#define HISTORY_HPP
+
+#include <string> // For std::string
+#include <vector> // For std::vector
+#include <map> // For std::map
+#include <fstream> // For std::ofstream
+#include <stdint.h> // For uint64_t
+
+// Per-channel scrollback: a fixed-size ring of recent events for every
+// channel. Sender prefixes and message texts are interned with reference
+// counts, so a user's prefix or a message sent to several channels is
+// stored only once no matter how many events refer to it.
+class History {
+    public:
+        enum EventType { EVENT_PRIVMSG, EVENT_NOTICE, EVENT_JOIN, EVENT_PART, EVENT_TOPIC };
+
+        struct Event {
+            uint64_t time_ms;           // Milliseconds since the epoch
+            EventType type;
+            const std::string* prefix;  // Interned nick!user@host
+            const std::string* text;    // Interned message/reason/topic (may be empty)
+        };
+
+    private:
+        struct Ring {
+            std::vector<Event> events;  // Grows up to capacity, then wraps
+            size_t head;                // Index of the oldest event once full
+        };
+
+        size_t capacity;                          // Events kept per channel
+        std::map<std::string, Ring> rings;        // Channel name -> its events
+        std::map<std::string, unsigned> interned; // Shared strings -> reference count
+        std::ofstream log;                        // Optional append-only event log
+
+        const std::string* intern(const std::string& value);
+        void release(const std::string* value);
+        void collect(const Ring& ring, std::vector<Event>& out) const;
+
+    public:
+        History(size_t events_per_channel);
+        ~History();
+
+        static uint64_t nowMs();
+        static std::string formatTime(uint64_t time_ms);     // ISO 8601, e.g. 2024-01-31T12:00:00.000Z
+        static bool parseTime(const std::string& text, uint64_t& time_ms);
+        static std::string formatEvent(const std::string& channel, const Event& event);
+
+        bool openLog(const std::string& path);
+        void flushLog();
+
+        void record(const std::string& channel, EventType type, const std::string& prefix, const std::string& text);
+        void dropChannel(const std::string& channel);
+
+        // Queries return events oldest first, at most `limit` of them
+        std::vector<Event> latest(const std::string& channel, size_t limit) const;
+        std::vector<Event> before(const std::string& channel, uint64_t time_ms, size_t limit) const;
+        std::vector<Event> after(const std::string& channel, uint64_t time_ms, size_t limit) const;
+        std::vector<Event> between(const std::string& channel, uint64_t from_ms, uint64_t to_ms, size_t limit) const;
+};
+
+#endif
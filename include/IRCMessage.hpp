@@ -5,9 +5,19 @@
 #include <vector> // For std::vector
 #include <iostream> // For std::cout
 #include <sstream> // For std::istringstream
+#include <map> // For std::map
+
+// IRCv3 capabilities a client can negotiate with CAP
+enum Capability {
+    CAP_MESSAGE_TAGS = 1 << 0,
+    CAP_SERVER_TIME = 1 << 1,
+    CAP_BATCH = 1 << 2,
+    CAP_SASL = 1 << 3
+};
 
 class IRCMessage {
     public:
+        std::map<std::string, std::string> tags; // IRCv3 message tags (unescaped)
         std::string prefix;
         std::string command;
         std::vector<std::string> params;
@@ -17,6 +27,30 @@ class IRCMessage {
         ~IRCMessage();
 };
 
+// A server-generated line together with its tagged variants. Tags are
+// serialized once when the message is built; each recipient then picks
+// the variant matching its capabilities.
+class OutgoingMessage {
+    public:
+        std::string plain;   // No tags
+        std::string timed;   // server-time only
+        std::string tagged;  // server-time, msgid and relayed client-only tags
+        mutable std::string frames[6]; // WebSocket frames of each variant, text and binary, built on first use
+
+        OutgoingMessage(const std::string& line, const std::string& time, const std::string& msgid, const std::string& client_tags = "");
+        ~OutgoingMessage();
+
+        const std::string& forCaps(unsigned int caps) const {
+            if (caps & CAP_MESSAGE_TAGS) return tagged;
+            if (caps & CAP_SERVER_TIME) return timed;
+            return plain;
+        }
+        // The variant for caps as a WebSocket frame, encoded once for all recipients
+        const std::string& webSocketFrame(unsigned int caps, bool text) const;
+};
+
 IRCMessage parseMessage(const std::string& raw_message);
+std::string escapeTagValue(const std::string& value);
+std::string unescapeTagValue(const std::string& value);
 
 #endif
\ No newline at end of file
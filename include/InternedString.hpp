@@ -0,0 +1,57 @@
+#ifndef INTERNEDSTRING_HPP
+#define INTERNEDSTRING_HPP
+
+#include <string> // For std::string
+#include <map> // For std::map
+#include <ostream> // For std::ostream
+
+// Immutable string whose value is stored once per process. Equal values
+// share one reference-counted table entry, so thousands of clients behind
+// the same NAT host or with the same ident cost a pointer each. Converts
+// to const std::string& wherever one is expected. Not thread-safe: only
+// the main thread touches client identities.
+class InternedString {
+    private:
+        typedef std::map<std::string, unsigned long> Table; // Value -> reference count
+        typedef Table::value_type Entry;
+
+        Entry* entry; // NULL for the empty string
+
+        static Table& table();
+        static Entry* acquire(const std::string& value);
+        static void release(Entry* entry);
+
+    public:
+        InternedString();
+        InternedString(const std::string& value);
+        InternedString(const char* value);
+        InternedString(const InternedString& other);
+        ~InternedString();
+
+        InternedString& operator=(const InternedString& other);
+        InternedString& operator=(const std::string& value);
+        InternedString& operator=(const char* value);
+
+        const std::string& str() const;
+        operator const std::string&() const { return str(); }
+        bool empty() const { return entry == NULL; }
+        size_t length() const { return str().length(); }
+        const char* c_str() const { return str().c_str(); }
+
+        // Equal values share their entry, so comparing two handles is a pointer compare
+        bool operator==(const InternedString& other) const { return entry == other.entry; }
+        bool operator!=(const InternedString& other) const { return entry != other.entry; }
+};
+
+// The std::string operators are templates, which never convert their arguments
+std::string operator+(const std::string& left, const InternedString& right);
+std::string operator+(const InternedString& left, const std::string& right);
+std::string operator+(const char* left, const InternedString& right);
+std::string operator+(const InternedString& left, const char* right);
+bool operator==(const InternedString& left, const std::string& right);
+bool operator==(const std::string& left, const InternedString& right);
+bool operator!=(const InternedString& left, const std::string& right);
+bool operator!=(const std::string& left, const InternedString& right);
+std::ostream& operator<<(std::ostream& out, const InternedString& value);
+
+#endif
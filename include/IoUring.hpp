@@ -0,0 +1,79 @@
+#ifndef IOURING_HPP
+#define IOURING_HPP
+
+#include <vector> // For std::vector
+#include <cstddef> // For size_t
+#include <stdint.h> // For uint64_t
+#include <linux/io_uring.h> // For io_uring_sqe, io_uring_cqe
+
+// Minimal io_uring driver on top of the raw syscalls (no liburing).
+// Requests are queued with the prep* calls and all go to the kernel in the
+// next submitAndWait(), which also waits for completions. Receives use a
+// provided-buffer ring: the kernel picks a free buffer per completion and
+// the caller hands it back with recycleBuffer() once the data is consumed.
+class IoUring {
+    public:
+        struct Completion {
+            uint64_t user_data;
+            int32_t res;
+            uint32_t flags;
+        };
+
+    private:
+        int ring_fd;
+        unsigned sq_entries;
+        unsigned to_submit;       // Queued entries the kernel has not consumed yet
+
+        void* sq_ring;
+        size_t sq_ring_size;
+        void* cq_ring;
+        size_t cq_ring_size;
+        struct io_uring_sqe* sqes;
+        size_t sqes_size;
+
+        unsigned* sq_head;
+        unsigned* sq_tail;
+        unsigned* sq_mask;
+        unsigned* sq_array;
+        unsigned* cq_head;
+        unsigned* cq_tail;
+        unsigned* cq_mask;
+        struct io_uring_cqe* cqes;
+
+        struct io_uring_buf_ring* buf_ring;
+        size_t buf_ring_size;
+        unsigned buffer_count;    // Power of two
+        unsigned buffer_size;
+        std::vector<char> buffers;
+
+        IoUring(const IoUring&);
+        IoUring& operator=(const IoUring&);
+
+        struct io_uring_sqe* nextSqe();
+        void commitSqe();
+        int enter(unsigned submit, unsigned wait, int timeout_ms);
+
+    public:
+        static const uint16_t BUFFER_GROUP = 0;
+
+        IoUring();
+        ~IoUring();
+
+        // Returns false if io_uring or a required feature is unavailable
+        bool setup(unsigned entries, unsigned receive_buffers, unsigned receive_buffer_size);
+
+        void prepAccept(int listen_fd, uint64_t user_data);     // Multishot
+        void prepRecv(int fd, uint64_t user_data);              // Multishot, provided buffers
+        void prepSend(int fd, const char* data, size_t length, uint64_t user_data);
+        void prepPoll(int fd, short events, bool multishot, uint64_t user_data);
+        void prepCancelAll(uint64_t user_data);
+
+        // Submits everything queued and waits up to timeout_ms (-1: forever) for a completion
+        int submitAndWait(int timeout_ms);
+        bool nextCompletion(Completion& completion);
+
+        const char* bufferData(uint16_t buffer_id) const { return &buffers[static_cast<size_t>(buffer_id) * buffer_size]; }
+        void recycleBuffer(uint16_t buffer_id);
+};
+
+#endif
@@ -0,0 +1,16 @@
+#ifndef MASK_HPP
+#define MASK_HPP
+
+#include <string> // For std::string
+
+// IRC casemapping (rfc1459): ASCII letters plus []\~ <-> {}|^
+char ircLower(char c);
+std::string ircLower(const std::string& text);
+
+// Case-insensitive glob match where '*' matches any run and '?' one character
+bool matchMask(const std::string& mask, const std::string& text);
+
+// True if the mask contains no wildcards and can be compared literally
+bool isLiteralMask(const std::string& mask);
+
+#endif
@@ -0,0 +1,55 @@
+#ifndef MASKLIST_HPP
+#define MASKLIST_HPP
+
+#include <string> // For std::string
+#include <vector> // For std::vector
+#include <map> // For std::map
+#include <ctime> // For time_t
+
+// A channel list mode (+b, +e, +I) holding nick!user@host masks.
+// Masks are indexed by the shape of their host part so that matching a
+// user only runs the glob matcher on a few candidates:
+//   - literal hosts ("*!*@irc.example.com") sit in an exact-host bucket
+//   - leading-wildcard hosts ("*!*@*.example.com") sit in a bucket keyed
+//     by their literal suffix and are found by looking up the suffixes of
+//     the user's host
+//   - anything else (e.g. "*!*@*") is checked one by one
+class MaskList {
+    public:
+        struct Entry {
+            std::string mask;    // Normalized nick!user@host, as set
+            std::string setter;  // Who set it
+            time_t set_time;
+        };
+
+    private:
+        struct SuffixBucket {
+            std::string suffix;          // Casemapped
+            std::vector<size_t> indexes; // Entries ending in it
+        };
+
+        std::vector<Entry> entries;
+        std::map<std::string, std::vector<size_t> > exact_hosts; // Casemapped host -> entry indexes
+        std::vector<SuffixBucket> host_suffixes;                // Sorted by suffix, searched in place
+        std::vector<size_t> generic;                            // Entries needing a full scan
+        size_t shortest_suffix;                                 // Skip suffix lookups shorter than this
+
+        void rebuildIndex();
+        static bool suffixLess(const SuffixBucket& bucket, const char* suffix);
+        bool matchesEntry(size_t index, const std::string& client_mask) const;
+
+    public:
+        MaskList();
+        ~MaskList();
+
+        static std::string normalize(const std::string& mask);
+
+        bool add(const std::string& mask, const std::string& setter, time_t set_time);
+        bool remove(const std::string& mask);
+        bool matches(const std::string& client_mask, const std::string& host) const;
+
+        const std::vector<Entry>& getEntries() const { return entries; }
+        size_t size() const { return entries.size(); }
+};
+
+#endif
@@ -0,0 +1,185 @@
+#ifndef POOLALLOCATOR_HPP
+#define POOLALLOCATOR_HPP
+
+#include <cstddef> // For size_t, ptrdiff_t
+#include <new> // For operator new, std::bad_alloc
+#include <vector> // For std::vector
+
+// Free-list pool handing out fixed-size nodes carved from large chunks.
+// Freed nodes are kept for reuse instead of going back to the global
+// allocator, so container churn (joins, parts, reconnects) does not grow
+// or fragment the heap.
+//
+// Not thread-safe: the free lists are process-wide singletons without a
+// lock. Only the event-loop thread may create, copy or destroy pooled
+// containers (Channel::FdSet, ChannelMap, ClientList). The worker threads (SASL
+// password checks, config reloads) only build plain std containers, and
+// anything they hand back is copied into pooled ones on the loop.
+template <size_t NodeSize>
+class NodePool {
+    private:
+        union Node {
+            Node* next;
+            char storage[NodeSize];
+        };
+
+        static const size_t NODES_PER_CHUNK = 256;
+
+        Node* free_list;
+        std::vector<Node*> chunks;
+
+        NodePool() : free_list(NULL) {}
+        ~NodePool() {
+            for (size_t i = 0; i < chunks.size(); i++) {
+                ::operator delete(chunks[i]);
+            }
+        }
+        NodePool(const NodePool&);
+        NodePool& operator=(const NodePool&);
+
+        void grow() {
+            Node* chunk = static_cast<Node*>(::operator new(sizeof(Node) * NODES_PER_CHUNK));
+            chunks.push_back(chunk);
+            for (size_t i = 0; i < NODES_PER_CHUNK; i++) {
+                chunk[i].next = free_list;
+                free_list = &chunk[i];
+            }
+        }
+
+    public:
+        static NodePool& instance() {
+            static NodePool pool;
+            return pool;
+        }
+
+        void* allocate() {
+            if (!free_list) {
+                grow();
+            }
+            Node* node = free_list;
+            free_list = node->next;
+            return node;
+        }
+
+        void deallocate(void* ptr) {
+            Node* node = static_cast<Node*>(ptr);
+            node->next = free_list;
+            free_list = node;
+        }
+};
+
+// Standard (C++98) allocator serving single-object allocations from a
+// NodePool sized for T. Node-based containers (std::set, std::map) only
+// ever allocate one node at a time; anything larger uses operator new.
+template <typename T>
+class PoolAllocator {
+    public:
+        typedef T value_type;
+        typedef T* pointer;
+        typedef const T* const_pointer;
+        typedef T& reference;
+        typedef const T& const_reference;
+        typedef size_t size_type;
+        typedef ptrdiff_t difference_type;
+
+        template <typename U>
+        struct rebind {
+            typedef PoolAllocator<U> other;
+        };
+
+        PoolAllocator() {}
+        PoolAllocator(const PoolAllocator&) {}
+        template <typename U>
+        PoolAllocator(const PoolAllocator<U>&) {}
+        ~PoolAllocator() {}
+
+        pointer address(reference value) const { return &value; }
+        const_pointer address(const_reference value) const { return &value; }
+        size_type max_size() const { return static_cast<size_type>(-1) / sizeof(T); }
+
+        pointer allocate(size_type n, const void* = 0) {
+            if (n == 1) {
+                return static_cast<pointer>(NodePool<sizeof(T)>::instance().allocate());
+            }
+            return static_cast<pointer>(::operator new(n * sizeof(T)));
+        }
+
+        void deallocate(pointer ptr, size_type n) {
+            if (n == 1) {
+                NodePool<sizeof(T)>::instance().deallocate(ptr);
+            } else {
+                ::operator delete(ptr);
+            }
+        }
+
+        void construct(pointer ptr, const T& value) { new (static_cast<void*>(ptr)) T(value); }
+        void destroy(pointer ptr) { ptr->~T(); }
+};
+
+// All PoolAllocators share the same pools, so any instance can free another's memory
+template <typename T, typename U>
+bool operator==(const PoolAllocator<T>&, const PoolAllocator<U>&) { return true; }
+
+template <typename T, typename U>
+bool operator!=(const PoolAllocator<T>&, const PoolAllocator<U>&) { return false; }
+
+// Indexed sequence whose elements live in NodePool nodes, with only the
+// pointers kept in order. Inserting or removing an element moves pointers
+// instead of copying elements, references stay valid until the element
+// is erased, and the nodes of removed elements are reused.
+template <typename T>
+class PooledVector {
+    private:
+        std::vector<T*> items;
+
+        PooledVector(const PooledVector&);
+        PooledVector& operator=(const PooledVector&);
+
+        static void destroy(T* item) {
+            item->~T();
+            NodePool<sizeof(T)>::instance().deallocate(item);
+        }
+
+    public:
+        PooledVector() {}
+        ~PooledVector() { clear(); }
+
+        size_t size() const { return items.size(); }
+        bool empty() const { return items.empty(); }
+        T& operator[](size_t index) { return *items[index]; }
+        const T& operator[](size_t index) const { return *items[index]; }
+        T& back() { return *items.back(); }
+        void reserve(size_t count) { items.reserve(count); }
+
+        void push_back(const T& value) {
+            void* node = NodePool<sizeof(T)>::instance().allocate();
+            T* item;
+            try {
+                item = new (node) T(value);
+            } catch (...) {
+                NodePool<sizeof(T)>::instance().deallocate(node);
+                throw;
+            }
+            try {
+                items.push_back(item);
+            } catch (...) {
+                destroy(item);
+                throw;
+            }
+        }
+
+        // Later elements move down by one
+        void erase(size_t index) {
+            destroy(items[index]);
+            items.erase(items.begin() + index);
+        }
+
+        void clear() {
+            for (size_t i = 0; i < items.size(); i++) {
+                destroy(items[i]);
+            }
+            items.clear();
+        }
+};
+
+#endif
@@ -0,0 +1,92 @@
+#ifndef RESOLVER_HPP
+#define RESOLVER_HPP
+
+#include <string> // For std::string
+#include <map> // For std::map
+#include <list> // For std::list
+#include <deque> // For std::deque
+#include <ctime> // For time_t
+#include <stdint.h> // For uint16_t, uint32_t
+
+// Non-blocking reverse DNS for connecting clients, spoken directly over one
+// UDP socket that sits in the event loop next to the client sockets.
+// A lookup asks for the PTR record of the address, then for the A/AAAA
+// records of the name it got back, and only reports the name if those
+// contain the address again (forward-confirmed reverse DNS). Answers,
+// including "no name", are kept in an LRU cache for at most their TTL.
+class Resolver {
+    public:
+        struct Result {
+            int client_fd;
+            std::string hostname; // Empty when the address has no confirmed name
+        };
+
+    private:
+        enum Stage {
+            STAGE_REVERSE, // Waiting for the PTR answer
+            STAGE_FORWARD  // Waiting for the A/AAAA answer confirming it
+        };
+
+        struct Lookup {
+            int client_fd;
+            std::string address;       // Printable address, also the cache key
+            unsigned char raw[16];     // Address as it appears in A (4 bytes) or AAAA records
+            bool ipv4;
+            Stage stage;
+            std::string question;      // Name asked about in the current stage
+            std::string hostname;      // PTR answer being confirmed
+            uint32_t ttl;              // Lowest TTL seen so far
+            std::string query;         // Last packet sent, for the retransmission
+            long long deadline;        // Monotonic ms at which the lookup gives up
+            long long retransmit_at;   // Monotonic ms of the single retransmission, 0 once done
+        };
+
+        struct CacheEntry {
+            std::string address;
+            std::string hostname;      // Empty for addresses without a confirmed name
+            time_t expires;
+        };
+
+        int fd;
+        int timeout_ms;
+        size_t cache_capacity;
+        uint32_t max_ttl;          // Cap on positive answers
+        uint32_t negative_ttl;     // How long failures are remembered
+        uint32_t random_state;     // Query id generator
+        std::map<uint16_t, Lookup> pending;  // Query id -> lookup
+        std::map<int, uint16_t> by_client;   // Client fd -> query id
+        std::list<CacheEntry> cache;         // Most recently used first
+        std::map<std::string, std::list<CacheEntry>::iterator> cache_index; // Address -> cache entry
+        std::deque<Result> results;          // Finished lookups not yet collected
+
+        uint16_t nextQueryId();
+        bool sendQuery(uint16_t id, Lookup& lookup, uint16_t type);
+        void handleAnswer(const unsigned char* packet, size_t length);
+        void finish(std::map<uint16_t, Lookup>::iterator it, const std::string& hostname, uint32_t ttl);
+        void remember(const std::string& address, const std::string& hostname, uint32_t ttl);
+
+    public:
+        Resolver(size_t cache_size, uint32_t max_ttl_seconds, uint32_t negative_ttl_seconds);
+        ~Resolver();
+
+        // nameserver is "address", "address:port" or "[address]:port"
+        bool open(const std::string& nameserver, int lookup_timeout_ms);
+        void close();
+        int getFd() const { return fd; }
+        bool isEnabled() const { return fd >= 0; }
+
+        // Answers from the cache right away (true, hostname set or empty);
+        // otherwise starts a lookup whose result shows up in nextResult()
+        bool lookup(int client_fd, const std::string& address, std::string& hostname);
+        void cancel(int client_fd);
+        void abandonAll(); // Every pending lookup ends without a name
+
+        void receive();       // Reads every answer waiting on the socket
+        void expire();        // Retransmits or gives up on overdue queries
+        int nextTimeout() const; // Milliseconds until expire() has work, -1 if none
+        bool nextResult(Result& result);
+
+        static std::string systemNameserver(); // First nameserver in /etc/resolv.conf
+};
+
+#endif
@@ -6,6 +6,7 @@
 #include <string> // For std::string
 #include <iostream> // For std::cout
 #include <cstring> // For std::strerror
+#include <cstdio> // For perror
 #include <cstdlib> // For std::atoi
 #include <unistd.h> // For close()
 #include <arpa/inet.h> // For inet_pton, sockaddr_in
@@ -17,52 +18,356 @@
 #include <utility> // For std::pair
 #include <errno.h> // For errno
 #include <fcntl.h> // fcntl
+#include <ctime> // For time()
+#include <netinet/in.h> // For sockaddr_in6
 #include <poll.h> // poll (or equivalent [select(), kqueue(), or epoll()])
+#include <csignal> // For signal, sig_atomic_t
 #include "Client.hpp"
 #include "IRCMessage.hpp"
 #include "Channel.hpp"
+#include "ConnectionThrottle.hpp"
+#include "DenyList.hpp"
+#include "IoUring.hpp"
+#include "History.hpp"
+#include "Mask.hpp"
+#include "Resolver.hpp"
+#include "Accounts.hpp"
+#include "Capture.hpp"
+#include "Config.hpp"
+#include "Transport.hpp"
+#include "Arena.hpp"
 
 class CommandHandler; // Forward declaration
 
+// Failed SASL logins of one connection
+struct LoginFailures {
+    unsigned count;
+    time_t retry_after; // No new check is started before then
+
+    LoginFailures() : count(0), retry_after(0) {}
+};
+
+// A LIST reply streamed to a client a chunk per loop tick
+struct ListRequest {
+    size_t min_users;       // ELIST U filters, inclusive bounds
+    size_t max_users;
+    time_t topic_after;     // ELIST T filters on the topic set time, 0 if unused
+    time_t topic_before;
+    bool by_size;           // Walk channels_by_size instead of name order
+    bool started;           // False until the first chunk was sent
+    std::string last_name;  // Resume point in name order...
+    std::pair<size_t, std::string> last_size_key; // ...or in size order
+
+    ListRequest() : min_users(0), max_users(static_cast<size_t>(-1)), topic_after(0), topic_before(0),
+                    by_size(false), started(false) {}
+};
+
+// Input a client sent that is not consumed yet
+struct ReceiveQueue {
+    std::string lines;             // Bytes after the last complete line
+    std::string websocket_input;   // WebSocket clients: raw bytes not decoded into frames yet
+    std::string websocket_message; // ...and fragments of the current message
+
+    bool empty() const { return lines.empty() && websocket_input.empty() && websocket_message.empty(); }
+};
+
+// A server on the network other than this one, linked directly or behind another
+struct PeerServer {
+    std::string name;
+    std::string uplink;      // Server that introduced it; ours for direct links
+    std::string description;
+    int hops;                // 1 for direct links
+    int link_fd;             // Link it is reached through
+
+    PeerServer() : hops(0), link_fd(-1) {}
+};
+
+// A connection to a directly linked server
+struct ServerLink {
+    std::string name;   // Peer server name (expected name while an outgoing link handshakes)
+    bool outgoing;      // Opened by CONNECT
+    bool established;   // SERVER exchanged and burst sent
+
+    ServerLink() : outgoing(false), established(false) {}
+};
+
 class Server
 {
 private:
-    static const int MAX_CLIENTS = 5;
+    static const int MAX_CLIENTS = 5; // Unless the config file sets max_clients
     static const int BUFFER_SIZE = 1024;
+    static const size_t NAMES_LINE_LIMIT = 400; // Split 353 replies beyond this length
+    static const size_t LIST_CHUNK = 50;          // LIST entries emitted per client per tick
+    static const size_t LIST_SENDQ_LIMIT = 16384; // Pause a LIST while this much output is pending
+    static const unsigned int THROTTLE_MAX_CONNECTIONS = 20; // Per source address/subnet...
+    static const int THROTTLE_WINDOW = 10;                  // ...within this many seconds
+    static const int UPGRADE_TIMEOUT_MS = 10000; // How long to wait for the new process to take over
+    static const char* const UPGRADE_ENV; // Names the handoff socket in the new process
+    static const int SNAPSHOT_INTERVAL = 60; // Seconds between channel snapshots
+    static const char* const SNAPSHOT_FILE; // Where permanent channels are persisted
+    static const char* const SNAPSHOT_TMP_FILE; // Written first, then renamed over SNAPSHOT_FILE
+    static const size_t HISTORY_SIZE = 100; // Scrollback events kept per channel
+    static const char* const HISTORY_LOG_ENV; // Append-only channel event log, off if unset
+    static const char* const DENY_FILE; // Persisted K-lines and D-lines
+    static const char* const OPER_FILE; // "name hash" lines accepted by OPER
+    static const unsigned MAX_OPER_FAILURES = 3; // Wrong OPER passwords before the client is dropped
+    static const char* const TLS_CERT_FILE; // PEM certificate chain for the TLS listener
+    static const char* const TLS_KEY_FILE;  // PEM private key for the TLS listener
+    static const char* const IO_BACKEND_ENV; // "io_uring" selects the io_uring event loop
+    static const unsigned URING_ENTRIES = 256;      // Submission queue size
+    static const unsigned URING_BUFFERS = 128;      // Provided receive buffers (power of two)
+    static const unsigned URING_BUFFER_SIZE = 2048; // Bytes per receive buffer
+    static const char* const SERVER_NAME_ENV; // Name of this server on the network, "ircserv" if unset
+    static const char* const SERVER_INFO;     // Description shown in LINKS
+    static const char* const LINK_FILE; // "name address port send_password accept_password" lines for server links
+    static const size_t BURST_LINE_LIMIT = 400; // Split NJOIN burst lines beyond this length
+    static const char* const RESOLVER_ENV;         // Nameserver for hostname lookups, "off" to disable
+    static const char* const RESOLVER_TIMEOUT_ENV; // Milliseconds registration may wait for a lookup
+    static const int RESOLVER_TIMEOUT_MS = 3000;   // ...when not set
+    static const size_t RESOLVER_CACHE_SIZE = 4096;  // Addresses whose lookup result is remembered
+    static const uint32_t RESOLVER_MAX_TTL = 3600;   // Longest a name is cached, whatever its TTL
+    static const uint32_t RESOLVER_NEGATIVE_TTL = 300; // How long an address without a name is remembered
+    static const char* const ACCOUNT_FILE; // "name hash" lines for SASL logins
+    static const size_t SASL_WORKERS = 2;      // Threads checking passwords
+    static const size_t SASL_QUEUE_LIMIT = 32; // Logins allowed to wait for a worker
+    static const unsigned SASL_MAX_FAILURES = 5; // Failed logins before the client is dropped
+    static const time_t SASL_BACKOFF = 1;        // Seconds to wait after the first failure, doubled after each
+    static const char* const CAPTURE_ENV; // File to record received traffic to, for ircreplay
+    static const char* const CONFIG_FILE; // Settings re-read on SIGHUP
+    static const size_t MONITOR_LIMIT = 100; // Nicknames one client may MONITOR
+    static const size_t WEBSOCKET_HANDSHAKE_LIMIT = 8192; // Longest upgrade request accepted
+    static const size_t WEBSOCKET_MESSAGE_LIMIT = 16384;  // Longest WebSocket message, all fragments together
+    static const size_t SENDQ_LIMIT = 1048576;        // Unsent bytes a client may have queued before it is dropped
+    static const size_t LINK_SENDQ_LIMIT = 67108864;  // ...and a server link, whose burst can be large
     
     int server_fd;
     int port;
+    int tls_fd; // TLS listener, -1 if disabled
+    int tls_port; // 0 if disabled
+    SSL_CTX* tls_ctx;
     std::string password;
-    std::vector<Client> clients;
-    std::map<std::string, Channel> channels; // Channel name -> Channel object
+    std::string default_password; // From the command line, used when the config file sets none
+    size_t max_clients;
+    std::map<int, int> extra_listeners; // Port -> listener fd, from the config file's listen and websocket lines
+    std::set<int> websocket_listeners; // Those of them speaking WebSocket
+    std::map<int, SocketProfile> listener_profiles; // Listener fd -> socket options for its connections
+    SocketProfile link_profile; // Socket options for outgoing server links
+    SocketTransport socket_transport;
+    Transport* transport; // Client connections' bytes go through this, socket_transport unless simulating
+    MemoryTransport* memory_transport; // The simulated connections, NULL when not simulating
+    ClientList clients;
+    std::vector<int> index_by_fd; // Client fd -> index in clients, -1 if none
+    ChannelMap channels; // Channel name -> Channel object
+    std::map<std::string, int> nick_index; // Casemapped nickname -> client fd
+    std::map<std::string, std::set<int> > monitors; // Casemapped nickname -> fds of local clients monitoring it
+    std::set<std::pair<size_t, std::string> > channels_by_size; // (member count, name) for LIST filters
+    std::map<int, ListRequest> list_requests; // Client fd -> LIST still being streamed
     CommandHandler* commandHandler; // Command handler instance
+    std::map<int, std::string> send_queues; // Client fd -> replies not yet written to the socket
+    std::map<int, size_t> send_heads; // Client fd -> bytes at the front of its queue that finish a partly written message
+    std::map<int, ReceiveQueue> receive_queues; // Client fd -> input not consumed yet, only while there is some
+    ConnectionThrottle throttle; // Per-source connection rate limiting
+    History history; // Channel scrollback
+    DenyList deny_list; // K-lines and D-lines
+    Resolver resolver; // Hostname lookups for connecting clients
+    Accounts accounts; // SASL accounts and operator credentials, checked on worker threads
+    std::map<int, unsigned long> pending_logins; // Client fd -> serial of its running account check
+    std::map<int, LoginFailures> login_failures; // Client fd -> failed logins so far
+    std::map<int, unsigned long> pending_opers; // Client fd -> serial of its running OPER check
+    std::map<int, unsigned> oper_failures; // Client fd -> wrong OPER passwords so far
+    unsigned long login_serial;
+    Capture capture; // Received lines, when recording is on
+    ConfigLoader config_loader; // Configuration reloads on SIGHUP
+    std::vector<std::pair<int, std::string> > pending_disconnects; // Client fds to drop at the end of the tick, with the reason
+
+    static volatile sig_atomic_t upgrade_requested; // Set by SIGUSR2
+    unsigned long msgid_counter; // Sequence part of generated msgid tags
+    unsigned long fanout_epoch; // Stamps the recipients of the current common-channel fan-out
+    pid_t snapshot_pid; // Child currently writing a snapshot, -1 if none
+    std::string snapshot_data; // What the snapshot file holds, to skip unchanged snapshots
+    std::string snapshot_writing; // What the running child is writing
+    time_t next_snapshot; // When the next snapshot is due
+
+    // io_uring backend state, per descriptor
+    struct UringSlot {
+        uint32_t generation;   // Bumped when the descriptor is closed, tags stale completions
+        bool armed;            // Multishot accept/recv/poll outstanding
+        bool pollout_armed;    // One-shot POLLOUT outstanding (TLS clients)
+        std::string inflight;  // Send buffer owned by the kernel until its completion
+
+        UringSlot() : generation(0), armed(false), pollout_armed(false) {}
+    };
+    IoUring* uring; // NULL when the poll() loop is used
+    std::vector<UringSlot> uring_slots;
+    std::map<uint64_t, std::string> orphaned_sends; // In-flight sends of closed clients
+    bool uring_quiescing; // Collecting completions without acting on them (upgrade)
+
+    // Server links. Remote users live in `clients` too, under negative ids
+    // (starting at -2, -1 means "no client" everywhere) instead of fds.
+    std::string server_name;
+    std::map<int, ServerLink> links; // Link fd -> link
+    std::map<std::string, PeerServer> peer_servers; // Casemapped name -> every other server on the network
+    std::map<int, int> remote_index; // Remote user id -> index in clients
+    std::map<int, std::string> offered_link_passwords; // Client fd -> PASS given before registering, in case it is a server
+    int next_remote_id;
+    size_t remote_users; // Entries of clients that are remote users
 
     // Private methods
     void setupSocket();
-    void acceptNewClient();
+    int openListener(int listen_port);
+    void acceptNewClient(int listen_fd);
+    bool admitConnection(int client_fd, const struct sockaddr_storage& client_addr);
+    void registerConnection(int client_fd, const struct sockaddr_storage& client_addr, int listen_fd);
     void handleClientMessage(int client_index);
-    void removeClient(int client_index);
+    void processClientInput(int client_index);
+    void removeClient(int client_index, const std::string& reason = "Client Quit");
+    void indexClients(size_t first_index);
+    bool flushClient(int client_fd);
+    void checkSendQueue(int client_fd, std::string& queue);
+    void notePartialSend(int client_fd, const std::string& queue, size_t sent);
+    void flushPendingOutput();
+    void continueLists();
+    void updateChannelSize(const Channel& channel, size_t old_count);
+    int tickTimeout();
+    void finishTick();
+    bool isDisconnecting(int client_fd) const;
+    void setupResolver();
+    void startHostLookup(int client_index);
+    void completeHostLookups();
+    void handleServiceEvent(int fd);
+    void completeLogins();
+    void completeOperCheck(const Accounts::Result& result);
+    void failPendingLogins();
+    void reapDisconnects();
+    void applyConfig(const Config& config);
+    void updateListeners(const std::set<int>& ports, const std::set<int>& websocket_ports);
+    void applySocketProfiles(const Config& config);
+    void closeListener(int listen_fd);
+    void completeReload();
+
+    // Live upgrade (Upgrade.cpp)
+    static void handleUpgradeSignal(int signum);
+    bool upgrade();
+    void resumeFromUpgrade(int handoff_fd);
+    bool isHandedOver(const Client& client) const;
+    std::string serializeState() const;
+    void restoreState(const std::string& state, const std::vector<int>& fds);
+
+    // TLS listener and sessions (Tls.cpp)
+    void setupTls();
+    bool startTlsSession(Client& client);
+    bool continueHandshake(int client_index);
+    ssize_t receiveInto(int client_index);
+    ssize_t sendToClient(int client_fd, const char* data, size_t length);
+    void closeTlsSession(Client& client);
+    void dropTlsClients();
+
+    // WebSocket clients (WebSocket.cpp)
+    void appendInput(Client& client, const char* data, size_t length);
+    void readWebSocket(int client_index);
+    void closeWebSocket(int client_index, unsigned short status, const std::string& reason);
+
+    // io_uring event loop (UringLoop.cpp)
+    bool startIoUring();
+    void runIoUring();
+    UringSlot& uringSlot(int fd);
+    void armIoUring();
+    void handleIoUringCompletion(const IoUring::Completion& completion);
+    bool queueIoUringSend(int client_fd);
+    bool ioUringSendInFlight(int client_fd) const;
+    void detachIoUringClient(int client_fd);
+    bool quiesceIoUring();
+    void resumeIoUring();
+
+    // Server-to-server links (Link.cpp)
+    bool isLink(int client_fd) const;
+    bool findLinkBlock(const std::string& name, std::string& address, std::string& port,
+                       std::string& send_password, std::string& accept_password) const;
+    void handleLinkMessage(int link_fd, const std::string& line, const IRCMessage& msg);
+    void completeLink(int link_fd, const std::string& name, const std::string& description);
+    void sendBurst(int link_fd);
+    std::string userIntroduction(const Client& client) const;
+    void linkNick(int link_fd, const std::string& line, const IRCMessage& msg, int source_index);
+    void linkJoin(int link_fd, const std::string& line, const IRCMessage& msg, const std::string& source);
+    void linkMode(int link_fd, const std::string& line, const IRCMessage& msg, const std::string& source, bool from_server);
+    void linkTopic(int link_fd, const std::string& line, const IRCMessage& msg, const std::string& source);
+    void killUser(int client_index, const std::string& reason);
+    void dropLink(int link_fd, const std::string& reason);
+    void removeServerTree(const std::string& name, const std::string& reason);
+    void dropLinks();
+
+    // Channel persistence (Snapshot.cpp)
+    void recallSnapshot();
+    void startSnapshot();
+    void reapSnapshot();
+    void loadSnapshot();
 
 public:
-    Server(const std::string& port_str, const std::string& pass);
+    Server(const std::string& port_str, const std::string& pass, const std::string& tls_port_str = "");
     ~Server();
     
     void run();
 
+    // Simulation: client connections live in memory and each step is one loop tick (Simulation.cpp)
+    void useMemoryTransport(MemoryTransport* memory);
+    int connectVirtual(const struct sockaddr_storage& address); // New client's fd, -1 if it was refused
+    void step();
+
     // Public methods for CommandHandler to use
     void sendMessage(int client_fd, const std::string& message);
+    void sendMessage(int client_fd, const OutgoingMessage& message);
+    OutgoingMessage makeMessage(const std::string& line, const std::string& client_tags = "");
     void sendWelcomeMessages(int client_index);
     bool isNicknameInUse(const std::string& nickname, int exclude_client_index = -1);
     bool isValidChannelName(const std::string& name);
     void broadcastToChannel(const std::string& channel_name, const std::string& message, int exclude_client_fd = -1);
-    void sendChannelUserList(int client_index, const std::string& channel_name);
+    // Once to every local user sharing a channel with the client (NICK, QUIT)
+    void broadcastToCommonChannels(int client_index, const std::string& message, bool include_self);
+    void broadcastToCommonChannels(Client& client, const std::string& message, bool include_self);
+    void sendChannelUserList(int client_index, const Channel& channel);
     int findClientByNickname(const std::string& nickname);
+    int findClientByFd(int client_fd) const;
     void removeClientFromAllChannels(int client_index);
+
+    // Membership and nickname changes go through here to keep the indexes in sync
+    Channel& createChannel(const std::string& name);
+    bool addToChannel(int client_index, Channel& channel);
+    void removeFromChannel(int client_index, Channel& channel);
+    void setNickname(int client_index, const std::string& nickname);
+    bool addMonitor(int client_index, const std::string& nickname); // False when the list is full
+    void removeMonitor(int client_index, const std::string& nickname);
+    void clearMonitors(int client_index);
+    void notifyMonitors(const Client& user, bool online); // 730/731 to everyone monitoring the user's nickname
+    void startList(int client_fd, const ListRequest& request);
     void cleanupEmptyChannels();
 
+    // Server operators and deny lists
+    bool startOperCheck(int client_index, const std::string& name, const std::string& password);
+    bool startLogin(int client_index, const std::string& account, const std::string& password);
+    time_t loginBackoff(int client_fd) const; // Seconds before the client may try to log in again
+    void disconnectClient(int client_fd, const std::string& reason);
+
+    // Server links
+    const std::string& getServerName() const { return server_name; }
+    const char* getServerInfo() const { return SERVER_INFO; }
+    const std::map<std::string, PeerServer>& getPeerServers() const { return peer_servers; }
+    void offerLinkPassword(int client_fd, const std::string& password);
+    void acceptLink(int client_index, const IRCMessage& msg);
+    bool connectLink(const std::string& name, std::string& error);
+    bool squitLink(const std::string& name, const std::string& reason);
+    void introduceUser(int client_index);
+    void propagateJoin(int client_index, const Channel& channel);
+    void propagate(const std::string& line, int except_link = -1);
+    void routeToChannel(const Channel& channel, const std::string& line, int except_link = -1);
+    void routeToUser(int client_index, const std::string& line);
+
     // Getters for CommandHandler
-    std::vector<Client>& getClients() { return clients; }
-    std::map<std::string, Channel>& getChannels() { return channels; }
+    ClientList& getClients() { return clients; }
+    ChannelMap& getChannels() { return channels; }
+    History& getHistory() { return history; }
+    DenyList& getDenyList() { return deny_list; }
+    const std::map<std::string, int>& getNickIndex() const { return nick_index; }
+    size_t getMonitorLimit() const { return MONITOR_LIMIT; }
     const std::string& getPassword() const { return password; }
 };
 
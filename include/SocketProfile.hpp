@@ -0,0 +1,28 @@
+#ifndef SOCKETPROFILE_HPP
+#define SOCKETPROFILE_HPP
+
+// TCP options for a listener and the connections accepted on it. Every
+// field is -1 while unset, which leaves the kernel default in place.
+struct SocketProfile {
+    int tcp_nodelay;         // 1 to send small writes right away, 0 for Nagle
+    int defer_accept;        // Seconds accept waits for the client's first bytes, 0 to disable
+    int receive_buffer;      // SO_RCVBUF bytes
+    int send_buffer;         // SO_SNDBUF bytes
+    int keepalive_idle;      // Seconds of silence before probing, enables SO_KEEPALIVE
+    int keepalive_interval;  // Seconds between probes
+    int keepalive_count;     // Unanswered probes before the connection is dropped
+    int user_timeout;        // Milliseconds written data may stay unacknowledged
+    int notsent_lowat;       // Unsent bytes below which the socket reports writable
+
+    SocketProfile();
+
+    // Fields set in overrides replace these
+    SocketProfile merged(const SocketProfile& overrides) const;
+
+    // Listener options, inherited by the connections it accepts; errors are logged
+    void applyToListener(int listen_fd, int port) const;
+    // Per-connection options, for accepted and outgoing connections
+    bool applyToConnection(int fd) const;
+};
+
+#endif
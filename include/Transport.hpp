@@ -0,0 +1,73 @@
+#ifndef TRANSPORT_HPP
+#define TRANSPORT_HPP
+
+#include <string> // For std::string
+#include <vector> // For std::vector
+#include <sys/types.h> // For ssize_t
+
+// How bytes reach client connections. The server reads, writes and closes
+// client descriptors only through its transport, with the errno
+// conventions of recv()/send(); listeners and the event loops stay on real
+// sockets.
+class Transport {
+    public:
+        virtual ~Transport();
+
+        virtual ssize_t receive(int fd, char* buffer, size_t length) = 0;
+        virtual ssize_t send(int fd, const char* data, size_t length) = 0;
+        virtual void close(int fd) = 0;
+};
+
+// Kernel sockets, the transport of a running server
+class SocketTransport : public Transport {
+    public:
+        virtual ~SocketTransport();
+
+        virtual ssize_t receive(int fd, char* buffer, size_t length);
+        virtual ssize_t send(int fd, const char* data, size_t length);
+        virtual void close(int fd);
+};
+
+// In-process connections for simulations, so client counts are not bound
+// by sockets. Each connection is a pair of byte queues under a descriptor
+// number above every real one; lower numbers are real sockets and are
+// passed on to the kernel.
+class MemoryTransport : public SocketTransport {
+    private:
+        struct Connection {
+            std::string to_server;
+            std::string to_client;
+            bool client_closed;   // The client hung up, reads end after the queued bytes
+            bool server_closed;
+
+            Connection() : client_closed(false), server_closed(false) {}
+        };
+
+        int first_fd;
+        std::vector<Connection> connections; // By fd - first_fd; numbers are never reused
+        std::vector<int> readable;           // Connections with input or a hang-up to look at
+        std::vector<int> written;            // Connections the server wrote to
+
+        Connection* find(int fd);
+        void markReadable(int fd);
+
+    public:
+        MemoryTransport();
+        virtual ~MemoryTransport();
+
+        // Client side
+        int open();                                   // New connection, by its server side descriptor
+        void write(int fd, const std::string& data);
+        void hangUp(int fd);
+        std::string& output(int fd);                  // Sent by the server and not consumed yet
+        bool isClosed(int fd) const;                  // Closed by the server
+        void takeWritten(std::vector<int>& fds);      // Connections with new output since the last call
+
+        // Server side
+        void takeReadable(std::vector<int>& fds);     // Connections to read from, like poll() reporting POLLIN
+        virtual ssize_t receive(int fd, char* buffer, size_t length);
+        virtual ssize_t send(int fd, const char* data, size_t length);
+        virtual void close(int fd);
+};
+
+#endif
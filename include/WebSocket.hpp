@@ -0,0 +1,55 @@
+#ifndef WEBSOCKET_HPP
+#define WEBSOCKET_HPP
+
+#include <string> // For std::string
+
+// RFC 6455 for IRC over WebSocket, as in the IRCv3 WebSocket spec: every
+// message carries exactly one IRC line without CR LF, in text frames
+// ("text.ircv3.net", also used when no subprotocol is asked for) or binary
+// frames ("binary.ircv3.net").
+
+enum WebSocketState {
+    WS_NONE,       // Plain IRC connection
+    WS_HANDSHAKE,  // Waiting for the HTTP upgrade request
+    WS_OPEN,
+    WS_CLOSING     // Close frame sent, nothing more goes out
+};
+
+enum WebSocketOpcode {
+    WS_CONTINUATION = 0x0,
+    WS_TEXT = 0x1,
+    WS_BINARY = 0x2,
+    WS_CLOSE = 0x8,
+    WS_PING = 0x9,
+    WS_PONG = 0xa
+};
+
+enum WebSocketDecode {
+    WS_FRAME_INCOMPLETE,
+    WS_FRAME_OK,
+    WS_FRAME_INVALID,   // Protocol error, close with 1002
+    WS_FRAME_TOO_BIG    // Over the payload limit, close with 1009
+};
+
+struct WebSocketFrame {
+    bool fin;
+    unsigned char opcode;
+    std::string payload;   // Unmasked
+};
+
+// Answers an upgrade request (everything up to and including the blank
+// line): the 101 response, or an HTTP error when it returns false.
+// text_frames tells which kind of frames the client gets.
+bool answerWebSocketHandshake(const std::string& request, std::string& response, bool& text_frames);
+
+// Decodes the client frame at pos, advancing pos past it when complete
+WebSocketDecode decodeWebSocketFrame(const std::string& input, size_t& pos, size_t payload_limit, WebSocketFrame& frame);
+
+// A single unmasked server frame
+std::string encodeWebSocketFrame(unsigned char opcode, const std::string& payload);
+
+bool isValidUtf8(const std::string& text);
+// Replaces every invalid sequence by U+FFFD, for text frames
+std::string toValidUtf8(const std::string& text);
+
+#endif
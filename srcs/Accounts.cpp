@@ -0,0 +1,266 @@
+#include "Accounts.hpp"
+#include <cctype> // For std::tolower, std::isalnum
+#include <cstdio> // For std::sscanf
+#include <fstream> // For std::ifstream
+#include <sstream> // For std::istringstream, std::ostringstream
+#include <iostream> // For std::cerr
+#include <errno.h> // For errno
+#include <stdint.h> // For uint64_t
+#include <unistd.h> // For read, write, close
+#include <sys/eventfd.h> // For eventfd
+#include <openssl/evp.h> // For EVP_PBE_scrypt, EVP_EncodeBlock, EVP_DecodeBlock
+#include <openssl/rand.h> // For RAND_bytes
+#include <openssl/crypto.h> // For CRYPTO_memcmp
+
+// Parameters for new hashes: N = 2^15, r = 8 costs 32 MiB and some tens of
+// milliseconds per check
+static const unsigned int HASH_LOG_N = 15;
+static const unsigned int HASH_R = 8;
+static const unsigned int HASH_P = 1;
+static const size_t SALT_LENGTH = 16;
+static const size_t KEY_LENGTH = 32;
+static const uint64_t MAX_HASH_MEMORY = 256u * 1024 * 1024; // Stored hashes asking for more are refused
+static const size_t MAX_ACCOUNT_LENGTH = 32;
+
+// ---- Encoding ----
+
+static std::string encodeBase64(const unsigned char* data, size_t length) {
+    std::string encoded(4 * ((length + 2) / 3) + 1, '\0');
+    int written = EVP_EncodeBlock(reinterpret_cast<unsigned char*>(&encoded[0]), data, static_cast<int>(length));
+    encoded.resize(written);
+    return encoded;
+}
+
+bool Accounts::decodeBase64(const std::string& text, std::string& decoded) {
+    if (text.length() % 4 != 0) {
+        return false;
+    }
+    decoded.assign(text.length() / 4 * 3 + 1, '\0');
+    int written = EVP_DecodeBlock(reinterpret_cast<unsigned char*>(&decoded[0]),
+                                  reinterpret_cast<const unsigned char*>(text.data()), static_cast<int>(text.length()));
+    if (written < 0) {
+        return false;
+    }
+    // EVP_DecodeBlock counts the padding as zero bytes
+    size_t padding = 0;
+    while (padding < 2 && padding < text.length() && text[text.length() - 1 - padding] == '=') {
+        padding++;
+    }
+    decoded.resize(written - padding);
+    return true;
+}
+
+// ---- Hashing ----
+
+static bool deriveKey(const std::string& password, const std::string& salt, unsigned int log_n,
+                      unsigned int r, unsigned int p, unsigned char* key, size_t key_length) {
+    if (log_n == 0 || log_n > 24 || r == 0 || p == 0 || p > 16
+        || 128ull * r * ((1ull << log_n) + p) > MAX_HASH_MEMORY) {
+        return false;
+    }
+    return EVP_PBE_scrypt(password.data(), password.length(),
+                          reinterpret_cast<const unsigned char*>(salt.data()), salt.length(),
+                          1ull << log_n, r, p, MAX_HASH_MEMORY + 1024 * 1024, key, key_length) == 1;
+}
+
+std::string Accounts::hashPassword(const std::string& password) {
+    unsigned char salt[SALT_LENGTH];
+    unsigned char key[KEY_LENGTH];
+    if (RAND_bytes(salt, sizeof(salt)) != 1
+        || !deriveKey(password, std::string(reinterpret_cast<char*>(salt), sizeof(salt)), HASH_LOG_N, HASH_R, HASH_P, key, sizeof(key))) {
+        return "";
+    }
+    std::ostringstream hash;
+    hash << "$scrypt$ln=" << HASH_LOG_N << ",r=" << HASH_R << ",p=" << HASH_P
+         << "$" << encodeBase64(salt, sizeof(salt)) << "$" << encodeBase64(key, sizeof(key));
+    return hash.str();
+}
+
+bool Accounts::verifyPassword(const std::string& password, const std::string& hash) {
+    // $scrypt$ln=15,r=8,p=1$<salt>$<key>
+    std::vector<std::string> fields;
+    std::istringstream parts(hash);
+    std::string field;
+    while (std::getline(parts, field, '$')) {
+        fields.push_back(field);
+    }
+    unsigned int log_n = 0, r = 0, p = 0;
+    std::string salt, expected;
+    bool parsed = fields.size() == 5 && fields[0].empty() && fields[1] == "scrypt"
+        && std::sscanf(fields[2].c_str(), "ln=%u,r=%u,p=%u", &log_n, &r, &p) == 3
+        && decodeBase64(fields[3], salt) && decodeBase64(fields[4], expected)
+        && !expected.empty() && expected.length() <= 64;
+
+    // Unknown accounts and broken entries cost as much as a real check
+    if (!parsed) {
+        unsigned char key[KEY_LENGTH];
+        deriveKey(password, "ircserv-no-such-account", HASH_LOG_N, HASH_R, HASH_P, key, sizeof(key));
+        return false;
+    }
+    unsigned char key[64];
+    if (!deriveKey(password, salt, log_n, r, p, key, expected.length())) {
+        return false;
+    }
+    return CRYPTO_memcmp(key, expected.data(), expected.length()) == 0;
+}
+
+bool Accounts::isValidName(const std::string& account) {
+    if (account.empty() || account.length() > MAX_ACCOUNT_LENGTH) {
+        return false;
+    }
+    for (size_t i = 0; i < account.length(); i++) {
+        unsigned char c = static_cast<unsigned char>(account[i]);
+        if (!std::isalnum(c) && c != '_' && c != '-' && c != '.') {
+            return false;
+        }
+    }
+    return true;
+}
+
+// ---- Worker pool ----
+
+Accounts::Accounts(const std::string& file_path, const std::string& oper_file_path, size_t workers, size_t max_queued)
+    : path(file_path), oper_path(oper_file_path), worker_count(workers), queue_limit(max_queued), stopping(false), event_fd(-1) {
+    pthread_mutex_init(&lock, NULL);
+    pthread_cond_init(&wakeup, NULL);
+}
+
+Accounts::~Accounts() {
+    stop();
+    pthread_cond_destroy(&wakeup);
+    pthread_mutex_destroy(&lock);
+}
+
+bool Accounts::start() {
+    event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (event_fd < 0) {
+        return false;
+    }
+    stopping = false;
+    for (size_t i = 0; i < worker_count; i++) {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, &Accounts::workerMain, this) != 0) {
+            break;
+        }
+        workers.push_back(thread);
+    }
+    if (workers.empty()) {
+        stop();
+        return false;
+    }
+    return true;
+}
+
+void Accounts::stop() {
+    pthread_mutex_lock(&lock);
+    stopping = true;
+    jobs.clear();
+    pthread_cond_broadcast(&wakeup);
+    pthread_mutex_unlock(&lock);
+    // A worker finishes the check it is in before it notices
+    for (size_t i = 0; i < workers.size(); i++) {
+        pthread_join(workers[i], NULL);
+    }
+    workers.clear();
+    results.clear();
+    if (event_fd >= 0) {
+        close(event_fd);
+        event_fd = -1;
+    }
+}
+
+void* Accounts::workerMain(void* self) {
+    static_cast<Accounts*>(self)->work();
+    return NULL;
+}
+
+void Accounts::work() {
+    pthread_mutex_lock(&lock);
+    while (true) {
+        while (!stopping && jobs.empty()) {
+            pthread_cond_wait(&wakeup, &lock);
+        }
+        if (stopping) {
+            break;
+        }
+        Job job = jobs.front();
+        jobs.pop_front();
+        pthread_mutex_unlock(&lock);
+
+        Result result;
+        result.client_fd = job.client_fd;
+        result.serial = job.serial;
+        result.account = job.account;
+        result.oper = job.oper;
+        // The file is read here too, so a slow disk holds up a worker and not the event loop
+        const std::string hash = findHash(job.oper ? oper_path : path, job.account);
+        result.valid = verifyPassword(job.password, hash) && !hash.empty();
+
+        pthread_mutex_lock(&lock);
+        results.push_back(result);
+        uint64_t one = 1;
+        if (write(event_fd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+            std::cerr << "Could not signal a finished account check" << std::endl;
+        }
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+std::string Accounts::findHash(const std::string& file_path, const std::string& account) {
+    // Read on every check so accounts can be changed without a restart
+    std::ifstream file(file_path.c_str());
+    std::string line;
+    while (std::getline(file, line)) {
+        std::istringstream fields(line);
+        std::string name, hash;
+        if (!(fields >> name >> hash) || name[0] == '#' || name.length() != account.length()) {
+            continue;
+        }
+        bool same = true;
+        for (size_t i = 0; i < name.length() && same; i++) {
+            same = std::tolower(static_cast<unsigned char>(name[i])) == std::tolower(static_cast<unsigned char>(account[i]));
+        }
+        if (same) {
+            return hash;
+        }
+    }
+    return "";
+}
+
+bool Accounts::submit(int client_fd, unsigned long serial, const std::string& account, const std::string& password, bool oper) {
+    if (!isEnabled()) {
+        return false;
+    }
+    Job job;
+    job.client_fd = client_fd;
+    job.serial = serial;
+    job.account = account;
+    job.password = password;
+    job.oper = oper;
+
+    pthread_mutex_lock(&lock);
+    bool accepted = jobs.size() < queue_limit;
+    if (accepted) {
+        jobs.push_back(job);
+        pthread_cond_signal(&wakeup);
+    }
+    pthread_mutex_unlock(&lock);
+    return accepted;
+}
+
+void Accounts::collect() {
+    uint64_t count;
+    while (read(event_fd, &count, sizeof(count)) < 0 && errno == EINTR) {
+    }
+}
+
+bool Accounts::nextResult(Result& result) {
+    pthread_mutex_lock(&lock);
+    bool found = !results.empty();
+    if (found) {
+        result = results.front();
+        results.pop_front();
+    }
+    pthread_mutex_unlock(&lock);
+    return found;
+}
@@ -0,0 +1,56 @@
+#include "Arena.hpp"
+
+// Every allocation starts on this boundary, enough for any scalar type
+static const size_t ARENA_ALIGNMENT = sizeof(void*) > sizeof(double) ? sizeof(void*) : sizeof(double);
+
+TickArena::TickArena() : current(0), used(0) {
+}
+
+TickArena::~TickArena() {
+    reset();
+    for (size_t i = 0; i < chunks.size(); i++) {
+        ::operator delete(chunks[i]);
+    }
+}
+
+TickArena& TickArena::instance() {
+    static TickArena arena;
+    return arena;
+}
+
+void* TickArena::allocate(size_t size) {
+    size = (size + ARENA_ALIGNMENT - 1) & ~(ARENA_ALIGNMENT - 1);
+    if (size > CHUNK_SIZE) {
+        oversized.reserve(oversized.size() + 1);
+        char* block = static_cast<char*>(::operator new(size));
+        oversized.push_back(block);
+        return block;
+    }
+    if (current == chunks.size() || used + size > CHUNK_SIZE) {
+        // The first allocation, or the current chunk is full: move on to the next one
+        if (current < chunks.size()) {
+            current++;
+        }
+        if (current == chunks.size()) {
+            chunks.reserve(chunks.size() + 1);
+            chunks.push_back(static_cast<char*>(::operator new(CHUNK_SIZE)));
+        }
+        used = 0;
+    }
+    void* ptr = chunks[current] + used;
+    used += size;
+    return ptr;
+}
+
+void TickArena::reset() {
+    for (size_t i = 0; i < oversized.size(); i++) {
+        ::operator delete(oversized[i]);
+    }
+    oversized.clear();
+    while (chunks.size() > KEPT_CHUNKS) {
+        ::operator delete(chunks.back());
+        chunks.pop_back();
+    }
+    current = 0;
+    used = 0;
+}
@@ -0,0 +1,360 @@
+#include "Capture.hpp"
+#include <cctype> // For std::toupper
+#include <cstring> // For std::strerror
+#include <fstream> // For std::ifstream
+#include <sstream> // For std::ostringstream
+#include <iostream> // For std::cerr
+#include <ctime> // For clock_gettime
+#include <errno.h> // For errno
+#include <fcntl.h> // For open
+#include <unistd.h> // For write, close
+#include <sys/stat.h> // For fstat
+
+static const char MAGIC[] = "IRCCAP1\n";
+static const size_t MAGIC_LENGTH = sizeof(MAGIC) - 1;
+
+static void putVarint(std::string& out, uint64_t value) {
+    while (value >= 0x80) {
+        out += static_cast<char>((value & 0x7f) | 0x80);
+        value >>= 7;
+    }
+    out += static_cast<char>(value);
+}
+
+static bool getVarint(const std::string& data, size_t& pos, uint64_t& value) {
+    value = 0;
+    for (unsigned int shift = 0; shift < 64; shift += 7) {
+        if (pos >= data.length()) {
+            return false;
+        }
+        unsigned char byte = static_cast<unsigned char>(data[pos++]);
+        value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+Capture::Capture() : fd(-1), next_id(0), last_us(0), writer_running(false), writing(false), stopping(false), dropped(0) {
+    pthread_mutex_init(&lock, NULL);
+    pthread_cond_init(&wakeup, NULL);
+    pthread_cond_init(&idle, NULL);
+}
+
+Capture::~Capture() {
+    flush();
+    stopWriter(false);
+    if (fd >= 0) {
+        close(fd);
+    }
+    pthread_cond_destroy(&idle);
+    pthread_cond_destroy(&wakeup);
+    pthread_mutex_destroy(&lock);
+}
+
+uint64_t Capture::nowUs() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return static_cast<uint64_t>(now.tv_sec) * 1000000 + now.tv_nsec / 1000;
+}
+
+bool Capture::open(const std::string& path, bool continued) {
+    // The file holds users' traffic, so it is only readable by the owner
+    fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat info;
+    if (fstat(fd, &info) == 0 && info.st_size == 0) {
+        buffer.append(MAGIC, MAGIC_LENGTH);
+    }
+    last_us = nowUs();
+    std::string start;
+    for (int i = 7; i >= 0; i--) {
+        start += static_cast<char>((last_us >> (i * 8)) & 0xff);
+    }
+    putRecord('S', continued ? 1 : 0, start);
+    stopping = false;
+    writer_running = pthread_create(&writer, NULL, &Capture::writerMain, this) == 0;
+    if (!writer_running) {
+        std::cerr << "Could not start the capture writer, writing on the event loop" << std::endl;
+    }
+    return true;
+}
+
+void Capture::putRecord(char type, unsigned long connection, const std::string& payload) {
+    uint64_t now = nowUs();
+    buffer += type;
+    putVarint(buffer, now - last_us);
+    putVarint(buffer, connection);
+    putVarint(buffer, payload.length());
+    buffer += payload;
+    last_us = now;
+}
+
+void Capture::opened(int client_fd, const std::string& address) {
+    if (fd < 0) {
+        return;
+    }
+    connections[client_fd] = ++next_id;
+    putRecord('O', next_id, address);
+}
+
+unsigned long Capture::idOf(int client_fd) const {
+    std::map<int, unsigned long>::const_iterator it = connections.find(client_fd);
+    return it == connections.end() ? 0 : it->second;
+}
+
+void Capture::resume(int client_fd, unsigned long id) {
+    if (fd < 0 || id == 0) {
+        return;
+    }
+    connections[client_fd] = id;
+    if (id > next_id) {
+        next_id = id;
+    }
+}
+
+void Capture::resumeClosed(unsigned long id) {
+    if (fd < 0 || id == 0) {
+        return;
+    }
+    if (id > next_id) {
+        next_id = id;
+    }
+    putRecord('C', id, "");
+}
+
+void Capture::detach() {
+    buffer.clear();
+    connections.clear();
+    stopWriter(true);
+    if (fd >= 0) {
+        close(fd);
+        fd = -1;
+    }
+}
+
+void Capture::line(int client_fd, const std::string& line) {
+    std::map<int, unsigned long>::const_iterator it = connections.find(client_fd);
+    if (fd < 0 || it == connections.end()) {
+        return;
+    }
+    putRecord('L', it->second, redact(line));
+}
+
+void Capture::closed(int client_fd) {
+    std::map<int, unsigned long>::iterator it = connections.find(client_fd);
+    if (fd < 0 || it == connections.end()) {
+        return;
+    }
+    putRecord('C', it->second, "");
+    connections.erase(it);
+}
+
+void Capture::flush() {
+    if (fd < 0 || buffer.empty()) {
+        return;
+    }
+    if (!writer_running) {
+        writeAll(buffer);
+        buffer.clear();
+        return;
+    }
+    pthread_mutex_lock(&lock);
+    if (backlog.length() + buffer.length() > BACKLOG_LIMIT) {
+        // Records go in whole ticks, so the file stays readable; replay timing skips the gap
+        if (dropped++ == 0) {
+            std::cerr << "Capture writer is behind, dropping records" << std::endl;
+        }
+    } else {
+        if (dropped > 0) {
+            std::cerr << "Capture writer caught up, " << dropped << " ticks of records dropped" << std::endl;
+            dropped = 0;
+        }
+        backlog += buffer;
+        pthread_cond_signal(&wakeup);
+    }
+    pthread_mutex_unlock(&lock);
+    buffer.clear();
+}
+
+void Capture::drain() {
+    flush();
+    if (!writer_running) {
+        return;
+    }
+    pthread_mutex_lock(&lock);
+    while (!backlog.empty() || writing) {
+        pthread_cond_wait(&idle, &lock);
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+void* Capture::writerMain(void* self) {
+    static_cast<Capture*>(self)->writeOut();
+    return NULL;
+}
+
+void Capture::writeOut() {
+    pthread_mutex_lock(&lock);
+    while (true) {
+        while (!stopping && backlog.empty()) {
+            pthread_cond_wait(&wakeup, &lock);
+        }
+        if (backlog.empty()) {
+            break; // Stopping, and everything handed over is written
+        }
+        std::string batch;
+        batch.swap(backlog);
+        writing = true;
+        pthread_mutex_unlock(&lock);
+        writeAll(batch);
+        pthread_mutex_lock(&lock);
+        writing = false;
+        pthread_cond_broadcast(&idle);
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+void Capture::stopWriter(bool discard) {
+    if (!writer_running) {
+        return;
+    }
+    pthread_mutex_lock(&lock);
+    if (discard) {
+        backlog.clear();
+    }
+    stopping = true;
+    pthread_cond_signal(&wakeup);
+    pthread_mutex_unlock(&lock);
+    pthread_join(writer, NULL);
+    writer_running = false;
+}
+
+void Capture::writeAll(const std::string& data) {
+    size_t written = 0;
+    while (written < data.length()) {
+        ssize_t result = write(fd, data.data() + written, data.length() - written);
+        if (result < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            // A full disk loses capture data, never the server
+            std::cerr << "Capture write failed: " << std::strerror(errno) << std::endl;
+            break;
+        }
+        written += result;
+    }
+}
+
+std::string Capture::redact(const std::string& line) {
+    // Skip tags and prefix to find the command
+    size_t start = 0;
+    for (int skipped = 0; skipped < 2 && start < line.length() && (line[start] == '@' || line[start] == ':'); skipped++) {
+        size_t space = line.find(' ', start);
+        if (space == std::string::npos) {
+            return line;
+        }
+        start = line.find_first_not_of(' ', space);
+        if (start == std::string::npos) {
+            return line;
+        }
+    }
+    size_t end = line.find(' ', start);
+    std::string command = line.substr(start, end == std::string::npos ? std::string::npos : end - start);
+    for (size_t i = 0; i < command.length(); i++) {
+        command[i] = std::toupper(command[i]);
+    }
+    if (end == std::string::npos) {
+        return line;
+    }
+
+    // Everything after the command, except OPER's name and SASL mechanism names
+    size_t secret = line.find_first_not_of(' ', end);
+    if (command == "OPER" && secret != std::string::npos) {
+        secret = line.find(' ', secret);
+        secret = secret == std::string::npos ? secret : line.find_first_not_of(' ', secret);
+    } else if (command == "AUTHENTICATE" && secret != std::string::npos) {
+        std::string argument = line.substr(secret);
+        if (argument == "PLAIN" || argument == "*" || argument == "+") {
+            return line;
+        }
+    } else if (command != "PASS") {
+        return line;
+    }
+    if (secret == std::string::npos) {
+        return line;
+    }
+    return line.substr(0, secret) + "*";
+}
+
+bool Capture::load(const std::string& path, std::vector<Record>& records, std::string& error) {
+    std::ifstream file(path.c_str(), std::ios::in | std::ios::binary);
+    if (!file) {
+        error = "cannot open " + path;
+        return false;
+    }
+    std::ostringstream contents;
+    contents << file.rdbuf();
+    const std::string data = contents.str();
+    if (data.compare(0, MAGIC_LENGTH, MAGIC) != 0) {
+        error = path + " is not a capture file";
+        return false;
+    }
+
+    size_t pos = MAGIC_LENGTH;
+    uint64_t now = 0;
+    unsigned long id_base = 0;    // Fresh segments number their connections from 1 again
+    unsigned long max_id = 0;
+    while (pos < data.length()) {
+        Record record;
+        record.type = data[pos++];
+        uint64_t delta, connection, length;
+        if (!getVarint(data, pos, delta) || !getVarint(data, pos, connection) || !getVarint(data, pos, length)
+            || length > data.length() - pos) {
+            error = "truncated record";
+            return false;
+        }
+        record.payload = data.substr(pos, length);
+        pos += length;
+        if (record.type == 'S') {
+            if (record.payload.length() != 8) {
+                error = "bad segment record";
+                return false;
+            }
+            // Segments are laid out on one time line by their absolute start
+            uint64_t start = 0;
+            for (size_t i = 0; i < 8; i++) {
+                start = (start << 8) | static_cast<unsigned char>(record.payload[i]);
+            }
+            if (!records.empty()) {
+                if (start < now) {
+                    start = now;
+                }
+                if (connection == 0) {
+                    id_base = max_id;
+                }
+            }
+            now = start;
+            continue;
+        }
+        now += delta;
+        record.time_us = now;
+        record.connection = id_base + connection;
+        if (record.connection > max_id) {
+            max_id = record.connection;
+        }
+        records.push_back(record);
+    }
+
+    // Times relative to the first record
+    if (!records.empty()) {
+        uint64_t origin = records[0].time_us;
+        for (size_t i = 0; i < records.size(); i++) {
+            records[i].time_us -= origin;
+        }
+    }
+    return true;
+}
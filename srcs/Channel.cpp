@@ -1,9 +1,9 @@
 #include "Channel.hpp"
 
-Channel::Channel() : name(""), topic(""), key(""), invite_only(false), topic_restricted(false), has_key(false), has_user_limit(false), user_limit(0) {
+Channel::Channel() : name(""), topic(""), topic_time(0), key(""), invite_only(false), topic_restricted(false), has_key(false), has_user_limit(false), user_limit(0), permanent(false) {
 }
 
-Channel::Channel(const std::string& channel_name) : name(channel_name), topic(""), key(""), invite_only(false), topic_restricted(false), has_key(false), has_user_limit(false), user_limit(0) {
+Channel::Channel(const std::string& channel_name) : name(channel_name), topic(""), topic_time(0), key(""), invite_only(false), topic_restricted(false), has_key(false), has_user_limit(false), user_limit(0), permanent(false) {
 }
 
 Channel::~Channel() {
@@ -35,6 +35,16 @@ bool Channel::addClient(int client_fd) {
     return true;
 }
 
+// Membership decided by another server: no user limit, no operator status
+// for the first member
+bool Channel::insertClient(int client_fd) {
+    if (!clients.insert(client_fd).second) {
+        return false;
+    }
+    removeInvite(client_fd);
+    return true;
+}
+
 bool Channel::removeClient(int client_fd) {
     if (!hasClient(client_fd)) {
         return false;
@@ -61,8 +71,9 @@ void Channel::removeOperator(int client_fd) {
     operators.erase(client_fd);
 }
 
-void Channel::setTopic(const std::string& new_topic) {
+void Channel::setTopic(const std::string& new_topic, time_t set_time) {
     topic = new_topic;
+    topic_time = set_time ? set_time : time(NULL);
 }
 
 void Channel::setInviteOnly(bool invite_only_mode) {
@@ -93,6 +104,10 @@ void Channel::removeUserLimit() {
     has_user_limit = false;
 }
 
+void Channel::setPermanent(bool permanent_mode) {
+    permanent = permanent_mode;
+}
+
 void Channel::inviteClient(int client_fd) {
     invited_clients.insert(client_fd);
 }
@@ -105,14 +120,18 @@ void Channel::removeInvite(int client_fd) {
     invited_clients.erase(client_fd);
 }
 
-bool Channel::canJoin(int client_fd, const std::string& provided_key) const {
+bool Channel::isBanned(const std::string& client_mask, const std::string& host) const {
+    return bans.matches(client_mask, host) && !exceptions.matches(client_mask, host);
+}
+
+bool Channel::canJoin(int client_fd, const std::string& provided_key, bool invite_exempt) const {
     // Check if channel has user limit and is full
     if (has_user_limit && clients.size() >= user_limit) {
         return false;
     }
     
     // Check if channel is invite-only
-    if (invite_only && !isInvited(client_fd)) {
+    if (invite_only && !isInvited(client_fd) && !invite_exempt) {
         return false;
     }
     
@@ -130,6 +149,7 @@ std::string Channel::getModeString() const {
     
     if (invite_only) modes += "i";
     if (topic_restricted) modes += "t";
+    if (permanent) modes += "P";
     if (has_key) {
         modes += "k";
         if (!params.empty()) params += " ";
@@ -1,6 +1,8 @@
 #include "Client.hpp"
+#include "Channel.hpp"
+#include <algorithm> // For std::lower_bound
 
-Client::Client() : fd(-1), nickname(""), username(""), realname(""), hostname(""), authenticated(false), registered(false), buffer("") {};
+Client::Client() : fd(-1), nickname(""), authenticated(false), registered(false), caps(0), cap_negotiating(false), resolving_host(false), server_operator(false), account(""), sasl_state(SASL_NONE), tls(NULL), tls_handshaking(false), tls_want_write(false), websocket(WS_NONE), websocket_text(true), websocket_fragmented(false), websocket_message_text(false), link_fd(-1), fanout_epoch(0) {};
         
 Client::~Client(){};
 
@@ -8,18 +10,35 @@ bool Client::isFullyRegistered() const {
     return authenticated && !nickname.empty() && !username.empty();
 }
 
-void Client::joinChannel(const std::string& channel_name) {
-    channels.insert(channel_name);
+bool Client::isRemote() const {
+    return link_fd >= 0;
 }
 
-void Client::leaveChannel(const std::string& channel_name) {
-    channels.erase(channel_name);
+std::string Client::getPrefix() const {
+    return nickname + "!" + username + "@" + hostname;
 }
 
-bool Client::isInChannel(const std::string& channel_name) const {
-    return channels.find(channel_name) != channels.end();
+static bool nameBefore(const Channel* channel, const Channel* other) {
+    return channel->getName() < other->getName();
 }
 
-const std::set<std::string>& Client::getChannels() const {
+void Client::joinChannel(Channel* channel) {
+    std::vector<Channel*>::iterator it = std::lower_bound(channels.begin(), channels.end(), channel, nameBefore);
+    if (it == channels.end() || *it != channel) {
+        channels.insert(it, channel);
+    }
+}
+
+void Client::leaveChannel(Channel* channel) {
+    std::vector<Channel*>::iterator it = std::lower_bound(channels.begin(), channels.end(), channel, nameBefore);
+    if (it != channels.end() && *it == channel) {
+        channels.erase(it);
+    }
+    if (channels.empty()) {
+        std::vector<Channel*>().swap(channels);
+    }
+}
+
+const std::vector<Channel*>& Client::getChannels() const {
     return channels;
-}
\ No newline at end of file
+}
@@ -4,8 +4,11 @@
 #include <sstream>
 #include <cctype>
 #include <cstdlib>
+#include <algorithm>
+#include <ctime>
+#include <openssl/crypto.h> // For CRYPTO_memcmp
 
-CommandHandler::CommandHandler(Server* srv) : server(srv) {
+CommandHandler::CommandHandler(Server* srv) : server(srv), batch_counter(0) {
 }
 
 CommandHandler::~CommandHandler() {
@@ -17,7 +20,7 @@ void CommandHandler::handleIRCMessage(int client_index, const IRCMessage& msg) {
     }
 
     // Convert command to uppercase for case-insensitive comparison
-    std::string cmd = msg.command;
+    ArenaString cmd(msg.command.data(), msg.command.length());
     for (size_t i = 0; i < cmd.length(); i++) {
         cmd[i] = std::toupper(cmd[i]);
     }
@@ -28,6 +31,10 @@ void CommandHandler::handleIRCMessage(int client_index, const IRCMessage& msg) {
         handleNick(client_index, msg);
     } else if (cmd == "USER") {
         handleUser(client_index, msg);
+    } else if (cmd == "CAP") {
+        handleCap(client_index, msg);
+    } else if (cmd == "AUTHENTICATE") {
+        handleAuthenticate(client_index, msg);
     } else if (cmd == "PING") {
         handlePing(client_index, msg);
     } else if (cmd == "QUIT") {
@@ -38,6 +45,8 @@ void CommandHandler::handleIRCMessage(int client_index, const IRCMessage& msg) {
         handlePart(client_index, msg);
     } else if (cmd == "PRIVMSG") {
         handlePrivmsg(client_index, msg);
+    } else if (cmd == "NOTICE") {
+        handleNotice(client_index, msg);
     } else if (cmd == "KICK") {
         handleKick(client_index, msg);
     } else if (cmd == "INVITE") {
@@ -48,17 +57,39 @@ void CommandHandler::handleIRCMessage(int client_index, const IRCMessage& msg) {
         handleMode(client_index, msg);
     } else if (cmd == "WHOIS") {
         handleWhois(client_index, msg);
+    } else if (cmd == "WHO") {
+        handleWho(client_index, msg);
+    } else if (cmd == "LIST") {
+        handleList(client_index, msg);
+    } else if (cmd == "CHATHISTORY") {
+        handleChathistory(client_index, msg);
+    } else if (cmd == "OPER") {
+        handleOper(client_index, msg);
+    } else if (cmd == "KLINE" || cmd == "UNKLINE") {
+        handleKline(client_index, msg, cmd == "KLINE");
+    } else if (cmd == "DLINE" || cmd == "UNDLINE") {
+        handleDline(client_index, msg, cmd == "DLINE");
+    } else if (cmd == "SERVER") {
+        handleServer(client_index, msg);
+    } else if (cmd == "CONNECT") {
+        handleConnect(client_index, msg);
+    } else if (cmd == "SQUIT") {
+        handleSquit(client_index, msg);
+    } else if (cmd == "LINKS") {
+        handleLinks(client_index, msg);
+    } else if (cmd == "MONITOR") {
+        handleMonitor(client_index, msg);
     } else {
         // Unknown command
-        std::vector<Client>& clients = server->getClients();
+        ClientList& clients = server->getClients();
         if (clients[client_index].isFullyRegistered()) {
-            server->sendMessage(clients[client_index].fd, "421 " + clients[client_index].nickname + " " + cmd + " :Unknown command");
+            server->sendMessage(clients[client_index].fd, "421 " + clients[client_index].nickname + " " + msg.command + " :Unknown command");
         }
     }
 }
 
 void CommandHandler::handlePass(int client_index, const IRCMessage& msg) {
-    std::vector<Client>& clients = server->getClients();
+    ClientList& clients = server->getClients();
     
     if (msg.params.empty()) {
         server->sendMessage(clients[client_index].fd, "461 * PASS :Not enough parameters");
@@ -70,7 +101,13 @@ void CommandHandler::handlePass(int client_index, const IRCMessage& msg) {
         return;
     }
 
-    if (msg.params[0] == server->getPassword()) {
+    // A server checks its own link password once it sends SERVER
+    server->offerLinkPassword(clients[client_index].fd, msg.params[0]);
+
+    // Compared in constant time, so response timing tells nothing about the password
+    const std::string& password = server->getPassword();
+    if (msg.params[0].length() == password.length()
+        && CRYPTO_memcmp(msg.params[0].data(), password.data(), password.length()) == 0) {
         clients[client_index].authenticated = true;
         std::cout << "Client " << clients[client_index].fd << " authenticated successfully" << std::endl;
     } else {
@@ -80,7 +117,7 @@ void CommandHandler::handlePass(int client_index, const IRCMessage& msg) {
 }
 
 void CommandHandler::handleNick(int client_index, const IRCMessage& msg) {
-    std::vector<Client>& clients = server->getClients();
+    ClientList& clients = server->getClients();
     
     if (msg.params.empty()) {
         server->sendMessage(clients[client_index].fd, "431 * :No nickname given");
@@ -102,7 +139,12 @@ void CommandHandler::handleNick(int client_index, const IRCMessage& msg) {
     }
 
     std::string old_nick = clients[client_index].nickname;
-    clients[client_index].nickname = new_nick;
+    const std::string old_prefix = clients[client_index].getPrefix();
+    server->setNickname(client_index, new_nick);
+    if (clients[client_index].registered) {
+        server->propagate(":" + old_prefix + " NICK " + new_nick);
+        server->broadcastToCommonChannels(client_index, ":" + old_prefix + " NICK " + new_nick, true);
+    }
     
     if (old_nick.empty()) {
         std::cout << "Client " << clients[client_index].fd << " set nickname to: " << new_nick << std::endl;
@@ -111,14 +153,11 @@ void CommandHandler::handleNick(int client_index, const IRCMessage& msg) {
     }
 
     // If client is now fully registered, send welcome messages
-    if (clients[client_index].isFullyRegistered() && !clients[client_index].registered) {
-        clients[client_index].registered = true;
-        server->sendWelcomeMessages(client_index);
-    }
+    completeRegistration(client_index);
 }
 
 void CommandHandler::handleUser(int client_index, const IRCMessage& msg) {
-    std::vector<Client>& clients = server->getClients();
+    ClientList& clients = server->getClients();
     
     if (msg.params.size() < 3 || msg.trailing.empty()) {
         server->sendMessage(clients[client_index].fd, "461 * USER :Not enough parameters");
@@ -143,14 +182,245 @@ void CommandHandler::handleUser(int client_index, const IRCMessage& msg) {
               << " realname: " << clients[client_index].realname << std::endl;
 
     // If client is now fully registered, send welcome messages
-    if (clients[client_index].isFullyRegistered() && !clients[client_index].registered) {
-        clients[client_index].registered = true;
+    completeRegistration(client_index);
+}
+
+// Masks are matched against both the hostname and the numeric address, so
+// bans and K-lines on an address keep working once its name is resolved
+static bool matchesClient(const MaskList& list, const Client& client) {
+    if (list.matches(client.getPrefix(), client.hostname)) {
+        return true;
+    }
+    return !client.address.empty() && client.address != client.hostname
+        && list.matches(client.nickname + "!" + client.username + "@" + client.address, client.address);
+}
+
+static bool isBannedFrom(const Channel& channel, const Client& client) {
+    return matchesClient(channel.getBans(), client) && !matchesClient(channel.getExceptions(), client);
+}
+
+static bool isKlined(const DenyList& deny_list, const Client& client) {
+    if (deny_list.isKlined(client.getPrefix(), client.hostname)) {
+        return true;
+    }
+    return !client.address.empty() && client.address != client.hostname
+        && deny_list.isKlined(client.nickname + "!" + client.username + "@" + client.address, client.address);
+}
+
+void CommandHandler::dropDeniedClients() {
+    ClientList& clients = server->getClients();
+    const DenyList& deny_list = server->getDenyList();
+    for (size_t i = 0; i < clients.size(); i++) {
+        if (clients[i].isRemote()) {
+            continue;
+        }
+        if (deny_list.isDenied(clients[i].address)) {
+            server->disconnectClient(clients[i].fd, "D-lined");
+        } else if (clients[i].registered && isKlined(deny_list, clients[i])) {
+            server->disconnectClient(clients[i].fd, "K-lined");
+        }
+    }
+}
+
+void CommandHandler::completeRegistration(int client_index) {
+    Client& client = server->getClients()[client_index];
+    if (client.isFullyRegistered() && !client.registered && !client.cap_negotiating && !client.resolving_host
+        && client.sasl_state != SASL_VERIFYING) {
+        if (isKlined(server->getDenyList(), client)) {
+            server->disconnectClient(client.fd, "K-lined");
+            return;
+        }
+        client.registered = true;
+        server->notifyMonitors(client, true);
         server->sendWelcomeMessages(client_index);
+        server->introduceUser(client_index);
+    }
+}
+
+// Capabilities offered in CAP LS, with their Client::caps bits
+static const struct {
+    const char* name;
+    unsigned int bit;
+} CAPABILITIES[] = {
+    { "batch", CAP_BATCH },
+    { "message-tags", CAP_MESSAGE_TAGS },
+    { "sasl", CAP_SASL },
+    { "server-time", CAP_SERVER_TIME }
+};
+static const size_t CAPABILITY_COUNT = sizeof(CAPABILITIES) / sizeof(CAPABILITIES[0]);
+
+// Space-separated names of the capabilities whose bits are set in `caps`
+static std::string capabilityNames(unsigned int caps) {
+    std::string names;
+    for (size_t i = 0; i < CAPABILITY_COUNT; i++) {
+        if (caps & CAPABILITIES[i].bit) {
+            if (!names.empty()) names += " ";
+            names += CAPABILITIES[i].name;
+        }
+    }
+    return names;
+}
+
+// Maps a capability name to its CAP_* bit, 0 if unsupported
+static unsigned int capabilityBit(const std::string& name) {
+    for (size_t i = 0; i < CAPABILITY_COUNT; i++) {
+        if (name == CAPABILITIES[i].name) return CAPABILITIES[i].bit;
+    }
+    return 0;
+}
+
+void CommandHandler::handleCap(int client_index, const IRCMessage& msg) {
+    ClientList& clients = server->getClients();
+    Client& client = clients[client_index];
+    std::string nick = client.nickname.empty() ? "*" : client.nickname;
+
+    if (msg.params.empty()) {
+        server->sendMessage(client.fd, "461 " + nick + " CAP :Not enough parameters");
+        return;
+    }
+
+    std::string subcommand = msg.params[0];
+    for (size_t i = 0; i < subcommand.length(); i++) {
+        subcommand[i] = std::toupper(subcommand[i]);
+    }
+
+    if (subcommand == "LS") {
+        // Negotiation started before registration holds it until CAP END
+        if (!client.registered) {
+            client.cap_negotiating = true;
+        }
+        server->sendMessage(client.fd, "CAP " + nick + " LS :" + capabilityNames(~0u));
+    } else if (subcommand == "LIST") {
+        server->sendMessage(client.fd, "CAP " + nick + " LIST :" + capabilityNames(client.caps));
+    } else if (subcommand == "REQ") {
+        if (!client.registered) {
+            client.cap_negotiating = true;
+        }
+        std::string requested = msg.trailing;
+        if (requested.empty() && msg.params.size() > 1) {
+            requested = msg.params[1];
+        }
+
+        // The request is applied atomically: any unknown capability rejects all of it
+        unsigned int add = 0, remove = 0;
+        bool valid = !requested.empty();
+        size_t start = requested.find_first_not_of(' ');
+        while (valid && start != std::string::npos) {
+            size_t end = requested.find(' ', start);
+            std::string name = requested.substr(start, end == std::string::npos ? std::string::npos : end - start);
+            bool removing = name[0] == '-';
+            unsigned int bit = capabilityBit(removing ? name.substr(1) : name);
+            if (bit == 0) {
+                valid = false;
+            } else if (removing) {
+                remove |= bit;
+            } else {
+                add |= bit;
+            }
+            start = requested.find_first_not_of(' ', end);
+        }
+
+        if (!valid) {
+            server->sendMessage(client.fd, "CAP " + nick + " NAK :" + requested);
+            return;
+        }
+        client.caps = (client.caps | add) & ~remove;
+        server->sendMessage(client.fd, "CAP " + nick + " ACK :" + requested);
+    } else if (subcommand == "END") {
+        client.cap_negotiating = false;
+        completeRegistration(client_index);
+    } else {
+        server->sendMessage(client.fd, "410 " + nick + " " + msg.params[0] + " :Invalid CAP command");
+    }
+}
+
+void CommandHandler::handleAuthenticate(int client_index, const IRCMessage& msg) {
+    Client& client = server->getClients()[client_index];
+    const std::string nick = client.nickname.empty() ? "*" : client.nickname;
+
+    if (!(client.caps & CAP_SASL)) {
+        server->sendMessage(client.fd, "904 " + nick + " :SASL authentication failed");
+        return;
+    }
+    if (!client.account.empty()) {
+        server->sendMessage(client.fd, "907 " + nick + " :You have already authenticated using SASL");
+        return;
+    }
+    std::string argument = msg.params.empty() ? msg.trailing : msg.params[0];
+    if (argument.empty()) {
+        server->sendMessage(client.fd, "461 " + nick + " AUTHENTICATE :Not enough parameters");
+        return;
+    }
+    if (client.sasl_state == SASL_VERIFYING) {
+        return; // The answer for the credentials already sent is still to come
+    }
+    if (argument == "*") {
+        client.sasl_state = SASL_NONE;
+        std::string().swap(client.sasl_payload);
+        server->sendMessage(client.fd, "906 " + nick + " :SASL authentication aborted");
+        return;
+    }
+
+    if (client.sasl_state == SASL_NONE) {
+        time_t backoff = server->loginBackoff(client.fd);
+        if (backoff > 0) {
+            std::ostringstream wait;
+            wait << backoff;
+            server->sendMessage(client.fd, "904 " + nick + " :SASL authentication failed (try again in " + wait.str() + "s)");
+            return;
+        }
+        for (size_t i = 0; i < argument.length(); i++) {
+            argument[i] = std::toupper(argument[i]);
+        }
+        if (argument != "PLAIN") {
+            server->sendMessage(client.fd, "908 " + nick + " PLAIN :are available SASL mechanisms");
+            server->sendMessage(client.fd, "904 " + nick + " :SASL authentication failed");
+            return;
+        }
+        client.sasl_state = SASL_STARTED;
+        server->sendMessage(client.fd, "AUTHENTICATE +");
+        return;
+    }
+
+    // The payload arrives base64-encoded in chunks of 400; a shorter chunk (or "+") ends it
+    if (argument.length() > SASL_CHUNK_SIZE || client.sasl_payload.length() + argument.length() > SASL_PAYLOAD_LIMIT) {
+        client.sasl_state = SASL_NONE;
+        std::string().swap(client.sasl_payload);
+        server->sendMessage(client.fd, "905 " + nick + " :SASL message too long");
+        return;
+    }
+    if (argument != "+") {
+        client.sasl_payload += argument;
+    }
+    if (argument.length() == SASL_CHUNK_SIZE) {
+        return;
+    }
+
+    // PLAIN: authorization identity, NUL, account, NUL, password
+    std::string decoded;
+    bool valid = Accounts::decodeBase64(client.sasl_payload, decoded);
+    std::string().swap(client.sasl_payload);
+    client.sasl_state = SASL_NONE;
+    size_t first = decoded.find('\0');
+    size_t second = first == std::string::npos ? first : decoded.find('\0', first + 1);
+    std::string authzid, account, password;
+    if (valid && second != std::string::npos) {
+        authzid = decoded.substr(0, first);
+        account = decoded.substr(first + 1, second - first - 1);
+        password = decoded.substr(second + 1);
+    }
+    if (!valid || second == std::string::npos || !Accounts::isValidName(account) || (!authzid.empty() && authzid != account)) {
+        server->sendMessage(client.fd, "904 " + nick + " :SASL authentication failed");
+        return;
+    }
+    // The answer comes back through Server::completeLogins()
+    if (!server->startLogin(client_index, account, password)) {
+        server->sendMessage(client.fd, "904 " + nick + " :SASL authentication failed (server busy, try again)");
     }
 }
 
 void CommandHandler::handlePing(int client_index, const IRCMessage& msg) {
-    std::vector<Client>& clients = server->getClients();
+    ClientList& clients = server->getClients();
     
     std::string response = "PONG";
     if (!msg.params.empty()) {
@@ -162,7 +432,7 @@ void CommandHandler::handlePing(int client_index, const IRCMessage& msg) {
 }
 
 void CommandHandler::handleQuit(int client_index, const IRCMessage& msg) {
-    std::vector<Client>& clients = server->getClients();
+    ClientList& clients = server->getClients();
     
     std::string quit_msg = msg.trailing.empty() ? "Client Quit" : msg.trailing;
     std::cout << "Client " << clients[client_index].fd << " (" << clients[client_index].nickname 
@@ -171,7 +441,7 @@ void CommandHandler::handleQuit(int client_index, const IRCMessage& msg) {
 }
 
 void CommandHandler::handleWhois(int client_index, const IRCMessage& msg) {
-    std::vector<Client>& clients = server->getClients();
+    ClientList& clients = server->getClients();
     
     if (!clients[client_index].isFullyRegistered()) {
         server->sendMessage(clients[client_index].fd, "451 * :You have not registered");
@@ -196,12 +466,50 @@ void CommandHandler::handleWhois(int client_index, const IRCMessage& msg) {
     
     // Send WHOIS information
     server->sendMessage(clients[client_index].fd, "311 " + clients[client_index].nickname + " " + target.nickname + " " + target.username + " " + target.hostname + " * :" + target.realname);
+    if (target.isRemote()) {
+        const std::map<std::string, PeerServer>& peers = server->getPeerServers();
+        std::map<std::string, PeerServer>::const_iterator home = peers.find(ircLower(target.server));
+        server->sendMessage(clients[client_index].fd, "312 " + clients[client_index].nickname + " " + target.nickname + " " + target.server
+                            + " :" + (home == peers.end() ? "" : home->second.description));
+    } else {
+        server->sendMessage(clients[client_index].fd, "312 " + clients[client_index].nickname + " " + target.nickname + " " + server->getServerName()
+                            + " :" + server->getServerInfo());
+    }
+    if (target.tls) {
+        server->sendMessage(clients[client_index].fd, "671 " + clients[client_index].nickname + " " + target.nickname + " :is using a secure connection");
+    }
+    if (!target.account.empty()) {
+        server->sendMessage(clients[client_index].fd, "330 " + clients[client_index].nickname + " " + target.nickname + " " + target.account + " :is logged in as");
+    }
+    if (target.server_operator) {
+        server->sendMessage(clients[client_index].fd, "313 " + clients[client_index].nickname + " " + target.nickname + " :is an IRC operator");
+    }
     server->sendMessage(clients[client_index].fd, "318 " + clients[client_index].nickname + " " + target.nickname + " :End of WHOIS list");
 }
 
+// Splits a comma-separated list. Empty entries are dropped unless
+// keep_empty is set (JOIN keys pair up with channels by position).
+static std::vector<std::string> splitList(const std::string& list, bool keep_empty = false) {
+    std::vector<std::string> items;
+    if (list.empty()) {
+        return items;
+    }
+    size_t start = 0;
+    while (start <= list.length()) {
+        size_t comma = list.find(',', start);
+        if (comma == std::string::npos) {
+            comma = list.length();
+        }
+        if (comma > start || keep_empty) {
+            items.push_back(list.substr(start, comma - start));
+        }
+        start = comma + 1;
+    }
+    return items;
+}
+
 void CommandHandler::handleJoin(int client_index, const IRCMessage& msg) {
-    std::vector<Client>& clients = server->getClients();
-    std::map<std::string, Channel>& channels = server->getChannels();
+    ClientList& clients = server->getClients();
     
     if (!clients[client_index].isFullyRegistered()) {
         server->sendMessage(clients[client_index].fd, "451 * :You have not registered");
@@ -213,70 +521,85 @@ void CommandHandler::handleJoin(int client_index, const IRCMessage& msg) {
         return;
     }
 
-    std::string channel_names = msg.params[0];
-    std::string keys = "";
-    if (msg.params.size() > 1) {
-        keys = msg.params[1];
-    }
+    // Handle multiple channels separated by commas; keys pair up by position
+    const std::vector<std::string> channel_names = splitList(msg.params[0]);
+    const std::vector<std::string> keys = splitList(msg.params.size() > 1 ? msg.params[1] : "", true);
+    Client& client = clients[client_index];
+    const std::string prefix = client.getPrefix();
+
+    // One pass over the list: each channel is looked up (or created) once and
+    // its whole response is queued right away. All of it leaves in the same
+    // write at the end of the loop tick.
+    for (size_t i = 0; i < channel_names.size(); i++) {
+        const std::string& channel_name = channel_names[i];
+        const std::string& key = i < keys.size() ? keys[i] : "";
 
-    // Handle multiple channels separated by commas
-    std::istringstream channels_stream(channel_names);
-    std::istringstream keys_stream(keys);
-    std::string channel_name, key;
-    
-    while (std::getline(channels_stream, channel_name, ',')) {
-        std::getline(keys_stream, key, ',');
-        
         if (!server->isValidChannelName(channel_name)) {
-            server->sendMessage(clients[client_index].fd, "403 " + clients[client_index].nickname + " " + channel_name + " :No such channel");
+            server->sendMessage(client.fd, "403 " + client.nickname + " " + channel_name + " :No such channel");
             continue;
         }
 
         // Create channel if it doesn't exist
-        if (channels.find(channel_name) == channels.end()) {
-            channels.insert(std::make_pair(channel_name, Channel(channel_name)));
-        }
+        Channel& channel = server->createChannel(channel_name);
 
-        Channel& channel = channels[channel_name];
+        if (channel.hasClient(client.fd)) {
+            continue; // Already there, nothing to do
+        }
         
+        // An invite gets past bans, like it gets past +i
+        if (!channel.isInvited(client.fd) && isBannedFrom(channel, client)) {
+            server->sendMessage(client.fd, "474 " + client.nickname + " " + channel_name + " :Cannot join channel (+b)");
+            continue;
+        }
+
         // Check if client can join
-        if (!channel.canJoin(clients[client_index].fd, key)) {
+        bool invite_exempt = channel.isInviteOnly() && matchesClient(channel.getInviteExceptions(), client);
+        if (!channel.canJoin(client.fd, key, invite_exempt)) {
             if (channel.getUserCount() >= channel.getUserLimit() && channel.hasUserLimit()) {
-                server->sendMessage(clients[client_index].fd, "471 " + clients[client_index].nickname + " " + channel_name + " :Cannot join channel (+l)");
-            } else if (channel.isInviteOnly() && !channel.isInvited(clients[client_index].fd)) {
-                server->sendMessage(clients[client_index].fd, "473 " + clients[client_index].nickname + " " + channel_name + " :Cannot join channel (+i)");
+                server->sendMessage(client.fd, "471 " + client.nickname + " " + channel_name + " :Cannot join channel (+l)");
+            } else if (channel.isInviteOnly() && !channel.isInvited(client.fd) && !invite_exempt) {
+                server->sendMessage(client.fd, "473 " + client.nickname + " " + channel_name + " :Cannot join channel (+i)");
             } else if (channel.hasKey() && key != channel.getKey()) {
-                server->sendMessage(clients[client_index].fd, "475 " + clients[client_index].nickname + " " + channel_name + " :Cannot join channel (+k)");
+                server->sendMessage(client.fd, "475 " + client.nickname + " " + channel_name + " :Cannot join channel (+k)");
             }
             continue;
         }
 
-        // Add client to channel
-        if (channel.addClient(clients[client_index].fd)) {
-            clients[client_index].joinChannel(channel_name);
-            
-            // Send JOIN confirmation to the client
-            server->sendMessage(clients[client_index].fd, ":" + clients[client_index].nickname + "!" + clients[client_index].username + "@" + clients[client_index].hostname + " JOIN " + channel_name);
-            
-            // Broadcast JOIN to other users in the channel
-            server->broadcastToChannel(channel_name, ":" + clients[client_index].nickname + "!" + clients[client_index].username + "@" + clients[client_index].hostname + " JOIN " + channel_name, clients[client_index].fd);
-            
-            // Send topic if exists
-            if (!channel.getTopic().empty()) {
-                server->sendMessage(clients[client_index].fd, "332 " + clients[client_index].nickname + " " + channel_name + " :" + channel.getTopic());
-            }
-            
-            // Send user list
-            server->sendChannelUserList(client_index, channel_name);
-            
-            std::cout << "Client " << clients[client_index].nickname << " joined channel " << channel_name << std::endl;
+        if (!server->addToChannel(client_index, channel)) {
+            continue;
+        }
+        server->propagateJoin(client_index, channel);
+
+        // Scrollback from before this JOIN, replayed after the NAMES list
+        std::vector<History::Event> replay;
+        if (HISTORY_JOIN_REPLAY > 0) {
+            replay = server->getHistory().latest(channel_name, HISTORY_JOIN_REPLAY);
+        }
+        server->getHistory().record(channel_name, History::EVENT_JOIN, prefix, "");
+
+        // The JOIN line is serialized once and goes to every member, the joiner included
+        const OutgoingMessage join_msg = server->makeMessage(":" + prefix + " JOIN " + channel_name);
+        const Channel::FdSet& members = channel.getClients();
+        for (Channel::FdSet::const_iterator it = members.begin(); it != members.end(); ++it) {
+            server->sendMessage(*it, join_msg);
         }
+        
+        // Send topic if exists
+        if (!channel.getTopic().empty()) {
+            server->sendMessage(client.fd, "332 " + client.nickname + " " + channel_name + " :" + channel.getTopic());
+        }
+        
+        // Send user list
+        server->sendChannelUserList(client_index, channel);
+        sendHistory(client_index, channel_name, replay);
+        
+        std::cout << "Client " << client.nickname << " joined channel " << channel_name << std::endl;
     }
 }
 
 void CommandHandler::handlePart(int client_index, const IRCMessage& msg) {
-    std::vector<Client>& clients = server->getClients();
-    std::map<std::string, Channel>& channels = server->getChannels();
+    ClientList& clients = server->getClients();
+    ChannelMap& channels = server->getChannels();
     
     if (!clients[client_index].isFullyRegistered()) {
         server->sendMessage(clients[client_index].fd, "451 * :You have not registered");
@@ -301,13 +624,14 @@ void CommandHandler::handlePart(int client_index, const IRCMessage& msg) {
         }
 
         // Remove client from channel
-        channels[channel_name].removeClient(clients[client_index].fd);
-        clients[client_index].leaveChannel(channel_name);
+        server->removeFromChannel(client_index, channels[channel_name]);
         
         // Send PART message to channel members (including the leaving client)
         std::string part_msg = ":" + clients[client_index].nickname + "!" + clients[client_index].username + "@" + clients[client_index].hostname + " PART " + channel_name + " :" + part_message;
         server->broadcastToChannel(channel_name, part_msg);
         server->sendMessage(clients[client_index].fd, part_msg);
+        server->propagate(part_msg);
+        server->getHistory().record(channel_name, History::EVENT_PART, clients[client_index].getPrefix(), part_message);
         
         std::cout << "Client " << clients[client_index].nickname << " left channel " << channel_name << std::endl;
     }
@@ -316,55 +640,131 @@ void CommandHandler::handlePart(int client_index, const IRCMessage& msg) {
 }
 
 void CommandHandler::handlePrivmsg(int client_index, const IRCMessage& msg) {
-    std::vector<Client>& clients = server->getClients();
-    std::map<std::string, Channel>& channels = server->getChannels();
+    relayMessage(client_index, msg, "PRIVMSG");
+}
+
+void CommandHandler::handleNotice(int client_index, const IRCMessage& msg) {
+    relayMessage(client_index, msg, "NOTICE");
+}
+
+void CommandHandler::relayMessage(int client_index, const IRCMessage& msg, const std::string& command) {
+    ClientList& clients = server->getClients();
+    ChannelMap& channels = server->getChannels();
+    // NOTICE must never trigger automatic replies (RFC 2812 3.3.2)
+    bool is_notice = (command == "NOTICE");
     
     if (!clients[client_index].isFullyRegistered()) {
-        server->sendMessage(clients[client_index].fd, "451 * :You have not registered");
+        if (!is_notice) {
+            server->sendMessage(clients[client_index].fd, "451 * :You have not registered");
+        }
         return;
     }
 
     if (msg.params.empty() || msg.trailing.empty()) {
-        server->sendMessage(clients[client_index].fd, "461 " + clients[client_index].nickname + " PRIVMSG :Not enough parameters");
+        if (!is_notice) {
+            server->sendMessage(clients[client_index].fd, "461 " + clients[client_index].nickname + " " + command + " :Not enough parameters");
+        }
         return;
     }
 
-    std::string target = msg.params[0];
-    std::string message = msg.trailing;
-    
-    // Check if target is a channel
-    if (target[0] == '#' || target[0] == '&') {
-        // Channel message
-        if (channels.find(target) == channels.end()) {
-            server->sendMessage(clients[client_index].fd, "403 " + clients[client_index].nickname + " " + target + " :No such channel");
-            return;
+    std::vector<std::string> targets = splitList(msg.params[0]);
+    if (targets.size() > MAX_TARGETS) {
+        if (!is_notice) {
+            server->sendMessage(clients[client_index].fd, "407 " + clients[client_index].nickname + " " + msg.params[0] + " :Too many recipients");
         }
-        
-        if (!channels[target].hasClient(clients[client_index].fd)) {
-            server->sendMessage(clients[client_index].fd, "404 " + clients[client_index].nickname + " " + target + " :Cannot send to channel");
-            return;
+        return;
+    }
+
+    // Serialize the parts shared by every target once; only the target name differs per line
+    const std::string prefix = clients[client_index].getPrefix();
+    const std::string head = ":" + prefix + " " + command + " ";
+    const std::string tail = " :" + msg.trailing;
+
+    // Client-only tags (+name) are relayed to recipients that support message tags
+    std::string client_tags;
+    if (clients[client_index].caps & CAP_MESSAGE_TAGS) {
+        for (std::map<std::string, std::string>::const_iterator it = msg.tags.begin(); it != msg.tags.end(); ++it) {
+            if (it->first[0] != '+') {
+                continue;
+            }
+            if (!client_tags.empty()) {
+                client_tags += ";";
+            }
+            client_tags += it->first;
+            if (!it->second.empty()) {
+                client_tags += "=" + escapeTagValue(it->second);
+            }
         }
-        
-        // Broadcast to channel (excluding sender)
-        std::string full_message = ":" + clients[client_index].nickname + "!" + clients[client_index].username + "@" + clients[client_index].hostname + " PRIVMSG " + target + " :" + message;
-        server->broadcastToChannel(target, full_message, clients[client_index].fd);
-    } else {
-        // Private message to user
-        int target_client = server->findClientByNickname(target);
-        if (target_client == -1) {
-            server->sendMessage(clients[client_index].fd, "401 " + clients[client_index].nickname + " " + target + " :No such nick");
-            return;
+    }
+
+    // Every recipient gets the message at most once, even when it shares several targeted channels.
+    // The sender is left out of channel fan-out only; a message to its own nick still reaches it.
+    const int sender_fd = clients[client_index].fd;
+    Channel::FdSet delivered;
+
+    for (size_t t = 0; t < targets.size(); t++) {
+        const std::string& target = targets[t];
+        // A target listed twice is only served once
+        if (std::find(targets.begin(), targets.begin() + t, target) != targets.begin() + t) {
+            continue;
+        }
+
+        // Check if target is a channel
+        if (target[0] == '#' || target[0] == '&') {
+            ChannelMap::iterator channel_it = channels.find(target);
+            if (channel_it == channels.end()) {
+                if (!is_notice) {
+                    server->sendMessage(clients[client_index].fd, "403 " + clients[client_index].nickname + " " + target + " :No such channel");
+                }
+                continue;
+            }
+
+            const Channel& channel = channel_it->second;
+            // Banned members stay silent unless they are operators
+            if (!channel.hasClient(clients[client_index].fd)
+                || (!channel.isOperator(clients[client_index].fd) && isBannedFrom(channel, clients[client_index]))) {
+                if (!is_notice) {
+                    server->sendMessage(clients[client_index].fd, "404 " + clients[client_index].nickname + " " + target + " :Cannot send to channel");
+                }
+                continue;
+            }
+
+            // Broadcast to channel (excluding sender and anyone already reached)
+            const OutgoingMessage full_message = server->makeMessage(head + target + tail, client_tags);
+            const Channel::FdSet& members = channel.getClients();
+            for (Channel::FdSet::const_iterator it = members.begin(); it != members.end(); ++it) {
+                if (*it != sender_fd && delivered.insert(*it).second) {
+                    server->sendMessage(*it, full_message);
+                }
+            }
+            // One copy per linked server with members, however many it has
+            server->routeToChannel(channel, head + target + tail);
+            server->getHistory().record(target, is_notice ? History::EVENT_NOTICE : History::EVENT_PRIVMSG, prefix, msg.trailing);
+        } else {
+            // Private message to user
+            int target_client = server->findClientByNickname(target);
+            if (target_client == -1) {
+                if (!is_notice) {
+                    server->sendMessage(clients[client_index].fd, "401 " + clients[client_index].nickname + " " + target + " :No such nick");
+                }
+                continue;
+            }
+
+            if (!delivered.insert(clients[target_client].fd).second) {
+                continue;
+            }
+            if (clients[target_client].isRemote()) {
+                server->routeToUser(target_client, head + target + tail);
+            } else {
+                server->sendMessage(clients[target_client].fd, server->makeMessage(head + target + tail, client_tags));
+            }
         }
-        
-        // Send private message
-        std::string full_message = ":" + clients[client_index].nickname + "!" + clients[client_index].username + "@" + clients[client_index].hostname + " PRIVMSG " + target + " :" + message;
-        server->sendMessage(clients[target_client].fd, full_message);
     }
 }
 
 void CommandHandler::handleKick(int client_index, const IRCMessage& msg) {
-    std::vector<Client>& clients = server->getClients();
-    std::map<std::string, Channel>& channels = server->getChannels();
+    ClientList& clients = server->getClients();
+    ChannelMap& channels = server->getChannels();
     
     if (!clients[client_index].isFullyRegistered()) {
         server->sendMessage(clients[client_index].fd, "451 * :You have not registered");
@@ -414,21 +814,21 @@ void CommandHandler::handleKick(int client_index, const IRCMessage& msg) {
     }
 
     // Perform the kick
-    channel.removeClient(clients[target_index].fd);
-    clients[target_index].leaveChannel(channel_name);
+    server->removeFromChannel(target_index, channel);
 
     // Send KICK message to channel (including the kicked user)
     std::string kick_msg = ":" + clients[client_index].nickname + "!" + clients[client_index].username + "@" + clients[client_index].hostname + " KICK " + channel_name + " " + target_nick + " :" + kick_reason;
     server->broadcastToChannel(channel_name, kick_msg);
     server->sendMessage(clients[target_index].fd, kick_msg);
+    server->propagate(kick_msg);
 
     std::cout << "Client " << clients[client_index].nickname << " kicked " << target_nick << " from " << channel_name << std::endl;
     server->cleanupEmptyChannels();
 }
 
 void CommandHandler::handleInvite(int client_index, const IRCMessage& msg) {
-    std::vector<Client>& clients = server->getClients();
-    std::map<std::string, Channel>& channels = server->getChannels();
+    ClientList& clients = server->getClients();
+    ChannelMap& channels = server->getChannels();
     
     if (!clients[client_index].isFullyRegistered()) {
         server->sendMessage(clients[client_index].fd, "451 * :You have not registered");
@@ -483,14 +883,19 @@ void CommandHandler::handleInvite(int client_index, const IRCMessage& msg) {
     server->sendMessage(clients[client_index].fd, "341 " + clients[client_index].nickname + " " + target_nick + " " + channel_name);
 
     // Send invite notification to target
-    server->sendMessage(clients[target_index].fd, ":" + clients[client_index].nickname + "!" + clients[client_index].username + "@" + clients[client_index].hostname + " INVITE " + target_nick + " " + channel_name);
+    std::string invite_msg = ":" + clients[client_index].nickname + "!" + clients[client_index].username + "@" + clients[client_index].hostname + " INVITE " + target_nick + " " + channel_name;
+    if (clients[target_index].isRemote()) {
+        server->routeToUser(target_index, invite_msg);
+    } else {
+        server->sendMessage(clients[target_index].fd, invite_msg);
+    }
 
     std::cout << "Client " << clients[client_index].nickname << " invited " << target_nick << " to " << channel_name << std::endl;
 }
 
 void CommandHandler::handleTopic(int client_index, const IRCMessage& msg) {
-    std::vector<Client>& clients = server->getClients();
-    std::map<std::string, Channel>& channels = server->getChannels();
+    ClientList& clients = server->getClients();
+    ChannelMap& channels = server->getChannels();
     
     if (!clients[client_index].isFullyRegistered()) {
         server->sendMessage(clients[client_index].fd, "451 * :You have not registered");
@@ -541,13 +946,15 @@ void CommandHandler::handleTopic(int client_index, const IRCMessage& msg) {
     // Broadcast topic change to channel
     std::string topic_msg = ":" + clients[client_index].nickname + "!" + clients[client_index].username + "@" + clients[client_index].hostname + " TOPIC " + channel_name + " :" + new_topic;
     server->broadcastToChannel(channel_name, topic_msg);
+    server->propagate(topic_msg);
+    server->getHistory().record(channel_name, History::EVENT_TOPIC, clients[client_index].getPrefix(), new_topic);
 
     std::cout << "Client " << clients[client_index].nickname << " changed topic of " << channel_name << " to: " << new_topic << std::endl;
 }
 
 void CommandHandler::handleMode(int client_index, const IRCMessage& msg) {
-    std::vector<Client>& clients = server->getClients();
-    std::map<std::string, Channel>& channels = server->getChannels();
+    ClientList& clients = server->getClients();
+    ChannelMap& channels = server->getChannels();
     
     if (!clients[client_index].isFullyRegistered()) {
         server->sendMessage(clients[client_index].fd, "451 * :You have not registered");
@@ -580,15 +987,28 @@ void CommandHandler::handleMode(int client_index, const IRCMessage& msg) {
         return;
     }
 
+    std::string mode_string = msg.params[1];
+
+    // "MODE #chan b" (or +b, e, I) without a mask lists the entries, open to anyone
+    if (msg.params.size() == 2) {
+        std::string list_mode = mode_string[0] == '+' ? mode_string.substr(1) : mode_string;
+        if (list_mode == "b" || list_mode == "e" || list_mode == "I") {
+            sendMaskList(client_index, channel, list_mode[0]);
+            return;
+        }
+    }
+
     // Check if client is an operator
     if (!channel.isOperator(clients[client_index].fd)) {
         server->sendMessage(clients[client_index].fd, "482 " + clients[client_index].nickname + " " + channel_name + " :You're not channel operator");
         return;
     }
 
-    std::string mode_string = msg.params[1];
     bool adding = true;
     int param_index = 2;
+    std::string applied; // Modes that went through, for the broadcast
+    std::string applied_params; // Their parameters, in the same order
+    char applied_sign = 0;
 
     for (size_t i = 0; i < mode_string.length(); i++) {
         char mode = mode_string[i];
@@ -602,6 +1022,7 @@ void CommandHandler::handleMode(int client_index, const IRCMessage& msg) {
             if (param_index < static_cast<int>(msg.params.size())) {
                 param = msg.params[param_index];
             }
+            bool with_param = false; // Whether the broadcast carries param
             
             switch (mode) {
                 case 'i': // Invite-only
@@ -610,6 +1031,14 @@ void CommandHandler::handleMode(int client_index, const IRCMessage& msg) {
                 case 't': // Topic restricted
                     channel.setTopicRestricted(adding);
                     break;
+                case 'P': // Permanent, survives being empty and restarts
+                    // Permanent channels outlive their users, so only IRC operators may create them
+                    if (!clients[client_index].server_operator) {
+                        server->sendMessage(clients[client_index].fd, "481 " + clients[client_index].nickname + " :Permission Denied- You're not an IRC operator");
+                        continue;
+                    }
+                    channel.setPermanent(adding);
+                    break;
                 case 'k': // Channel key
                     if (adding) {
                         if (param.empty()) {
@@ -618,6 +1047,7 @@ void CommandHandler::handleMode(int client_index, const IRCMessage& msg) {
                         }
                         channel.setKey(param);
                         param_index++;
+                        with_param = true;
                     } else {
                         channel.removeKey();
                     }
@@ -628,44 +1058,617 @@ void CommandHandler::handleMode(int client_index, const IRCMessage& msg) {
                             server->sendMessage(clients[client_index].fd, "461 " + clients[client_index].nickname + " MODE :Not enough parameters");
                             continue;
                         }
+                        param_index++;
                         long limit = strtol(param.c_str(), NULL, 10);
-                        if (limit > 0) {
-                            channel.setUserLimit(static_cast<size_t>(limit));
+                        if (limit <= 0) {
+                            continue;
                         }
-                        param_index++;
+                        channel.setUserLimit(static_cast<size_t>(limit));
+                        with_param = true;
                     } else {
                         channel.removeUserLimit();
                     }
                     break;
-                case 'o': // Operator privilege
+                case 'b': // Ban mask
+                case 'e': // Ban exception mask
+                case 'I': // Invite exception mask
+                    if (param.empty()) {
+                        sendMaskList(client_index, channel, mode);
+                        continue;
+                    }
+                    param_index++;
+                    if (adding) {
+                        MaskList& list = maskListFor(channel, mode);
+                        if (list.size() >= MAX_LIST_ENTRIES) {
+                            server->sendMessage(clients[client_index].fd, "478 " + clients[client_index].nickname + " " + channel_name + " " + param + " :Channel list is full");
+                            continue;
+                        }
+                        list.add(param, clients[client_index].getPrefix(), time(NULL));
+                    } else {
+                        maskListFor(channel, mode).remove(param);
+                    }
+                    with_param = true;
+                    break;
+                case 'o': { // Operator privilege
                     if (param.empty()) {
                         server->sendMessage(clients[client_index].fd, "461 " + clients[client_index].nickname + " MODE :Not enough parameters");
                         continue;
                     }
+                    param_index++;
                     int target_index = server->findClientByNickname(param);
                     if (target_index == -1) {
                         server->sendMessage(clients[client_index].fd, "401 " + clients[client_index].nickname + " " + param + " :No such nick");
-                    } else if (!channel.hasClient(clients[target_index].fd)) {
+                        continue;
+                    }
+                    if (!channel.hasClient(clients[target_index].fd)) {
                         server->sendMessage(clients[client_index].fd, "441 " + clients[client_index].nickname + " " + param + " " + channel_name + " :They aren't on that channel");
+                        continue;
+                    }
+                    if (adding) {
+                        channel.addOperator(clients[target_index].fd);
                     } else {
-                        if (adding) {
-                            channel.addOperator(clients[target_index].fd);
-                        } else {
-                            channel.removeOperator(clients[target_index].fd);
-                        }
+                        channel.removeOperator(clients[target_index].fd);
                     }
-                    param_index++;
+                    with_param = true;
                     break;
+                }
+                default:
+                    server->sendMessage(clients[client_index].fd, "472 " + clients[client_index].nickname + " " + std::string(1, mode) + " :is unknown mode char to me");
+                    continue;
+            }
+            if (applied_sign != (adding ? '+' : '-')) {
+                applied_sign = adding ? '+' : '-';
+                applied += applied_sign;
+            }
+            applied += mode;
+            if (with_param) {
+                applied_params += " " + param;
             }
         }
     }
+    if (applied.empty()) {
+        return;
+    }
 
     // Broadcast mode change to channel
-    std::string mode_msg = ":" + clients[client_index].nickname + "!" + clients[client_index].username + "@" + clients[client_index].hostname + " MODE " + channel_name + " " + mode_string;
-    for (int i = 2; i < param_index && i < static_cast<int>(msg.params.size()); i++) {
-        mode_msg += " " + msg.params[i];
-    }
+    std::string mode_msg = ":" + clients[client_index].nickname + "!" + clients[client_index].username + "@" + clients[client_index].hostname + " MODE " + channel_name + " " + applied + applied_params;
     server->broadcastToChannel(channel_name, mode_msg);
+    server->propagate(mode_msg);
+
+    std::cout << "Client " << clients[client_index].nickname << " changed mode of " << channel_name << ": " << applied << std::endl;
+}
+MaskList& CommandHandler::maskListFor(Channel& channel, char mode) {
+    if (mode == 'e') {
+        return channel.getExceptions();
+    }
+    if (mode == 'I') {
+        return channel.getInviteExceptions();
+    }
+    return channel.getBans();
+}
+
+void CommandHandler::sendMaskList(int client_index, Channel& channel, char mode) {
+    const Client& client = server->getClients()[client_index];
+    // Entry and end-of-list numerics for +b, +e and +I
+    const char* entry_numeric = mode == 'e' ? "348" : mode == 'I' ? "346" : "367";
+    const char* end_numeric = mode == 'e' ? "349" : mode == 'I' ? "347" : "368";
+    const char* end_text = mode == 'e' ? "End of channel exception list" : mode == 'I' ? "End of channel invite list" : "End of channel ban list";
+
+    const std::vector<MaskList::Entry>& entries = maskListFor(channel, mode).getEntries();
+    for (size_t i = 0; i < entries.size(); i++) {
+        std::ostringstream line;
+        line << entry_numeric << " " << client.nickname << " " << channel.getName() << " "
+             << entries[i].mask << " " << entries[i].setter << " " << entries[i].set_time;
+        server->sendMessage(client.fd, line.str());
+    }
+    server->sendMessage(client.fd, std::string(end_numeric) + " " + client.nickname + " " + channel.getName() + " :" + end_text);
+}
 
-    std::cout << "Client " << clients[client_index].nickname << " changed mode of " << channel_name << ": " << mode_string << std::endl;
-}
\ No newline at end of file
+void CommandHandler::sendHistory(int client_index, const std::string& channel_name, const std::vector<History::Event>& events) {
+    const Client& client = server->getClients()[client_index];
+    if (events.empty()) {
+        return;
+    }
+
+    // With batch negotiated the replay is framed as one chathistory batch
+    std::string batch_ref;
+    if (client.caps & CAP_BATCH) {
+        std::ostringstream ref;
+        ref << "h" << ++batch_counter;
+        batch_ref = ref.str();
+        server->sendMessage(client.fd, "BATCH +" + batch_ref + " chathistory " + channel_name);
+    }
+
+    for (size_t i = 0; i < events.size(); i++) {
+        std::string tags;
+        if (!batch_ref.empty()) {
+            tags = "batch=" + batch_ref;
+        }
+        // Replayed events carry their original time so clients can page further back
+        if (client.caps & (CAP_SERVER_TIME | CAP_MESSAGE_TAGS)) {
+            tags += (tags.empty() ? "" : ";") + std::string("time=") + History::formatTime(events[i].time_ms);
+        }
+        if (tags.empty()) {
+            server->sendMessage(client.fd, History::formatEvent(channel_name, events[i]));
+        } else {
+            server->sendMessage(client.fd, "@" + tags + " " + History::formatEvent(channel_name, events[i]));
+        }
+    }
+
+    if (!batch_ref.empty()) {
+        server->sendMessage(client.fd, "BATCH -" + batch_ref);
+    }
+}
+
+// Parses a CHATHISTORY message reference; only timestamps are supported
+static bool parseHistoryReference(const std::string& reference, uint64_t& time_ms) {
+    const std::string prefix = "timestamp=";
+    if (reference.compare(0, prefix.length(), prefix) != 0) {
+        return false;
+    }
+    return History::parseTime(reference.substr(prefix.length()), time_ms);
+}
+
+void CommandHandler::handleChathistory(int client_index, const IRCMessage& msg) {
+    ClientList& clients = server->getClients();
+    ChannelMap& channels = server->getChannels();
+    
+    if (!clients[client_index].isFullyRegistered()) {
+        server->sendMessage(clients[client_index].fd, "451 * :You have not registered");
+        return;
+    }
+
+    if (msg.params.size() < 4) {
+        server->sendMessage(clients[client_index].fd, "FAIL CHATHISTORY NEED_MORE_PARAMS :Missing parameters");
+        return;
+    }
+
+    std::string subcommand = msg.params[0];
+    for (size_t i = 0; i < subcommand.length(); i++) {
+        subcommand[i] = std::toupper(subcommand[i]);
+    }
+    const std::string& target = msg.params[1];
+
+    ChannelMap::iterator channel_it = channels.find(target);
+    if (channel_it == channels.end() || !channel_it->second.hasClient(clients[client_index].fd)) {
+        server->sendMessage(clients[client_index].fd, "FAIL CHATHISTORY INVALID_TARGET " + subcommand + " " + target + " :Messages could not be retrieved");
+        return;
+    }
+
+    // The limit is always the last parameter
+    long requested = strtol(msg.params[msg.params.size() - 1].c_str(), NULL, 10);
+    if (requested <= 0) {
+        server->sendMessage(clients[client_index].fd, "FAIL CHATHISTORY INVALID_PARAMS " + subcommand + " :Invalid limit");
+        return;
+    }
+    size_t limit = static_cast<size_t>(requested) < CHATHISTORY_MAX_LIMIT ? static_cast<size_t>(requested) : CHATHISTORY_MAX_LIMIT;
+
+    History& history = server->getHistory();
+    std::vector<History::Event> events;
+    uint64_t first_ms, second_ms;
+
+    if (subcommand == "LATEST") {
+        if (msg.params[2] == "*") {
+            events = history.latest(target, limit);
+        } else if (parseHistoryReference(msg.params[2], first_ms)) {
+            events = history.between(target, first_ms, static_cast<uint64_t>(-1), limit);
+        } else {
+            server->sendMessage(clients[client_index].fd, "FAIL CHATHISTORY INVALID_PARAMS LATEST :Invalid message reference");
+            return;
+        }
+    } else if (subcommand == "BEFORE" || subcommand == "AFTER") {
+        if (!parseHistoryReference(msg.params[2], first_ms)) {
+            server->sendMessage(clients[client_index].fd, "FAIL CHATHISTORY INVALID_PARAMS " + subcommand + " :Invalid message reference");
+            return;
+        }
+        events = subcommand == "BEFORE" ? history.before(target, first_ms, limit) : history.after(target, first_ms, limit);
+    } else if (subcommand == "BETWEEN") {
+        if (msg.params.size() < 5 || !parseHistoryReference(msg.params[2], first_ms) || !parseHistoryReference(msg.params[3], second_ms)) {
+            server->sendMessage(clients[client_index].fd, "FAIL CHATHISTORY INVALID_PARAMS BETWEEN :Invalid message reference");
+            return;
+        }
+        if (first_ms > second_ms) {
+            std::swap(first_ms, second_ms);
+        }
+        events = history.between(target, first_ms, second_ms, limit);
+    } else {
+        server->sendMessage(clients[client_index].fd, "FAIL CHATHISTORY INVALID_PARAMS " + subcommand + " :Unknown subcommand");
+        return;
+    }
+
+    sendHistory(client_index, target, events);
+}
+
+void CommandHandler::sendWhoReply(int client_index, const std::string& channel_name, const Client& target, bool is_operator) {
+    const Client& client = server->getClients()[client_index];
+    server->sendMessage(client.fd, "352 " + client.nickname + " " + channel_name + " " + target.username + " " + target.hostname
+                        + " " + (target.isRemote() ? target.server.str() : server->getServerName()) + " " + target.nickname + (is_operator ? " H@" : " H") + " :0 " + target.realname);
+}
+
+void CommandHandler::handleWho(int client_index, const IRCMessage& msg) {
+    ClientList& clients = server->getClients();
+    ChannelMap& channels = server->getChannels();
+    
+    if (!clients[client_index].isFullyRegistered()) {
+        server->sendMessage(clients[client_index].fd, "451 * :You have not registered");
+        return;
+    }
+
+    std::string mask = msg.params.empty() || msg.params[0] == "0" ? "*" : msg.params[0];
+
+    if (server->isValidChannelName(mask)) {
+        // Channel members come straight from the membership set
+        ChannelMap::const_iterator channel_it = channels.find(mask);
+        if (channel_it != channels.end()) {
+            const Channel::FdSet& members = channel_it->second.getClients();
+            for (Channel::FdSet::const_iterator it = members.begin(); it != members.end(); ++it) {
+                int member_index = server->findClientByFd(*it);
+                if (member_index != -1) {
+                    sendWhoReply(client_index, mask, clients[member_index], channel_it->second.isOperator(*it));
+                }
+            }
+        }
+    } else {
+        // Masks match the nickname, or the full nick!user@host if they contain '!' or '@'.
+        // The nickname index is sorted, so only nicks sharing the mask's literal
+        // prefix are visited.
+        std::string nick_mask = mask.substr(0, mask.find_first_of("!@"));
+        bool full_mask = nick_mask.length() != mask.length();
+        std::string literal = ircLower(nick_mask.substr(0, nick_mask.find_first_of("*?")));
+
+        const std::map<std::string, int>& nick_index = server->getNickIndex();
+        std::map<std::string, int>::const_iterator it = nick_index.lower_bound(literal);
+        for (; it != nick_index.end() && it->first.compare(0, literal.length(), literal) == 0; ++it) {
+            int target_index = server->findClientByFd(it->second);
+            if (target_index == -1 || !clients[target_index].registered) {
+                continue;
+            }
+            const Client& target = clients[target_index];
+            if (full_mask ? matchMask(mask, target.getPrefix()) : matchMask(nick_mask, target.nickname)) {
+                sendWhoReply(client_index, "*", target, false);
+            }
+        }
+    }
+
+    server->sendMessage(clients[client_index].fd, "315 " + clients[client_index].nickname + " " + mask + " :End of WHO list");
+}
+
+void CommandHandler::handleList(int client_index, const IRCMessage& msg) {
+    ClientList& clients = server->getClients();
+    ChannelMap& channels = server->getChannels();
+    
+    if (!clients[client_index].isFullyRegistered()) {
+        server->sendMessage(clients[client_index].fd, "451 * :You have not registered");
+        return;
+    }
+
+    ListRequest request;
+    std::vector<std::string> names;
+    std::vector<std::string> items = splitList(msg.params.empty() ? "" : msg.params[0]);
+    time_t now = time(NULL);
+
+    // ELIST filters: >N / <N on member count, T>N / T<N on topic age in minutes
+    for (size_t i = 0; i < items.size(); i++) {
+        const std::string& item = items[i];
+        bool topic_filter = item.length() > 2 && (item[0] == 'T' || item[0] == 't') && (item[1] == '<' || item[1] == '>');
+        char op = topic_filter ? item[1] : item[0];
+        if (!topic_filter && op != '<' && op != '>') {
+            names.push_back(item);
+            continue;
+        }
+        long value = strtol(item.c_str() + (topic_filter ? 2 : 1), NULL, 10);
+        if (value < 0) {
+            value = 0;
+        }
+        if (topic_filter) {
+            // T<N: topic set less than N minutes ago, T>N: more than N minutes ago
+            if (op == '<') {
+                request.topic_after = now - value * 60;
+            } else {
+                request.topic_before = now - value * 60;
+            }
+        } else if (op == '>') {
+            request.min_users = static_cast<size_t>(value) + 1;
+            request.by_size = true;
+        } else if (value == 0) {
+            request.max_users = 0;
+            request.min_users = 1; // "<0" can never match
+            request.by_size = true;
+        } else {
+            request.max_users = static_cast<size_t>(value) - 1;
+        }
+    }
+
+    // Explicit channel names are answered directly
+    if (!names.empty()) {
+        server->sendMessage(clients[client_index].fd, "321 " + clients[client_index].nickname + " Channel :Users Name");
+        for (size_t i = 0; i < names.size(); i++) {
+            ChannelMap::const_iterator channel_it = channels.find(names[i]);
+            if (channel_it == channels.end()) {
+                continue;
+            }
+            std::ostringstream line;
+            line << "322 " << clients[client_index].nickname << " " << channel_it->first << " "
+                 << channel_it->second.getUserCount() << " :" << channel_it->second.getTopic();
+            server->sendMessage(clients[client_index].fd, line.str());
+        }
+        server->sendMessage(clients[client_index].fd, "323 " + clients[client_index].nickname + " :End of LIST");
+        return;
+    }
+
+    // Everything else is streamed into the send queue over the next loop ticks
+    server->startList(clients[client_index].fd, request);
+}
+
+bool CommandHandler::requireServerOperator(int client_index) {
+    const Client& client = server->getClients()[client_index];
+    if (!client.isFullyRegistered()) {
+        server->sendMessage(client.fd, "451 * :You have not registered");
+        return false;
+    }
+    if (!client.server_operator) {
+        server->sendMessage(client.fd, "481 " + client.nickname + " :Permission Denied- You're not an IRC operator");
+        return false;
+    }
+    return true;
+}
+
+void CommandHandler::handleOper(int client_index, const IRCMessage& msg) {
+    ClientList& clients = server->getClients();
+
+    if (!clients[client_index].isFullyRegistered()) {
+        server->sendMessage(clients[client_index].fd, "451 * :You have not registered");
+        return;
+    }
+
+    if (msg.params.size() < 2) {
+        server->sendMessage(clients[client_index].fd, "461 " + clients[client_index].nickname + " OPER :Not enough parameters");
+        return;
+    }
+
+    // The answer comes back through Server::completeLogins()
+    if (!server->startOperCheck(client_index, msg.params[0], msg.params[1])) {
+        server->sendMessage(clients[client_index].fd, "NOTICE " + clients[client_index].nickname + " :*** OPER check failed (server busy, try again)");
+    }
+}
+
+void CommandHandler::handleKline(int client_index, const IRCMessage& msg, bool adding) {
+    const std::string command = adding ? "KLINE" : "UNKLINE";
+    if (!requireServerOperator(client_index)) {
+        return;
+    }
+    ClientList& clients = server->getClients();
+    Client& oper = clients[client_index];
+
+    if (msg.params.empty()) {
+        server->sendMessage(oper.fd, "461 " + oper.nickname + " " + command + " :Not enough parameters");
+        return;
+    }
+    const std::string& mask = msg.params[0];
+    DenyList& deny_list = server->getDenyList();
+
+    if (!adding) {
+        if (deny_list.removeKline(mask)) {
+            server->sendMessage(oper.fd, "NOTICE " + oper.nickname + " :Removed K-line for " + mask);
+        } else {
+            server->sendMessage(oper.fd, "NOTICE " + oper.nickname + " :No K-line for " + mask);
+        }
+        return;
+    }
+
+    const std::string reason = msg.trailing.empty() ? "No reason" : msg.trailing;
+    if (!deny_list.addKline(mask, oper.nickname, time(NULL), reason)) {
+        server->sendMessage(oper.fd, "NOTICE " + oper.nickname + " :Invalid or existing K-line " + mask + " (expected user@host)");
+        return;
+    }
+    server->sendMessage(oper.fd, "NOTICE " + oper.nickname + " :Added K-line for " + mask);
+
+    // Local users already connected under the mask are dropped too
+    for (size_t i = 0; i < clients.size(); i++) {
+        if (clients[i].registered && !clients[i].isRemote() && isKlined(deny_list, clients[i])) {
+            server->disconnectClient(clients[i].fd, "K-lined (" + reason + ")");
+        }
+    }
+}
+
+void CommandHandler::handleDline(int client_index, const IRCMessage& msg, bool adding) {
+    const std::string command = adding ? "DLINE" : "UNDLINE";
+    if (!requireServerOperator(client_index)) {
+        return;
+    }
+    ClientList& clients = server->getClients();
+    Client& oper = clients[client_index];
+
+    if (msg.params.empty()) {
+        server->sendMessage(oper.fd, "461 " + oper.nickname + " " + command + " :Not enough parameters");
+        return;
+    }
+    const std::string& cidr = msg.params[0];
+    DenyList& deny_list = server->getDenyList();
+
+    if (!adding) {
+        if (deny_list.removeDline(cidr)) {
+            server->sendMessage(oper.fd, "NOTICE " + oper.nickname + " :Removed D-line for " + cidr);
+        } else {
+            server->sendMessage(oper.fd, "NOTICE " + oper.nickname + " :No D-line for " + cidr);
+        }
+        return;
+    }
+
+    const std::string reason = msg.trailing.empty() ? "No reason" : msg.trailing;
+    if (!deny_list.addDline(cidr, oper.nickname, time(NULL), reason)) {
+        server->sendMessage(oper.fd, "NOTICE " + oper.nickname + " :Invalid or existing D-line " + cidr + " (expected address or CIDR range)");
+        return;
+    }
+    server->sendMessage(oper.fd, "NOTICE " + oper.nickname + " :Added D-line for " + cidr);
+
+    // Connections from the range, registered or not, are dropped too
+    for (size_t i = 0; i < clients.size(); i++) {
+        if (!clients[i].isRemote() && deny_list.isDenied(clients[i].address)) {
+            server->disconnectClient(clients[i].fd, "D-lined (" + reason + ")");
+        }
+    }
+}
+
+void CommandHandler::handleServer(int client_index, const IRCMessage& msg) {
+    const Client& client = server->getClients()[client_index];
+    if (client.registered) {
+        server->sendMessage(client.fd, "462 " + client.nickname + " :You may not reregister");
+        return;
+    }
+    server->acceptLink(client_index, msg);
+}
+
+void CommandHandler::handleConnect(int client_index, const IRCMessage& msg) {
+    if (!requireServerOperator(client_index)) {
+        return;
+    }
+    const Client& oper = server->getClients()[client_index];
+    if (msg.params.empty()) {
+        server->sendMessage(oper.fd, "461 " + oper.nickname + " CONNECT :Not enough parameters");
+        return;
+    }
+
+    std::string error;
+    if (!server->connectLink(msg.params[0], error)) {
+        server->sendMessage(oper.fd, "NOTICE " + oper.nickname + " :CONNECT " + msg.params[0] + ": " + error);
+        return;
+    }
+    server->sendMessage(oper.fd, "NOTICE " + oper.nickname + " :Connecting to " + msg.params[0]);
+}
+
+void CommandHandler::handleSquit(int client_index, const IRCMessage& msg) {
+    if (!requireServerOperator(client_index)) {
+        return;
+    }
+    const Client& oper = server->getClients()[client_index];
+    if (msg.params.empty()) {
+        server->sendMessage(oper.fd, "461 " + oper.nickname + " SQUIT :Not enough parameters");
+        return;
+    }
+
+    // Only direct links can be closed from here
+    const std::string reason = msg.trailing.empty() ? "Closed by " + oper.nickname : msg.trailing;
+    if (!server->squitLink(msg.params[0], reason)) {
+        server->sendMessage(oper.fd, "402 " + oper.nickname + " " + msg.params[0] + " :No such server");
+    }
+}
+
+void CommandHandler::handleLinks(int client_index, const IRCMessage& msg) {
+    const Client& client = server->getClients()[client_index];
+    if (!client.isFullyRegistered()) {
+        server->sendMessage(client.fd, "451 * :You have not registered");
+        return;
+    }
+    const std::string mask = msg.params.empty() ? "*" : msg.params[msg.params.size() - 1];
+
+    if (matchMask(mask, server->getServerName())) {
+        server->sendMessage(client.fd, "364 " + client.nickname + " " + server->getServerName() + " "
+                            + server->getServerName() + " :0 " + server->getServerInfo());
+    }
+    const std::map<std::string, PeerServer>& peers = server->getPeerServers();
+    for (std::map<std::string, PeerServer>::const_iterator it = peers.begin(); it != peers.end(); ++it) {
+        if (matchMask(mask, it->second.name)) {
+            std::ostringstream line;
+            line << "364 " << client.nickname << " " << it->second.name << " " << it->second.uplink
+                 << " :" << it->second.hops << " " << it->second.description;
+            server->sendMessage(client.fd, line.str());
+        }
+    }
+    server->sendMessage(client.fd, "365 " + client.nickname + " " + mask + " :End of LINKS list");
+}
+
+static const size_t MONITOR_LINE_LIMIT = 400; // Split 730-732 replies beyond this length
+
+// Sends "<numeric> <nick> :a,b,c" lines, split to stay within the line limit
+static void sendTargetList(Server* server, const Client& client, const std::string& numeric,
+                           const std::vector<std::string>& targets) {
+    const std::string head = numeric + " " + client.nickname + " :";
+    std::string list;
+    for (size_t i = 0; i < targets.size(); i++) {
+        if (!list.empty() && head.length() + list.length() + targets[i].length() + 1 > MONITOR_LINE_LIMIT) {
+            server->sendMessage(client.fd, head + list);
+            list.clear();
+        }
+        if (!list.empty()) list += ",";
+        list += targets[i];
+    }
+    if (!list.empty()) {
+        server->sendMessage(client.fd, head + list);
+    }
+}
+
+// 730 for the nicknames in use, 731 for the others
+void CommandHandler::sendMonitorStatus(int client_index, const std::vector<std::string>& nicknames) {
+    const ClientList& clients = server->getClients();
+    std::vector<std::string> online, offline;
+    for (size_t i = 0; i < nicknames.size(); i++) {
+        int target_index = server->findClientByNickname(nicknames[i]);
+        if (target_index != -1 && clients[target_index].registered) {
+            online.push_back(clients[target_index].getPrefix());
+        } else {
+            offline.push_back(nicknames[i]);
+        }
+    }
+    sendTargetList(server, clients[client_index], "730", online);
+    sendTargetList(server, clients[client_index], "731", offline);
+}
+
+void CommandHandler::handleMonitor(int client_index, const IRCMessage& msg) {
+    const Client& client = server->getClients()[client_index];
+    if (!client.isFullyRegistered()) {
+        server->sendMessage(client.fd, "451 * :You have not registered");
+        return;
+    }
+    if (msg.params.empty()) {
+        server->sendMessage(client.fd, "461 " + client.nickname + " MONITOR :Not enough parameters");
+        return;
+    }
+    const std::string& subcommand = msg.params[0];
+    const std::string target_list = msg.params.size() > 1 ? msg.params[1] : msg.trailing;
+
+    if (subcommand == "+" || subcommand == "-") {
+        if (target_list.empty()) {
+            server->sendMessage(client.fd, "461 " + client.nickname + " MONITOR :Not enough parameters");
+            return;
+        }
+        std::vector<std::string> targets;
+        std::istringstream items(target_list);
+        std::string target;
+        while (std::getline(items, target, ',')) {
+            if (!target.empty()) {
+                targets.push_back(target);
+            }
+        }
+        if (subcommand == "-") {
+            for (size_t i = 0; i < targets.size(); i++) {
+                server->removeMonitor(client_index, targets[i]);
+            }
+            return;
+        }
+        std::vector<std::string> added;
+        for (size_t i = 0; i < targets.size(); i++) {
+            if (!server->addMonitor(client_index, targets[i])) {
+                // Everything from the first target that did not fit is refused
+                std::ostringstream full;
+                full << "734 " << client.nickname << " " << server->getMonitorLimit() << " ";
+                for (size_t j = i; j < targets.size(); j++) {
+                    full << (j > i ? "," : "") << targets[j];
+                }
+                full << " :Monitor list is full";
+                server->sendMessage(client.fd, full.str());
+                break;
+            }
+            added.push_back(targets[i]);
+        }
+        sendMonitorStatus(client_index, added);
+    } else if (subcommand == "C" || subcommand == "c") {
+        server->clearMonitors(client_index);
+    } else if (subcommand == "L" || subcommand == "l") {
+        std::vector<std::string> nicknames(client.monitoring.begin(), client.monitoring.end());
+        sendTargetList(server, client, "732", nicknames);
+        server->sendMessage(client.fd, "733 " + client.nickname + " :End of MONITOR list");
+    } else if (subcommand == "S" || subcommand == "s") {
+        sendMonitorStatus(client_index, std::vector<std::string>(client.monitoring.begin(), client.monitoring.end()));
+    }
+}
@@ -0,0 +1,254 @@
+#include "Config.hpp"
+#include <cstdlib> // For std::strtol
+#include <fstream> // For std::ifstream
+#include <sstream> // For std::ostringstream
+#include <iostream> // For std::cerr
+#include <csignal> // For sigset_t, sigprocmask
+#include <errno.h> // For errno
+#include <stdint.h> // For uint64_t
+#include <unistd.h> // For read, write, close
+#include <sys/eventfd.h> // For eventfd
+#include <sys/signalfd.h> // For signalfd
+
+static const long MAX_CLIENTS_LIMIT = 1000000;
+static const long MAX_THROTTLE_WINDOW = 86400;
+
+Config::Config(size_t default_max_clients, unsigned int default_throttle_connections, int default_throttle_window,
+               const std::string& deny_file)
+    : max_clients(default_max_clients), throttle_connections(default_throttle_connections),
+      throttle_window(default_throttle_window), deny_list(deny_file), deny_revision(0) {
+    // Replies are already batched into one write per tick, Nagle would only hold them back
+    socket_profile.tcp_nodelay = 1;
+}
+
+static std::string trim(const std::string& text) {
+    size_t start = text.find_first_not_of(" \t\r");
+    if (start == std::string::npos) {
+        return "";
+    }
+    return text.substr(start, text.find_last_not_of(" \t\r") - start + 1);
+}
+
+static bool parseNumber(const std::string& text, long min, long max, long& value) {
+    char* end;
+    errno = 0;
+    value = std::strtol(text.c_str(), &end, 10);
+    return !text.empty() && *end == '\0' && errno == 0 && value >= min && value <= max;
+}
+
+static const long MAX_SOCKET_BUFFER = 16 * 1024 * 1024;
+
+// Parses a socket profile setting into profile; false if name is not one
+static bool setSocketOption(SocketProfile& profile, const std::string& name, const std::string& value, bool& valid) {
+    long number = 0;
+    int* field;
+    if (name == "tcp_nodelay") {
+        valid = value == "on" || value == "off";
+        profile.tcp_nodelay = value == "on";
+        return true;
+    } else if (name == "defer_accept") {
+        valid = parseNumber(value, 0, 3600, number);
+        field = &profile.defer_accept;
+    } else if (name == "receive_buffer") {
+        valid = parseNumber(value, 4096, MAX_SOCKET_BUFFER, number);
+        field = &profile.receive_buffer;
+    } else if (name == "send_buffer") {
+        valid = parseNumber(value, 4096, MAX_SOCKET_BUFFER, number);
+        field = &profile.send_buffer;
+    } else if (name == "keepalive_idle") {
+        valid = parseNumber(value, 1, 32767, number);
+        field = &profile.keepalive_idle;
+    } else if (name == "keepalive_interval") {
+        valid = parseNumber(value, 1, 32767, number);
+        field = &profile.keepalive_interval;
+    } else if (name == "keepalive_count") {
+        valid = parseNumber(value, 1, 127, number);
+        field = &profile.keepalive_count;
+    } else if (name == "user_timeout") {
+        valid = parseNumber(value, 0, 3600000, number);
+        field = &profile.user_timeout;
+    } else if (name == "notsent_lowat") {
+        valid = parseNumber(value, 1, MAX_SOCKET_BUFFER, number);
+        field = &profile.notsent_lowat;
+    } else {
+        return false;
+    }
+    *field = static_cast<int>(number);
+    return true;
+}
+
+bool Config::load(const std::string& path, Config& config, std::string& error) {
+    std::ifstream file(path.c_str());
+    if (file) {
+        std::string text;
+        size_t line_number = 0;
+        while (std::getline(file, text)) {
+            line_number++;
+            text = trim(text);
+            if (text.empty() || text[0] == '#') {
+                continue;
+            }
+            size_t equals = text.find('=');
+            std::string key = trim(text.substr(0, equals));
+            std::string value = equals == std::string::npos ? "" : trim(text.substr(equals + 1));
+            long number = 0;
+            bool valid;
+            if (key == "password") {
+                valid = !value.empty() && value.find(' ') == std::string::npos;
+                config.password = value;
+            } else if (key == "max_clients") {
+                valid = parseNumber(value, 1, MAX_CLIENTS_LIMIT, number);
+                config.max_clients = static_cast<size_t>(number);
+            } else if (key == "throttle_connections") {
+                valid = parseNumber(value, 1, MAX_CLIENTS_LIMIT, number);
+                config.throttle_connections = static_cast<unsigned int>(number);
+            } else if (key == "throttle_window") {
+                valid = parseNumber(value, 1, MAX_THROTTLE_WINDOW, number);
+                config.throttle_window = static_cast<int>(number);
+            } else if (key == "listen") {
+                valid = parseNumber(value, 1024, 65535, number);
+                config.listen_ports.insert(static_cast<int>(number));
+            } else if (key == "websocket") {
+                valid = parseNumber(value, 1024, 65535, number);
+                config.websocket_ports.insert(static_cast<int>(number));
+            } else if (setSocketOption(config.socket_profile, key, value, valid)) {
+                // Applies to every listener without an override
+            } else if (key.find('.') != std::string::npos
+                       && parseNumber(key.substr(0, key.find('.')), 1, 65535, number)
+                       && setSocketOption(config.port_profiles[static_cast<int>(number)], key.substr(key.find('.') + 1), value, valid)) {
+                // <port>.<setting>
+            } else {
+                std::ostringstream message;
+                message << path << ":" << line_number << ": unknown setting " << key;
+                error = message.str();
+                return false;
+            }
+            if (!valid) {
+                std::ostringstream message;
+                message << path << ":" << line_number << ": invalid value for " << key;
+                error = message.str();
+                return false;
+            }
+        }
+    }
+    for (std::set<int>::const_iterator it = config.websocket_ports.begin(); it != config.websocket_ports.end(); ++it) {
+        if (config.listen_ports.find(*it) != config.listen_ports.end()) {
+            std::ostringstream message;
+            message << path << ": port " << *it << " is both a listen and a websocket port";
+            error = message.str();
+            return false;
+        }
+    }
+    config.deny_list.load();
+    return true;
+}
+
+// ---- Reloading ----
+
+ConfigLoader::ConfigLoader(const std::string& file_path, const Config& default_config)
+    : path(file_path), defaults(default_config), signal_fd(-1), event_fd(-1), requested(false),
+      running(false), finished(false), result(NULL) {
+}
+
+ConfigLoader::~ConfigLoader() {
+    if (running) {
+        pthread_join(thread, NULL);
+    }
+    delete result;
+    if (signal_fd >= 0) {
+        close(signal_fd);
+    }
+    if (event_fd >= 0) {
+        close(event_fd);
+    }
+}
+
+void ConfigLoader::blockSignal() {
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGHUP);
+    sigprocmask(SIG_BLOCK, &signals, NULL);
+}
+
+bool ConfigLoader::start() {
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGHUP);
+    signal_fd = signalfd(-1, &signals, SFD_NONBLOCK | SFD_CLOEXEC);
+    event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (signal_fd < 0 || event_fd < 0) {
+        if (signal_fd >= 0) {
+            close(signal_fd);
+        }
+        if (event_fd >= 0) {
+            close(event_fd);
+        }
+        signal_fd = -1;
+        event_fd = -1;
+        return false;
+    }
+    return true;
+}
+
+void ConfigLoader::receiveSignal() {
+    struct signalfd_siginfo info;
+    while (read(signal_fd, &info, sizeof(info)) == sizeof(info)) {
+        requested = true;
+    }
+}
+
+void ConfigLoader::collect() {
+    uint64_t count;
+    while (read(event_fd, &count, sizeof(count)) < 0 && errno == EINTR) {
+    }
+    if (running) {
+        // The thread signalled as its last step, joining does not wait
+        pthread_join(thread, NULL);
+        running = false;
+        finished = true;
+    }
+}
+
+void* ConfigLoader::threadMain(void* self) {
+    static_cast<ConfigLoader*>(self)->load();
+    return NULL;
+}
+
+void ConfigLoader::load() {
+    Config::load(path, *result, error);
+    uint64_t one = 1;
+    if (write(event_fd, &one, sizeof(one)) < 0) {
+        std::cerr << "Could not signal a finished configuration reload" << std::endl;
+    }
+}
+
+void ConfigLoader::startRequested(unsigned long running_deny_revision) {
+    // Signals arriving during a reload are served by one more reload after it
+    if (!requested || running || finished) {
+        return;
+    }
+    requested = false;
+    result = new Config(defaults);
+    result->deny_revision = running_deny_revision;
+    error.clear();
+    if (pthread_create(&thread, NULL, &ConfigLoader::threadMain, this) == 0) {
+        running = true;
+        return;
+    }
+    // Without a thread the reload still happens, just on the loop
+    load();
+    collect();
+    finished = true;
+}
+
+bool ConfigLoader::takeResult(Config& config, std::string& reload_error) {
+    finished = false;
+    bool valid = error.empty();
+    if (valid) {
+        config = *result;
+    }
+    reload_error = error;
+    delete result;
+    result = NULL;
+    return valid;
+}
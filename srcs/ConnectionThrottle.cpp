@@ -0,0 +1,91 @@
+#include "ConnectionThrottle.hpp"
+#include <cstring> // For std::memcpy
+#include <netinet/in.h> // For sockaddr_in, sockaddr_in6
+
+ConnectionThrottle::ConnectionThrottle(unsigned int max_per_window, time_t window_seconds)
+    : max_connections(max_per_window), window(window_seconds) {
+    Entry empty;
+    empty.key = 0;
+    empty.window_start = 0;
+    empty.count = 0;
+    table.assign(TABLE_SIZE, empty);
+}
+
+ConnectionThrottle::~ConnectionThrottle() {
+}
+
+void ConnectionThrottle::setLimits(unsigned int max_per_window, time_t window_seconds) {
+    max_connections = max_per_window;
+    window = window_seconds;
+}
+
+size_t ConnectionThrottle::hashKey(uint64_t key) {
+    // 64-bit mix (splitmix64 finalizer) so neighbouring addresses spread out
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdULL;
+    key ^= key >> 33;
+    key *= 0xc4ceb9fe1a85ec53ULL;
+    key ^= key >> 33;
+    return static_cast<size_t>(key) & (TABLE_SIZE - 1);
+}
+
+uint64_t ConnectionThrottle::keyFor(const struct sockaddr_storage& addr) {
+    if (addr.ss_family == AF_INET6) {
+        const struct sockaddr_in6* addr6 = reinterpret_cast<const struct sockaddr_in6*>(&addr);
+        const unsigned char* bytes = addr6->sin6_addr.s6_addr;
+
+        // IPv4-mapped peers (::ffff:a.b.c.d) are throttled per address like plain IPv4
+        if (IN6_IS_ADDR_V4MAPPED(&addr6->sin6_addr)) {
+            uint32_t v4;
+            std::memcpy(&v4, bytes + 12, sizeof(v4));
+            return (1ULL << 32) | ntohl(v4);
+        }
+
+        // Native IPv6 peers are throttled per /64, the usual end-site allocation
+        uint64_t prefix = 0;
+        for (int i = 0; i < 8; i++) {
+            prefix = (prefix << 8) | bytes[i];
+        }
+        // IPv4 keys live in 0:1::/32, which is never allocated to real IPv6 hosts
+        return prefix;
+    }
+
+    const struct sockaddr_in* addr4 = reinterpret_cast<const struct sockaddr_in*>(&addr);
+    return (1ULL << 32) | ntohl(addr4->sin_addr.s_addr);
+}
+
+bool ConnectionThrottle::allow(uint64_t key, time_t now) {
+    size_t slot = hashKey(key);
+    size_t victim = slot;
+
+    for (size_t probe = 0; probe < MAX_PROBES; probe++) {
+        Entry& entry = table[(slot + probe) & (TABLE_SIZE - 1)];
+        bool expired = entry.count == 0 || now - entry.window_start >= window;
+
+        if (entry.count != 0 && entry.key == key) {
+            if (expired) {
+                entry.window_start = now;
+                entry.count = 1;
+                return true;
+            }
+            if (entry.count >= max_connections) {
+                return false;
+            }
+            entry.count++;
+            return true;
+        }
+
+        // Remember the best slot to reuse: a free/expired one, else the oldest
+        Entry& best = table[victim];
+        bool best_expired = best.count == 0 || now - best.window_start >= window;
+        if (!best_expired && (expired || entry.window_start < best.window_start)) {
+            victim = (slot + probe) & (TABLE_SIZE - 1);
+        }
+    }
+
+    Entry& entry = table[victim];
+    entry.key = key;
+    entry.window_start = now;
+    entry.count = 1;
+    return true;
+}
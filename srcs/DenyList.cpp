@@ -0,0 +1,291 @@
+#include "DenyList.hpp"
+#include "Mask.hpp"
+#include <cstdio> // For std::rename
+#include <cstdlib> // For std::strtol
+#include <cstring> // For std::memset, std::memcmp
+#include <fstream> // For std::ifstream, std::ofstream
+#include <iostream> // For std::cerr
+#include <sstream> // For std::istringstream
+#include <arpa/inet.h> // For inet_pton
+#include <netinet/in.h> // For sockaddr_in, sockaddr_in6
+
+DenyList::DenyList(const std::string& file_path) : path(file_path), revision(0) {
+    rebuildTrie();
+}
+
+DenyList::~DenyList() {
+}
+
+// ---- Address parsing ----
+
+bool DenyList::parseAddress(const std::string& text, unsigned char address[16]) {
+    struct in_addr addr4;
+    if (inet_pton(AF_INET, text.c_str(), &addr4) == 1) {
+        // ::ffff:a.b.c.d, the same form accept() reports on the dual-stack listener
+        std::memset(address, 0, 10);
+        address[10] = 0xff;
+        address[11] = 0xff;
+        std::memcpy(address + 12, &addr4, 4);
+        return true;
+    }
+    return inet_pton(AF_INET6, text.c_str(), address) == 1;
+}
+
+bool DenyList::parseCidr(const std::string& cidr, unsigned char address[16], unsigned int& prefix_length) {
+    size_t slash = cidr.find('/');
+    std::string host = cidr.substr(0, slash);
+    if (!parseAddress(host, address)) {
+        return false;
+    }
+    bool is_ipv4 = host.find(':') == std::string::npos;
+    unsigned int max_length = is_ipv4 ? 32 : 128;
+
+    prefix_length = max_length;
+    if (slash != std::string::npos) {
+        std::string length_text = cidr.substr(slash + 1);
+        char* end;
+        long length = std::strtol(length_text.c_str(), &end, 10);
+        if (length_text.empty() || *end != '\0' || length < 0 || length > static_cast<long>(max_length)) {
+            return false;
+        }
+        prefix_length = static_cast<unsigned int>(length);
+    }
+    if (is_ipv4) {
+        prefix_length += 96;
+    }
+    return true;
+}
+
+bool DenyList::isValidCidr(const std::string& cidr) {
+    unsigned char address[16];
+    unsigned int prefix_length;
+    return parseCidr(cidr, address, prefix_length);
+}
+
+// Two CIDR strings naming the same range, e.g. "10.0.0.1/8" and "10.0.0.0/8"
+bool DenyList::sameRange(const std::string& first, const std::string& second) {
+    unsigned char first_address[16], second_address[16];
+    unsigned int first_length, second_length;
+    if (!parseCidr(first, first_address, first_length) || !parseCidr(second, second_address, second_length)
+        || first_length != second_length) {
+        return false;
+    }
+    for (unsigned int bit = 0; bit < first_length; bit++) {
+        unsigned int shift = 7 - (bit & 7);
+        if (((first_address[bit >> 3] >> shift) & 1) != ((second_address[bit >> 3] >> shift) & 1)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// ---- Prefix trie ----
+
+void DenyList::insertPrefix(const unsigned char address[16], unsigned int prefix_length) {
+    uint32_t node = 0;
+    for (unsigned int bit = 0; bit < prefix_length; bit++) {
+        if (trie[node].terminal) {
+            return; // A shorter prefix already covers this range
+        }
+        int branch = (address[bit >> 3] >> (7 - (bit & 7))) & 1;
+        if (trie[node].child[branch] == 0) {
+            Node empty = { { 0, 0 }, false };
+            trie.push_back(empty);
+            trie[node].child[branch] = static_cast<uint32_t>(trie.size() - 1);
+        }
+        node = trie[node].child[branch];
+    }
+    trie[node].terminal = true;
+}
+
+bool DenyList::containsAddress(const unsigned char address[16]) const {
+    uint32_t node = 0;
+    for (unsigned int bit = 0; bit < 128; bit++) {
+        if (trie[node].terminal) {
+            return true;
+        }
+        node = trie[node].child[(address[bit >> 3] >> (7 - (bit & 7))) & 1];
+        if (node == 0) {
+            return false;
+        }
+    }
+    return trie[node].terminal;
+}
+
+void DenyList::rebuildTrie() {
+    Node root = { { 0, 0 }, false };
+    trie.assign(1, root);
+    for (size_t i = 0; i < dlines.size(); i++) {
+        unsigned char address[16];
+        unsigned int prefix_length;
+        if (parseCidr(dlines[i].mask, address, prefix_length)) {
+            insertPrefix(address, prefix_length);
+        }
+    }
+}
+
+bool DenyList::isDenied(const struct sockaddr_storage& addr) const {
+    if (dlines.empty()) {
+        return false;
+    }
+    unsigned char address[16];
+    if (addr.ss_family == AF_INET6) {
+        std::memcpy(address, reinterpret_cast<const struct sockaddr_in6*>(&addr)->sin6_addr.s6_addr, 16);
+    } else {
+        std::memset(address, 0, 10);
+        address[10] = 0xff;
+        address[11] = 0xff;
+        std::memcpy(address + 12, &reinterpret_cast<const struct sockaddr_in*>(&addr)->sin_addr, 4);
+    }
+    return containsAddress(address);
+}
+
+bool DenyList::isDenied(const std::string& host) const {
+    unsigned char address[16];
+    return !dlines.empty() && parseAddress(host, address) && containsAddress(address);
+}
+
+bool DenyList::isKlined(const std::string& client_mask, const std::string& host) const {
+    return kline_masks.matches(client_mask, host);
+}
+
+// ---- Management ----
+
+bool DenyList::insertDline(const Line& line) {
+    unsigned char address[16];
+    unsigned int prefix_length;
+    if (!parseCidr(line.mask, address, prefix_length)) {
+        return false;
+    }
+    for (size_t i = 0; i < dlines.size(); i++) {
+        if (sameRange(dlines[i].mask, line.mask)) {
+            return false;
+        }
+    }
+    dlines.push_back(line);
+    insertPrefix(address, prefix_length);
+    return true;
+}
+
+bool DenyList::insertKline(const Line& line) {
+    if (line.mask.find('@') == std::string::npos || line.mask.find('!') != std::string::npos) {
+        return false;
+    }
+    if (!kline_masks.add(line.mask, line.setter, line.set_time)) {
+        return false;
+    }
+    klines.push_back(line);
+    return true;
+}
+
+static DenyList::Line makeLine(const std::string& mask, const std::string& setter, time_t set_time, const std::string& reason) {
+    DenyList::Line line;
+    line.mask = mask;
+    line.setter = setter;
+    line.set_time = set_time;
+    line.reason = reason;
+    return line;
+}
+
+bool DenyList::addDline(const std::string& cidr, const std::string& setter, time_t set_time, const std::string& reason) {
+    if (!insertDline(makeLine(cidr, setter, set_time, reason))) {
+        return false;
+    }
+    save();
+    return true;
+}
+
+bool DenyList::removeDline(const std::string& cidr) {
+    for (size_t i = 0; i < dlines.size(); i++) {
+        if (sameRange(dlines[i].mask, cidr)) {
+            dlines.erase(dlines.begin() + i);
+            // Removals are rare, the trie is simply rebuilt
+            rebuildTrie();
+            save();
+            return true;
+        }
+    }
+    return false;
+}
+
+bool DenyList::addKline(const std::string& mask, const std::string& setter, time_t set_time, const std::string& reason) {
+    if (!insertKline(makeLine(mask, setter, set_time, reason))) {
+        return false;
+    }
+    save();
+    return true;
+}
+
+bool DenyList::removeKline(const std::string& mask) {
+    if (!kline_masks.remove(mask)) {
+        return false;
+    }
+    for (size_t i = 0; i < klines.size(); i++) {
+        if (ircLower(klines[i].mask) == ircLower(mask)) {
+            klines.erase(klines.begin() + i);
+            break;
+        }
+    }
+    save();
+    return true;
+}
+
+// ---- Persistence ----
+
+void DenyList::load() {
+    std::ifstream file(path.c_str());
+    if (!file) {
+        return; // Nothing denied yet
+    }
+
+    std::string text;
+    size_t line_number = 0;
+    while (std::getline(file, text)) {
+        line_number++;
+        if (text.empty() || text[0] == '#') {
+            continue;
+        }
+        size_t reason_start = text.find(" :");
+        std::istringstream fields(text.substr(0, reason_start));
+        std::string type, mask, setter;
+        long set_time = 0;
+        fields >> type >> mask >> setter >> set_time;
+        std::string reason = reason_start == std::string::npos ? "" : text.substr(reason_start + 2);
+
+        bool added = false;
+        if (type == "DLINE") {
+            added = insertDline(makeLine(mask, setter, set_time, reason));
+        } else if (type == "KLINE") {
+            added = insertKline(makeLine(mask, setter, set_time, reason));
+        }
+        if (!added) {
+            std::cerr << path << ":" << line_number << ": ignoring invalid deny line" << std::endl;
+        }
+    }
+}
+
+static void writeLines(std::ofstream& file, const char* type, const std::vector<DenyList::Line>& lines) {
+    for (size_t i = 0; i < lines.size(); i++) {
+        file << type << " " << lines[i].mask << " " << lines[i].setter << " "
+             << static_cast<long>(lines[i].set_time) << " :" << lines[i].reason << "\n";
+    }
+}
+
+bool DenyList::save() {
+    revision++;
+    // Written aside and renamed so a crash never leaves a half-written list
+    std::string tmp_path = path + ".tmp";
+    std::ofstream file(tmp_path.c_str(), std::ios::out | std::ios::trunc);
+    if (!file) {
+        std::cerr << "Cannot write deny list " << tmp_path << std::endl;
+        return false;
+    }
+    writeLines(file, "DLINE", dlines);
+    writeLines(file, "KLINE", klines);
+    file.close();
+    if (!file || std::rename(tmp_path.c_str(), path.c_str()) != 0) {
+        std::cerr << "Cannot write deny list " << path << std::endl;
+        return false;
+    }
+    return true;
+}
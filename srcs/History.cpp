@@ -0,0 +1,179 @@
+#include "History.hpp"
+#include <cstring> // For std::memset
+#include <ctime> // For gmtime_r, timegm
+#include <cstdio> // For snprintf, sscanf
+#include <sys/time.h> // For gettimeofday
+
+History::History(size_t events_per_channel) : capacity(events_per_channel) {
+}
+
+History::~History() {
+    flushLog();
+}
+
+uint64_t History::nowMs() {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return static_cast<uint64_t>(tv.tv_sec) * 1000 + tv.tv_usec / 1000;
+}
+
+std::string History::formatTime(uint64_t time_ms) {
+    time_t seconds = static_cast<time_t>(time_ms / 1000);
+    struct tm utc;
+    gmtime_r(&seconds, &utc);
+    char buffer[32];
+    snprintf(buffer, sizeof(buffer), "%04d-%02d-%02dT%02d:%02d:%02d.%03dZ",
+             utc.tm_year + 1900, utc.tm_mon + 1, utc.tm_mday,
+             utc.tm_hour, utc.tm_min, utc.tm_sec, static_cast<int>(time_ms % 1000));
+    return buffer;
+}
+
+bool History::parseTime(const std::string& text, uint64_t& time_ms) {
+    struct tm utc;
+    int millis = 0;
+    std::memset(&utc, 0, sizeof(utc));
+    int fields = sscanf(text.c_str(), "%4d-%2d-%2dT%2d:%2d:%2d.%3dZ",
+                        &utc.tm_year, &utc.tm_mon, &utc.tm_mday,
+                        &utc.tm_hour, &utc.tm_min, &utc.tm_sec, &millis);
+    if (fields < 6) {
+        return false;
+    }
+    utc.tm_year -= 1900;
+    utc.tm_mon -= 1;
+    time_t seconds = timegm(&utc);
+    if (seconds < 0) {
+        return false;
+    }
+    time_ms = static_cast<uint64_t>(seconds) * 1000 + millis;
+    return true;
+}
+
+std::string History::formatEvent(const std::string& channel, const Event& event) {
+    static const char* const commands[] = { "PRIVMSG", "NOTICE", "JOIN", "PART", "TOPIC" };
+    std::string line = ":" + *event.prefix + " " + commands[event.type] + " " + channel;
+    if (event.type != EVENT_JOIN) {
+        line += " :" + *event.text;
+    }
+    return line;
+}
+
+bool History::openLog(const std::string& path) {
+    log.open(path.c_str(), std::ios::out | std::ios::app);
+    return log.is_open();
+}
+
+void History::flushLog() {
+    if (log.is_open()) {
+        log.flush();
+    }
+}
+
+const std::string* History::intern(const std::string& value) {
+    std::map<std::string, unsigned>::iterator it = interned.insert(std::make_pair(value, 0u)).first;
+    it->second++;
+    return &it->first;
+}
+
+void History::release(const std::string* value) {
+    std::map<std::string, unsigned>::iterator it = interned.find(*value);
+    if (it != interned.end() && --it->second == 0) {
+        interned.erase(it);
+    }
+}
+
+void History::record(const std::string& channel, EventType type, const std::string& prefix, const std::string& text) {
+    if (capacity == 0) {
+        return;
+    }
+
+    Event event;
+    event.time_ms = nowMs();
+    event.type = type;
+    event.prefix = intern(prefix);
+    event.text = intern(text);
+
+    Ring& ring = rings[channel];
+    if (ring.events.size() < capacity) {
+        if (ring.events.empty()) {
+            ring.head = 0;
+        }
+        ring.events.push_back(event);
+    } else {
+        // Overwrite the oldest event
+        Event& oldest = ring.events[ring.head];
+        release(oldest.prefix);
+        release(oldest.text);
+        oldest = event;
+        ring.head = (ring.head + 1) % capacity;
+    }
+
+    // Buffered; flushLog() pushes it to disk once per loop tick
+    if (log.is_open()) {
+        log << formatTime(event.time_ms) << " " << formatEvent(channel, event) << "\n";
+    }
+}
+
+void History::dropChannel(const std::string& channel) {
+    std::map<std::string, Ring>::iterator it = rings.find(channel);
+    if (it == rings.end()) {
+        return;
+    }
+    for (size_t i = 0; i < it->second.events.size(); i++) {
+        release(it->second.events[i].prefix);
+        release(it->second.events[i].text);
+    }
+    rings.erase(it);
+}
+
+void History::collect(const Ring& ring, std::vector<Event>& out) const {
+    size_t count = ring.events.size();
+    out.reserve(count);
+    for (size_t i = 0; i < count; i++) {
+        out.push_back(ring.events[(ring.head + i) % count]);
+    }
+}
+
+std::vector<History::Event> History::latest(const std::string& channel, size_t limit) const {
+    return before(channel, static_cast<uint64_t>(-1), limit);
+}
+
+std::vector<History::Event> History::before(const std::string& channel, uint64_t time_ms, size_t limit) const {
+    return between(channel, 0, time_ms, limit);
+}
+
+std::vector<History::Event> History::after(const std::string& channel, uint64_t time_ms, size_t limit) const {
+    std::vector<Event> result;
+    std::map<std::string, Ring>::const_iterator it = rings.find(channel);
+    if (it == rings.end()) {
+        return result;
+    }
+    std::vector<Event> ordered;
+    collect(it->second, ordered);
+    // Oldest events strictly after the timestamp
+    for (size_t i = 0; i < ordered.size() && result.size() < limit; i++) {
+        if (ordered[i].time_ms > time_ms) {
+            result.push_back(ordered[i]);
+        }
+    }
+    return result;
+}
+
+std::vector<History::Event> History::between(const std::string& channel, uint64_t from_ms, uint64_t to_ms, size_t limit) const {
+    std::vector<Event> result;
+    std::map<std::string, Ring>::const_iterator it = rings.find(channel);
+    if (it == rings.end()) {
+        return result;
+    }
+    std::vector<Event> ordered;
+    collect(it->second, ordered);
+    // Events strictly between the two timestamps, keeping the newest `limit`
+    for (size_t i = 0; i < ordered.size(); i++) {
+        if (ordered[i].time_ms > from_ms && ordered[i].time_ms < to_ms) {
+            result.push_back(ordered[i]);
+        }
+    }
+    if (result.size() > limit) {
+        result.erase(result.begin(), result.end() - limit);
+    }
+    return result;
+}
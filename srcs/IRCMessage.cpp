@@ -1,12 +1,69 @@
 #include "IRCMessage.hpp"
+#include "WebSocket.hpp"
+#include "Arena.hpp"
 
 IRCMessage::IRCMessage() : prefix(""), command(""), trailing("") {}
 
 IRCMessage::~IRCMessage() {}
 
+OutgoingMessage::OutgoingMessage(const std::string& line, const std::string& time, const std::string& msgid, const std::string& client_tags)
+    : plain(line), timed("@time=" + time + " " + line), tagged("@time=" + time + ";msgid=" + msgid) {
+    if (!client_tags.empty()) {
+        tagged += ";" + client_tags;
+    }
+    tagged += " " + line;
+}
+
+OutgoingMessage::~OutgoingMessage() {}
+
+const std::string& OutgoingMessage::webSocketFrame(unsigned int caps, bool text) const {
+    const std::string& line = forCaps(caps);
+    std::string& frame = frames[(&line == &plain ? 0 : &line == &timed ? 2 : 4) + text];
+    if (frame.empty()) {
+        frame = text ? encodeWebSocketFrame(WS_TEXT, toValidUtf8(line)) : encodeWebSocketFrame(WS_BINARY, line);
+    }
+    return frame;
+}
+
+std::string escapeTagValue(const std::string& value) {
+    std::string escaped;
+    for (size_t i = 0; i < value.length(); i++) {
+        switch (value[i]) {
+            case ';': escaped += "\\:"; break;
+            case ' ': escaped += "\\s"; break;
+            case '\\': escaped += "\\\\"; break;
+            case '\r': escaped += "\\r"; break;
+            case '\n': escaped += "\\n"; break;
+            default: escaped += value[i];
+        }
+    }
+    return escaped;
+}
+
+std::string unescapeTagValue(const std::string& value) {
+    std::string unescaped;
+    for (size_t i = 0; i < value.length(); i++) {
+        if (value[i] != '\\') {
+            unescaped += value[i];
+            continue;
+        }
+        if (++i >= value.length())
+            break; // A trailing backslash is dropped
+        switch (value[i]) {
+            case ':': unescaped += ';'; break;
+            case 's': unescaped += ' '; break;
+            case 'r': unescaped += '\r'; break;
+            case 'n': unescaped += '\n'; break;
+            default: unescaped += value[i]; // Covers "\\" and unknown escapes
+        }
+    }
+    return unescaped;
+}
+
 IRCMessage parseMessage(const std::string& raw_message) {
     IRCMessage msg;
-    std::string line = raw_message;
+    // Working copies only live while the line is parsed, so they come from the tick arena
+    ArenaString line(raw_message.data(), raw_message.length());
     
     // Remove \r\n at the end
     if(!line.empty() && line[line.length() - 1] == '\n') 
@@ -20,43 +77,71 @@ IRCMessage parseMessage(const std::string& raw_message) {
     
     size_t pos = 0;
     
-    // Step 1: Parse prefix (optional, starts with ':')
-    if(line[0] == ':') {
+    // Step 0: Parse IRCv3 message tags (optional, starts with '@')
+    if(line[0] == '@') {
         size_t space_pos = line.find(' ');
+        if(space_pos == std::string::npos) {
+            return msg;  // Tags without a command
+        }
+        size_t tag_start = 1;
+        while(tag_start < space_pos) {
+            size_t tag_end = line.find(';', tag_start);
+            if(tag_end == std::string::npos || tag_end > space_pos)
+                tag_end = space_pos;
+            ArenaString tag = line.substr(tag_start, tag_end - tag_start);
+            size_t equals = tag.find('=');
+            if(!tag.empty() && equals != 0) {
+                if(equals == ArenaString::npos)
+                    msg.tags[std::string(tag.data(), tag.length())] = "";
+                else
+                    msg.tags[std::string(tag.data(), equals)] = unescapeTagValue(std::string(tag.data() + equals + 1, tag.length() - equals - 1));
+            }
+            tag_start = tag_end + 1;
+        }
+        pos = line.find_first_not_of(' ', space_pos);
+        if(pos == std::string::npos) {
+            return msg;
+        }
+    }
+    
+    // Step 1: Parse prefix (optional, starts with ':')
+    if(line[pos] == ':') {
+        size_t space_pos = line.find(' ', pos);
         if(space_pos != std::string::npos) {
-            msg.prefix = line.substr(1, space_pos - 1);  // Skip ':'
+            msg.prefix.assign(line.data() + pos + 1, space_pos - pos - 1);  // Skip ':'
             pos = space_pos + 1;  // Continue after space
         } else {
             // No spaces found, entire line is prefix (shouldn't happen)
-            msg.prefix = line.substr(1);
+            msg.prefix.assign(line.data() + pos + 1, line.length() - pos - 1);
             return msg;
         }
     }
     
     // Step 2: Find and separate trailing (optional, ' :' pattern)
     size_t trailing_pos = line.find(" :", pos);
-    std::string params_part;
+    ArenaString params_part;
     
     if(trailing_pos != std::string::npos) {
         params_part = line.substr(pos, trailing_pos - pos);
-        msg.trailing = line.substr(trailing_pos + 2);  // Skip " :"
+        msg.trailing.assign(line.data() + trailing_pos + 2, line.length() - trailing_pos - 2);  // Skip " :"
     } else {
         params_part = line.substr(pos);
         msg.trailing = "";
     }
     
-    // Step 3: Extract command and params from params_part
-    std::istringstream iss(params_part);
-    std::string word;
-    bool first_word = true;
-    
-    while(iss >> word) {
-        if(first_word) {
-            msg.command = word;
-            first_word = false;
+    // Step 3: Extract command and params from params_part, splitting on spaces
+    size_t word_start = params_part.find_first_not_of(' ');
+    while(word_start != std::string::npos) {
+        size_t word_end = params_part.find(' ', word_start);
+        if(word_end == std::string::npos)
+            word_end = params_part.length();
+        
+        if(msg.command.empty()) {
+            msg.command.assign(params_part.data() + word_start, word_end - word_start);
         } else {
-            msg.params.push_back(word);
+            msg.params.push_back(std::string(params_part.data() + word_start, word_end - word_start));
         }
+        word_start = params_part.find_first_not_of(' ', word_end);
     }
     
     return msg;
@@ -0,0 +1,106 @@
+#include "InternedString.hpp"
+
+InternedString::Table& InternedString::table() {
+    static Table values;
+    return values;
+}
+
+InternedString::Entry* InternedString::acquire(const std::string& value) {
+    if (value.empty()) {
+        return NULL;
+    }
+    Table& values = table();
+    Table::iterator it = values.lower_bound(value);
+    if (it == values.end() || it->first != value) {
+        it = values.insert(it, Entry(value, 0));
+    }
+    it->second++;
+    return &*it;
+}
+
+void InternedString::release(Entry* entry) {
+    if (entry && --entry->second == 0) {
+        table().erase(entry->first);
+    }
+}
+
+InternedString::InternedString() : entry(NULL) {
+}
+
+InternedString::InternedString(const std::string& value) : entry(acquire(value)) {
+}
+
+InternedString::InternedString(const char* value) : entry(acquire(value)) {
+}
+
+InternedString::InternedString(const InternedString& other) : entry(other.entry) {
+    if (entry) {
+        entry->second++;
+    }
+}
+
+InternedString::~InternedString() {
+    release(entry);
+}
+
+InternedString& InternedString::operator=(const InternedString& other) {
+    // Taking the new reference first keeps self-assignment safe
+    if (other.entry) {
+        other.entry->second++;
+    }
+    release(entry);
+    entry = other.entry;
+    return *this;
+}
+
+InternedString& InternedString::operator=(const std::string& value) {
+    Entry* acquired = acquire(value);
+    release(entry);
+    entry = acquired;
+    return *this;
+}
+
+InternedString& InternedString::operator=(const char* value) {
+    return *this = std::string(value);
+}
+
+const std::string& InternedString::str() const {
+    static const std::string empty_value;
+    return entry ? entry->first : empty_value;
+}
+
+std::string operator+(const std::string& left, const InternedString& right) {
+    return left + right.str();
+}
+
+std::string operator+(const InternedString& left, const std::string& right) {
+    return left.str() + right;
+}
+
+std::string operator+(const char* left, const InternedString& right) {
+    return left + right.str();
+}
+
+std::string operator+(const InternedString& left, const char* right) {
+    return left.str() + right;
+}
+
+bool operator==(const InternedString& left, const std::string& right) {
+    return left.str() == right;
+}
+
+bool operator==(const std::string& left, const InternedString& right) {
+    return left == right.str();
+}
+
+bool operator!=(const InternedString& left, const std::string& right) {
+    return left.str() != right;
+}
+
+bool operator!=(const std::string& left, const InternedString& right) {
+    return left != right.str();
+}
+
+std::ostream& operator<<(std::ostream& out, const InternedString& value) {
+    return out << value.str();
+}
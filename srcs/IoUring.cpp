@@ -0,0 +1,237 @@
+#include "IoUring.hpp"
+#include <cerrno> // For errno
+#include <cstring> // For std::memset
+#include <unistd.h> // For syscall, close
+#include <poll.h> // For POLLIN
+#include <sys/mman.h> // For mmap
+#include <sys/socket.h> // For SOCK_NONBLOCK
+#include <sys/syscall.h> // For __NR_io_uring_*
+
+// Ring indexes are shared with the kernel: loads of what it writes need
+// acquire, stores it reads need release
+static unsigned loadAcquire(const unsigned* value) {
+    return __atomic_load_n(value, __ATOMIC_ACQUIRE);
+}
+
+static void storeRelease(unsigned* value, unsigned new_value) {
+    __atomic_store_n(value, new_value, __ATOMIC_RELEASE);
+}
+
+IoUring::IoUring() : ring_fd(-1), sq_entries(0), to_submit(0), sq_ring(MAP_FAILED), sq_ring_size(0),
+                     cq_ring(MAP_FAILED), cq_ring_size(0), sqes(NULL), sqes_size(0), sq_head(NULL), sq_tail(NULL),
+                     sq_mask(NULL), sq_array(NULL), cq_head(NULL), cq_tail(NULL), cq_mask(NULL), cqes(NULL),
+                     buf_ring(NULL), buf_ring_size(0), buffer_count(0), buffer_size(0) {
+}
+
+IoUring::~IoUring() {
+    if (buf_ring) {
+        munmap(buf_ring, buf_ring_size);
+    }
+    if (sqes) {
+        munmap(sqes, sqes_size);
+    }
+    if (cq_ring != MAP_FAILED && cq_ring != sq_ring) {
+        munmap(cq_ring, cq_ring_size);
+    }
+    if (sq_ring != MAP_FAILED) {
+        munmap(sq_ring, sq_ring_size);
+    }
+    if (ring_fd >= 0) {
+        close(ring_fd);
+    }
+}
+
+bool IoUring::setup(unsigned entries, unsigned receive_buffers, unsigned receive_buffer_size) {
+    struct io_uring_params params;
+    std::memset(&params, 0, sizeof(params));
+    ring_fd = syscall(__NR_io_uring_setup, entries, &params);
+    if (ring_fd < 0) {
+        return false;
+    }
+    // Timed waits need EXT_ARG, and no completion may ever be dropped
+    if (!(params.features & IORING_FEAT_EXT_ARG) || !(params.features & IORING_FEAT_NODROP)) {
+        errno = ENOSYS;
+        return false;
+    }
+    sq_entries = params.sq_entries;
+
+    sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        sq_ring_size = cq_ring_size = sq_ring_size > cq_ring_size ? sq_ring_size : cq_ring_size;
+    }
+    sq_ring = mmap(NULL, sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+    if (sq_ring == MAP_FAILED) {
+        return false;
+    }
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        cq_ring = sq_ring;
+    } else {
+        cq_ring = mmap(NULL, cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_CQ_RING);
+        if (cq_ring == MAP_FAILED) {
+            return false;
+        }
+    }
+    sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    void* sqe_memory = mmap(NULL, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+    if (sqe_memory == MAP_FAILED) {
+        return false;
+    }
+    sqes = static_cast<struct io_uring_sqe*>(sqe_memory);
+
+    char* sq = static_cast<char*>(sq_ring);
+    char* cq = static_cast<char*>(cq_ring);
+    sq_head = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+    sq_tail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+    sq_mask = reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+    sq_array = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+    cq_head = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+    cq_tail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+    cq_mask = reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+    cqes = reinterpret_cast<struct io_uring_cqe*>(cq + params.cq_off.cqes);
+
+    // Provided-buffer ring for receives: one io_uring_buf per buffer, page aligned
+    buffer_count = receive_buffers;
+    buffer_size = receive_buffer_size;
+    buffers.resize(static_cast<size_t>(buffer_count) * buffer_size);
+    buf_ring_size = buffer_count * sizeof(struct io_uring_buf);
+    void* ring_memory = mmap(NULL, buf_ring_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ring_memory == MAP_FAILED) {
+        return false;
+    }
+    buf_ring = static_cast<struct io_uring_buf_ring*>(ring_memory);
+
+    struct io_uring_buf_reg reg;
+    std::memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = reinterpret_cast<uint64_t>(buf_ring);
+    reg.ring_entries = buffer_count;
+    reg.bgid = BUFFER_GROUP;
+    if (syscall(__NR_io_uring_register, ring_fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+        return false;
+    }
+    for (unsigned i = 0; i < buffer_count; i++) {
+        recycleBuffer(static_cast<uint16_t>(i));
+    }
+    return true;
+}
+
+void IoUring::recycleBuffer(uint16_t buffer_id) {
+    unsigned short tail = buf_ring->tail;
+    // The ring is an array of io_uring_buf starting at offset 0. The header's
+    // C++ flavour of the flexible "bufs" member lands at offset 8, so it is not used.
+    struct io_uring_buf* buf = reinterpret_cast<struct io_uring_buf*>(buf_ring) + (tail & (buffer_count - 1));
+    buf->addr = reinterpret_cast<uint64_t>(&buffers[static_cast<size_t>(buffer_id) * buffer_size]);
+    buf->len = buffer_size;
+    buf->bid = buffer_id;
+    __atomic_store_n(&buf_ring->tail, static_cast<unsigned short>(tail + 1), __ATOMIC_RELEASE);
+}
+
+struct io_uring_sqe* IoUring::nextSqe() {
+    unsigned tail = *sq_tail;
+    if (tail - loadAcquire(sq_head) >= sq_entries) {
+        // Submission queue full: hand what is queued to the kernel first
+        enter(to_submit, 0, 0);
+    }
+    struct io_uring_sqe* sqe = &sqes[tail & *sq_mask];
+    std::memset(sqe, 0, sizeof(*sqe));
+    sq_array[tail & *sq_mask] = tail & *sq_mask;
+    return sqe;
+}
+
+// Publishes the entry returned by the last nextSqe()
+void IoUring::commitSqe() {
+    storeRelease(sq_tail, *sq_tail + 1);
+    to_submit++;
+}
+
+void IoUring::prepAccept(int listen_fd, uint64_t user_data) {
+    struct io_uring_sqe* sqe = nextSqe();
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = listen_fd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+    sqe->user_data = user_data;
+    commitSqe();
+}
+
+void IoUring::prepRecv(int fd, uint64_t user_data) {
+    struct io_uring_sqe* sqe = nextSqe();
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = fd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = BUFFER_GROUP;
+    sqe->user_data = user_data;
+    commitSqe();
+}
+
+void IoUring::prepSend(int fd, const char* data, size_t length, uint64_t user_data) {
+    struct io_uring_sqe* sqe = nextSqe();
+    sqe->opcode = IORING_OP_SEND;
+    sqe->fd = fd;
+    sqe->addr = reinterpret_cast<uint64_t>(data);
+    sqe->len = static_cast<uint32_t>(length);
+    sqe->msg_flags = MSG_NOSIGNAL;
+    sqe->user_data = user_data;
+    commitSqe();
+}
+
+void IoUring::prepPoll(int fd, short events, bool multishot, uint64_t user_data) {
+    struct io_uring_sqe* sqe = nextSqe();
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->poll32_events = static_cast<unsigned short>(events);
+    sqe->len = multishot ? IORING_POLL_ADD_MULTI : 0;
+    sqe->user_data = user_data;
+    commitSqe();
+}
+
+void IoUring::prepCancelAll(uint64_t user_data) {
+    struct io_uring_sqe* sqe = nextSqe();
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->cancel_flags = IORING_ASYNC_CANCEL_ANY;
+    sqe->user_data = user_data;
+    commitSqe();
+}
+
+int IoUring::enter(unsigned submit, unsigned wait, int timeout_ms) {
+    struct __kernel_timespec timeout;
+    struct io_uring_getevents_arg arg;
+    std::memset(&arg, 0, sizeof(arg));
+    unsigned flags = IORING_ENTER_EXT_ARG;
+    if (wait) {
+        flags |= IORING_ENTER_GETEVENTS;
+        if (timeout_ms >= 0) {
+            timeout.tv_sec = timeout_ms / 1000;
+            timeout.tv_nsec = static_cast<long long>(timeout_ms % 1000) * 1000000;
+            arg.ts = reinterpret_cast<uint64_t>(&timeout);
+        }
+    }
+    int result = syscall(__NR_io_uring_enter, ring_fd, submit, wait, flags, &arg, sizeof(arg));
+    if (result > 0) {
+        to_submit -= static_cast<unsigned>(result) < to_submit ? result : to_submit;
+    }
+    return result;
+}
+
+int IoUring::submitAndWait(int timeout_ms) {
+    int result = enter(to_submit, timeout_ms == 0 ? 0 : 1, timeout_ms);
+    if (result < 0 && errno == ETIME) {
+        return 0; // Timed out without completions
+    }
+    return result;
+}
+
+bool IoUring::nextCompletion(Completion& completion) {
+    unsigned head = *cq_head;
+    if (head == loadAcquire(cq_tail)) {
+        return false;
+    }
+    const struct io_uring_cqe& cqe = cqes[head & *cq_mask];
+    completion.user_data = cqe.user_data;
+    completion.res = cqe.res;
+    completion.flags = cqe.flags;
+    storeRelease(cq_head, head + 1);
+    return true;
+}
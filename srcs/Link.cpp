@@ -0,0 +1,781 @@
+#include "Server.hpp"
+#include <algorithm> // For std::find, std::stable_sort
+#include <fstream> // For std::ifstream
+#include <netdb.h> // For getaddrinfo
+#include <openssl/crypto.h> // For CRYPTO_memcmp
+
+// Server-to-server links.
+//
+// Servers are linked in a spanning tree and every server knows all users,
+// channel memberships, modes and topics of the network. Remote users are
+// entries of `clients` under negative ids, tagged with the link they are
+// reached through. State changes go down every link; PRIVMSG and NOTICE only
+// go down the links that lead to a recipient. A line is never sent back over
+// the link it arrived on.
+//
+// Link protocol, one event per line:
+//   PASS <password>                      send password of the link block; the peer
+//                                        checks it against its accept password
+//   SERVER <name> <hops> :<info>         handshake; with the uplink as prefix it
+//                                        announces a server behind the link
+//   NICK <nick> <hops> <user> <host> <server> <+modes> :<realname>
+//   :<server> NJOIN <channel> :[@]<nick>,[@]<nick>...      joins, live and in bursts
+//   :<server> MODE <channel> <modes> [params]              burst channel modes
+//   :<server> TOPIC <channel> <set time> :<topic>          burst topic
+//   :<server> KILL <nick> :<reason>                        nickname collisions
+//   :<server> SQUIT <server> :<reason>                     a server and all behind it left
+// NICK changes, QUIT, PART, KICK, MODE, TOPIC, INVITE, PRIVMSG and NOTICE from
+// users travel in the form clients see them, with the nick!user@host prefix.
+// Once the handshake is done both sides send a burst of everything they know.
+
+static std::string toString(long value) {
+    std::ostringstream out;
+    out << value;
+    return out.str();
+}
+
+static std::string upper(std::string text) {
+    for (size_t i = 0; i < text.length(); i++) {
+        text[i] = std::toupper(text[i]);
+    }
+    return text;
+}
+
+static bool nearerFirst(const PeerServer* first, const PeerServer* second) {
+    return first->hops < second->hops;
+}
+
+// Compared in constant time, so response timing tells nothing about the password
+static bool samePassword(const std::string& given, const std::string& expected) {
+    return given.length() == expected.length()
+        && CRYPTO_memcmp(given.data(), expected.data(), expected.length()) == 0;
+}
+
+bool Server::isLink(int client_fd) const {
+    return links.find(client_fd) != links.end();
+}
+
+bool Server::findLinkBlock(const std::string& name, std::string& address, std::string& port_str,
+                           std::string& send_password, std::string& accept_password) const {
+    // Read on every use, like the operator file, so links can be added without a restart
+    std::ifstream file(LINK_FILE);
+    std::string line;
+    while (std::getline(file, line)) {
+        std::istringstream fields(line);
+        std::string block_name;
+        if (fields >> block_name >> address >> port_str >> send_password >> accept_password && block_name[0] != '#'
+            && ircLower(block_name) == ircLower(name)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Whether a server name is taken on the network, or by a link still handshaking
+static bool serverNameInUse(const std::string& name, const std::string& own_name,
+                            const std::map<std::string, PeerServer>& peer_servers,
+                            const std::map<int, ServerLink>& links) {
+    const std::string lowered = ircLower(name);
+    if (lowered == ircLower(own_name) || peer_servers.find(lowered) != peer_servers.end()) {
+        return true;
+    }
+    for (std::map<int, ServerLink>::const_iterator it = links.begin(); it != links.end(); ++it) {
+        if (ircLower(it->second.name) == lowered) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool Server::connectLink(const std::string& name, std::string& error) {
+    std::string address, port_str, send_password, accept_password;
+    if (!findLinkBlock(name, address, port_str, send_password, accept_password)) {
+        error = "No link block for " + name;
+        return false;
+    }
+    if (serverNameInUse(name, server_name, peer_servers, links)) {
+        error = "Server " + name + " is already linked";
+        return false;
+    }
+    if (clients.size() - remote_users >= max_clients) {
+        error = "No free connection slot";
+        return false;
+    }
+
+    // Addresses are numeric, so CONNECT never waits on a DNS lookup
+    struct addrinfo hints;
+    std::memset(&hints, 0, sizeof(hints));
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_NUMERICHOST | AI_NUMERICSERV;
+    struct addrinfo* result;
+    if (getaddrinfo(address.c_str(), port_str.c_str(), &hints, &result) != 0) {
+        error = "Invalid address " + address + " port " + port_str;
+        return false;
+    }
+    int link_fd = socket(result->ai_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (link_fd < 0 || (connect(link_fd, result->ai_addr, result->ai_addrlen) < 0 && errno != EINPROGRESS)) {
+        error = std::string("Connection failed: ") + std::strerror(errno);
+        if (link_fd >= 0) {
+            close(link_fd);
+        }
+        freeaddrinfo(result);
+        return false;
+    }
+    freeaddrinfo(result);
+    link_profile.applyToConnection(link_fd);
+
+    // The link is a connection like any other; the handshake is queued until it completes
+    Client link;
+    link.fd = link_fd;
+    link.address = address;
+    link.hostname = address;
+    clients.push_back(link);
+    indexClients(clients.size() - 1);
+    ServerLink& pending = links[link_fd];
+    pending.name = name;
+    pending.outgoing = true;
+    sendMessage(link_fd, "PASS " + send_password);
+    sendMessage(link_fd, "SERVER " + server_name + " 1 :" + SERVER_INFO);
+    std::cout << "Connecting to server " << name << " at " << address << " port " << port_str << std::endl;
+    return true;
+}
+
+bool Server::squitLink(const std::string& name, const std::string& reason) {
+    for (std::map<int, ServerLink>::const_iterator it = links.begin(); it != links.end(); ++it) {
+        if (ircLower(it->second.name) == ircLower(name)) {
+            disconnectClient(it->first, reason);
+            return true;
+        }
+    }
+    return false;
+}
+
+void Server::acceptLink(int client_index, const IRCMessage& msg) {
+    const Client& client = clients[client_index];
+    const int client_fd = client.fd;
+    if (msg.params.empty()) {
+        sendMessage(client_fd, "461 * SERVER :Not enough parameters");
+        return;
+    }
+    const std::string name = msg.params[0];
+
+    // The peer proves itself with the accept password of its link block, from the address in it
+    std::map<int, std::string>::iterator offered = offered_link_passwords.find(client_fd);
+    const std::string given = offered == offered_link_passwords.end() ? "" : offered->second;
+    if (offered != offered_link_passwords.end()) {
+        offered_link_passwords.erase(offered);
+    }
+    std::string address, port_str, send_password, accept_password;
+    unsigned char expected[16], actual[16];
+    if (client.websocket != WS_NONE || !findLinkBlock(name, address, port_str, send_password, accept_password)
+        || !samePassword(given, accept_password)
+        || !DenyList::parseAddress(address, expected) || !DenyList::parseAddress(client.address, actual)
+        || std::memcmp(expected, actual, sizeof(expected)) != 0) {
+        std::cout << "Rejected server link from " << client.address << " as " << name << std::endl;
+        disconnectClient(client_fd, "No link access for " + name);
+        return;
+    }
+    if (serverNameInUse(name, server_name, peer_servers, links)) {
+        disconnectClient(client_fd, "Server " + name + " already exists");
+        return;
+    }
+
+    links[client_fd].name = name;
+    clients[client_index].authenticated = true;
+    // Servers are known by their address, nothing waits for a lookup any more
+    resolver.cancel(client_fd);
+    clients[client_index].resolving_host = false;
+    // The link protocol is not replayed, its recording ends here
+    capture.closed(client_fd);
+    sendMessage(client_fd, "PASS " + send_password);
+    sendMessage(client_fd, "SERVER " + server_name + " 1 :" + SERVER_INFO);
+    completeLink(client_fd, name, msg.trailing);
+}
+
+void Server::completeLink(int link_fd, const std::string& name, const std::string& description) {
+    ServerLink& link = links[link_fd];
+    link.name = name;
+    link.established = true;
+
+    // The rest of the network hears about the new server before anything behind it
+    propagate(":" + server_name + " SERVER " + name + " 2 :" + description, link_fd);
+    PeerServer& peer = peer_servers[ircLower(name)];
+    peer.name = name;
+    peer.uplink = server_name;
+    peer.description = description;
+    peer.hops = 1;
+    peer.link_fd = link_fd;
+    std::cout << "Linked with server " << name << std::endl;
+
+    sendBurst(link_fd);
+}
+
+std::string Server::userIntroduction(const Client& user) const {
+    int hops = 1;
+    if (user.isRemote()) {
+        std::map<std::string, PeerServer>::const_iterator home = peer_servers.find(ircLower(user.server));
+        hops = home == peer_servers.end() ? 1 : home->second.hops + 1;
+    }
+    return "NICK " + user.nickname + " " + toString(hops) + " " + user.username + " " + user.hostname + " "
+        + (user.isRemote() ? user.server.str() : server_name) + " " + (user.server_operator ? "+o" : "+") + " :" + user.realname;
+}
+
+void Server::sendBurst(int link_fd) {
+    // Servers nearest first, so every uplink is known before what sits behind it
+    std::vector<const PeerServer*> servers;
+    for (std::map<std::string, PeerServer>::const_iterator it = peer_servers.begin(); it != peer_servers.end(); ++it) {
+        if (it->second.link_fd != link_fd) {
+            servers.push_back(&it->second);
+        }
+    }
+    std::stable_sort(servers.begin(), servers.end(), nearerFirst);
+    for (size_t i = 0; i < servers.size(); i++) {
+        sendMessage(link_fd, ":" + servers[i]->uplink + " SERVER " + servers[i]->name + " "
+                    + toString(servers[i]->hops + 1) + " :" + servers[i]->description);
+    }
+
+    for (size_t i = 0; i < clients.size(); i++) {
+        if (clients[i].registered && clients[i].link_fd != link_fd) {
+            sendMessage(link_fd, userIntroduction(clients[i]));
+        }
+    }
+
+    const std::string source = ":" + server_name;
+    for (ChannelMap::const_iterator it = channels.begin(); it != channels.end(); ++it) {
+        const Channel& channel = it->second;
+
+        // Members, several per line
+        const std::string head = source + " NJOIN " + it->first + " :";
+        std::string members;
+        const Channel::FdSet& channel_clients = channel.getClients();
+        for (Channel::FdSet::const_iterator member = channel_clients.begin(); member != channel_clients.end(); ++member) {
+            int member_index = findClientByFd(*member);
+            if (member_index == -1 || clients[member_index].link_fd == link_fd) {
+                continue;
+            }
+            const std::string entry = std::string(channel.isOperator(*member) ? "@" : "") + clients[member_index].nickname;
+            if (!members.empty() && head.length() + members.length() + entry.length() + 1 > BURST_LINE_LIMIT) {
+                sendMessage(link_fd, head + members);
+                members.clear();
+            }
+            if (!members.empty()) members += ",";
+            members += entry;
+        }
+        if (!members.empty()) {
+            sendMessage(link_fd, head + members);
+        }
+
+        const std::string modes = channel.getModeString();
+        if (!modes.empty()) {
+            sendMessage(link_fd, source + " MODE " + it->first + " " + modes);
+        }
+        const char list_modes[] = { 'b', 'e', 'I' };
+        const MaskList* lists[] = { &channel.getBans(), &channel.getExceptions(), &channel.getInviteExceptions() };
+        for (size_t l = 0; l < 3; l++) {
+            const std::vector<MaskList::Entry>& entries = lists[l]->getEntries();
+            for (size_t e = 0; e < entries.size(); e++) {
+                sendMessage(link_fd, source + " MODE " + it->first + " +" + list_modes[l] + " " + entries[e].mask);
+            }
+        }
+        if (!channel.getTopic().empty()) {
+            sendMessage(link_fd, source + " TOPIC " + it->first + " " + toString(channel.getTopicTime()) + " :" + channel.getTopic());
+        }
+    }
+}
+
+void Server::propagate(const std::string& line, int except_link) {
+    for (std::map<int, ServerLink>::const_iterator it = links.begin(); it != links.end(); ++it) {
+        if (it->second.established && it->first != except_link) {
+            sendMessage(it->first, line);
+        }
+    }
+}
+
+void Server::routeToChannel(const Channel& channel, const std::string& line, int except_link) {
+    // Remote ids are negative and sort first, so local members are never visited
+    std::vector<int> sent;
+    const Channel::FdSet& members = channel.getClients();
+    for (Channel::FdSet::const_iterator it = members.begin(); it != members.end() && *it < 0; ++it) {
+        int member_index = findClientByFd(*it);
+        if (member_index == -1) {
+            continue;
+        }
+        int link_fd = clients[member_index].link_fd;
+        if (link_fd != except_link && std::find(sent.begin(), sent.end(), link_fd) == sent.end()) {
+            sent.push_back(link_fd);
+            sendMessage(link_fd, line);
+        }
+    }
+}
+
+void Server::routeToUser(int client_index, const std::string& line) {
+    sendMessage(clients[client_index].link_fd, line);
+}
+
+void Server::offerLinkPassword(int client_fd, const std::string& password) {
+    // Kept until the connection registers as a user or as a server
+    offered_link_passwords[client_fd] = password;
+}
+
+void Server::introduceUser(int client_index) {
+    offered_link_passwords.erase(clients[client_index].fd);
+    propagate(userIntroduction(clients[client_index]));
+}
+
+void Server::propagateJoin(int client_index, const Channel& channel) {
+    const Client& client = clients[client_index];
+    propagate(":" + server_name + " NJOIN " + channel.getName() + " :"
+              + (channel.isOperator(client.fd) ? "@" : "") + client.nickname);
+}
+
+void Server::handleLinkMessage(int link_fd, const std::string& line, const IRCMessage& msg) {
+    const std::string cmd = upper(msg.command);
+    ServerLink& link = links[link_fd];
+
+    if (cmd == "ERROR") {
+        std::cout << "Server " << link.name << " closed the link: " << msg.trailing << std::endl;
+        disconnectClient(link_fd, "Link closed by peer");
+        return;
+    }
+
+    if (!link.established) {
+        // An outgoing link waits for the peer's PASS and SERVER
+        int link_index = findClientByFd(link_fd);
+        std::string address, port_str, send_password, accept_password;
+        if (cmd == "PASS" && !msg.params.empty() && findLinkBlock(link.name, address, port_str, send_password, accept_password)
+            && samePassword(msg.params[0], accept_password)) {
+            clients[link_index].authenticated = true;
+        } else if (cmd == "SERVER") {
+            if (!clients[link_index].authenticated || msg.params.empty() || ircLower(msg.params[0]) != ircLower(link.name)) {
+                disconnectClient(link_fd, "Link handshake failed");
+            } else if (peer_servers.find(ircLower(link.name)) != peer_servers.end()) {
+                disconnectClient(link_fd, "Server " + link.name + " already exists");
+            } else {
+                completeLink(link_fd, msg.params[0], msg.trailing);
+            }
+        }
+        return;
+    }
+
+    // Who the line comes from: a user or a server behind this link, the peer itself if unprefixed
+    std::string source = link.name;
+    int source_index = -1;
+    if (!msg.prefix.empty()) {
+        size_t bang = msg.prefix.find('!');
+        std::map<std::string, PeerServer>::const_iterator peer = peer_servers.find(ircLower(msg.prefix));
+        if (bang == std::string::npos && peer != peer_servers.end()) {
+            source = peer->second.name;
+        } else {
+            source_index = findClientByNickname(msg.prefix.substr(0, bang));
+            // Users killed or gone meanwhile, or arriving from the wrong direction
+            if (source_index == -1 || clients[source_index].link_fd != link_fd) {
+                return;
+            }
+            source = clients[source_index].getPrefix();
+        }
+    }
+    const std::string target = msg.params.empty() ? "" : msg.params[0];
+
+    if (cmd == "PING") {
+        sendMessage(link_fd, "PONG " + server_name + " :" + (target.empty() ? msg.trailing : target));
+    } else if (cmd == "SERVER") {
+        // :<uplink> SERVER <name> <hops> :<info>
+        if (target.empty()) {
+            return;
+        }
+        if (serverNameInUse(target, server_name, peer_servers, links)) {
+            // A second path to a known server would close a loop
+            disconnectClient(link_fd, "Server " + target + " already exists");
+            return;
+        }
+        PeerServer& peer = peer_servers[ircLower(target)];
+        peer.name = target;
+        peer.uplink = source;
+        peer.description = msg.trailing;
+        peer.hops = msg.params.size() > 1 ? std::atoi(msg.params[1].c_str()) : 2;
+        peer.link_fd = link_fd;
+        propagate(":" + source + " SERVER " + target + " " + toString(peer.hops + 1) + " :" + msg.trailing, link_fd);
+    } else if (cmd == "NICK") {
+        linkNick(link_fd, line, msg, source_index);
+    } else if (cmd == "QUIT") {
+        if (source_index != -1) {
+            propagate(line, link_fd);
+            removeClient(source_index, msg.trailing);
+        }
+    } else if (cmd == "NJOIN") {
+        linkJoin(link_fd, line, msg, source);
+    } else if (cmd == "PART") {
+        ChannelMap::iterator channel_it = channels.find(target);
+        if (source_index == -1 || channel_it == channels.end() || !channel_it->second.hasClient(clients[source_index].fd)) {
+            return;
+        }
+        broadcastToChannel(target, ":" + source + " PART " + target + " :" + msg.trailing);
+        removeFromChannel(source_index, channel_it->second);
+        history.record(target, History::EVENT_PART, source, msg.trailing);
+        propagate(line, link_fd);
+        cleanupEmptyChannels();
+    } else if (cmd == "KICK") {
+        ChannelMap::iterator channel_it = channels.find(target);
+        int target_index = msg.params.size() > 1 ? findClientByNickname(msg.params[1]) : -1;
+        if (channel_it == channels.end() || target_index == -1 || !channel_it->second.hasClient(clients[target_index].fd)) {
+            return;
+        }
+        // Delivered before the removal so a local target sees its own KICK
+        broadcastToChannel(target, ":" + source + " KICK " + target + " " + clients[target_index].nickname + " :" + msg.trailing);
+        removeFromChannel(target_index, channel_it->second);
+        propagate(line, link_fd);
+        cleanupEmptyChannels();
+    } else if (cmd == "MODE") {
+        linkMode(link_fd, line, msg, source, source_index == -1);
+    } else if (cmd == "TOPIC") {
+        linkTopic(link_fd, line, msg, source);
+    } else if (cmd == "INVITE") {
+        int target_index = findClientByNickname(target);
+        if (source_index == -1 || target_index == -1 || msg.params.size() < 2) {
+            return;
+        }
+        if (clients[target_index].isRemote()) {
+            if (clients[target_index].link_fd != link_fd) {
+                routeToUser(target_index, line);
+            }
+            return;
+        }
+        ChannelMap::iterator channel_it = channels.find(msg.params[1]);
+        if (channel_it != channels.end()) {
+            channel_it->second.inviteClient(clients[target_index].fd);
+        }
+        sendMessage(clients[target_index].fd, ":" + source + " INVITE " + clients[target_index].nickname + " " + msg.params[1]);
+    } else if (cmd == "PRIVMSG" || cmd == "NOTICE") {
+        if (source_index == -1 || target.empty()) {
+            return;
+        }
+        const std::string local_line = ":" + source + " " + cmd + " " + target + " :" + msg.trailing;
+        if (isValidChannelName(target)) {
+            ChannelMap::const_iterator channel_it = channels.find(target);
+            if (channel_it == channels.end()) {
+                return;
+            }
+            broadcastToChannel(target, local_line);
+            history.record(target, cmd == "NOTICE" ? History::EVENT_NOTICE : History::EVENT_PRIVMSG, source, msg.trailing);
+            routeToChannel(channel_it->second, line, link_fd);
+            return;
+        }
+        int target_index = findClientByNickname(target);
+        if (target_index == -1) {
+            return;
+        }
+        if (!clients[target_index].isRemote()) {
+            sendMessage(clients[target_index].fd, makeMessage(local_line));
+        } else if (clients[target_index].link_fd != link_fd) {
+            routeToUser(target_index, line);
+        }
+    } else if (cmd == "KILL") {
+        int target_index = findClientByNickname(target);
+        if (target_index != -1) {
+            propagate(line, link_fd);
+            killUser(target_index, source + " (" + msg.trailing + ")");
+        }
+    } else if (cmd == "SQUIT") {
+        std::map<std::string, PeerServer>::const_iterator peer = peer_servers.find(ircLower(target));
+        if (peer == peer_servers.end() || peer->second.link_fd != link_fd) {
+            return;
+        }
+        if (peer->second.hops == 1) {
+            // The peer itself is leaving; the link goes down with it
+            disconnectClient(link_fd, msg.trailing);
+            return;
+        }
+        const std::string quit_reason = peer->second.uplink + " " + peer->second.name;
+        std::cout << "Server " << peer->second.name << " split: " << msg.trailing << std::endl;
+        propagate(line, link_fd);
+        removeServerTree(target, quit_reason);
+    }
+    // Numerics and anything unknown are ignored
+}
+
+void Server::linkNick(int link_fd, const std::string& line, const IRCMessage& msg, int source_index) {
+    if (source_index == -1) {
+        // NICK <nick> <hops> <user> <host> <server> <+modes> :<realname>
+        if (msg.params.size() < 6) {
+            return;
+        }
+        const std::string& nick = msg.params[0];
+        std::map<std::string, PeerServer>::const_iterator home = peer_servers.find(ircLower(msg.params[4]));
+        if (home == peer_servers.end() || home->second.link_fd != link_fd) {
+            return;
+        }
+        int existing = findClientByNickname(nick);
+        if (existing != -1) {
+            // Both users lose; the KILL also goes back towards the newcomer's server
+            std::cout << "Nick collision on " << nick << std::endl;
+            propagate(":" + server_name + " KILL " + nick + " :Nick collision");
+            killUser(existing, server_name + " (Nick collision)");
+            return;
+        }
+
+        Client user;
+        user.fd = next_remote_id--;
+        user.nickname = nick;
+        user.username = msg.params[2];
+        user.hostname = msg.params[3];
+        user.realname = msg.trailing;
+        user.server = home->second.name;
+        user.link_fd = link_fd;
+        user.authenticated = true;
+        user.registered = true;
+        user.server_operator = msg.params[5].find('o') != std::string::npos;
+        clients.push_back(user);
+        remote_users++;
+        indexClients(clients.size() - 1);
+        nick_index[ircLower(nick)] = user.fd;
+        notifyMonitors(user, true);
+        propagate(userIntroduction(user), link_fd);
+        return;
+    }
+
+    // :<nick> NICK <new nick>
+    const std::string new_nick = msg.params.empty() ? msg.trailing : msg.params[0];
+    if (new_nick.empty()) {
+        return;
+    }
+    int holder = findClientByNickname(new_nick);
+    if (holder != -1 && holder != source_index) {
+        // Both users lose. The side the change came from knows the changer by
+        // its new nickname, the rest of the network still by the old one.
+        const int holder_id = clients[holder].fd;
+        std::cout << "Nick collision on " << new_nick << std::endl;
+        propagate(":" + server_name + " KILL " + new_nick + " :Nick collision");
+        propagate(":" + server_name + " KILL " + clients[source_index].nickname + " :Nick collision", link_fd);
+        removeClient(source_index, "Killed (" + server_name + " (Nick collision))");
+        killUser(findClientByFd(holder_id), server_name + " (Nick collision)");
+        return;
+    }
+    const std::string old_prefix = clients[source_index].getPrefix();
+    setNickname(source_index, new_nick);
+    propagate(line, link_fd);
+    broadcastToCommonChannels(source_index, ":" + old_prefix + " NICK " + new_nick, false);
+}
+
+void Server::linkJoin(int link_fd, const std::string& line, const IRCMessage& msg, const std::string& source) {
+    if (msg.params.empty() || !isValidChannelName(msg.params[0])) {
+        return;
+    }
+    const std::string& channel_name = msg.params[0];
+    Channel& channel = createChannel(channel_name);
+
+    std::istringstream members(msg.trailing);
+    std::string entry;
+    while (std::getline(members, entry, ',')) {
+        bool is_operator = !entry.empty() && entry[0] == '@';
+        const std::string nick = is_operator ? entry.substr(1) : entry;
+        int member_index = findClientByNickname(nick);
+        if (member_index == -1 || clients[member_index].link_fd != link_fd) {
+            continue;
+        }
+        const int member_id = clients[member_index].fd;
+        size_t old_count = channel.getUserCount();
+        if (channel.insertClient(member_id)) {
+            clients[member_index].joinChannel(&channel);
+            updateChannelSize(channel, old_count);
+            const std::string prefix = clients[member_index].getPrefix();
+            broadcastToChannel(channel_name, ":" + prefix + " JOIN " + channel_name);
+            history.record(channel_name, History::EVENT_JOIN, prefix, "");
+        }
+        if (is_operator && !channel.isOperator(member_id)) {
+            channel.addOperator(member_id);
+            broadcastToChannel(channel_name, ":" + source + " MODE " + channel_name + " +o " + nick);
+        }
+    }
+    propagate(line, link_fd);
+    cleanupEmptyChannels();
+}
+
+void Server::linkMode(int link_fd, const std::string& line, const IRCMessage& msg, const std::string& source, bool from_server) {
+    if (msg.params.size() < 2) {
+        return;
+    }
+    const std::string& target = msg.params[0];
+    const std::string& mode_string = msg.params[1];
+
+    if (!isValidChannelName(target)) {
+        // Of the user modes only operator status is known network-wide
+        int user_index = findClientByNickname(target);
+        if (user_index == -1 || clients[user_index].link_fd != link_fd) {
+            return;
+        }
+        bool adding = true;
+        for (size_t i = 0; i < mode_string.length(); i++) {
+            if (mode_string[i] == '+' || mode_string[i] == '-') {
+                adding = mode_string[i] == '+';
+            } else if (mode_string[i] == 'o') {
+                clients[user_index].server_operator = adding;
+            }
+        }
+        propagate(line, link_fd);
+        return;
+    }
+
+    // Applied without permission checks, the originating server made them.
+    // Parameters are consumed exactly as handleMode does.
+    Channel& channel = createChannel(target);
+    bool adding = true;
+    size_t param_index = 2;
+    for (size_t i = 0; i < mode_string.length(); i++) {
+        char mode = mode_string[i];
+        const std::string param = param_index < msg.params.size() ? msg.params[param_index] : "";
+        switch (mode) {
+            case '+':
+            case '-':
+                adding = mode == '+';
+                break;
+            case 'i':
+                channel.setInviteOnly(adding);
+                break;
+            case 't':
+                channel.setTopicRestricted(adding);
+                break;
+            case 'P':
+                channel.setPermanent(adding);
+                break;
+            case 'k':
+                if (!adding) {
+                    channel.removeKey();
+                } else if (!param.empty()) {
+                    // Bursts meet halfway on conflicting keys: both sides keep the smaller one
+                    if (!from_server || !channel.hasKey() || param < channel.getKey()) {
+                        channel.setKey(param);
+                    }
+                    param_index++;
+                }
+                break;
+            case 'l':
+                if (!adding) {
+                    channel.removeUserLimit();
+                } else if (!param.empty()) {
+                    long limit = strtol(param.c_str(), NULL, 10);
+                    if (limit > 0 && (!from_server || !channel.hasUserLimit() || static_cast<size_t>(limit) < channel.getUserLimit())) {
+                        channel.setUserLimit(static_cast<size_t>(limit));
+                    }
+                    param_index++;
+                }
+                break;
+            case 'b':
+            case 'e':
+            case 'I':
+                if (!param.empty()) {
+                    MaskList& list = mode == 'e' ? channel.getExceptions() : mode == 'I' ? channel.getInviteExceptions() : channel.getBans();
+                    if (adding) {
+                        list.add(param, source, time(NULL));
+                    } else {
+                        list.remove(param);
+                    }
+                    param_index++;
+                }
+                break;
+            case 'o':
+                if (!param.empty()) {
+                    int member_index = findClientByNickname(param);
+                    if (member_index != -1 && adding) {
+                        channel.addOperator(clients[member_index].fd);
+                    } else if (member_index != -1) {
+                        channel.removeOperator(clients[member_index].fd);
+                    }
+                    param_index++;
+                }
+                break;
+        }
+    }
+
+    std::string local_line = ":" + source + " MODE " + target + " " + mode_string;
+    for (size_t i = 2; i < param_index; i++) {
+        local_line += " " + msg.params[i];
+    }
+    broadcastToChannel(target, local_line);
+    propagate(line, link_fd);
+    cleanupEmptyChannels();
+}
+
+void Server::linkTopic(int link_fd, const std::string& line, const IRCMessage& msg, const std::string& source) {
+    if (msg.params.empty() || !isValidChannelName(msg.params[0])) {
+        return;
+    }
+    const std::string& channel_name = msg.params[0];
+    Channel& channel = createChannel(channel_name);
+
+    time_t set_time = 0;
+    if (msg.params.size() > 1) {
+        // Burst: the newer topic wins on both sides, ties go to the greater text
+        set_time = static_cast<time_t>(strtol(msg.params[1].c_str(), NULL, 10));
+        if (!channel.getTopic().empty() && (set_time < channel.getTopicTime()
+            || (set_time == channel.getTopicTime() && msg.trailing <= channel.getTopic()))) {
+            cleanupEmptyChannels();
+            return;
+        }
+    }
+    channel.setTopic(msg.trailing, set_time);
+    broadcastToChannel(channel_name, ":" + source + " TOPIC " + channel_name + " :" + msg.trailing);
+    history.record(channel_name, History::EVENT_TOPIC, source, msg.trailing);
+    propagate(line, link_fd);
+    cleanupEmptyChannels();
+}
+
+void Server::killUser(int client_index, const std::string& reason) {
+    if (clients[client_index].isRemote()) {
+        removeClient(client_index, "Killed (" + reason + ")");
+    } else {
+        disconnectClient(clients[client_index].fd, "Killed (" + reason + ")");
+    }
+}
+
+void Server::dropLink(int link_fd, const std::string& reason) {
+    std::map<int, ServerLink>::iterator it = links.find(link_fd);
+    const ServerLink link = it->second;
+    links.erase(it);
+    if (!link.established) {
+        std::cout << "Link with server " << link.name << " failed: " << reason << std::endl;
+        return;
+    }
+    std::cout << "Lost link with server " << link.name << ": " << reason << std::endl;
+    removeServerTree(link.name, server_name + " " + link.name);
+    propagate(":" + server_name + " SQUIT " + link.name + " :" + reason);
+}
+
+void Server::removeServerTree(const std::string& name, const std::string& reason) {
+    // The server and, transitively, every server it introduced
+    std::set<std::string> gone;
+    gone.insert(ircLower(name));
+    bool grew = true;
+    while (grew) {
+        grew = false;
+        for (std::map<std::string, PeerServer>::const_iterator it = peer_servers.begin(); it != peer_servers.end(); ++it) {
+            if (!gone.count(it->first) && gone.count(ircLower(it->second.uplink))) {
+                gone.insert(it->first);
+                grew = true;
+            }
+        }
+    }
+
+    for (size_t i = clients.size(); i-- > 0; ) {
+        if (clients[i].isRemote() && gone.count(ircLower(clients[i].server))) {
+            removeClient(i, reason);
+        }
+    }
+    for (std::set<std::string>::const_iterator it = gone.begin(); it != gone.end(); ++it) {
+        peer_servers.erase(*it);
+    }
+}
+
+void Server::dropLinks() {
+    // Remote state cannot be handed over; links are made again after the upgrade
+    std::vector<int> link_fds;
+    for (std::map<int, ServerLink>::const_iterator it = links.begin(); it != links.end(); ++it) {
+        link_fds.push_back(it->first);
+    }
+    for (size_t i = 0; i < link_fds.size(); i++) {
+        int link_index = findClientByFd(link_fds[i]);
+        if (link_index != -1) {
+            sendMessage(link_fds[i], "ERROR :Closing Link: Server upgrading");
+            removeClient(link_index, "Server upgrading");
+        }
+    }
+}
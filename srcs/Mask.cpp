@@ -0,0 +1,46 @@
+#include "Mask.hpp"
+
+char ircLower(char c) {
+    if (c >= 'A' && c <= '^') {
+        return c + ('a' - 'A'); // Covers A-Z and [\]^
+    }
+    return c;
+}
+
+std::string ircLower(const std::string& text) {
+    std::string lowered = text;
+    for (size_t i = 0; i < lowered.length(); i++) {
+        lowered[i] = ircLower(lowered[i]);
+    }
+    return lowered;
+}
+
+bool matchMask(const std::string& mask, const std::string& text) {
+    size_t m = 0, t = 0;
+    size_t star = std::string::npos; // Position of the last '*' seen in the mask
+    size_t resume = 0;               // Text position that '*' currently extends to
+
+    // Greedy matching with single-star backtracking: linear for typical masks
+    while (t < text.length()) {
+        if (m < mask.length() && (mask[m] == '?' || ircLower(mask[m]) == ircLower(text[t]))) {
+            m++;
+            t++;
+        } else if (m < mask.length() && mask[m] == '*') {
+            star = m++;
+            resume = t;
+        } else if (star != std::string::npos) {
+            m = star + 1;
+            t = ++resume;
+        } else {
+            return false;
+        }
+    }
+    while (m < mask.length() && mask[m] == '*') {
+        m++;
+    }
+    return m == mask.length();
+}
+
+bool isLiteralMask(const std::string& mask) {
+    return mask.find_first_of("*?") == std::string::npos;
+}
@@ -0,0 +1,127 @@
+#include "MaskList.hpp"
+#include "Mask.hpp"
+#include <algorithm> // For std::lower_bound
+
+MaskList::MaskList() : shortest_suffix(0) {
+}
+
+MaskList::~MaskList() {
+}
+
+std::string MaskList::normalize(const std::string& mask) {
+    size_t bang = mask.find('!');
+    size_t at = mask.find('@');
+
+    // Fill in missing parts the usual way: "nick" -> "nick!*@*", "user@host" -> "*!user@host"
+    if (bang == std::string::npos && at == std::string::npos) {
+        return mask + "!*@*";
+    }
+    if (bang == std::string::npos) {
+        return "*!" + mask;
+    }
+    if (at == std::string::npos) {
+        return mask + "@*";
+    }
+    return mask;
+}
+
+void MaskList::rebuildIndex() {
+    exact_hosts.clear();
+    host_suffixes.clear();
+    generic.clear();
+    shortest_suffix = static_cast<size_t>(-1);
+
+    std::map<std::string, std::vector<size_t> > suffixes;
+    for (size_t i = 0; i < entries.size(); i++) {
+        std::string host = ircLower(entries[i].mask.substr(entries[i].mask.rfind('@') + 1));
+        if (isLiteralMask(host)) {
+            exact_hosts[host].push_back(i);
+        } else if (host.length() > 1 && host[0] == '*' && isLiteralMask(host.substr(1))) {
+            suffixes[host.substr(1)].push_back(i);
+            if (host.length() - 1 < shortest_suffix) {
+                shortest_suffix = host.length() - 1;
+            }
+        } else {
+            generic.push_back(i);
+        }
+    }
+
+    // The map leaves them sorted for the binary search in matches()
+    host_suffixes.resize(suffixes.size());
+    size_t slot = 0;
+    for (std::map<std::string, std::vector<size_t> >::iterator it = suffixes.begin(); it != suffixes.end(); ++it, ++slot) {
+        host_suffixes[slot].suffix = it->first;
+        host_suffixes[slot].indexes.swap(it->second);
+    }
+}
+
+bool MaskList::suffixLess(const SuffixBucket& bucket, const char* suffix) {
+    return bucket.suffix.compare(suffix) < 0;
+}
+
+bool MaskList::add(const std::string& mask, const std::string& setter, time_t set_time) {
+    std::string normalized = normalize(mask);
+    for (size_t i = 0; i < entries.size(); i++) {
+        if (ircLower(entries[i].mask) == ircLower(normalized)) {
+            return false;
+        }
+    }
+    Entry entry;
+    entry.mask = normalized;
+    entry.setter = setter;
+    entry.set_time = set_time;
+    entries.push_back(entry);
+    rebuildIndex();
+    return true;
+}
+
+bool MaskList::remove(const std::string& mask) {
+    std::string normalized = ircLower(normalize(mask));
+    for (size_t i = 0; i < entries.size(); i++) {
+        if (ircLower(entries[i].mask) == normalized) {
+            entries.erase(entries.begin() + i);
+            rebuildIndex();
+            return true;
+        }
+    }
+    return false;
+}
+
+bool MaskList::matchesEntry(size_t index, const std::string& client_mask) const {
+    return matchMask(entries[index].mask, client_mask);
+}
+
+bool MaskList::matches(const std::string& client_mask, const std::string& host) const {
+    if (entries.empty()) {
+        return false;
+    }
+    const std::string lowered_host = ircLower(host);
+
+    std::map<std::string, std::vector<size_t> >::const_iterator bucket = exact_hosts.find(lowered_host);
+    if (bucket != exact_hosts.end()) {
+        for (size_t i = 0; i < bucket->second.size(); i++) {
+            if (matchesEntry(bucket->second[i], client_mask)) return true;
+        }
+    }
+
+    // "*suffix" masks: look up every suffix of the host long enough to hold
+    // one, as a pointer into the host rather than a copy of its tail
+    if (!host_suffixes.empty()) {
+        for (size_t start = 0; start + shortest_suffix <= lowered_host.length(); start++) {
+            const char* suffix = lowered_host.c_str() + start;
+            std::vector<SuffixBucket>::const_iterator found =
+                std::lower_bound(host_suffixes.begin(), host_suffixes.end(), suffix, suffixLess);
+            if (found == host_suffixes.end() || found->suffix.compare(suffix) != 0) {
+                continue;
+            }
+            for (size_t i = 0; i < found->indexes.size(); i++) {
+                if (matchesEntry(found->indexes[i], client_mask)) return true;
+            }
+        }
+    }
+
+    for (size_t i = 0; i < generic.size(); i++) {
+        if (matchesEntry(generic[i], client_mask)) return true;
+    }
+    return false;
+}
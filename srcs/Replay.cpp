@@ -0,0 +1,277 @@
+// ircreplay: plays a capture recorded with IRCSERV_CAPTURE back against a
+// server, one client connection per recorded connection, keeping the
+// recorded timing (scaled by the speed factor) or as fast as possible.
+// Server output is read and counted but not interpreted.
+
+#include "Capture.hpp"
+#include <cstdlib> // For std::strtod, std::exit
+#include <cstring> // For std::strerror, std::memset
+#include <iostream> // For std::cout, std::cerr
+#include <map> // For std::map
+#include <errno.h> // For errno
+#include <netdb.h> // For getaddrinfo
+#include <poll.h> // For poll
+#include <signal.h> // For signal, SIGPIPE
+#include <unistd.h> // For read, write, close
+#include <sys/socket.h> // For socket, connect
+
+static const int DRAIN_MS = 1000; // Replay ends when the server stayed silent this long after the last line
+
+struct Connection {
+    int fd;
+    bool connecting;   // Non-blocking connect not finished yet
+    bool closing;      // Recorded close reached, shut down once the output is written
+    bool shut;         // Write side shut down, reading replies until the server closes
+    std::string output;
+
+    Connection() : fd(-1), connecting(false), closing(false), shut(false) {}
+};
+
+struct Stats {
+    unsigned long connections;
+    unsigned long failed;
+    unsigned long lines;
+    unsigned long long bytes_sent;
+    unsigned long long bytes_received;
+    uint64_t max_lag_us;  // Worst delay of a line behind its schedule
+    uint64_t last_activity_us; // Last time bytes went either way
+
+    Stats() : connections(0), failed(0), lines(0), bytes_sent(0), bytes_received(0), max_lag_us(0), last_activity_us(0) {}
+};
+
+static void usage(const char* name) {
+    std::cerr << "Usage: " << name << " <capture> <host> <port> [-s speed|max] [-p password]" << std::endl;
+    std::exit(1);
+}
+
+static struct addrinfo* resolve(const char* host, const char* port) {
+    struct addrinfo hints;
+    std::memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    struct addrinfo* result = NULL;
+    int error = getaddrinfo(host, port, &hints, &result);
+    if (error != 0) {
+        std::cerr << "Error: " << host << ": " << gai_strerror(error) << std::endl;
+        std::exit(1);
+    }
+    return result;
+}
+
+static bool openConnection(Connection& connection, const struct addrinfo* target) {
+    connection.fd = socket(target->ai_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (connection.fd < 0) {
+        return false;
+    }
+    if (connect(connection.fd, target->ai_addr, target->ai_addrlen) < 0) {
+        if (errno != EINPROGRESS) {
+            close(connection.fd);
+            connection.fd = -1;
+            return false;
+        }
+        connection.connecting = true;
+    }
+    return true;
+}
+
+static void closeConnection(Connection& connection) {
+    if (connection.fd >= 0) {
+        close(connection.fd);
+        connection.fd = -1;
+    }
+    connection.output.clear();
+}
+
+// Writes what the socket takes; false when the connection is gone
+static bool writeOutput(Connection& connection, Stats& stats) {
+    while (!connection.output.empty()) {
+        ssize_t written = write(connection.fd, connection.output.data(), connection.output.length());
+        if (written < 0) {
+            return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+        }
+        stats.bytes_sent += written;
+        stats.last_activity_us = Capture::nowUs();
+        connection.output.erase(0, written);
+    }
+    return true;
+}
+
+// Reads and discards replies; false on EOF or error
+static bool readInput(Connection& connection, Stats& stats) {
+    char buffer[65536];
+    while (true) {
+        ssize_t received = read(connection.fd, buffer, sizeof(buffer));
+        if (received > 0) {
+            stats.bytes_received += received;
+            stats.last_activity_us = Capture::nowUs();
+            continue;
+        }
+        if (received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+            return true;
+        }
+        return false;
+    }
+}
+
+int main(int ac, char** av) {
+    if (ac < 4) {
+        usage(av[0]);
+    }
+    double speed = 1.0; // 0 for as fast as possible
+    std::string password;
+    bool have_password = false;
+    for (int i = 4; i < ac; i++) {
+        std::string option = av[i];
+        if (option == "-s" && i + 1 < ac) {
+            std::string value = av[++i];
+            char* end;
+            speed = value == "max" ? 0 : std::strtod(value.c_str(), &end);
+            if (value != "max" && (*end != '\0' || speed <= 0)) {
+                usage(av[0]);
+            }
+        } else if (option == "-p" && i + 1 < ac) {
+            password = av[++i];
+            have_password = true;
+        } else {
+            usage(av[0]);
+        }
+    }
+
+    std::vector<Capture::Record> records;
+    std::string error;
+    if (!Capture::load(av[1], records, error)) {
+        std::cerr << "Error: " << error << std::endl;
+        return 1;
+    }
+    struct addrinfo* target = resolve(av[2], av[3]);
+    signal(SIGPIPE, SIG_IGN);
+
+    std::map<unsigned long, Connection> connections; // Recorded connection id -> live connection
+    Stats stats;
+    size_t next = 0;
+    const uint64_t start = Capture::nowUs();
+    stats.last_activity_us = start;
+
+    while (true) {
+        // Hand every record that is due to its connection
+        uint64_t now = Capture::nowUs();
+        while (next < records.size()) {
+            const Capture::Record& record = records[next];
+            uint64_t due = speed > 0 ? start + static_cast<uint64_t>(record.time_us / speed) : now;
+            if (due > now) {
+                break;
+            }
+            Connection& connection = connections[record.connection];
+            if (record.type == 'O') {
+                closeConnection(connection);
+                connection = Connection();
+                if (openConnection(connection, target)) {
+                    stats.connections++;
+                } else {
+                    stats.failed++;
+                }
+            } else if (record.type == 'L' && connection.fd >= 0) {
+                // The capture never holds passwords; the replay target may want one
+                if (have_password && record.payload == "PASS *") {
+                    connection.output += "PASS " + password;
+                } else {
+                    connection.output += record.payload;
+                }
+                connection.output += "\r\n";
+                stats.lines++;
+                if (now - due > stats.max_lag_us) {
+                    stats.max_lag_us = now - due;
+                }
+            } else if (record.type == 'C') {
+                connection.closing = true;
+            }
+            next++;
+        }
+
+        std::vector<struct pollfd> poll_fds;
+        std::vector<unsigned long> ids;
+        bool writing = false;
+        std::map<unsigned long, Connection>::iterator it = connections.begin();
+        while (it != connections.end()) {
+            Connection& connection = it->second;
+            if (connection.fd >= 0 && !connection.connecting && !writeOutput(connection, stats)) {
+                closeConnection(connection);
+            }
+            // Like the recorded client, hang up and let the server finish
+            if (connection.fd >= 0 && connection.closing && !connection.shut && !connection.connecting
+                && connection.output.empty()) {
+                shutdown(connection.fd, SHUT_WR);
+                connection.shut = true;
+            }
+            // Lines recorded after a close the server made are dropped
+            if (connection.fd < 0) {
+                connections.erase(it++);
+                continue;
+            }
+            struct pollfd entry;
+            entry.fd = connection.fd;
+            entry.events = POLLIN;
+            if (connection.connecting || !connection.output.empty()) {
+                entry.events |= POLLOUT;
+                writing = true;
+            }
+            entry.revents = 0;
+            poll_fds.push_back(entry);
+            ids.push_back(it->first);
+            ++it;
+        }
+
+        // Once everything is written, replies are read until the server goes quiet
+        now = Capture::nowUs();
+        int timeout_ms;
+        if (next < records.size()) {
+            uint64_t due = speed > 0 ? start + static_cast<uint64_t>(records[next].time_us / speed) : now;
+            timeout_ms = due > now ? static_cast<int>((due - now + 999) / 1000) : 0;
+        } else if (writing) {
+            timeout_ms = 100;
+        } else {
+            uint64_t quiet_ms = (now - stats.last_activity_us) / 1000;
+            if (poll_fds.empty() || quiet_ms >= static_cast<uint64_t>(DRAIN_MS)) {
+                break;
+            }
+            timeout_ms = DRAIN_MS - static_cast<int>(quiet_ms);
+        }
+
+        if (poll(poll_fds.empty() ? NULL : &poll_fds[0], poll_fds.size(), timeout_ms) < 0 && errno != EINTR) {
+            std::cerr << "Error: poll: " << std::strerror(errno) << std::endl;
+            break;
+        }
+        for (size_t i = 0; i < poll_fds.size(); i++) {
+            Connection& connection = connections[ids[i]];
+            if (poll_fds[i].revents == 0) {
+                continue;
+            }
+            if (connection.connecting) {
+                int socket_error = 0;
+                socklen_t length = sizeof(socket_error);
+                getsockopt(connection.fd, SOL_SOCKET, SO_ERROR, &socket_error, &length);
+                if (socket_error != 0) {
+                    stats.failed++;
+                    closeConnection(connection);
+                    continue;
+                }
+                connection.connecting = false;
+            }
+            if ((poll_fds[i].revents & (POLLIN | POLLHUP | POLLERR)) && !readInput(connection, stats)) {
+                closeConnection(connection);
+            }
+        }
+    }
+    freeaddrinfo(target);
+
+    // Up to the last byte moved, so the final wait for silence does not count
+    double elapsed = (stats.last_activity_us - start) / 1e6;
+    double replay_time = records.empty() ? 0 : records.back().time_us / 1e6;
+    std::cout << "Records:        " << records.size() << " over " << replay_time << " s recorded" << std::endl;
+    std::cout << "Connections:    " << stats.connections << " (" << stats.failed << " failed)" << std::endl;
+    std::cout << "Lines sent:     " << stats.lines << " (" << stats.bytes_sent << " bytes)" << std::endl;
+    std::cout << "Bytes received: " << stats.bytes_received << std::endl;
+    std::cout << "Elapsed:        " << elapsed << " s, " << (elapsed > 0 ? stats.lines / elapsed : 0) << " lines/s" << std::endl;
+    std::cout << "Max lag:        " << stats.max_lag_us / 1000.0 << " ms" << std::endl;
+    return 0;
+}
@@ -0,0 +1,523 @@
+#include "Resolver.hpp"
+#include <algorithm> // For std::min
+#include <cstring> // For std::memcpy, std::memcmp
+#include <cstdlib> // For std::strtol
+#include <cctype> // For std::isalnum, std::isalpha, std::tolower
+#include <fstream> // For std::ifstream
+#include <sstream> // For std::istringstream
+#include <errno.h> // For errno
+#include <fcntl.h> // For open
+#include <unistd.h> // For read, close, getpid
+#include <arpa/inet.h> // For inet_pton
+#include <netinet/in.h> // For sockaddr_in, sockaddr_in6
+#include <sys/socket.h> // For socket, connect, send, recv
+
+static const size_t MAX_PACKET = 512;  // Plain UDP DNS, no EDNS0
+static const size_t MAX_HOSTNAME = 63; // Longer names are not used as hostnames
+static const uint16_t TYPE_A = 1;
+static const uint16_t TYPE_PTR = 12;
+static const uint16_t TYPE_AAAA = 28;
+static const uint16_t CLASS_IN = 1;
+
+static long long monotonicMs() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return static_cast<long long>(now.tv_sec) * 1000 + now.tv_nsec / 1000000;
+}
+
+// ---- Wire format ----
+
+static void putShort(std::string& out, uint16_t value) {
+    out += static_cast<char>(value >> 8);
+    out += static_cast<char>(value & 0xff);
+}
+
+static uint16_t getShort(const unsigned char* data) {
+    return static_cast<uint16_t>((data[0] << 8) | data[1]);
+}
+
+static uint32_t getLong(const unsigned char* data) {
+    return (static_cast<uint32_t>(getShort(data)) << 16) | getShort(data + 2);
+}
+
+static bool putName(std::string& out, const std::string& name) {
+    size_t start = 0;
+    while (start < name.length()) {
+        size_t dot = name.find('.', start);
+        if (dot == std::string::npos) {
+            dot = name.length();
+        }
+        size_t label_length = dot - start;
+        if (label_length == 0 || label_length > 63) {
+            return false;
+        }
+        out += static_cast<char>(label_length);
+        out.append(name, start, label_length);
+        start = dot + 1;
+    }
+    out += '\0';
+    return true;
+}
+
+// Reads a possibly compressed name at offset; next is set past its in-place part
+static bool readName(const unsigned char* packet, size_t length, size_t offset, std::string& name, size_t& next) {
+    name.clear();
+    bool jumped = false;
+    for (int jumps = 0; jumps < 16; ) {
+        if (offset >= length) {
+            return false;
+        }
+        unsigned char label_length = packet[offset];
+        if ((label_length & 0xc0) == 0xc0) {
+            if (offset + 1 >= length) {
+                return false;
+            }
+            if (!jumped) {
+                next = offset + 2;
+            }
+            offset = ((label_length & 0x3f) << 8) | packet[offset + 1];
+            jumped = true;
+            jumps++;
+            continue;
+        }
+        if (label_length & 0xc0) {
+            return false;
+        }
+        if (label_length == 0) {
+            if (!jumped) {
+                next = offset + 1;
+            }
+            return true;
+        }
+        if (offset + 1 + label_length > length || name.length() + label_length + 1 > 255) {
+            return false;
+        }
+        if (!name.empty()) {
+            name += '.';
+        }
+        name.append(reinterpret_cast<const char*>(packet + offset + 1), label_length);
+        offset += 1 + label_length;
+    }
+    return false;
+}
+
+static bool sameName(const std::string& first, const std::string& second) {
+    if (first.length() != second.length()) {
+        return false;
+    }
+    for (size_t i = 0; i < first.length(); i++) {
+        if (std::tolower(static_cast<unsigned char>(first[i])) != std::tolower(static_cast<unsigned char>(second[i]))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Only plain DNS names are shown as hosts; anything else (spaces, ':',
+// or a name made to look like an address) would confuse nick!user@host
+static bool isUsableHostname(const std::string& name) {
+    if (name.empty() || name.length() > MAX_HOSTNAME || name[0] == '-' || name[0] == '.') {
+        return false;
+    }
+    bool has_letter = false;
+    for (size_t i = 0; i < name.length(); i++) {
+        unsigned char c = static_cast<unsigned char>(name[i]);
+        if (!std::isalnum(c) && c != '-' && c != '.') {
+            return false;
+        }
+        has_letter = has_letter || std::isalpha(c);
+    }
+    return has_letter;
+}
+
+static std::string reverseName(const unsigned char* raw, bool ipv4) {
+    static const char hex[] = "0123456789abcdef";
+    std::ostringstream name;
+    if (ipv4) {
+        name << static_cast<int>(raw[3]) << "." << static_cast<int>(raw[2]) << "."
+             << static_cast<int>(raw[1]) << "." << static_cast<int>(raw[0]) << ".in-addr.arpa";
+    } else {
+        for (int i = 15; i >= 0; i--) {
+            name << hex[raw[i] & 0x0f] << "." << hex[raw[i] >> 4] << ".";
+        }
+        name << "ip6.arpa";
+    }
+    return name.str();
+}
+
+// ---- Setup ----
+
+Resolver::Resolver(size_t cache_size, uint32_t max_ttl_seconds, uint32_t negative_ttl_seconds)
+    : fd(-1), timeout_ms(0), cache_capacity(cache_size), max_ttl(max_ttl_seconds),
+      negative_ttl(negative_ttl_seconds), random_state(0) {
+}
+
+Resolver::~Resolver() {
+    close();
+}
+
+bool Resolver::open(const std::string& nameserver, int lookup_timeout_ms) {
+    close();
+    std::string host = nameserver;
+    std::string port = "53";
+    if (!host.empty() && host[0] == '[') {
+        size_t end = host.find(']');
+        if (end == std::string::npos) {
+            return false;
+        }
+        if (end + 1 < host.length()) {
+            if (host[end + 1] != ':') {
+                return false;
+            }
+            port = host.substr(end + 2);
+        }
+        host = host.substr(1, end - 1);
+    } else if (host.find(':') != std::string::npos && host.find(':') == host.rfind(':')) {
+        port = host.substr(host.find(':') + 1);
+        host.erase(host.find(':'));
+    }
+    char* end;
+    long port_number = std::strtol(port.c_str(), &end, 10);
+    if (port.empty() || *end != '\0' || port_number < 1 || port_number > 65535) {
+        return false;
+    }
+
+    struct sockaddr_storage server;
+    socklen_t server_length;
+    std::memset(&server, 0, sizeof(server));
+    struct sockaddr_in* server4 = reinterpret_cast<struct sockaddr_in*>(&server);
+    struct sockaddr_in6* server6 = reinterpret_cast<struct sockaddr_in6*>(&server);
+    if (inet_pton(AF_INET, host.c_str(), &server4->sin_addr) == 1) {
+        server4->sin_family = AF_INET;
+        server4->sin_port = htons(static_cast<uint16_t>(port_number));
+        server_length = sizeof(struct sockaddr_in);
+    } else if (inet_pton(AF_INET6, host.c_str(), &server6->sin6_addr) == 1) {
+        server6->sin6_family = AF_INET6;
+        server6->sin6_port = htons(static_cast<uint16_t>(port_number));
+        server_length = sizeof(struct sockaddr_in6);
+    } else {
+        return false;
+    }
+
+    // A connected socket only ever sees datagrams from the nameserver itself
+    fd = socket(server.ss_family, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return false;
+    }
+    if (connect(fd, reinterpret_cast<struct sockaddr*>(&server), server_length) < 0) {
+        close();
+        return false;
+    }
+
+    // Unpredictable query ids, together with the random source port, make forged answers harder
+    int random_fd = ::open("/dev/urandom", O_RDONLY | O_CLOEXEC);
+    if (random_fd < 0 || read(random_fd, &random_state, sizeof(random_state)) != sizeof(random_state)) {
+        random_state = static_cast<uint32_t>(time(NULL)) ^ static_cast<uint32_t>(getpid());
+    }
+    if (random_fd >= 0) {
+        ::close(random_fd);
+    }
+    if (random_state == 0) {
+        random_state = 1;
+    }
+    timeout_ms = lookup_timeout_ms;
+    return true;
+}
+
+void Resolver::close() {
+    if (fd >= 0) {
+        ::close(fd);
+        fd = -1;
+    }
+    abandonAll();
+}
+
+std::string Resolver::systemNameserver() {
+    std::ifstream file("/etc/resolv.conf");
+    std::string line;
+    while (std::getline(file, line)) {
+        std::istringstream fields(line);
+        std::string keyword, address;
+        if (fields >> keyword >> address && keyword == "nameserver") {
+            return address;
+        }
+    }
+    return "";
+}
+
+// ---- Lookups ----
+
+uint16_t Resolver::nextQueryId() {
+    uint16_t id;
+    do {
+        // xorshift32
+        random_state ^= random_state << 13;
+        random_state ^= random_state >> 17;
+        random_state ^= random_state << 5;
+        id = static_cast<uint16_t>(random_state);
+    } while (pending.find(id) != pending.end());
+    return id;
+}
+
+bool Resolver::sendQuery(uint16_t id, Lookup& lookup, uint16_t type) {
+    std::string packet;
+    putShort(packet, id);
+    putShort(packet, 0x0100); // Standard query, recursion desired
+    putShort(packet, 1);      // One question
+    putShort(packet, 0);
+    putShort(packet, 0);
+    putShort(packet, 0);
+    if (!putName(packet, lookup.question)) {
+        return false;
+    }
+    putShort(packet, type);
+    putShort(packet, CLASS_IN);
+
+    lookup.query = packet;
+    lookup.retransmit_at = monotonicMs() + timeout_ms / 3;
+    // A full socket buffer is left to the retransmission
+    return send(fd, packet.data(), packet.length(), 0) >= 0 || errno == EAGAIN || errno == EWOULDBLOCK;
+}
+
+bool Resolver::lookup(int client_fd, const std::string& address, std::string& hostname) {
+    hostname.clear();
+    std::map<std::string, std::list<CacheEntry>::iterator>::iterator cached = cache_index.find(address);
+    if (cached != cache_index.end()) {
+        if (cached->second->expires > time(NULL)) {
+            cache.splice(cache.begin(), cache, cached->second);
+            hostname = cached->second->hostname;
+            return true;
+        }
+        cache.erase(cached->second);
+        cache_index.erase(cached);
+    }
+    if (!isEnabled()) {
+        return true;
+    }
+
+    Lookup lookup;
+    lookup.client_fd = client_fd;
+    lookup.address = address;
+    lookup.ipv4 = inet_pton(AF_INET, address.c_str(), lookup.raw) == 1;
+    if (!lookup.ipv4 && inet_pton(AF_INET6, address.c_str(), lookup.raw) != 1) {
+        return true;
+    }
+    lookup.stage = STAGE_REVERSE;
+    lookup.question = reverseName(lookup.raw, lookup.ipv4);
+    lookup.ttl = max_ttl;
+    lookup.deadline = monotonicMs() + timeout_ms;
+
+    cancel(client_fd);
+    uint16_t id = nextQueryId();
+    if (!sendQuery(id, lookup, TYPE_PTR)) {
+        return true;
+    }
+    pending[id] = lookup;
+    by_client[client_fd] = id;
+    return false;
+}
+
+void Resolver::cancel(int client_fd) {
+    std::map<int, uint16_t>::iterator it = by_client.find(client_fd);
+    if (it != by_client.end()) {
+        pending.erase(it->second);
+        by_client.erase(it);
+    }
+}
+
+void Resolver::abandonAll() {
+    for (std::map<uint16_t, Lookup>::iterator it = pending.begin(); it != pending.end(); ++it) {
+        Result result;
+        result.client_fd = it->second.client_fd;
+        results.push_back(result);
+    }
+    pending.clear();
+    by_client.clear();
+}
+
+void Resolver::finish(std::map<uint16_t, Lookup>::iterator it, const std::string& hostname, uint32_t ttl) {
+    if (ttl > 0) {
+        remember(it->second.address, hostname, ttl);
+    }
+    Result result;
+    result.client_fd = it->second.client_fd;
+    result.hostname = hostname;
+    results.push_back(result);
+    by_client.erase(it->second.client_fd);
+    pending.erase(it);
+}
+
+void Resolver::remember(const std::string& address, const std::string& hostname, uint32_t ttl) {
+    if (cache_capacity == 0) {
+        return;
+    }
+    std::map<std::string, std::list<CacheEntry>::iterator>::iterator existing = cache_index.find(address);
+    if (existing != cache_index.end()) {
+        cache.erase(existing->second);
+        cache_index.erase(existing);
+    }
+    CacheEntry entry;
+    entry.address = address;
+    entry.hostname = hostname;
+    entry.expires = time(NULL) + ttl;
+    cache.push_front(entry);
+    cache_index[address] = cache.begin();
+    if (cache.size() > cache_capacity) {
+        cache_index.erase(cache.back().address);
+        cache.pop_back();
+    }
+}
+
+// ---- Event loop side ----
+
+void Resolver::receive() {
+    if (!isEnabled()) {
+        return;
+    }
+    unsigned char packet[MAX_PACKET];
+    while (true) {
+        ssize_t length = recv(fd, packet, sizeof(packet), 0);
+        if (length < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            // Nothing listens on the nameserver port: no point waiting for the timeout
+            if (errno == ECONNREFUSED) {
+                while (!pending.empty()) {
+                    finish(pending.begin(), "", 0);
+                }
+                continue;
+            }
+            return;
+        }
+        handleAnswer(packet, static_cast<size_t>(length));
+    }
+}
+
+void Resolver::handleAnswer(const unsigned char* packet, size_t length) {
+    if (length < 12) {
+        return;
+    }
+    std::map<uint16_t, Lookup>::iterator it = pending.find(getShort(packet));
+    uint16_t flags = getShort(packet + 2);
+    if (it == pending.end() || !(flags & 0x8000) || getShort(packet + 4) != 1) {
+        return;
+    }
+    Lookup& lookup = it->second;
+    const uint16_t expected_type = lookup.stage == STAGE_REVERSE ? TYPE_PTR : (lookup.ipv4 ? TYPE_A : TYPE_AAAA);
+
+    // The answer has to echo the question we asked, or it is not ours
+    std::string name;
+    size_t offset;
+    if (!readName(packet, length, 12, name, offset) || offset + 4 > length || !sameName(name, lookup.question)
+        || getShort(packet + offset) != expected_type || getShort(packet + offset + 2) != CLASS_IN) {
+        return;
+    }
+    offset += 4;
+
+    // NXDOMAIN is a definite "no name"; other failures are not remembered
+    uint16_t rcode = flags & 0x000f;
+    if (rcode != 0) {
+        finish(it, "", rcode == 3 ? negative_ttl : 0);
+        return;
+    }
+
+    std::string found;
+    bool confirmed = false;
+    uint16_t answers = getShort(packet + 6);
+    for (uint16_t i = 0; i < answers; i++) {
+        if (!readName(packet, length, offset, name, offset) || offset + 10 > length) {
+            break;
+        }
+        uint16_t type = getShort(packet + offset);
+        uint16_t rr_class = getShort(packet + offset + 2);
+        uint32_t ttl = getLong(packet + offset + 4);
+        uint16_t rdata_length = getShort(packet + offset + 8);
+        size_t rdata = offset + 10;
+        offset = rdata + rdata_length;
+        if (offset > length || rr_class != CLASS_IN || type != expected_type) {
+            continue;
+        }
+        if (type == TYPE_PTR) {
+            size_t unused;
+            if (found.empty() && readName(packet, length, rdata, name, unused) && isUsableHostname(name)) {
+                found = name;
+                lookup.ttl = std::min(lookup.ttl, ttl);
+            }
+        } else if (rdata_length == (lookup.ipv4 ? 4 : 16) && std::memcmp(packet + rdata, lookup.raw, rdata_length) == 0) {
+            confirmed = true;
+            lookup.ttl = std::min(lookup.ttl, ttl);
+        }
+    }
+
+    if (lookup.stage == STAGE_REVERSE) {
+        if (found.empty()) {
+            finish(it, "", negative_ttl);
+            return;
+        }
+        // Same lookup, new question under a fresh id
+        Lookup next = lookup;
+        next.stage = STAGE_FORWARD;
+        next.question = found;
+        next.hostname = found;
+        pending.erase(it);
+        uint16_t id = nextQueryId();
+        if (!sendQuery(id, next, next.ipv4 ? TYPE_A : TYPE_AAAA)) {
+            by_client.erase(next.client_fd);
+            Result result;
+            result.client_fd = next.client_fd;
+            results.push_back(result);
+            return;
+        }
+        pending[id] = next;
+        by_client[next.client_fd] = id;
+        return;
+    }
+    if (confirmed) {
+        finish(it, lookup.hostname, lookup.ttl);
+    } else {
+        finish(it, "", negative_ttl);
+    }
+}
+
+void Resolver::expire() {
+    long long now = monotonicMs();
+    std::map<uint16_t, Lookup>::iterator it = pending.begin();
+    while (it != pending.end()) {
+        Lookup& lookup = it->second;
+        if (now >= lookup.deadline) {
+            // Timeouts are not remembered, the next connection tries again
+            finish(it++, "", 0);
+            continue;
+        }
+        if (lookup.retransmit_at && now >= lookup.retransmit_at) {
+            send(fd, lookup.query.data(), lookup.query.length(), 0);
+            lookup.retransmit_at = 0;
+        }
+        ++it;
+    }
+}
+
+int Resolver::nextTimeout() const {
+    if (pending.empty()) {
+        return -1;
+    }
+    long long now = monotonicMs();
+    long long next = -1;
+    for (std::map<uint16_t, Lookup>::const_iterator it = pending.begin(); it != pending.end(); ++it) {
+        long long due = it->second.retransmit_at ? it->second.retransmit_at : it->second.deadline;
+        if (next == -1 || due < next) {
+            next = due;
+        }
+    }
+    return next <= now ? 0 : static_cast<int>(next - now);
+}
+
+bool Resolver::nextResult(Result& result) {
+    if (results.empty()) {
+        return false;
+    }
+    result = results.front();
+    results.pop_front();
+    return true;
+}
@@ -1,31 +1,127 @@
 #include "Server.hpp"
 #include "CommandHandler.hpp"
+#include <fstream> // For std::ifstream
 
-Server::Server(const std::string& port_str, const std::string& pass) : server_fd(-1), password(pass), commandHandler(nullptr) {
-    // Parse port
+const char* const Server::UPGRADE_ENV = "IRCSERV_UPGRADE_FD";
+const char* const Server::SNAPSHOT_FILE = "ircserv.channels";
+const char* const Server::SNAPSHOT_TMP_FILE = "ircserv.channels.tmp";
+const char* const Server::HISTORY_LOG_ENV = "IRCSERV_HISTORY_LOG";
+const char* const Server::DENY_FILE = "ircserv.deny";
+const char* const Server::OPER_FILE = "ircserv.opers";
+const char* const Server::TLS_CERT_FILE = "ircserv.crt";
+const char* const Server::TLS_KEY_FILE = "ircserv.key";
+const char* const Server::IO_BACKEND_ENV = "IRCSERV_IO_BACKEND";
+const char* const Server::SERVER_NAME_ENV = "IRCSERV_NAME";
+const char* const Server::SERVER_INFO = "ft_irc server";
+const char* const Server::LINK_FILE = "ircserv.links";
+const char* const Server::RESOLVER_ENV = "IRCSERV_RESOLVER";
+const char* const Server::RESOLVER_TIMEOUT_ENV = "IRCSERV_RESOLVER_TIMEOUT";
+const char* const Server::ACCOUNT_FILE = "ircserv.accounts";
+const char* const Server::CAPTURE_ENV = "IRCSERV_CAPTURE";
+const char* const Server::CONFIG_FILE = "ircserv.conf";
+
+static int parsePort(const std::string& port_str) {
     char *end;
     long temp = strtol(port_str.c_str(), &end, 10);
     if (temp < 1024 || temp > 65535 || *end != '\0')
     {
         throw std::runtime_error("Invalid Port");
     }
-    port = static_cast<int>(temp);
+    return static_cast<int>(temp);
+}
+
+Server::Server(const std::string& port_str, const std::string& pass, const std::string& tls_port_str) : server_fd(-1), tls_fd(-1), tls_port(0), tls_ctx(NULL), password(pass), default_password(pass), max_clients(MAX_CLIENTS), transport(&socket_transport), memory_transport(NULL), commandHandler(NULL), throttle(THROTTLE_MAX_CONNECTIONS, THROTTLE_WINDOW), history(HISTORY_SIZE), deny_list(DENY_FILE), resolver(RESOLVER_CACHE_SIZE, RESOLVER_MAX_TTL, RESOLVER_NEGATIVE_TTL), accounts(ACCOUNT_FILE, OPER_FILE, SASL_WORKERS, SASL_QUEUE_LIMIT), login_serial(0), config_loader(CONFIG_FILE, Config(MAX_CLIENTS, THROTTLE_MAX_CONNECTIONS, THROTTLE_WINDOW, DENY_FILE)), msgid_counter(0), fanout_epoch(0), snapshot_pid(-1), next_snapshot(time(NULL) + SNAPSHOT_INTERVAL), uring(NULL), uring_quiescing(false), server_name("ircserv"), next_remote_id(-2), remote_users(0) {
+    // SIGHUP is read from a signalfd; no thread may be started before it is blocked
+    ConfigLoader::blockSignal();
+
+    // Parse port
+    port = parsePort(port_str);
     std::cout << "Port parsed: " << port << std::endl;
+    if (!tls_port_str.empty())
+    {
+        tls_port = parsePort(tls_port_str);
+        if (tls_port == port)
+        {
+            throw std::runtime_error("TLS port must differ from the plaintext port");
+        }
+        setupTls();
+    }
+
+    const char* name = getenv(SERVER_NAME_ENV);
+    if (name && *name)
+    {
+        server_name = name;
+        if (server_name.find_first_of(" :,!@*?") != std::string::npos)
+        {
+            throw std::runtime_error("Invalid server name");
+        }
+    }
+
+    const char* history_log_path = getenv(HISTORY_LOG_ENV);
+    if (history_log_path && *history_log_path && !history.openLog(history_log_path))
+    {
+        std::cerr << "Could not open history log " << history_log_path << std::endl;
+    }
 
-    setupSocket();
+    // A broken file at startup is fatal, unlike on a reload
+    Config config(MAX_CLIENTS, THROTTLE_MAX_CONNECTIONS, THROTTLE_WINDOW, DENY_FILE);
+    std::string config_error;
+    if (!Config::load(CONFIG_FILE, config, config_error))
+    {
+        throw std::runtime_error(config_error);
+    }
+    if (!config_loader.start())
+    {
+        std::cerr << "Could not set up SIGHUP handling, configuration reloads disabled" << std::endl;
+    }
+    setupResolver();
+    if (!accounts.start())
+    {
+        std::cerr << "Could not start the account workers, SASL logins disabled" << std::endl;
+    }
+
+    const char* capture_path = getenv(CAPTURE_ENV);
+    if (capture_path && *capture_path)
+    {
+        // After a live upgrade the file continues the previous process's recording
+        if (!capture.open(capture_path, getenv(UPGRADE_ENV) != NULL))
+        {
+            std::cerr << "Could not open capture file " << capture_path << std::endl;
+        }
+    }
+
+    // A process started by a live upgrade inherits its sockets instead of binding
+    const char* handoff_fd = getenv(UPGRADE_ENV);
+    if (handoff_fd)
+    {
+        int fd = std::atoi(handoff_fd);
+        unsetenv(UPGRADE_ENV);
+        resumeFromUpgrade(fd);
+        recallSnapshot();
+    }
+    else
+    {
+        setupSocket();
+        loadSnapshot();
+    }
     
     // Initialize command handler
     commandHandler = new CommandHandler(this);
+    applyConfig(config);
 }
 
 Server::~Server() {
     // Clean up command handler
     delete commandHandler;
+    delete uring;
     
     // Clean up all client connections
     for (size_t i = 0; i < clients.size(); i++)
     {
-        close(clients[i].fd);
+        if (clients[i].isRemote())
+            continue;
+        closeTlsSession(clients[i]);
+        transport->close(clients[i].fd);
     }
     
     // Close server socket
@@ -33,94 +129,494 @@ Server::~Server() {
     {
         close(server_fd);
     }
+    if (tls_fd >= 0)
+    {
+        close(tls_fd);
+    }
+    for (std::map<int, int>::iterator it = extra_listeners.begin(); it != extra_listeners.end(); ++it)
+    {
+        close(it->second);
+    }
+    SSL_CTX_free(tls_ctx);
 }
 
 void Server::setupSocket() {
-    // Create socket
-    server_fd = socket(AF_INET, SOCK_STREAM, 0);
-    if (server_fd < 0)
+    server_fd = openListener(port);
+    if (tls_port)
     {
-        throw std::runtime_error("socket creation failed");
+        tls_fd = openListener(tls_port);
     }
+}
 
-    // Set socket to non-blocking mode - CRITICAL FIX
-    if (fcntl(server_fd, F_SETFL, O_NONBLOCK) < 0)
+int Server::openListener(int listen_port) {
+    // Create a dual-stack socket, falling back to IPv4 if IPv6 is unavailable
+    bool ipv6 = true;
+    int listen_fd = socket(AF_INET6, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (listen_fd < 0 && (errno == EAFNOSUPPORT || errno == EPROTONOSUPPORT))
     {
-        close(server_fd);
-        throw std::runtime_error("fcntl failed to set non-blocking");
+        ipv6 = false;
+        listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    }
+    if (listen_fd < 0)
+    {
+        throw std::runtime_error("socket creation failed");
     }
 
     // Allow socket reuse
     int opt = 1;
-    if (setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0)
+    if (setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0)
     {
-        close(server_fd);
+        close(listen_fd);
         throw std::runtime_error("setsockopt failed");
     }
 
     // Setup server address
-    struct sockaddr_in server_add;
-    server_add.sin_family = AF_INET;
-    server_add.sin_addr.s_addr = INADDR_ANY;
-    server_add.sin_port = htons(port);
+    struct sockaddr_storage server_add;
+    socklen_t server_len;
+    std::memset(&server_add, 0, sizeof(server_add));
+    if (ipv6)
+    {
+        // Accept IPv4 clients too, as IPv4-mapped addresses
+        int v6only = 0;
+        if (setsockopt(listen_fd, IPPROTO_IPV6, IPV6_V6ONLY, &v6only, sizeof(v6only)) < 0)
+        {
+            close(listen_fd);
+            throw std::runtime_error("setsockopt IPV6_V6ONLY failed");
+        }
+        struct sockaddr_in6* addr6 = reinterpret_cast<struct sockaddr_in6*>(&server_add);
+        addr6->sin6_family = AF_INET6;
+        addr6->sin6_addr = in6addr_any;
+        addr6->sin6_port = htons(listen_port);
+        server_len = sizeof(struct sockaddr_in6);
+    }
+    else
+    {
+        struct sockaddr_in* addr4 = reinterpret_cast<struct sockaddr_in*>(&server_add);
+        addr4->sin_family = AF_INET;
+        addr4->sin_addr.s_addr = INADDR_ANY;
+        addr4->sin_port = htons(listen_port);
+        server_len = sizeof(struct sockaddr_in);
+    }
 
     // Bind socket
-    if (bind(server_fd, (struct sockaddr*)&server_add, sizeof(server_add)) < 0)
+    if (bind(listen_fd, (struct sockaddr*)&server_add, server_len) < 0)
     {
-        close(server_fd);
+        close(listen_fd);
         throw std::runtime_error("bind failed");
     }
 
-    // Start listening
-    if (listen(server_fd, MAX_CLIENTS) < 0)
+    // Start listening, with a backlog large enough to absorb reconnect storms
+    if (listen(listen_fd, SOMAXCONN) < 0)
     {
-        close(server_fd);
+        close(listen_fd);
         throw std::runtime_error("listen failed");
     }
 
-    std::cout << "Server listening on port " << port << std::endl;
+    std::cout << "Server listening on port " << listen_port << (ipv6 ? " (IPv4/IPv6)" : " (IPv4)") << std::endl;
+    return listen_fd;
 }
 
-void Server::acceptNewClient() {
-    struct sockaddr_in client_addr;
-    socklen_t client_len = sizeof(client_addr);
-    int client_fd = accept(server_fd, (struct sockaddr*)&client_addr, &client_len);
-    
-    if (client_fd < 0)
+// Printable form of a peer address; IPv4-mapped IPv6 peers are shown as plain IPv4
+static std::string addressToString(const struct sockaddr_storage& addr) {
+    char host[INET6_ADDRSTRLEN];
+
+    if (addr.ss_family == AF_INET6) {
+        const struct sockaddr_in6* addr6 = reinterpret_cast<const struct sockaddr_in6*>(&addr);
+        if (IN6_IS_ADDR_V4MAPPED(&addr6->sin6_addr)) {
+            if (inet_ntop(AF_INET, addr6->sin6_addr.s6_addr + 12, host, sizeof(host)))
+                return host;
+        } else if (inet_ntop(AF_INET6, &addr6->sin6_addr, host, sizeof(host))) {
+            std::string result = host;
+            // A leading ':' would break the nick!user@host prefix
+            if (result[0] == ':')
+                result = "0" + result;
+            return result;
+        }
+    } else {
+        const struct sockaddr_in* addr4 = reinterpret_cast<const struct sockaddr_in*>(&addr);
+        if (inet_ntop(AF_INET, &addr4->sin_addr, host, sizeof(host)))
+            return host;
+    }
+    return "unknown";
+}
+
+void Server::acceptNewClient(int listen_fd) {
+    // Drain the whole backlog so a burst of connections is absorbed in one tick
+    while (true)
     {
-        // In non-blocking mode, EAGAIN/EWOULDBLOCK is normal when no connection is pending
-        if (errno != EAGAIN && errno != EWOULDBLOCK)
-            perror("accept");
+        struct sockaddr_storage client_addr;
+        socklen_t client_len = sizeof(client_addr);
+        int client_fd = accept4(listen_fd, (struct sockaddr*)&client_addr, &client_len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+
+        if (client_fd < 0)
+        {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            // In non-blocking mode, EAGAIN/EWOULDBLOCK means the backlog is empty
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                perror("accept");
+            return;
+        }
+
+        registerConnection(client_fd, client_addr, listen_fd);
+    }
+}
+
+void Server::registerConnection(int client_fd, const struct sockaddr_storage& client_addr, int listen_fd) {
+    // D-lined sources are dropped before any other work is done for them
+    if (deny_list.isDenied(client_addr))
+    {
+        transport->close(client_fd);
         return;
     }
 
-    // Set client socket to non-blocking mode - CRITICAL FIX
-    if (fcntl(client_fd, F_SETFL, O_NONBLOCK) < 0)
+    if (!admitConnection(client_fd, client_addr))
     {
-        perror("fcntl failed for client socket");
-        close(client_fd);
+        transport->close(client_fd);
         return;
     }
+    // A connection that refuses an option still works, just untuned
+    std::map<int, SocketProfile>::const_iterator profile = listener_profiles.find(listen_fd);
+    if (profile != listener_profiles.end())
+    {
+        profile->second.applyToConnection(client_fd);
+    }
 
-    if (clients.size() >= MAX_CLIENTS)
+    Client new_client;
+    new_client.fd = client_fd;
+    new_client.address = addressToString(client_addr);
+    new_client.hostname = new_client.address;
+    if (websocket_listeners.find(listen_fd) != websocket_listeners.end())
+    {
+        new_client.websocket = WS_HANDSHAKE;
+    }
+    if (tls_fd >= 0 && listen_fd == tls_fd && !startTlsSession(new_client))
+    {
+        transport->close(client_fd);
+        return;
+    }
+    clients.push_back(new_client);
+    indexClients(clients.size() - 1);
+    capture.opened(client_fd, new_client.address);
+    std::cout << "New client connected. client_fd: " << new_client.fd 
+              << " from " << new_client.hostname << std::endl;
+    // WebSocket clients get the lookup notices once their handshake is done
+    if (new_client.websocket == WS_NONE)
+    {
+        startHostLookup(clients.size() - 1);
+    }
+}
+
+void Server::setupResolver() {
+    const char* nameserver = getenv(RESOLVER_ENV);
+    std::string address = nameserver ? nameserver : Resolver::systemNameserver();
+    if (address == "off") {
+        std::cout << "Hostname lookups disabled" << std::endl;
+        return;
+    }
+    if (address.empty()) {
+        address = "127.0.0.1";
+    }
+    const char* timeout = getenv(RESOLVER_TIMEOUT_ENV);
+    int timeout_ms = timeout ? std::atoi(timeout) : RESOLVER_TIMEOUT_MS;
+    if (timeout_ms <= 0) {
+        timeout_ms = RESOLVER_TIMEOUT_MS;
+    }
+    // Clients are still accepted without lookups, they just keep their addresses
+    if (!resolver.open(address, timeout_ms)) {
+        std::cerr << "Could not use nameserver " << address << ", hostname lookups disabled" << std::endl;
+    }
+}
+
+void Server::startHostLookup(int client_index) {
+    Client& client = clients[client_index];
+    std::string hostname;
+    if (resolver.lookup(client.fd, client.address, hostname)) {
+        if (!hostname.empty()) {
+            client.hostname = hostname;
+            sendMessage(client.fd, "NOTICE * :*** Found your hostname (cached)");
+        } else if (resolver.isEnabled()) {
+            sendMessage(client.fd, "NOTICE * :*** Couldn't look up your hostname (cached)");
+        }
+        return;
+    }
+    // Registration waits for the answer, at most the resolver timeout
+    client.resolving_host = true;
+    sendMessage(client.fd, "NOTICE * :*** Looking up your hostname...");
+}
+
+void Server::completeHostLookups() {
+    resolver.expire();
+    Resolver::Result result;
+    while (resolver.nextResult(result)) {
+        int client_index = findClientByFd(result.client_fd);
+        if (client_index == -1 || !clients[client_index].resolving_host) {
+            continue;
+        }
+        Client& client = clients[client_index];
+        client.resolving_host = false;
+        if (result.hostname.empty()) {
+            sendMessage(client.fd, "NOTICE * :*** Couldn't look up your hostname");
+        } else {
+            client.hostname = result.hostname;
+            sendMessage(client.fd, "NOTICE * :*** Found your hostname");
+        }
+        // NICK and USER may both have arrived while the lookup was running
+        commandHandler->completeRegistration(client_index);
+    }
+}
+
+void Server::handleServiceEvent(int fd) {
+    if (fd == resolver.getFd()) {
+        resolver.receive();
+    } else if (fd == accounts.getFd()) {
+        accounts.collect();
+    } else if (fd == config_loader.getSignalFd()) {
+        config_loader.receiveSignal();
+    } else if (fd == config_loader.getEventFd()) {
+        config_loader.collect();
+    }
+}
+
+void Server::completeReload() {
+    if (config_loader.hasResult()) {
+        Config config(MAX_CLIENTS, THROTTLE_MAX_CONNECTIONS, THROTTLE_WINDOW, DENY_FILE);
+        std::string error;
+        if (config_loader.takeResult(config, error)) {
+            applyConfig(config);
+            std::cout << "Configuration reloaded" << std::endl;
+        } else {
+            std::cerr << "Configuration not reloaded: " << error << std::endl;
+        }
+    }
+    // Started here, after the previous result is in, so it sees the current deny list
+    config_loader.startRequested(deny_list.getRevision());
+}
+
+void Server::applyConfig(const Config& config) {
+    password = config.password.empty() ? default_password : config.password;
+    // Reserved so connecting clients do not reallocate the index. Entries
+    // still shift when a client is removed, so keep indexes, not pointers.
+    max_clients = config.max_clients;
+    clients.reserve(max_clients);
+    throttle.setLimits(config.throttle_connections, config.throttle_window);
+    // A K-line or D-line set meanwhile has rewritten the file, the running list is newer
+    if (config.deny_revision == deny_list.getRevision()) {
+        deny_list = config.deny_list;
+        commandHandler->dropDeniedClients();
+    }
+    updateListeners(config.listen_ports, config.websocket_ports);
+    applySocketProfiles(config);
+}
+
+void Server::updateListeners(const std::set<int>& ports, const std::set<int>& websocket_ports) {
+    std::map<int, int>::iterator it = extra_listeners.begin();
+    while (it != extra_listeners.end()) {
+        if (ports.find(it->first) == ports.end() && websocket_ports.find(it->first) == websocket_ports.end()) {
+            std::cout << "No longer listening on port " << it->first << std::endl;
+            closeListener(it->second);
+            extra_listeners.erase(it++);
+        } else {
+            ++it;
+        }
+    }
+    for (std::set<int>::const_iterator port_it = ports.begin(); port_it != ports.end(); ++port_it) {
+        if (*port_it == port || *port_it == tls_port || extra_listeners.find(*port_it) != extra_listeners.end()) {
+            continue;
+        }
+        try {
+            extra_listeners[*port_it] = openListener(*port_it);
+        } catch (const std::exception& e) {
+            std::cerr << "Could not listen on port " << *port_it << ": " << e.what() << std::endl;
+        }
+    }
+    // A port moved between listen and websocket keeps its socket, only new connections change
+    websocket_listeners.clear();
+    for (std::set<int>::const_iterator port_it = websocket_ports.begin(); port_it != websocket_ports.end(); ++port_it) {
+        if (*port_it == port || *port_it == tls_port) {
+            continue;
+        }
+        if (extra_listeners.find(*port_it) == extra_listeners.end()) {
+            try {
+                extra_listeners[*port_it] = openListener(*port_it);
+            } catch (const std::exception& e) {
+                std::cerr << "Could not listen on port " << *port_it << ": " << e.what() << std::endl;
+                continue;
+            }
+        }
+        websocket_listeners.insert(extra_listeners[*port_it]);
+    }
+}
+
+void Server::applySocketProfiles(const Config& config) {
+    // Connections already accepted keep the options they were given
+    std::map<int, int> listeners(extra_listeners);
+    listeners[port] = server_fd;
+    if (tls_fd >= 0) {
+        listeners[tls_port] = tls_fd;
+    }
+    listener_profiles.clear();
+    for (std::map<int, int>::iterator it = listeners.begin(); it != listeners.end(); ++it) {
+        std::map<int, SocketProfile>::const_iterator port_profile = config.port_profiles.find(it->first);
+        SocketProfile profile = port_profile == config.port_profiles.end()
+                                ? config.socket_profile : config.socket_profile.merged(port_profile->second);
+        profile.applyToListener(it->second, it->first);
+        listener_profiles[it->second] = profile;
+    }
+    link_profile = config.socket_profile;
+}
+
+void Server::closeListener(int listen_fd) {
+    if (uring) {
+        detachIoUringClient(listen_fd);
+    }
+    close(listen_fd);
+}
+
+bool Server::startLogin(int client_index, const std::string& account, const std::string& password) {
+    const int client_fd = clients[client_index].fd;
+    if (pending_logins.count(client_fd)) {
+        return true; // One check at a time; the answer to the first is still to come
+    }
+    if (!accounts.submit(client_fd, ++login_serial, account, password)) {
+        return false;
+    }
+    pending_logins[client_fd] = login_serial;
+    clients[client_index].sasl_state = SASL_VERIFYING;
+    return true;
+}
+
+bool Server::startOperCheck(int client_index, const std::string& name, const std::string& password) {
+    const int client_fd = clients[client_index].fd;
+    if (pending_opers.count(client_fd)) {
+        return true; // One check at a time; the answer to the first is still to come
+    }
+    if (!accounts.submit(client_fd, ++login_serial, name, password, true)) {
+        return false;
+    }
+    pending_opers[client_fd] = login_serial;
+    return true;
+}
+
+void Server::completeOperCheck(const Accounts::Result& result) {
+    std::map<int, unsigned long>::iterator pending = pending_opers.find(result.client_fd);
+    int client_index = findClientByFd(result.client_fd);
+    if (pending == pending_opers.end() || pending->second != result.serial || client_index == -1) {
+        return;
+    }
+    pending_opers.erase(pending);
+    Client& client = clients[client_index];
+    if (!result.valid) {
+        sendMessage(client.fd, "464 " + client.nickname + " :Password incorrect");
+        std::cout << "Client " << client.nickname << " failed OPER as " << result.account << std::endl;
+        // Guessing costs a reconnect every few attempts
+        if (++oper_failures[client.fd] >= MAX_OPER_FAILURES) {
+            disconnectClient(client.fd, "Too many failed OPER attempts");
+        }
+        return;
+    }
+    oper_failures.erase(client.fd);
+    client.server_operator = true;
+    sendMessage(client.fd, "381 " + client.nickname + " :You are now an IRC operator");
+    propagate(":" + client.getPrefix() + " MODE " + client.nickname + " +o");
+    std::cout << "Client " << client.nickname << " is now an IRC operator" << std::endl;
+}
+
+void Server::completeLogins() {
+    Accounts::Result result;
+    while (accounts.nextResult(result)) {
+        if (result.oper) {
+            completeOperCheck(result);
+            continue;
+        }
+        // Clients that left, or whose fd was reused, meanwhile are not waiting any more
+        std::map<int, unsigned long>::iterator pending = pending_logins.find(result.client_fd);
+        int client_index = findClientByFd(result.client_fd);
+        if (pending == pending_logins.end() || pending->second != result.serial || client_index == -1) {
+            continue;
+        }
+        pending_logins.erase(pending);
+        Client& client = clients[client_index];
+        const std::string nick = client.nickname.empty() ? "*" : client.nickname;
+        client.sasl_state = SASL_NONE;
+        if (result.valid) {
+            client.account = result.account;
+            sendMessage(client.fd, "900 " + nick + " " + client.getPrefix() + " " + client.account
+                        + " :You are now logged in as " + client.account);
+            sendMessage(client.fd, "903 " + nick + " :SASL authentication successful");
+            std::cout << "Client " << client.fd << " logged in as " << client.account << std::endl;
+            login_failures.erase(client.fd);
+        } else {
+            sendMessage(client.fd, "904 " + nick + " :SASL authentication failed");
+            std::cout << "Client " << client.fd << " failed to log in as " << result.account << std::endl;
+            // Each failure doubles the wait before the next check, and enough of them end the connection
+            LoginFailures& failures = login_failures[client.fd];
+            if (++failures.count >= SASL_MAX_FAILURES) {
+                disconnectClient(client.fd, "Too many failed logins");
+                continue;
+            }
+            failures.retry_after = time(NULL) + (SASL_BACKOFF << (failures.count - 1));
+        }
+        commandHandler->completeRegistration(client_index);
+    }
+}
+
+time_t Server::loginBackoff(int client_fd) const {
+    std::map<int, LoginFailures>::const_iterator failures = login_failures.find(client_fd);
+    time_t now = time(NULL);
+    return failures == login_failures.end() || failures->second.retry_after <= now ? 0 : failures->second.retry_after - now;
+}
+
+void Server::failPendingLogins() {
+    // Checks still running would report to a process that no longer exists
+    for (std::map<int, unsigned long>::const_iterator it = pending_logins.begin(); it != pending_logins.end(); ++it) {
+        int client_index = findClientByFd(it->first);
+        if (client_index == -1) {
+            continue;
+        }
+        Client& client = clients[client_index];
+        client.sasl_state = SASL_NONE;
+        sendMessage(client.fd, "904 " + (client.nickname.empty() ? std::string("*") : client.nickname)
+                    + " :SASL authentication failed");
+        commandHandler->completeRegistration(client_index);
+    }
+    pending_logins.clear();
+    for (std::map<int, unsigned long>::const_iterator it = pending_opers.begin(); it != pending_opers.end(); ++it) {
+        int client_index = findClientByFd(it->first);
+        if (client_index != -1) {
+            sendMessage(it->first, "NOTICE " + clients[client_index].nickname + " :*** OPER check interrupted, please try again");
+        }
+    }
+    pending_opers.clear();
+}
+
+bool Server::admitConnection(int client_fd, const struct sockaddr_storage& client_addr) {
+    if (clients.size() - remote_users >= max_clients)
     {
         std::cerr << "Maximum amount of Clients reached. Connection rejected :(" << std::endl;
-        close(client_fd);
+        return false;
     }
-    else
+
+    if (!throttle.allow(ConnectionThrottle::keyFor(client_addr), time(NULL)))
     {
-        Client new_client;
-        new_client.fd = client_fd;
-        new_client.hostname = inet_ntoa(client_addr.sin_addr);
-        clients.push_back(new_client);
-        std::cout << "New client connected. client_fd: " << new_client.fd 
-                  << " from " << new_client.hostname << std::endl;
+        std::cerr << "Connection from " << addressToString(client_addr) << " throttled" << std::endl;
+        // Nothing is queued for this fd yet, a direct best-effort send is enough
+        const std::string error = "ERROR :Trying to reconnect too fast\r\n";
+        transport->send(client_fd, error.c_str(), error.length());
+        return false;
     }
+    return true;
 }
 
 void Server::handleClientMessage(int client_index) {
-    char buffer[BUFFER_SIZE];
-    ssize_t bytes_recv = recv(clients[client_index].fd, buffer, BUFFER_SIZE - 1, 0);
+    if (clients[client_index].tls_handshaking)
+    {
+        if (!continueHandshake(client_index) || clients[client_index].tls_handshaking)
+            return;
+        // Application data may have arrived right behind the final handshake flight
+    }
+
+    ssize_t bytes_recv = receiveInto(client_index);
 
     if (bytes_recv < 0)
     {
@@ -131,62 +627,252 @@ void Server::handleClientMessage(int client_index) {
         // Any other error means connection problem
         perror("recv");
         std::cout << "Client " << clients[client_index].fd << " disconnected due to error" << std::endl;
-        removeClient(client_index);
+        removeClient(client_index, "Read error");
         return;
     }
     
     if (bytes_recv == 0)
     {
         std::cout << "Client " << clients[client_index].fd << " disconnected" << std::endl;
-        removeClient(client_index);
+        removeClient(client_index, "Connection closed");
         return;
     }
 
-    buffer[bytes_recv] = '\0';
-    clients[client_index].buffer += buffer;
+    processClientInput(client_index);
+}
 
-    // Process complete messages (ending with \r\n or \n)
+void Server::processClientInput(int client_index) {
+    if (clients[client_index].websocket != WS_NONE) {
+        readWebSocket(client_index);
+    }
+    // Process complete messages (ending with \r\n or \n). Lines are consumed
+    // by offset and the buffer is compacted once after the loop, instead of
+    // copying the remaining data on every line.
+    const int client_fd = clients[client_index].fd;
+    std::map<int, ReceiveQueue>::iterator queue = receive_queues.find(client_fd);
+    if (queue == receive_queues.end()) {
+        return;
+    }
+    std::string& buffer = queue->second.lines;
+    size_t start = 0;
     size_t pos = 0;
-    while ((pos = clients[client_index].buffer.find('\n')) != std::string::npos)
+    while ((pos = buffer.find('\n', start)) != std::string::npos)
     {
-        std::string message = clients[client_index].buffer.substr(0, pos);
-        clients[client_index].buffer.erase(0, pos + 1);
+        std::string message = buffer.substr(start, pos - start);
+        start = pos + 1;
         
         if (!message.empty())
         {
-            std::cout << "Client " << clients[client_index].fd << " sent: " << message << std::endl;
+            std::cout << "Client " << client_fd << " sent: " << message << std::endl;
+            if (capture.isEnabled()) {
+                capture.line(client_fd, message[message.size() - 1] == '\r' ? message.substr(0, message.size() - 1) : message);
+            }
             IRCMessage parsed_msg = parseMessage(message);
+
+            // Peer servers speak the link protocol instead
+            if (isLink(client_fd)) {
+                // Lines are relayed verbatim, so they must not carry the CR along
+                if (message[message.size() - 1] == '\r') {
+                    message.erase(message.size() - 1);
+                }
+                handleLinkMessage(client_fd, message, parsed_msg);
+                // Remote users removed by the line moved later clients down
+                client_index = findClientByFd(client_fd);
+                if (isDisconnecting(client_fd)) {
+                    break;
+                }
+                continue;
+            }
             
             // Handle QUIT specially since it needs to remove the client
             if (!parsed_msg.command.empty()) {
-                std::string cmd = parsed_msg.command;
+                ArenaString cmd(parsed_msg.command.data(), parsed_msg.command.length());
                 for (size_t i = 0; i < cmd.length(); i++) {
                     cmd[i] = std::toupper(cmd[i]);
                 }
                 
                 if (cmd == "QUIT") {
                     std::string quit_msg = parsed_msg.trailing.empty() ? "Client Quit" : parsed_msg.trailing;
-                    std::cout << "Client " << clients[client_index].fd << " (" << clients[client_index].nickname 
+                    std::cout << "Client " << client_fd << " (" << clients[client_index].nickname 
                               << ") quit: " << quit_msg << std::endl;
-                    removeClient(client_index);
+                    removeClient(client_index, quit_msg);
                     return; // Important: return immediately after removing client
                 }
             }
             
             // Use command handler for other commands
             commandHandler->handleIRCMessage(client_index, parsed_msg);
+            client_index = findClientByFd(client_fd);
+
+            // Nothing more is read from a client that is being dropped
+            if (isDisconnecting(client_fd)) {
+                break;
+            }
         }
     }
+    // Idle clients hold no input buffer at all
+    buffer.erase(0, start);
+    if (queue->second.empty()) {
+        receive_queues.erase(queue);
+    }
 }
 
 void Server::sendMessage(int client_fd, const std::string& message) {
-    std::string full_message = message + "\r\n";
-    ssize_t bytes_sent = send(client_fd, full_message.c_str(), full_message.length(), 0);
+    // Remote users are reached through routeToUser() and routeToChannel(),
+    // and nothing follows the ERROR of a client being dropped
+    if (client_fd < 0 || isDisconnecting(client_fd)) {
+        return;
+    }
+    // Replies are only queued here; flushPendingOutput() writes everything
+    // generated during a loop tick with a single send() per client
+    int client_index = findClientByFd(client_fd);
+    if (client_index != -1 && clients[client_index].websocket != WS_NONE) {
+        // One line per frame, and none before the handshake or after the close frame
+        const Client& client = clients[client_index];
+        if (client.websocket == WS_OPEN) {
+            std::string& queue = send_queues[client_fd];
+            queue += client.websocket_text ? encodeWebSocketFrame(WS_TEXT, toValidUtf8(message))
+                                           : encodeWebSocketFrame(WS_BINARY, message);
+            checkSendQueue(client_fd, queue);
+        }
+        return;
+    }
+    std::string& queue = send_queues[client_fd];
+    queue += message;
+    queue += "\r\n";
+    checkSendQueue(client_fd, queue);
+}
+
+void Server::checkSendQueue(int client_fd, std::string& queue) {
+    // A client that stops reading would otherwise grow its queue without bound
+    const size_t limit = isLink(client_fd) ? LINK_SENDQ_LIMIT : SENDQ_LIMIT;
+    if (queue.length() <= limit || isDisconnecting(client_fd)) {
+        return;
+    }
+    std::cerr << "Client " << client_fd << " exceeded its SendQ (" << queue.length() << " bytes)" << std::endl;
+    // The rest of a message whose start is already on the wire stays, so the
+    // ERROR line begins on a line or frame boundary. While an io_uring send
+    // is in flight, the queue only holds whole messages after it.
+    size_t head = 0;
+    std::map<int, size_t>::const_iterator partial = send_heads.find(client_fd);
+    if (partial != send_heads.end() && !(uring && ioUringSendInFlight(client_fd))) {
+        head = partial->second;
+    }
+    std::string(queue, 0, head).swap(queue);
+    disconnectClient(client_fd, "SendQ exceeded");
+}
+
+// End of the queued message starting at offset: past the LF of a line, or
+// past a whole WebSocket frame (server frames are never masked)
+static size_t messageEnd(const Client& client, const std::string& queue, size_t offset) {
+    if (client.websocket == WS_NONE || client.websocket == WS_HANDSHAKE) {
+        size_t lf = queue.find('\n', offset);
+        return lf == std::string::npos ? queue.length() : lf + 1;
+    }
+    size_t header = 2;
+    if (queue.length() - offset < header) {
+        return queue.length();
+    }
+    uint64_t length = static_cast<unsigned char>(queue[offset + 1]) & 0x7f;
+    if (length >= 126) {
+        const size_t extended = length == 126 ? 2 : 8;
+        if (queue.length() - offset < header + extended) {
+            return queue.length();
+        }
+        length = 0;
+        for (size_t i = 0; i < extended; i++) {
+            length = (length << 8) | static_cast<unsigned char>(queue[offset + header + i]);
+        }
+        header += extended;
+    }
+    if (queue.length() - offset - header < length) {
+        return queue.length();
+    }
+    return offset + header + length;
+}
+
+void Server::notePartialSend(int client_fd, const std::string& queue, size_t sent) {
+    // Walk the messages from the known boundary to the one the write stopped in
+    std::map<int, size_t>::iterator partial = send_heads.find(client_fd);
+    size_t end = partial == send_heads.end() ? 0 : partial->second;
+    int client_index = findClientByFd(client_fd);
+    while (client_index != -1 && end < sent) {
+        end = messageEnd(clients[client_index], queue, end);
+    }
+    if (end > sent) {
+        send_heads[client_fd] = end - sent;
+    } else if (partial != send_heads.end()) {
+        send_heads.erase(partial);
+    }
+}
+
+bool Server::flushClient(int client_fd) {
+    std::map<int, std::string>::iterator it = send_queues.find(client_fd);
+    if (it == send_queues.end()) {
+        return true;
+    }
+    // Writing now would overtake the io_uring send already in flight
+    if (uring && ioUringSendInFlight(client_fd)) {
+        return false;
+    }
+
+    ssize_t bytes_sent = sendToClient(client_fd, it->second.data(), it->second.length());
     if (bytes_sent < 0) {
+        // Socket buffer is full, keep the data and wait for POLLOUT
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            return false;
+        }
         perror("send");
+        send_queues.erase(it);
+        send_heads.erase(client_fd);
+        disconnectClient(client_fd, "Write error");
+        return true;
+    }
+
+    if (static_cast<size_t>(bytes_sent) < it->second.length()) {
+        notePartialSend(client_fd, it->second, bytes_sent);
+        it->second.erase(0, bytes_sent);
+        return false;
     }
-    // Add flush to ensure immediate sending
-    fsync(client_fd);
+    send_queues.erase(it);
+    send_heads.erase(client_fd);
+    return true;
+}
+
+void Server::flushPendingOutput() {
+    std::map<int, std::string>::iterator it = send_queues.begin();
+    while (it != send_queues.end()) {
+        int client_fd = it->first;
+        ++it; // flushClient() may erase the current entry
+        if (uring && queueIoUringSend(client_fd)) {
+            continue; // Goes out with the next batched submission
+        }
+        flushClient(client_fd);
+    }
+}
+
+void Server::sendMessage(int client_fd, const OutgoingMessage& message) {
+    if (isDisconnecting(client_fd)) {
+        return;
+    }
+    int client_index = findClientByFd(client_fd);
+    if (client_index != -1 && clients[client_index].websocket != WS_NONE) {
+        const Client& client = clients[client_index];
+        if (client.websocket == WS_OPEN) {
+            std::string& queue = send_queues[client_fd];
+            queue += message.webSocketFrame(client.caps, client.websocket_text);
+            checkSendQueue(client_fd, queue);
+        }
+        return;
+    }
+    sendMessage(client_fd, message.forCaps(client_index == -1 ? 0 : clients[client_index].caps));
+}
+
+OutgoingMessage Server::makeMessage(const std::string& line, const std::string& client_tags) {
+    static const unsigned long start_time = static_cast<unsigned long>(time(NULL));
+    char msgid[48];
+    snprintf(msgid, sizeof(msgid), "%lx-%lx", start_time, ++msgid_counter);
+    return OutgoingMessage(line, History::formatTime(History::nowMs()), msgid, client_tags);
 }
 
 void Server::sendWelcomeMessages(int client_index) {
@@ -194,20 +880,19 @@ void Server::sendWelcomeMessages(int client_index) {
     std::string nick = client.nickname;
     
     sendMessage(client.fd, "001 " + nick + " :Welcome to the IRC Server, " + nick + "!");
-    sendMessage(client.fd, "002 " + nick + " :Your host is ircserv, running version 1.0");
+    sendMessage(client.fd, "002 " + nick + " :Your host is " + server_name + ", running version 1.0");
     sendMessage(client.fd, "003 " + nick + " :This server was created today");
-    sendMessage(client.fd, "004 " + nick + " ircserv 1.0 o o");
+    sendMessage(client.fd, "004 " + nick + " " + server_name + " 1.0 o o");
+    std::ostringstream isupport;
+    isupport << "005 " << nick << " MONITOR=" << MONITOR_LIMIT << " :are supported by this server";
+    sendMessage(client.fd, isupport.str());
     
     std::cout << "Sent welcome messages to " << nick << std::endl;
 }
 
 bool Server::isNicknameInUse(const std::string& nickname, int exclude_client_index) {
-    for (size_t i = 0; i < clients.size(); i++) {
-        if (static_cast<int>(i) != exclude_client_index && clients[i].nickname == nickname) {
-            return true;
-        }
-    }
-    return false;
+    int client_index = findClientByNickname(nickname);
+    return client_index != -1 && client_index != exclude_client_index;
 }
 
 bool Server::isValidChannelName(const std::string& name) {
@@ -215,67 +900,241 @@ bool Server::isValidChannelName(const std::string& name) {
 }
 
 void Server::broadcastToChannel(const std::string& channel_name, const std::string& message, int exclude_client_fd) {
-    if (channels.find(channel_name) == channels.end()) {
+    ChannelMap::const_iterator channel_it = channels.find(channel_name);
+    if (channel_it == channels.end()) {
         return;
     }
 
-    const std::set<int>& channel_clients = channels[channel_name].getClients();
-    for (std::set<int>::const_iterator it = channel_clients.begin(); it != channel_clients.end(); ++it) {
+    // Tags are serialized once here; each recipient only picks its variant
+    const OutgoingMessage outgoing = makeMessage(message);
+    const Channel::FdSet& channel_clients = channel_it->second.getClients();
+    for (Channel::FdSet::const_iterator it = channel_clients.begin(); it != channel_clients.end(); ++it) {
         if (*it != exclude_client_fd) {
-            sendMessage(*it, message);
+            sendMessage(*it, outgoing);
         }
     }
 }
 
-void Server::sendChannelUserList(int client_index, const std::string& channel_name) {
-    if (channels.find(channel_name) == channels.end()) {
-        return;
+void Server::broadcastToCommonChannels(int client_index, const std::string& message, bool include_self) {
+    broadcastToCommonChannels(clients[client_index], message, include_self);
+}
+
+void Server::broadcastToCommonChannels(Client& client, const std::string& message, bool include_self) {
+    // Recipients are stamped with this fan-out's epoch instead of being
+    // collected in a set, so a member of many shared channels is found
+    // repeatedly but gets the line once
+    const unsigned long epoch = ++fanout_epoch;
+    const OutgoingMessage outgoing = makeMessage(message);
+    client.fanout_epoch = epoch;
+    if (include_self) {
+        sendMessage(client.fd, outgoing);
+    }
+    const std::vector<Channel*>& shared = client.getChannels();
+    for (size_t i = 0; i < shared.size(); i++) {
+        const Channel::FdSet& members = shared[i]->getClients();
+        for (Channel::FdSet::const_iterator it = members.begin(); it != members.end(); ++it) {
+            // Remote members hear about it from their own server
+            if (*it < 0) {
+                continue;
+            }
+            int member_index = findClientByFd(*it);
+            if (member_index == -1 || clients[member_index].fanout_epoch == epoch) {
+                continue;
+            }
+            clients[member_index].fanout_epoch = epoch;
+            sendMessage(*it, outgoing);
+        }
     }
+}
 
-    const Channel& channel = channels[channel_name];
-    const std::set<int>& channel_clients = channel.getClients();
+void Server::sendChannelUserList(int client_index, const Channel& channel) {
+    const Channel::FdSet& channel_clients = channel.getClients();
+    const Client& client = clients[client_index];
+    const std::string head = "353 " + client.nickname + " = " + channel.getName() + " :";
     
+    // Long member lists are split across several 353 lines to stay within the line limit
     std::string user_list = "";
-    for (std::set<int>::const_iterator it = channel_clients.begin(); it != channel_clients.end(); ++it) {
-        // Find client by fd
-        for (size_t i = 0; i < clients.size(); i++) {
-            if (clients[i].fd == *it) {
-                if (!user_list.empty()) user_list += " ";
-                if (channel.isOperator(*it)) user_list += "@";
-                user_list += clients[i].nickname;
-                break;
-            }
+    for (Channel::FdSet::const_iterator it = channel_clients.begin(); it != channel_clients.end(); ++it) {
+        int member_index = findClientByFd(*it);
+        if (member_index == -1) {
+            continue;
         }
+        const std::string& nick = clients[member_index].nickname;
+        if (!user_list.empty() && head.length() + user_list.length() + nick.length() + 2 > NAMES_LINE_LIMIT) {
+            sendMessage(client.fd, head + user_list);
+            user_list.clear();
+        }
+        if (!user_list.empty()) user_list += " ";
+        if (channel.isOperator(*it)) user_list += "@";
+        user_list += nick;
     }
 
-    sendMessage(clients[client_index].fd, "353 " + clients[client_index].nickname + " = " + channel_name + " :" + user_list);
-    sendMessage(clients[client_index].fd, "366 " + clients[client_index].nickname + " " + channel_name + " :End of NAMES list");
+    sendMessage(client.fd, head + user_list);
+    sendMessage(client.fd, "366 " + client.nickname + " " + channel.getName() + " :End of NAMES list");
+}
+
+int Server::findClientByFd(int client_fd) const {
+    if (client_fd < 0) {
+        std::map<int, int>::const_iterator it = remote_index.find(client_fd);
+        return it == remote_index.end() ? -1 : it->second;
+    }
+    if (static_cast<size_t>(client_fd) >= index_by_fd.size()) {
+        return -1;
+    }
+    return index_by_fd[client_fd];
+}
+
+void Server::indexClients(size_t first_index) {
+    for (size_t i = first_index; i < clients.size(); i++) {
+        if (clients[i].isRemote()) {
+            remote_index[clients[i].fd] = static_cast<int>(i);
+            continue;
+        }
+        size_t fd = static_cast<size_t>(clients[i].fd);
+        if (fd >= index_by_fd.size()) {
+            index_by_fd.resize(fd + 1, -1);
+        }
+        index_by_fd[fd] = static_cast<int>(i);
+    }
 }
 
 int Server::findClientByNickname(const std::string& nickname) {
-    for (size_t i = 0; i < clients.size(); i++) {
-        if (clients[i].nickname == nickname) {
-            return static_cast<int>(i);
+    std::map<std::string, int>::const_iterator it = nick_index.find(ircLower(nickname));
+    if (it == nick_index.end()) {
+        return -1;
+    }
+    return findClientByFd(it->second);
+}
+
+void Server::setNickname(int client_index, const std::string& nickname) {
+    Client& client = clients[client_index];
+    // A change of case only is not a different user for MONITOR
+    const bool renamed = client.registered && ircLower(client.nickname) != ircLower(nickname);
+    if (renamed) {
+        notifyMonitors(client, false);
+    }
+    if (!client.nickname.empty()) {
+        nick_index.erase(ircLower(client.nickname));
+    }
+    client.nickname = nickname;
+    nick_index[ircLower(nickname)] = client.fd;
+    if (renamed) {
+        notifyMonitors(client, true);
+    }
+}
+
+bool Server::addMonitor(int client_index, const std::string& nickname) {
+    Client& client = clients[client_index];
+    const std::string name = ircLower(nickname);
+    if (client.monitoring.find(name) != client.monitoring.end()) {
+        return true;
+    }
+    if (client.monitoring.size() >= MONITOR_LIMIT) {
+        return false;
+    }
+    client.monitoring.insert(name);
+    monitors[name].insert(client.fd);
+    return true;
+}
+
+void Server::removeMonitor(int client_index, const std::string& nickname) {
+    Client& client = clients[client_index];
+    const std::string name = ircLower(nickname);
+    if (client.monitoring.erase(name) == 0) {
+        return;
+    }
+    std::map<std::string, std::set<int> >::iterator it = monitors.find(name);
+    if (it != monitors.end()) {
+        it->second.erase(client.fd);
+        if (it->second.empty()) {
+            monitors.erase(it);
         }
     }
-    return -1;
 }
 
-void Server::removeClientFromAllChannels(int client_index) {
-    const std::set<std::string>& client_channels = clients[client_index].getChannels();
-    for (std::set<std::string>::const_iterator it = client_channels.begin(); it != client_channels.end(); ++it) {
-        if (channels.find(*it) != channels.end()) {
-            channels[*it].removeClient(clients[client_index].fd);
+void Server::clearMonitors(int client_index) {
+    Client& client = clients[client_index];
+    for (std::set<std::string>::const_iterator name = client.monitoring.begin(); name != client.monitoring.end(); ++name) {
+        std::map<std::string, std::set<int> >::iterator it = monitors.find(*name);
+        if (it != monitors.end()) {
+            it->second.erase(client.fd);
+            if (it->second.empty()) {
+                monitors.erase(it);
+            }
         }
     }
+    client.monitoring.clear();
+}
+
+void Server::notifyMonitors(const Client& user, bool online) {
+    // Only the watchers of this nickname are visited, nobody polls
+    std::map<std::string, std::set<int> >::const_iterator it = monitors.find(ircLower(user.nickname));
+    if (it == monitors.end()) {
+        return;
+    }
+    const std::string target = online ? user.getPrefix() : user.nickname;
+    for (std::set<int>::const_iterator fd = it->second.begin(); fd != it->second.end(); ++fd) {
+        int watcher_index = findClientByFd(*fd);
+        if (watcher_index != -1) {
+            sendMessage(*fd, (online ? "730 " : "731 ") + clients[watcher_index].nickname + " :" + target);
+        }
+    }
+}
+
+void Server::removeClientFromAllChannels(int client_index) {
+    std::vector<Channel*> client_channels;
+    client_channels.swap(clients[client_index].channels);
+    for (size_t i = 0; i < client_channels.size(); i++) {
+        size_t old_count = client_channels[i]->getUserCount();
+        client_channels[i]->removeClient(clients[client_index].fd);
+        updateChannelSize(*client_channels[i], old_count);
+    }
+}
+
+Channel& Server::createChannel(const std::string& name) {
+    // Reuse the lookup as insertion hint
+    ChannelMap::iterator channel_it = channels.lower_bound(name);
+    if (channel_it == channels.end() || channel_it->first != name) {
+        channel_it = channels.insert(channel_it, std::make_pair(name, Channel(name)));
+        channels_by_size.insert(std::make_pair(static_cast<size_t>(0), name));
+    }
+    return channel_it->second;
+}
+
+bool Server::addToChannel(int client_index, Channel& channel) {
+    size_t old_count = channel.getUserCount();
+    if (!channel.addClient(clients[client_index].fd)) {
+        return false;
+    }
+    clients[client_index].joinChannel(&channel);
+    updateChannelSize(channel, old_count);
+    return true;
+}
+
+void Server::removeFromChannel(int client_index, Channel& channel) {
+    size_t old_count = channel.getUserCount();
+    if (channel.removeClient(clients[client_index].fd)) {
+        updateChannelSize(channel, old_count);
+    }
+    clients[client_index].leaveChannel(&channel);
+}
+
+void Server::updateChannelSize(const Channel& channel, size_t old_count) {
+    if (old_count == channel.getUserCount()) {
+        return;
+    }
+    channels_by_size.erase(std::make_pair(old_count, channel.getName()));
+    channels_by_size.insert(std::make_pair(channel.getUserCount(), channel.getName()));
 }
 
 void Server::cleanupEmptyChannels() {
-    std::map<std::string, Channel>::iterator it = channels.begin();
+    ChannelMap::iterator it = channels.begin();
     while (it != channels.end()) {
-        if (it->second.isEmpty()) {
-            std::map<std::string, Channel>::iterator to_erase = it;
+        if (it->second.isEmpty() && !it->second.isPermanent()) {
+            ChannelMap::iterator to_erase = it;
             ++it;
+            history.dropChannel(to_erase->first);
+            channels_by_size.erase(std::make_pair(static_cast<size_t>(0), to_erase->first));
             channels.erase(to_erase);
         } else {
             ++it;
@@ -283,17 +1142,247 @@ void Server::cleanupEmptyChannels() {
     }
 }
 
-void Server::removeClient(int client_index) {
+void Server::removeClient(int client_index, const std::string& reason) {
+    if (clients[client_index].isRemote()) {
+        // Remote users only exist in the indexes; their server told us they left
+        broadcastToCommonChannels(client_index, ":" + clients[client_index].getPrefix() + " QUIT :" + reason, false);
+        removeClientFromAllChannels(client_index);
+        notifyMonitors(clients[client_index], false);
+        nick_index.erase(ircLower(clients[client_index].nickname));
+        remote_index.erase(clients[client_index].fd);
+        clients.erase(client_index);
+        remote_users--;
+        indexClients(client_index);
+        cleanupEmptyChannels();
+        return;
+    }
+
+    const int client_fd = clients[client_index].fd;
+    if (isLink(client_fd)) {
+        // Everything reached through the link goes with it
+        dropLink(client_fd, reason);
+        client_index = findClientByFd(client_fd);
+    } else if (clients[client_index].registered) {
+        const std::string quit = ":" + clients[client_index].getPrefix() + " QUIT :" + reason;
+        propagate(quit);
+        broadcastToCommonChannels(client_index, quit, false);
+    }
+
     removeClientFromAllChannels(client_index);
-    close(clients[client_index].fd);
-    clients.erase(clients.begin() + client_index);
+    if (clients[client_index].websocket == WS_OPEN) {
+        send_queues[client_fd] += encodeWebSocketFrame(WS_CLOSE, std::string("\x03\xe8", 2)); // 1000, normal closure
+    }
+    // Best effort delivery of replies queued for this client before closing
+    flushClient(clients[client_index].fd);
+    send_queues.erase(clients[client_index].fd);
+    send_heads.erase(clients[client_index].fd);
+    // A reused descriptor must not inherit a pending disconnect
+    for (size_t i = pending_disconnects.size(); i-- > 0; ) {
+        if (pending_disconnects[i].first == client_fd) {
+            pending_disconnects.erase(pending_disconnects.begin() + i);
+        }
+    }
+    receive_queues.erase(clients[client_index].fd);
+    list_requests.erase(clients[client_index].fd);
+    resolver.cancel(clients[client_index].fd);
+    pending_logins.erase(clients[client_index].fd);
+    pending_opers.erase(clients[client_index].fd);
+    login_failures.erase(clients[client_index].fd);
+    oper_failures.erase(clients[client_index].fd);
+    offered_link_passwords.erase(clients[client_index].fd);
+    capture.closed(clients[client_index].fd);
+    clearMonitors(client_index);
+    if (clients[client_index].registered) {
+        notifyMonitors(clients[client_index], false);
+    }
+    if (!clients[client_index].nickname.empty()) {
+        nick_index.erase(ircLower(clients[client_index].nickname));
+    }
+    closeTlsSession(clients[client_index]);
+    if (uring) {
+        detachIoUringClient(clients[client_index].fd);
+    }
+    transport->close(clients[client_index].fd);
+    index_by_fd[clients[client_index].fd] = -1;
+    clients.erase(client_index);
+    indexClients(client_index); // Later clients moved down by one
     cleanupEmptyChannels();
 }
 
+void Server::disconnectClient(int client_fd, const std::string& reason) {
+    if (isDisconnecting(client_fd)) {
+        return;
+    }
+    sendMessage(client_fd, "ERROR :Closing Link: " + reason);
+    pending_disconnects.push_back(std::make_pair(client_fd, reason));
+}
+
+bool Server::isDisconnecting(int client_fd) const {
+    for (size_t i = 0; i < pending_disconnects.size(); i++) {
+        if (pending_disconnects[i].first == client_fd) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void Server::reapDisconnects() {
+    // removeClient() takes entries off the list, so work on a copy
+    std::vector<std::pair<int, std::string> > pending;
+    pending.swap(pending_disconnects);
+    for (size_t i = 0; i < pending.size(); i++) {
+        int client_index = findClientByFd(pending[i].first);
+        if (client_index != -1) {
+            std::cout << "Client " << pending[i].first << " (" << clients[client_index].nickname
+                      << ") disconnected by the server" << std::endl;
+            removeClient(client_index, pending[i].second);
+        }
+    }
+}
+
+void Server::startList(int client_fd, const ListRequest& request) {
+    int client_index = findClientByFd(client_fd);
+    if (client_index == -1) {
+        return;
+    }
+    // A LIST still streaming is cut short, so every 321 gets its 323
+    if (list_requests.erase(client_fd) > 0) {
+        sendMessage(client_fd, "323 " + clients[client_index].nickname + " :End of LIST");
+    }
+    sendMessage(client_fd, "321 " + clients[client_index].nickname + " Channel :Users Name");
+    list_requests[client_fd] = request;
+}
+
+// Whether a channel passes the ELIST topic-time filters of a request
+static bool matchesTopicFilters(const ListRequest& request, const Channel& channel) {
+    if (!request.topic_after && !request.topic_before) {
+        return true;
+    }
+    if (channel.getTopicTime() == 0) {
+        return false;
+    }
+    return (!request.topic_after || channel.getTopicTime() > request.topic_after)
+        && (!request.topic_before || channel.getTopicTime() < request.topic_before);
+}
+
+void Server::continueLists() {
+    std::map<int, ListRequest>::iterator it = list_requests.begin();
+    while (it != list_requests.end()) {
+        int client_fd = it->first;
+        ListRequest& request = it->second;
+        int client_index = findClientByFd(client_fd);
+
+        // Let the client drain what it already has before producing more
+        std::map<int, std::string>::const_iterator queue = send_queues.find(client_fd);
+        if (client_index == -1 || (queue != send_queues.end() && queue->second.length() > LIST_SENDQ_LIMIT)) {
+            ++it;
+            continue;
+        }
+
+        const std::string head = "322 " + clients[client_index].nickname + " ";
+        size_t emitted = 0;
+        bool finished = false;
+
+        if (request.by_size) {
+            // Size order: start at the smallest qualifying count, stop past the largest
+            std::set<std::pair<size_t, std::string> >::const_iterator entry = request.started
+                ? channels_by_size.upper_bound(request.last_size_key)
+                : channels_by_size.lower_bound(std::make_pair(request.min_users, std::string()));
+            for (; entry != channels_by_size.end() && emitted < LIST_CHUNK; ++entry) {
+                if (entry->first > request.max_users) {
+                    break;
+                }
+                request.last_size_key = *entry;
+                ChannelMap::const_iterator channel_it = channels.find(entry->second);
+                if (channel_it != channels.end() && matchesTopicFilters(request, channel_it->second)) {
+                    std::ostringstream line;
+                    line << head << entry->second << " " << entry->first << " :" << channel_it->second.getTopic();
+                    sendMessage(client_fd, line.str());
+                }
+                emitted++;
+            }
+            finished = entry == channels_by_size.end() || entry->first > request.max_users;
+        } else {
+            ChannelMap::const_iterator channel_it = request.started
+                ? channels.upper_bound(request.last_name)
+                : channels.begin();
+            for (; channel_it != channels.end() && emitted < LIST_CHUNK; ++channel_it) {
+                request.last_name = channel_it->first;
+                const Channel& channel = channel_it->second;
+                if (channel.getUserCount() <= request.max_users && matchesTopicFilters(request, channel)) {
+                    std::ostringstream line;
+                    line << head << channel_it->first << " " << channel.getUserCount() << " :" << channel.getTopic();
+                    sendMessage(client_fd, line.str());
+                }
+                emitted++;
+            }
+            finished = channel_it == channels.end();
+        }
+        request.started = true;
+
+        if (finished) {
+            sendMessage(client_fd, "323 " + clients[client_index].nickname + " :End of LIST");
+            list_requests.erase(it++);
+        } else {
+            ++it;
+        }
+    }
+}
+
+int Server::tickTimeout() {
+    // Sleep no longer than until the next channel snapshot is due
+    time_t now = time(NULL);
+    if (now >= next_snapshot) {
+        startSnapshot();
+        next_snapshot = now + SNAPSHOT_INTERVAL;
+    }
+    int timeout_ms = static_cast<int>(next_snapshot - now) * 1000;
+    // ...or until a hostname lookup needs a retransmission or times out
+    int lookup_ms = resolver.nextTimeout();
+    if (lookup_ms >= 0 && lookup_ms < timeout_ms) {
+        timeout_ms = lookup_ms;
+    }
+    return timeout_ms;
+}
+
+void Server::finishTick() {
+    // Write out everything queued during this tick, once per client
+    completeReload();
+    completeHostLookups();
+    completeLogins();
+    continueLists();
+    reapDisconnects();
+    flushPendingOutput();
+    history.flushLog();
+    capture.flush();
+    reapSnapshot();
+    // Nothing allocated from the arena outlives the tick
+    TickArena::instance().reset();
+}
+
 void Server::run() {
     std::vector<struct pollfd> poll_fds;
+
+    // SIGUSR2 hands the whole server over to a freshly started binary
+    signal(SIGUSR2, Server::handleUpgradeSignal);
+
+    const char* backend = getenv(IO_BACKEND_ENV);
+    if (backend && std::string(backend) == "io_uring") {
+        if (startIoUring()) {
+            runIoUring();
+            return;
+        }
+        std::cerr << "io_uring unavailable (" << std::strerror(errno) << "), using poll()" << std::endl;
+    }
     
     while (true) {
+        if (upgrade_requested) {
+            upgrade_requested = 0;
+            if (upgrade()) {
+                return;
+            }
+        }
+
         poll_fds.clear();
         
         // Add server socket
@@ -302,39 +1391,91 @@ void Server::run() {
         server_pollfd.events = POLLIN;
         server_pollfd.revents = 0;
         poll_fds.push_back(server_pollfd);
+        // The TLS listener, when enabled, always sits right after it
+        if (tls_fd >= 0) {
+            server_pollfd.fd = tls_fd;
+            poll_fds.push_back(server_pollfd);
+        }
+        // Then the listeners added by the config file
+        for (std::map<int, int>::iterator it = extra_listeners.begin(); it != extra_listeners.end(); ++it) {
+            server_pollfd.fd = it->second;
+            poll_fds.push_back(server_pollfd);
+        }
+        // Then the resolver socket, the account workers' eventfd and the reload descriptors
+        const size_t first_service = poll_fds.size();
+        if (resolver.isEnabled()) {
+            server_pollfd.fd = resolver.getFd();
+            poll_fds.push_back(server_pollfd);
+        }
+        if (accounts.isEnabled()) {
+            server_pollfd.fd = accounts.getFd();
+            poll_fds.push_back(server_pollfd);
+        }
+        if (config_loader.isEnabled()) {
+            server_pollfd.fd = config_loader.getSignalFd();
+            poll_fds.push_back(server_pollfd);
+            server_pollfd.fd = config_loader.getEventFd();
+            poll_fds.push_back(server_pollfd);
+        }
+        const size_t first_client = poll_fds.size();
         
         // Add client sockets
         for (size_t i = 0; i < clients.size(); i++) {
+            if (clients[i].isRemote()) {
+                continue;
+            }
             struct pollfd client_pollfd;
             client_pollfd.fd = clients[i].fd;
             client_pollfd.events = POLLIN;
+            // Wait for writability only while replies (or a streamed LIST) are pending
+            if (send_queues.find(clients[i].fd) != send_queues.end()
+                || list_requests.find(clients[i].fd) != list_requests.end()) {
+                client_pollfd.events |= POLLOUT;
+            }
+            // A TLS handshake waits on whichever direction OpenSSL asked for
+            if (clients[i].tls_handshaking) {
+                client_pollfd.events = clients[i].tls_want_write ? POLLOUT : POLLIN;
+            }
             client_pollfd.revents = 0;
             poll_fds.push_back(client_pollfd);
         }
         
+        int timeout_ms = tickTimeout();
+
         // Poll for events
-        int poll_result = poll(&poll_fds[0], poll_fds.size(), -1);
+        int poll_result = poll(&poll_fds[0], poll_fds.size(), timeout_ms);
         if (poll_result < 0) {
+            if (errno == EINTR) {
+                continue; // Interrupted by a signal, re-check the flags
+            }
             perror("poll");
             break;
         }
         
-        // Check server socket for new connections
-        if (poll_fds[0].revents & POLLIN) {
-            acceptNewClient();
+        // Check the listeners for new connections
+        for (size_t i = 0; i < first_service; i++) {
+            if (poll_fds[i].revents & POLLIN) {
+                acceptNewClient(poll_fds[i].fd);
+            }
+        }
+        for (size_t i = first_service; i < first_client; i++) {
+            if (poll_fds[i].revents & POLLIN) {
+                handleServiceEvent(poll_fds[i].fd);
+            }
         }
         
         // Check client sockets for messages
-        for (size_t i = 1; i < poll_fds.size(); i++) {
-            if (poll_fds[i].revents & POLLIN) {
-                // Find client index by fd
-                for (int j = static_cast<int>(clients.size()) - 1; j >= 0; j--) {
-                    if (clients[j].fd == poll_fds[i].fd) {
-                        handleClientMessage(j);
-                        break;
-                    }
+        for (size_t i = first_client; i < poll_fds.size(); i++) {
+            if (poll_fds[i].revents & (POLLIN | POLLOUT)) {
+                // Clients may have been removed earlier in this tick
+                int client_index = findClientByFd(poll_fds[i].fd);
+                // POLLOUT only matters here while a TLS handshake is in progress
+                if (client_index != -1 && ((poll_fds[i].revents & POLLIN) || clients[client_index].tls_handshaking)) {
+                    handleClientMessage(client_index);
                 }
             }
         }
+
+        finishTick();
     }
 }
\ No newline at end of file
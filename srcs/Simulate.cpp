@@ -0,0 +1,309 @@
+// ircsim: runs the server in-process against simulated clients connected
+// through a MemoryTransport, on a virtual clock. Clients connect at a fixed
+// rate, register, join channels, then talk in them; the server is stepped
+// once per virtual tick and the run goes as fast as the CPU allows, so
+// client counts far beyond what loopback sockets allow can be measured.
+
+#include "Server.hpp"
+#include "Transport.hpp"
+#include <cstdlib> // For std::strtoul, std::exit, setenv, mkdtemp
+#include <cstring> // For std::memset
+#include <fstream> // For std::ofstream, std::ifstream
+#include <iostream> // For std::cout, std::cerr
+#include <queue> // For std::priority_queue
+#include <dirent.h> // For opendir, readdir
+#include <stdint.h> // For uint64_t
+#include <unistd.h> // For chdir, unlink, rmdir, sysconf
+#include <sys/time.h> // For gettimeofday
+
+struct Options {
+    unsigned long clients;
+    unsigned long channels;
+    unsigned long joins;         // Channels each client joins
+    unsigned long connect_rate;  // New connections per virtual second
+    unsigned long message_rate;  // Messages per client per virtual minute
+    unsigned long duration;      // Virtual seconds of traffic after the last connection
+    unsigned long tick_ms;       // Virtual time per server loop tick
+    unsigned long hosts;         // Distinct source addresses, shared round-robin
+    unsigned long idents;        // Distinct usernames, shared the same way
+    unsigned long seed;
+    std::string port;            // The server's listener is opened but never served
+
+    Options() : clients(10000), channels(1000), joins(5), connect_rate(10000), message_rate(1), duration(60),
+                tick_ms(50), hosts(0), idents(0), seed(1), port("16667") {}
+};
+
+struct SimClient {
+    int fd;
+    bool registered;  // 001 seen
+    bool closed;      // Closed by the server
+
+    SimClient() : fd(-1), registered(false), closed(false) {}
+};
+
+struct Stats {
+    unsigned long registered;
+    unsigned long closed;
+    unsigned long refused;
+    unsigned long long lines_in;    // Sent to the server
+    unsigned long long lines_out;   // Received from it
+    unsigned long long bytes_out;
+    unsigned long ticks;
+
+    Stats() : registered(0), closed(0), refused(0), lines_in(0), lines_out(0), bytes_out(0), ticks(0) {}
+};
+
+static void usage(const char* name) {
+    std::cerr << "Usage: " << name << " [-c clients] [-n channels] [-j joins] [-r connects/s] [-m messages/min]"
+              << " [-d seconds] [-t tick_ms] [-a hosts] [-u idents] [-s seed] [-p port]" << std::endl;
+    std::exit(1);
+}
+
+static unsigned long parseOption(const char* name, const char* value, unsigned long min) {
+    char* end;
+    unsigned long number = std::strtoul(value, &end, 10);
+    if (*value == '\0' || *end != '\0' || number < min) {
+        usage(name);
+    }
+    return number;
+}
+
+// splitmix64: deterministic choices without storing them per client
+static uint64_t mix(uint64_t value) {
+    value += 0x9e3779b97f4a7c15ULL;
+    value = (value ^ (value >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    value = (value ^ (value >> 27)) * 0x94d049bb133111ebULL;
+    return value ^ (value >> 31);
+}
+
+static std::string number(unsigned long value) {
+    std::ostringstream text;
+    text << value;
+    return text.str();
+}
+
+// The k-th channel client i joins
+static std::string channelOf(const Options& options, unsigned long client, unsigned long k) {
+    return "#c" + number(mix(options.seed ^ (client * options.joins + k)) % options.channels);
+}
+
+// The 10.0.0.0/8 address of a source host
+static struct sockaddr_storage addressOf(unsigned long host) {
+    struct sockaddr_storage address;
+    std::memset(&address, 0, sizeof(address));
+    struct sockaddr_in* ipv4 = reinterpret_cast<struct sockaddr_in*>(&address);
+    ipv4->sin_family = AF_INET;
+    ipv4->sin_addr.s_addr = htonl(0x0a000000 | ((host + 1) & 0xffffff));
+    return address;
+}
+
+static uint64_t wallUs() {
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    return static_cast<uint64_t>(now.tv_sec) * 1000000 + now.tv_usec;
+}
+
+static unsigned long residentBytes() {
+    std::ifstream statm("/proc/self/statm");
+    unsigned long size = 0, resident = 0;
+    statm >> size >> resident;
+    return resident * static_cast<unsigned long>(sysconf(_SC_PAGESIZE));
+}
+
+// The simulated server runs in a scratch directory, away from real state files
+static std::string makeScratchDirectory() {
+    char path[] = "/tmp/ircsim.XXXXXX";
+    if (!mkdtemp(path) || chdir(path) != 0) {
+        std::cerr << "Error: could not create a scratch directory" << std::endl;
+        std::exit(1);
+    }
+    return path;
+}
+
+static void removeScratchDirectory(const std::string& path) {
+    DIR* directory = opendir(path.c_str());
+    if (directory) {
+        struct dirent* entry;
+        while ((entry = readdir(directory)) != NULL) {
+            std::string name = entry->d_name;
+            if (name != "." && name != "..") {
+                unlink((path + "/" + name).c_str());
+            }
+        }
+        closedir(directory);
+    }
+    if (chdir("/") != 0 || rmdir(path.c_str()) != 0) {
+        std::cerr << "Could not remove " << path << std::endl;
+    }
+}
+
+// Consumes what the server sent since the last tick
+static void readOutput(MemoryTransport& transport, std::vector<SimClient>& sim_clients, std::vector<int>& fds,
+                       int first_fd, Stats& stats) {
+    transport.takeWritten(fds);
+    for (size_t i = 0; i < fds.size(); i++) {
+        SimClient& client = sim_clients[fds[i] - first_fd];
+        std::string& output = transport.output(fds[i]);
+        stats.bytes_out += output.length();
+        for (size_t pos = output.find('\n'); pos != std::string::npos; pos = output.find('\n', pos + 1)) {
+            stats.lines_out++;
+        }
+        if (!client.registered && (output.compare(0, 4, "001 ") == 0 || output.find("\n001 ") != std::string::npos)) {
+            client.registered = true;
+            stats.registered++;
+        }
+        std::string().swap(output);
+        if (!client.closed && transport.isClosed(fds[i])) {
+            client.closed = true;
+            stats.closed++;
+        }
+    }
+}
+
+int main(int ac, char** av) {
+    Options options;
+    for (int i = 1; i < ac; i++) {
+        std::string option = av[i];
+        if (i + 1 >= ac) {
+            usage(av[0]);
+        }
+        const char* value = av[++i];
+        if (option == "-c") options.clients = parseOption(av[0], value, 1);
+        else if (option == "-n") options.channels = parseOption(av[0], value, 1);
+        else if (option == "-j") options.joins = parseOption(av[0], value, 0);
+        else if (option == "-r") options.connect_rate = parseOption(av[0], value, 1);
+        else if (option == "-m") options.message_rate = parseOption(av[0], value, 0);
+        else if (option == "-d") options.duration = parseOption(av[0], value, 0);
+        else if (option == "-t") options.tick_ms = parseOption(av[0], value, 1);
+        else if (option == "-a") options.hosts = parseOption(av[0], value, 1);
+        else if (option == "-u") options.idents = parseOption(av[0], value, 1);
+        else if (option == "-s") options.seed = parseOption(av[0], value, 0);
+        else if (option == "-p") options.port = value;
+        else usage(av[0]);
+    }
+
+    // Every client on its own address and with its own username unless told otherwise
+    if (options.hosts == 0 || options.hosts > options.clients) {
+        options.hosts = options.clients;
+    }
+    if (options.idents == 0 || options.idents > options.clients) {
+        options.idents = options.clients;
+    }
+
+    const std::string scratch = makeScratchDirectory();
+    {
+        // Clients sharing an address must not trip the connection throttle
+        std::ofstream config("ircserv.conf");
+        config << "max_clients = " << options.clients << "\n";
+        config << "throttle_connections = " << options.clients << "\n";
+    }
+    setenv("IRCSERV_RESOLVER", "off", 1);
+    // The server's per-line logging would dominate the run
+    std::streambuf* log = std::cout.rdbuf(NULL);
+
+    Stats stats;
+    uint64_t virtual_ms = 0;
+    uint64_t start_us = 0, connected_us = 0;
+    unsigned long base_rss = 0, connected_rss = 0;
+    int exit_code = 0;
+    try {
+        MemoryTransport transport; // Outlives the server, which closes its connections through it
+        Server server(options.port, "sim");
+        server.useMemoryTransport(&transport);
+
+        std::vector<SimClient> sim_clients;
+        sim_clients.reserve(options.clients);
+        int first_fd = -1;
+        // (due virtual ms, client) of each client's next message
+        typedef std::pair<uint64_t, unsigned long> Due;
+        std::priority_queue<Due, std::vector<Due>, std::greater<Due> > schedule;
+        const uint64_t message_interval = options.message_rate ? 60000 / options.message_rate : 0;
+        std::vector<int> fds;
+
+        base_rss = residentBytes();
+        start_us = wallUs();
+        uint64_t end_ms = 0;
+        while (sim_clients.size() < options.clients || virtual_ms < end_ms) {
+            // New connections due by now, registering and joining in their first lines
+            const uint64_t connect_due = (virtual_ms + options.tick_ms) * options.connect_rate / 1000;
+            while (sim_clients.size() < options.clients && sim_clients.size() < connect_due) {
+                const unsigned long id = sim_clients.size();
+                SimClient client;
+                client.fd = server.connectVirtual(addressOf(id % options.hosts));
+                if (client.fd < 0) {
+                    stats.refused++;
+                    client.closed = true;
+                } else {
+                    if (first_fd < 0) {
+                        first_fd = client.fd - static_cast<int>(id);
+                    }
+                    const std::string nick = "u" + number(id);
+                    const std::string user = "u" + number(id % options.idents);
+                    std::string lines = "PASS sim\r\nNICK " + nick + "\r\nUSER " + user + " 0 * :sim\r\n";
+                    for (unsigned long k = 0; k < options.joins; k++) {
+                        lines += "JOIN " + channelOf(options, id, k) + "\r\n";
+                    }
+                    transport.write(client.fd, lines);
+                    stats.lines_in += 3 + options.joins;
+                    if (message_interval && options.joins) {
+                        schedule.push(Due(virtual_ms + mix(options.seed ^ ~static_cast<uint64_t>(id)) % message_interval, id));
+                    }
+                }
+                sim_clients.push_back(client);
+                if (sim_clients.size() == options.clients) {
+                    end_ms = virtual_ms + options.duration * 1000;
+                }
+            }
+
+            // Messages due by now
+            while (!schedule.empty() && schedule.top().first <= virtual_ms) {
+                const unsigned long id = schedule.top().second;
+                const uint64_t due = schedule.top().first;
+                schedule.pop();
+                if (sim_clients[id].closed) {
+                    continue;
+                }
+                const std::string channel = channelOf(options, id, mix(due ^ id) % options.joins);
+                transport.write(sim_clients[id].fd, "PRIVMSG " + channel + " :message at " + number(due) + "\r\n");
+                stats.lines_in++;
+                schedule.push(Due(due + message_interval, id));
+            }
+
+            server.step();
+            stats.ticks++;
+            if (first_fd >= 0) {
+                readOutput(transport, sim_clients, fds, first_fd, stats);
+            }
+            if (connected_us == 0 && sim_clients.size() == options.clients) {
+                // Everyone connected and registered, before any talking
+                connected_us = wallUs();
+                connected_rss = residentBytes();
+            }
+            virtual_ms += options.tick_ms;
+        }
+    } catch (const std::exception& e) {
+        std::cout.rdbuf(log);
+        std::cerr << "Error: " << e.what() << std::endl;
+        exit_code = 1;
+    }
+    const uint64_t end_us = wallUs();
+    std::cout.rdbuf(log);
+    std::cout.clear();
+    removeScratchDirectory(scratch);
+    if (exit_code != 0) {
+        return exit_code;
+    }
+
+    const double wall = (end_us - start_us) / 1e6;
+    const unsigned long connected = options.clients - stats.refused;
+    std::cout << "Clients:        " << connected << " connected (" << stats.refused << " refused), "
+              << stats.registered << " registered, " << stats.closed << " closed by the server" << std::endl;
+    std::cout << "Virtual time:   " << virtual_ms / 1000.0 << " s in " << stats.ticks << " ticks" << std::endl;
+    std::cout << "Wall time:      " << wall << " s (connecting " << (connected_us - start_us) / 1e6 << " s)" << std::endl;
+    std::cout << "Lines in:       " << stats.lines_in << " (" << (wall > 0 ? stats.lines_in / wall : 0) << " per second)" << std::endl;
+    std::cout << "Lines out:      " << stats.lines_out << " (" << stats.bytes_out << " bytes)" << std::endl;
+    std::cout << "Memory:         " << connected_rss / 1024 << " KiB resident after connecting, "
+              << (connected ? (connected_rss > base_rss ? connected_rss - base_rss : 0) / connected : 0)
+              << " bytes per idle client" << std::endl;
+    return 0;
+}
@@ -0,0 +1,30 @@
+#include "Server.hpp"
+
+// A simulated server is built like any other, then has its client side
+// swapped for in-memory connections. Nothing polls: the driver feeds input
+// into the transport and calls step() for each loop tick.
+
+void Server::useMemoryTransport(MemoryTransport* memory) {
+    memory_transport = memory;
+    transport = memory;
+}
+
+int Server::connectVirtual(const struct sockaddr_storage& address) {
+    const int client_fd = memory_transport->open();
+    // Registered as if accepted on no listener: plaintext, default socket options
+    registerConnection(client_fd, address, -1);
+    return findClientByFd(client_fd) == -1 ? -1 : client_fd;
+}
+
+void Server::step() {
+    // Connections with input, as poll() would have reported them
+    std::vector<int> readable;
+    memory_transport->takeReadable(readable);
+    for (size_t i = 0; i < readable.size(); i++) {
+        int client_index = findClientByFd(readable[i]);
+        if (client_index != -1) {
+            handleClientMessage(client_index);
+        }
+    }
+    finishTick();
+}
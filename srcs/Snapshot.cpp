@@ -0,0 +1,281 @@
+#include "Server.hpp"
+#include <stdint.h> // For uint32_t
+#include <sys/mman.h> // For mmap
+#include <sys/stat.h> // For fstat
+#include <sys/wait.h> // For waitpid
+
+// Channel snapshots: the state of every permanent (+P) channel is written
+// periodically to a compact binary file by a forked child, so the event
+// loop never blocks on disk I/O. The parent encodes the snapshot and only
+// forks when it differs from what the file already holds. At startup the
+// file is mapped with mmap and the channels are rebuilt directly from the
+// mapping.
+//
+// File layout (all integers little-endian):
+//   "IRCSNAP3"  magic ("IRCSNAP2" files without topic times and "IRCSNAP1"
+//               files without mask lists still load)
+//   u32         channel count
+//   per channel:
+//     u32 length + bytes   name
+//     u32 length + bytes   topic
+//     u32                  topic set time (0 if never set)
+//     u32 length + bytes   key (empty if no +k)
+//     u32                  mode flags (SNAP_* below)
+//     u32                  user limit (+l)
+//     3 x mask list        bans (+b), exceptions (+e), invite exceptions (+I):
+//       u32                  entry count
+//       per entry: u32 length + bytes mask, u32 length + bytes setter, u32 set time
+
+static const char SNAPSHOT_MAGIC[8] = { 'I', 'R', 'C', 'S', 'N', 'A', 'P', '3' };
+
+enum {
+    SNAP_INVITE_ONLY = 1 << 0,
+    SNAP_TOPIC_RESTRICTED = 1 << 1,
+    SNAP_KEY = 1 << 2,
+    SNAP_USER_LIMIT = 1 << 3
+};
+
+static void putU32(std::string& out, uint32_t value) {
+    for (int i = 0; i < 4; i++) {
+        out += static_cast<char>((value >> (i * 8)) & 0xff);
+    }
+}
+
+static void putField(std::string& out, const std::string& value) {
+    putU32(out, static_cast<uint32_t>(value.length()));
+    out += value;
+}
+
+static bool getU32(const unsigned char*& pos, const unsigned char* end, uint32_t& value) {
+    if (end - pos < 4) {
+        return false;
+    }
+    value = pos[0] | (pos[1] << 8) | (pos[2] << 16) | (static_cast<uint32_t>(pos[3]) << 24);
+    pos += 4;
+    return true;
+}
+
+static bool getField(const unsigned char*& pos, const unsigned char* end, std::string& value) {
+    uint32_t length;
+    if (!getU32(pos, end, length) || static_cast<size_t>(end - pos) < length) {
+        return false;
+    }
+    value.assign(reinterpret_cast<const char*>(pos), length);
+    pos += length;
+    return true;
+}
+
+static void putMaskList(std::string& out, const MaskList& list) {
+    const std::vector<MaskList::Entry>& entries = list.getEntries();
+    putU32(out, static_cast<uint32_t>(entries.size()));
+    for (size_t i = 0; i < entries.size(); i++) {
+        putField(out, entries[i].mask);
+        putField(out, entries[i].setter);
+        putU32(out, static_cast<uint32_t>(entries[i].set_time));
+    }
+}
+
+static bool getMaskList(const unsigned char*& pos, const unsigned char* end, MaskList& list) {
+    uint32_t count;
+    if (!getU32(pos, end, count)) {
+        return false;
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        std::string mask, setter;
+        uint32_t set_time;
+        if (!getField(pos, end, mask) || !getField(pos, end, setter) || !getU32(pos, end, set_time)) {
+            return false;
+        }
+        list.add(mask, setter, static_cast<time_t>(set_time));
+    }
+    return true;
+}
+
+static std::string encodeSnapshot(const ChannelMap& channels) {
+    std::string data(SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+    std::string records;
+    uint32_t count = 0;
+
+    for (ChannelMap::const_iterator it = channels.begin(); it != channels.end(); ++it) {
+        const Channel& channel = it->second;
+        if (!channel.isPermanent()) {
+            continue;
+        }
+        uint32_t flags = 0;
+        if (channel.isInviteOnly()) flags |= SNAP_INVITE_ONLY;
+        if (channel.isTopicRestricted()) flags |= SNAP_TOPIC_RESTRICTED;
+        if (channel.hasKey()) flags |= SNAP_KEY;
+        if (channel.hasUserLimit()) flags |= SNAP_USER_LIMIT;
+
+        putField(records, channel.getName());
+        putField(records, channel.getTopic());
+        putU32(records, static_cast<uint32_t>(channel.getTopicTime()));
+        putField(records, channel.getKey());
+        putU32(records, flags);
+        putU32(records, static_cast<uint32_t>(channel.getUserLimit()));
+        putMaskList(records, channel.getBans());
+        putMaskList(records, channel.getExceptions());
+        putMaskList(records, channel.getInviteExceptions());
+        count++;
+    }
+    putU32(data, count);
+    return data + records;
+}
+
+// Maps a snapshot file read-only; NULL if there is none or it is too short to hold a header
+static const unsigned char* mapSnapshot(const char* path, size_t& size) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return NULL; // No snapshot yet
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_size < static_cast<off_t>(sizeof(SNAPSHOT_MAGIC) + 4)) {
+        close(fd);
+        return NULL;
+    }
+    size = static_cast<size_t>(st.st_size);
+    void* mapping = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        perror("mmap");
+        return NULL;
+    }
+    return static_cast<const unsigned char*>(mapping);
+}
+
+void Server::recallSnapshot() {
+    // A missing file holds no permanent channels
+    snapshot_data = encodeSnapshot(ChannelMap());
+    size_t size;
+    const unsigned char* mapping = mapSnapshot(SNAPSHOT_FILE, size);
+    if (mapping) {
+        snapshot_data.assign(reinterpret_cast<const char*>(mapping), size);
+        munmap(const_cast<unsigned char*>(mapping), size);
+    }
+}
+
+void Server::startSnapshot() {
+    if (snapshot_pid > 0) {
+        return; // Previous snapshot still being written
+    }
+    // Encoding happens here, not in the child: the worker threads may hold
+    // the malloc lock at fork time, so the child must not allocate
+    std::string data = encodeSnapshot(channels);
+    if (data == snapshot_data) {
+        return; // Nothing changed since the last snapshot
+    }
+    const char* tmp_path = SNAPSHOT_TMP_FILE;
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        return;
+    }
+    if (pid == 0) {
+        // Child: only async-signal-safe calls from here on
+        int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+        if (fd < 0) {
+            _exit(1);
+        }
+        size_t written = 0;
+        while (written < data.length()) {
+            ssize_t result = write(fd, data.data() + written, data.length() - written);
+            if (result < 0) {
+                if (errno == EINTR)
+                    continue;
+                close(fd);
+                _exit(1);
+            }
+            written += result;
+        }
+        // Readers only ever see a complete file
+        if (fsync(fd) < 0 || close(fd) < 0 || rename(tmp_path, SNAPSHOT_FILE) < 0) {
+            _exit(1);
+        }
+        _exit(0);
+    }
+    snapshot_pid = pid;
+    snapshot_writing.swap(data);
+}
+
+void Server::reapSnapshot() {
+    if (snapshot_pid <= 0) {
+        return;
+    }
+    int status;
+    pid_t result = waitpid(snapshot_pid, &status, WNOHANG);
+    if (result == snapshot_pid) {
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            std::cerr << "Channel snapshot failed" << std::endl;
+        } else {
+            snapshot_data.swap(snapshot_writing);
+        }
+        std::string().swap(snapshot_writing);
+        snapshot_pid = -1;
+    } else if (result < 0) {
+        std::string().swap(snapshot_writing);
+        snapshot_pid = -1;
+    }
+}
+
+void Server::loadSnapshot() {
+    recallSnapshot();
+    size_t size;
+    const unsigned char* mapping = mapSnapshot(SNAPSHOT_FILE, size);
+    if (!mapping) {
+        return;
+    }
+
+    const unsigned char* pos = mapping;
+    const unsigned char* end = pos + size;
+    uint32_t count = 0;
+    // Only the last magic byte differs between versions: 1 has no mask
+    // lists, 2 no topic times
+    char version = pos[sizeof(SNAPSHOT_MAGIC) - 1];
+    bool valid = std::memcmp(pos, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC) - 1) == 0;
+    valid = valid && version >= '1' && version <= SNAPSHOT_MAGIC[sizeof(SNAPSHOT_MAGIC) - 1];
+    bool has_lists = version >= '2';
+    bool has_topic_time = version >= '3';
+    pos += sizeof(SNAPSHOT_MAGIC);
+    valid = valid && getU32(pos, end, count);
+
+    size_t loaded = 0;
+    for (uint32_t i = 0; valid && i < count; i++) {
+        std::string name, topic, key;
+        uint32_t topic_time = 0, flags, limit;
+        if (!getField(pos, end, name) || !getField(pos, end, topic)
+            || (has_topic_time && !getU32(pos, end, topic_time)) || !getField(pos, end, key)
+            || !getU32(pos, end, flags) || !getU32(pos, end, limit) || !isValidChannelName(name)) {
+            valid = false;
+            break;
+        }
+
+        Channel& channel = createChannel(name);
+        channel.setPermanent(true);
+        if (!topic.empty()) {
+            channel.setTopic(topic, static_cast<time_t>(topic_time));
+        }
+        channel.setInviteOnly(flags & SNAP_INVITE_ONLY);
+        channel.setTopicRestricted(flags & SNAP_TOPIC_RESTRICTED);
+        if (flags & SNAP_KEY) {
+            channel.setKey(key);
+        }
+        if (flags & SNAP_USER_LIMIT) {
+            channel.setUserLimit(limit);
+        }
+        if (has_lists && (!getMaskList(pos, end, channel.getBans()) || !getMaskList(pos, end, channel.getExceptions())
+                          || !getMaskList(pos, end, channel.getInviteExceptions()))) {
+            valid = false;
+            break;
+        }
+        loaded++;
+    }
+    munmap(const_cast<unsigned char*>(mapping), size);
+
+    if (!valid) {
+        std::cerr << "Channel snapshot " << SNAPSHOT_FILE << " is corrupt, loaded " << loaded << " channels" << std::endl;
+    } else {
+        std::cout << "Restored " << loaded << " permanent channels from " << SNAPSHOT_FILE << std::endl;
+    }
+}
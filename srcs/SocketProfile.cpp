@@ -0,0 +1,61 @@
+#include "SocketProfile.hpp"
+#include <cstring> // For std::strerror
+#include <iostream> // For std::cerr
+#include <errno.h> // For errno
+#include <netinet/in.h> // For IPPROTO_TCP
+#include <netinet/tcp.h> // For TCP_NODELAY, TCP_DEFER_ACCEPT, TCP_KEEPIDLE...
+#include <sys/socket.h> // For setsockopt
+
+SocketProfile::SocketProfile()
+    : tcp_nodelay(-1), defer_accept(-1), receive_buffer(-1), send_buffer(-1), keepalive_idle(-1),
+      keepalive_interval(-1), keepalive_count(-1), user_timeout(-1), notsent_lowat(-1) {
+}
+
+static void overrideField(int& field, int value) {
+    if (value != -1) {
+        field = value;
+    }
+}
+
+SocketProfile SocketProfile::merged(const SocketProfile& overrides) const {
+    SocketProfile profile = *this;
+    overrideField(profile.tcp_nodelay, overrides.tcp_nodelay);
+    overrideField(profile.defer_accept, overrides.defer_accept);
+    overrideField(profile.receive_buffer, overrides.receive_buffer);
+    overrideField(profile.send_buffer, overrides.send_buffer);
+    overrideField(profile.keepalive_idle, overrides.keepalive_idle);
+    overrideField(profile.keepalive_interval, overrides.keepalive_interval);
+    overrideField(profile.keepalive_count, overrides.keepalive_count);
+    overrideField(profile.user_timeout, overrides.user_timeout);
+    overrideField(profile.notsent_lowat, overrides.notsent_lowat);
+    return profile;
+}
+
+// Sets an option unless the profile leaves it unset
+static bool setOption(int fd, int level, int name, int value) {
+    return value == -1 || setsockopt(fd, level, name, &value, sizeof(value)) == 0;
+}
+
+void SocketProfile::applyToListener(int listen_fd, int port) const {
+    // Buffer sizes must be on the listener already: the window scale is
+    // settled in the SYN-ACK, before the connection is accepted. Deferred
+    // accepts are switched off again when a reload drops the setting.
+    if (!setOption(listen_fd, IPPROTO_TCP, TCP_DEFER_ACCEPT, defer_accept == -1 ? 0 : defer_accept)
+        || !setOption(listen_fd, SOL_SOCKET, SO_RCVBUF, receive_buffer)
+        || !setOption(listen_fd, SOL_SOCKET, SO_SNDBUF, send_buffer)) {
+        std::cerr << "Could not apply the socket settings of port " << port << ": " << std::strerror(errno) << std::endl;
+    }
+}
+
+bool SocketProfile::applyToConnection(int fd) const {
+    bool ok = setOption(fd, IPPROTO_TCP, TCP_NODELAY, tcp_nodelay)
+              && setOption(fd, IPPROTO_TCP, TCP_USER_TIMEOUT, user_timeout)
+              && setOption(fd, IPPROTO_TCP, TCP_NOTSENT_LOWAT, notsent_lowat);
+    if (ok && keepalive_idle != -1) {
+        ok = setOption(fd, SOL_SOCKET, SO_KEEPALIVE, 1)
+             && setOption(fd, IPPROTO_TCP, TCP_KEEPIDLE, keepalive_idle)
+             && setOption(fd, IPPROTO_TCP, TCP_KEEPINTVL, keepalive_interval)
+             && setOption(fd, IPPROTO_TCP, TCP_KEEPCNT, keepalive_count);
+    }
+    return ok;
+}
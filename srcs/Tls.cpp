@@ -0,0 +1,169 @@
+#include "Server.hpp"
+#include <climits> // For INT_MAX
+#include <openssl/err.h> // For ERR_get_error
+
+// TLS listener: sessions are driven by the same poll() loop as plaintext
+// clients. The handshake runs non-blocking, waiting on whichever direction
+// OpenSSL asks for. With SSL_OP_ENABLE_KTLS, OpenSSL hands the negotiated
+// keys to the kernel once the handshake is done (if the kernel and cipher
+// support it); SSL_read/SSL_write then become plain socket calls and the
+// record encryption happens in the kernel instead of in this process.
+
+static std::string lastTlsError() {
+    unsigned long error = ERR_get_error();
+    ERR_clear_error();
+    if (!error) {
+        return "connection closed";
+    }
+    char text[256];
+    ERR_error_string_n(error, text, sizeof(text));
+    return text;
+}
+
+void Server::setupTls() {
+    // SSL_write() goes through write(), which raises SIGPIPE on a closed peer
+    signal(SIGPIPE, SIG_IGN);
+
+    tls_ctx = SSL_CTX_new(TLS_server_method());
+    if (!tls_ctx) {
+        throw std::runtime_error("TLS context creation failed");
+    }
+    SSL_CTX_set_min_proto_version(tls_ctx, TLS1_2_VERSION);
+    SSL_CTX_set_options(tls_ctx, SSL_OP_ENABLE_KTLS | SSL_OP_NO_RENEGOTIATION);
+    // Send queues are written in pieces and may move between attempts
+    SSL_CTX_set_mode(tls_ctx, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+
+    if (SSL_CTX_use_certificate_chain_file(tls_ctx, TLS_CERT_FILE) != 1
+        || SSL_CTX_use_PrivateKey_file(tls_ctx, TLS_KEY_FILE, SSL_FILETYPE_PEM) != 1
+        || SSL_CTX_check_private_key(tls_ctx) != 1) {
+        std::string error = lastTlsError();
+        SSL_CTX_free(tls_ctx);
+        tls_ctx = NULL;
+        throw std::runtime_error(std::string("cannot load ") + TLS_CERT_FILE + " / " + TLS_KEY_FILE + ": " + error);
+    }
+}
+
+bool Server::startTlsSession(Client& client) {
+    client.tls = SSL_new(tls_ctx);
+    if (!client.tls || SSL_set_fd(client.tls, client.fd) != 1) {
+        std::cerr << "TLS session setup failed: " << lastTlsError() << std::endl;
+        SSL_free(client.tls);
+        client.tls = NULL;
+        return false;
+    }
+    SSL_set_accept_state(client.tls);
+    client.tls_handshaking = true;
+    client.tls_want_write = false;
+    return true;
+}
+
+bool Server::continueHandshake(int client_index) {
+    Client& client = clients[client_index];
+    int result = SSL_do_handshake(client.tls);
+    if (result == 1) {
+        client.tls_handshaking = false;
+        client.tls_want_write = false;
+        std::cout << "TLS handshake with " << client.hostname << " complete (" << SSL_get_version(client.tls)
+                  << ", " << SSL_get_cipher_name(client.tls)
+                  << ", kTLS send " << (BIO_get_ktls_send(SSL_get_wbio(client.tls)) ? "on" : "off")
+                  << ", recv " << (BIO_get_ktls_recv(SSL_get_rbio(client.tls)) ? "on" : "off") << ")" << std::endl;
+        return true;
+    }
+
+    int error = SSL_get_error(client.tls, result);
+    if (error == SSL_ERROR_WANT_READ || error == SSL_ERROR_WANT_WRITE) {
+        client.tls_want_write = (error == SSL_ERROR_WANT_WRITE);
+        return true;
+    }
+    std::cerr << "TLS handshake with " << client.hostname << " failed: " << lastTlsError() << std::endl;
+    removeClient(client_index);
+    return false;
+}
+
+ssize_t Server::receiveInto(int client_index) {
+    Client& client = clients[client_index];
+    char buffer[BUFFER_SIZE];
+
+    if (!client.tls) {
+        ssize_t bytes_recv = transport->receive(client.fd, buffer, BUFFER_SIZE - 1);
+        if (bytes_recv > 0) {
+            appendInput(client, buffer, bytes_recv);
+        }
+        return bytes_recv;
+    }
+
+    // Read until OpenSSL runs dry: data it buffered is invisible to poll(), and
+    // the io_uring loop is only woken for new arrivals
+    ssize_t total = 0;
+    while (true) {
+        int bytes_read = SSL_read(client.tls, buffer, sizeof(buffer));
+        if (bytes_read <= 0) {
+            int error = SSL_get_error(client.tls, bytes_read);
+            if (total > 0) {
+                return total; // Report what was read; a close or error shows up on the next call
+            }
+            if (error == SSL_ERROR_WANT_READ || error == SSL_ERROR_WANT_WRITE) {
+                errno = EAGAIN;
+                return -1;
+            }
+            if (error == SSL_ERROR_ZERO_RETURN || (error == SSL_ERROR_SYSCALL && errno == 0)) {
+                return 0; // close_notify or plain EOF
+            }
+            if (error != SSL_ERROR_SYSCALL) {
+                std::cerr << "TLS error from " << client.hostname << ": " << lastTlsError() << std::endl;
+                errno = EPROTO;
+            }
+            return -1;
+        }
+        appendInput(client, buffer, bytes_read);
+        total += bytes_read;
+    }
+}
+
+ssize_t Server::sendToClient(int client_fd, const char* data, size_t length) {
+    int client_index = findClientByFd(client_fd);
+    if (client_index == -1 || !clients[client_index].tls) {
+        return transport->send(client_fd, data, length);
+    }
+
+    Client& client = clients[client_index];
+    if (client.tls_handshaking) {
+        errno = EAGAIN;
+        return -1;
+    }
+    int bytes_sent = SSL_write(client.tls, data, length > INT_MAX ? INT_MAX : static_cast<int>(length));
+    if (bytes_sent > 0) {
+        return bytes_sent;
+    }
+    int error = SSL_get_error(client.tls, bytes_sent);
+    if (error == SSL_ERROR_WANT_WRITE || error == SSL_ERROR_WANT_READ) {
+        errno = EAGAIN;
+    } else if (error != SSL_ERROR_SYSCALL) {
+        ERR_clear_error();
+        errno = EPROTO;
+    }
+    return -1;
+}
+
+void Server::closeTlsSession(Client& client) {
+    if (!client.tls) {
+        return;
+    }
+    // Best-effort close_notify; a non-blocking socket never waits for the peer's
+    if (!client.tls_handshaking) {
+        SSL_shutdown(client.tls);
+    }
+    SSL_free(client.tls);
+    ERR_clear_error();
+    client.tls = NULL;
+}
+
+void Server::dropTlsClients() {
+    // Session keys live in this process and cannot be handed to a new one
+    for (size_t i = clients.size(); i-- > 0; ) {
+        if (clients[i].tls) {
+            sendMessage(clients[i].fd, "ERROR :Closing Link: Server upgrading, please reconnect");
+            removeClient(i, "Server upgrading");
+        }
+    }
+}
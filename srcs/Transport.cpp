@@ -0,0 +1,146 @@
+#include "Transport.hpp"
+#include <errno.h> // For errno
+#include <unistd.h> // For close
+#include <sys/resource.h> // For getrlimit
+#include <sys/socket.h> // For recv, send
+
+Transport::~Transport() {
+}
+
+// ---- Kernel sockets ----
+
+SocketTransport::~SocketTransport() {
+}
+
+ssize_t SocketTransport::receive(int fd, char* buffer, size_t length) {
+    return ::recv(fd, buffer, length, 0);
+}
+
+ssize_t SocketTransport::send(int fd, const char* data, size_t length) {
+    return ::send(fd, data, length, MSG_NOSIGNAL);
+}
+
+void SocketTransport::close(int fd) {
+    ::close(fd);
+}
+
+// ---- In-process connections ----
+
+MemoryTransport::MemoryTransport() : first_fd(1024) {
+    // No real descriptor can reach the soft limit while it is in force
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur != RLIM_INFINITY && limit.rlim_cur > 1024) {
+        first_fd = static_cast<int>(limit.rlim_cur);
+    }
+}
+
+MemoryTransport::~MemoryTransport() {
+}
+
+MemoryTransport::Connection* MemoryTransport::find(int fd) {
+    if (fd < first_fd || static_cast<size_t>(fd - first_fd) >= connections.size()) {
+        return NULL;
+    }
+    return &connections[fd - first_fd];
+}
+
+void MemoryTransport::markReadable(int fd) {
+    readable.push_back(fd);
+}
+
+int MemoryTransport::open() {
+    connections.push_back(Connection());
+    return first_fd + static_cast<int>(connections.size() - 1);
+}
+
+void MemoryTransport::write(int fd, const std::string& data) {
+    Connection* connection = find(fd);
+    if (!connection || connection->server_closed || connection->client_closed) {
+        return;
+    }
+    if (connection->to_server.empty()) {
+        markReadable(fd);
+    }
+    connection->to_server += data;
+}
+
+void MemoryTransport::hangUp(int fd) {
+    Connection* connection = find(fd);
+    if (!connection || connection->client_closed) {
+        return;
+    }
+    connection->client_closed = true;
+    connection->to_client.clear();
+    if (!connection->server_closed) {
+        markReadable(fd);
+    }
+}
+
+std::string& MemoryTransport::output(int fd) {
+    return connections[fd - first_fd].to_client;
+}
+
+bool MemoryTransport::isClosed(int fd) const {
+    return connections[fd - first_fd].server_closed;
+}
+
+void MemoryTransport::takeWritten(std::vector<int>& fds) {
+    fds.clear();
+    fds.swap(written);
+}
+
+void MemoryTransport::takeReadable(std::vector<int>& fds) {
+    fds.clear();
+    fds.swap(readable);
+}
+
+ssize_t MemoryTransport::receive(int fd, char* buffer, size_t length) {
+    Connection* connection = find(fd);
+    if (!connection) {
+        return SocketTransport::receive(fd, buffer, length);
+    }
+    if (connection->to_server.empty()) {
+        if (connection->client_closed) {
+            return 0;
+        }
+        errno = EAGAIN;
+        return -1;
+    }
+    size_t count = connection->to_server.copy(buffer, length);
+    connection->to_server.erase(0, count);
+    // Level-triggered, like poll(): what is left is reported again
+    if (!connection->to_server.empty() || connection->client_closed) {
+        markReadable(fd);
+    }
+    return static_cast<ssize_t>(count);
+}
+
+ssize_t MemoryTransport::send(int fd, const char* data, size_t length) {
+    Connection* connection = find(fd);
+    if (!connection) {
+        return SocketTransport::send(fd, data, length);
+    }
+    if (connection->client_closed || connection->server_closed) {
+        errno = EPIPE;
+        return -1;
+    }
+    if (connection->to_client.empty()) {
+        written.push_back(fd);
+    }
+    connection->to_client.append(data, length);
+    return static_cast<ssize_t>(length);
+}
+
+void MemoryTransport::close(int fd) {
+    Connection* connection = find(fd);
+    if (!connection) {
+        SocketTransport::close(fd);
+        return;
+    }
+    connection->server_closed = true;
+    std::string().swap(connection->to_server);
+    // The client still gets to see what was sent before the close
+    if (!connection->client_closed) {
+        written.push_back(fd);
+    }
+}
@@ -0,0 +1,638 @@
+#include "Server.hpp"
+#include <algorithm> // For std::min
+#include <csignal> // For sig_atomic_t, kill
+#include <climits> // For PATH_MAX
+#include <stdint.h> // For uint32_t, uint64_t
+#include <sys/wait.h> // For waitpid
+#include <sys/uio.h> // For struct iovec
+
+extern char** environ;
+
+// Live upgrade: on SIGUSR2 the running server execs a fresh copy of its
+// binary and hands it the listening socket, every client socket and the
+// complete client/channel state over a UNIX socketpair. Clients stay
+// connected throughout; if the new process fails to resume, the old one
+// simply keeps serving. TLS sessions and server links cannot move between
+// processes: their users travel as departed entries, which the new process
+// announces as QUITs, and the old one closes those sockets once the new one
+// has taken over.
+//
+// The handoff opens with a magic number and the state format version. The
+// new process answers 'R' when it can read that version, before the old
+// one changes anything, so an upgrade between incompatible builds leaves
+// the running server untouched. Bump UPGRADE_VERSION on every change to
+// what serializeState() writes.
+
+static const uint64_t UPGRADE_MAGIC = 0x6972637365727675ULL; // "ircservu"
+static const uint64_t UPGRADE_VERSION = 3;
+
+volatile sig_atomic_t Server::upgrade_requested = 0;
+
+void Server::handleUpgradeSignal(int) {
+    upgrade_requested = 1;
+}
+
+// ---- State serialization helpers ----
+
+static void putNumber(std::string& out, uint64_t value) {
+    for (int i = 7; i >= 0; i--) {
+        out += static_cast<char>((value >> (i * 8)) & 0xff);
+    }
+}
+
+static void putString(std::string& out, const std::string& value) {
+    putNumber(out, value.length());
+    out += value;
+}
+
+class StateReader {
+    private:
+        const std::string& data;
+        size_t pos;
+
+    public:
+        StateReader(const std::string& state) : data(state), pos(0) {}
+
+        uint64_t getNumber() {
+            if (data.length() - pos < 8) {
+                throw std::runtime_error("upgrade state truncated");
+            }
+            uint64_t value = 0;
+            for (int i = 0; i < 8; i++) {
+                value = (value << 8) | static_cast<unsigned char>(data[pos++]);
+            }
+            return value;
+        }
+
+        std::string getString() {
+            uint64_t length = getNumber();
+            if (data.length() - pos < length) {
+                throw std::runtime_error("upgrade state truncated");
+            }
+            std::string value = data.substr(pos, length);
+            pos += length;
+            return value;
+        }
+};
+
+static void putFdSet(std::string& out, const Channel::FdSet& fds) {
+    putNumber(out, fds.size());
+    for (Channel::FdSet::const_iterator it = fds.begin(); it != fds.end(); ++it) {
+        putNumber(out, *it);
+    }
+}
+
+static void putMaskList(std::string& out, const MaskList& list) {
+    const std::vector<MaskList::Entry>& entries = list.getEntries();
+    putNumber(out, entries.size());
+    for (size_t i = 0; i < entries.size(); i++) {
+        putString(out, entries[i].mask);
+        putString(out, entries[i].setter);
+        putNumber(out, entries[i].set_time);
+    }
+}
+
+static void getMaskList(StateReader& reader, MaskList& list) {
+    uint64_t count = reader.getNumber();
+    for (uint64_t i = 0; i < count; i++) {
+        std::string mask = reader.getString();
+        std::string setter = reader.getString();
+        list.add(mask, setter, static_cast<time_t>(reader.getNumber()));
+    }
+}
+
+// ---- Socket helpers for the handoff channel ----
+
+static bool writeAll(int fd, const char* data, size_t length) {
+    while (length > 0) {
+        ssize_t written = send(fd, data, length, MSG_NOSIGNAL);
+        if (written < 0) {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        data += written;
+        length -= written;
+    }
+    return true;
+}
+
+static bool readAll(int fd, char* data, size_t length);
+
+// Waits for the one-byte answer of the new process
+static bool awaitReply(int fd, char expected, int timeout_ms) {
+    struct pollfd reply_poll;
+    reply_poll.fd = fd;
+    reply_poll.events = POLLIN;
+    reply_poll.revents = 0;
+    char reply = 0;
+    return poll(&reply_poll, 1, timeout_ms) == 1 && readAll(fd, &reply, 1) && reply == expected;
+}
+
+static bool readAll(int fd, char* data, size_t length) {
+    while (length > 0) {
+        ssize_t received = recv(fd, data, length, 0);
+        if (received < 0 && errno == EINTR)
+            continue;
+        if (received <= 0)
+            return false;
+        data += received;
+        length -= received;
+    }
+    return true;
+}
+
+// At most this many descriptors travel in one SCM_RIGHTS message (kernel limit is 253)
+static const size_t FDS_PER_MESSAGE = 200;
+
+static bool sendFds(int sock, const std::vector<int>& fds) {
+    for (size_t offset = 0; offset < fds.size(); offset += FDS_PER_MESSAGE) {
+        size_t count = std::min(FDS_PER_MESSAGE, fds.size() - offset);
+        std::vector<char> control(CMSG_SPACE(count * sizeof(int)), 0);
+        char marker = 'F';
+        struct iovec iov;
+        iov.iov_base = &marker;
+        iov.iov_len = 1;
+
+        struct msghdr msg;
+        std::memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = &control[0];
+        msg.msg_controllen = control.size();
+
+        struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(count * sizeof(int));
+        std::memcpy(CMSG_DATA(cmsg), &fds[offset], count * sizeof(int));
+
+        if (sendmsg(sock, &msg, MSG_NOSIGNAL) != 1) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool recvFds(int sock, std::vector<int>& fds, size_t count) {
+    while (fds.size() < count) {
+        size_t batch = std::min(FDS_PER_MESSAGE, count - fds.size());
+        std::vector<char> control(CMSG_SPACE(batch * sizeof(int)), 0);
+        char marker;
+        struct iovec iov;
+        iov.iov_base = &marker;
+        iov.iov_len = 1;
+
+        struct msghdr msg;
+        std::memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = &control[0];
+        msg.msg_controllen = control.size();
+
+        // Received descriptors stay close-on-exec, ready for the next upgrade
+        if (recvmsg(sock, &msg, MSG_CMSG_CLOEXEC) != 1) {
+            return false;
+        }
+        struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+        if (!cmsg || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) {
+            return false;
+        }
+        size_t received = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        const int* data = reinterpret_cast<const int*>(CMSG_DATA(cmsg));
+        fds.insert(fds.end(), data, data + received);
+    }
+    return true;
+}
+
+// A user the new process only learns about to announce their departure
+struct DepartedUser {
+    Client user; // Collects the channels the user was in
+    bool announce;
+    std::string reason;
+};
+
+// ---- Server side of the handoff ----
+
+bool Server::isHandedOver(const Client& client) const {
+    return !client.tls && !client.isRemote() && !isLink(client.fd);
+}
+
+std::string Server::serializeState() const {
+    std::string state;
+
+    putNumber(state, extra_listeners.size());
+    for (std::map<int, int>::const_iterator it = extra_listeners.begin(); it != extra_listeners.end(); ++it) {
+        putNumber(state, it->first);
+        putNumber(state, websocket_listeners.find(it->second) != websocket_listeners.end());
+    }
+
+    std::vector<const Client*> handed_over;
+    std::vector<const Client*> departed;
+    for (size_t i = 0; i < clients.size(); i++) {
+        (isHandedOver(clients[i]) ? handed_over : departed).push_back(&clients[i]);
+    }
+
+    putNumber(state, handed_over.size());
+    for (size_t i = 0; i < handed_over.size(); i++) {
+        const Client& client = *handed_over[i];
+        putNumber(state, client.fd);
+        putString(state, client.nickname);
+        putString(state, client.username);
+        putString(state, client.realname);
+        putString(state, client.hostname);
+        putString(state, client.address);
+        putNumber(state, client.authenticated);
+        putNumber(state, client.registered);
+        putNumber(state, client.caps);
+        putNumber(state, client.cap_negotiating);
+        putNumber(state, client.server_operator);
+        putString(state, client.account);
+        putNumber(state, capture.idOf(client.fd));
+        std::map<int, ReceiveQueue>::const_iterator input = receive_queues.find(client.fd);
+        const ReceiveQueue received = input == receive_queues.end() ? ReceiveQueue() : input->second;
+        putString(state, received.lines);
+        putNumber(state, client.websocket);
+        putNumber(state, client.websocket_text);
+        putNumber(state, client.websocket_fragmented);
+        putNumber(state, client.websocket_message_text);
+        putString(state, received.websocket_input);
+        putString(state, received.websocket_message);
+        // Channel memberships are rebuilt from the channels' member lists
+        putNumber(state, client.monitoring.size());
+        for (std::set<std::string>::const_iterator it = client.monitoring.begin(); it != client.monitoring.end(); ++it) {
+            putString(state, *it);
+        }
+
+        // Replies the socket would not take yet travel with the client
+        std::map<int, std::string>::const_iterator queue = send_queues.find(client.fd);
+        putString(state, queue == send_queues.end() ? "" : queue->second);
+        std::map<int, size_t>::const_iterator head = send_heads.find(client.fd);
+        putNumber(state, head == send_heads.end() ? 0 : head->second);
+    }
+
+    putNumber(state, departed.size());
+    for (size_t i = 0; i < departed.size(); i++) {
+        const Client& client = *departed[i];
+        putNumber(state, client.fd);
+        putNumber(state, client.registered && !isLink(client.fd));
+        putString(state, client.nickname);
+        putString(state, client.username);
+        putString(state, client.hostname);
+        putNumber(state, capture.idOf(client.fd));
+        // Remote users quit as in a netsplit of the link that introduced them
+        std::map<int, ServerLink>::const_iterator link = links.find(client.link_fd);
+        putString(state, link != links.end() ? server_name + " " + link->second.name : "Server upgrading");
+    }
+
+    putNumber(state, channels.size());
+    for (ChannelMap::const_iterator it = channels.begin(); it != channels.end(); ++it) {
+        const Channel& channel = it->second;
+        putString(state, channel.getName());
+        putString(state, channel.getTopic());
+        putNumber(state, channel.getTopicTime());
+        putNumber(state, channel.hasKey());
+        putString(state, channel.getKey());
+        putNumber(state, channel.isInviteOnly());
+        putNumber(state, channel.isTopicRestricted());
+        putNumber(state, channel.hasUserLimit());
+        putNumber(state, channel.getUserLimit());
+        putNumber(state, channel.isPermanent());
+        putFdSet(state, channel.getClients());
+        putFdSet(state, channel.getOperators());
+        putFdSet(state, channel.getInvited());
+        putMaskList(state, channel.getBans());
+        putMaskList(state, channel.getExceptions());
+        putMaskList(state, channel.getInviteExceptions());
+    }
+
+    return state;
+}
+
+void Server::restoreState(const std::string& state, const std::vector<int>& fds) {
+    StateReader reader(state);
+    std::map<int, int> fd_map; // Descriptor in the old process -> descriptor here
+    size_t next_fd = 0;
+
+    server_fd = fds[next_fd++];
+    // The new process was started with the same TLS port, if any
+    if (tls_port) {
+        tls_fd = fds[next_fd++];
+    }
+
+    // Listeners the config file added come next, in port order
+    uint64_t listener_count = reader.getNumber();
+    for (uint64_t i = 0; i < listener_count && next_fd < fds.size(); i++) {
+        int listen_port = static_cast<int>(reader.getNumber());
+        if (reader.getNumber()) {
+            websocket_listeners.insert(fds[next_fd]);
+        }
+        extra_listeners[listen_port] = fds[next_fd++];
+    }
+
+    uint64_t client_count = reader.getNumber();
+    if (fds.size() != client_count + next_fd) {
+        throw std::runtime_error("upgrade descriptor count mismatch");
+    }
+    for (uint64_t i = 0; i < client_count; i++) {
+        Client client;
+        int old_fd = static_cast<int>(reader.getNumber());
+        client.fd = fds[next_fd++];
+        fd_map[old_fd] = client.fd;
+        client.nickname = reader.getString();
+        client.username = reader.getString();
+        client.realname = reader.getString();
+        client.hostname = reader.getString();
+        client.address = reader.getString();
+        client.authenticated = reader.getNumber() != 0;
+        client.registered = reader.getNumber() != 0;
+        client.caps = static_cast<unsigned int>(reader.getNumber());
+        client.cap_negotiating = reader.getNumber() != 0;
+        client.server_operator = reader.getNumber() != 0;
+        client.account = reader.getString();
+        capture.resume(client.fd, static_cast<unsigned long>(reader.getNumber()));
+        ReceiveQueue received;
+        received.lines = reader.getString();
+        client.websocket = static_cast<WebSocketState>(reader.getNumber());
+        client.websocket_text = reader.getNumber() != 0;
+        client.websocket_fragmented = reader.getNumber() != 0;
+        client.websocket_message_text = reader.getNumber() != 0;
+        received.websocket_input = reader.getString();
+        received.websocket_message = reader.getString();
+        if (!received.empty()) {
+            receive_queues[client.fd] = received;
+        }
+
+        uint64_t monitor_count = reader.getNumber();
+        for (uint64_t j = 0; j < monitor_count; j++) {
+            const std::string name = reader.getString();
+            client.monitoring.insert(name);
+            monitors[name].insert(client.fd);
+        }
+
+        std::string pending = reader.getString();
+        if (!pending.empty()) {
+            send_queues[client.fd] = pending;
+        }
+        size_t head = static_cast<size_t>(reader.getNumber());
+        if (head > 0) {
+            send_heads[client.fd] = head;
+        }
+        clients.push_back(client);
+        indexClients(clients.size() - 1);
+        if (!client.nickname.empty()) {
+            nick_index[ircLower(client.nickname)] = client.fd;
+        }
+    }
+
+    std::map<int, DepartedUser> departed; // By id in the old process
+    uint64_t departed_count = reader.getNumber();
+    for (uint64_t i = 0; i < departed_count; i++) {
+        DepartedUser& entry = departed[static_cast<int>(reader.getNumber())];
+        entry.announce = reader.getNumber() != 0;
+        entry.user.nickname = reader.getString();
+        entry.user.username = reader.getString();
+        entry.user.hostname = reader.getString();
+        capture.resumeClosed(static_cast<unsigned long>(reader.getNumber()));
+        entry.reason = reader.getString();
+    }
+
+    uint64_t channel_count = reader.getNumber();
+    for (uint64_t i = 0; i < channel_count; i++) {
+        std::string name = reader.getString();
+        Channel& channel = createChannel(name);
+
+        std::string topic = reader.getString();
+        time_t topic_time = static_cast<time_t>(reader.getNumber());
+        if (!topic.empty()) {
+            channel.setTopic(topic, topic_time);
+        }
+        bool has_key = reader.getNumber() != 0;
+        std::string key = reader.getString();
+        if (has_key) {
+            channel.setKey(key);
+        }
+        channel.setInviteOnly(reader.getNumber() != 0);
+        channel.setTopicRestricted(reader.getNumber() != 0);
+        bool has_limit = reader.getNumber() != 0;
+        size_t limit = static_cast<size_t>(reader.getNumber());
+        channel.setPermanent(reader.getNumber() != 0);
+
+        // Members go in before the limit is applied so a full channel restores intact
+        uint64_t member_count = reader.getNumber();
+        for (uint64_t j = 0; j < member_count; j++) {
+            int old_fd = static_cast<int>(reader.getNumber());
+            std::map<int, int>::iterator mapped = fd_map.find(old_fd);
+            if (mapped != fd_map.end()) {
+                channel.addClient(mapped->second);
+                clients[findClientByFd(mapped->second)].joinChannel(&channel);
+            } else if (departed.count(old_fd)) {
+                departed[old_fd].user.joinChannel(&channel);
+            }
+        }
+        updateChannelSize(channel, 0);
+        // addClient() promotes the first member; replace that with the saved operators
+        Channel::FdSet promoted = channel.getOperators();
+        for (Channel::FdSet::const_iterator it = promoted.begin(); it != promoted.end(); ++it) {
+            channel.removeOperator(*it);
+        }
+        uint64_t operator_count = reader.getNumber();
+        for (uint64_t j = 0; j < operator_count; j++) {
+            std::map<int, int>::iterator mapped = fd_map.find(static_cast<int>(reader.getNumber()));
+            if (mapped != fd_map.end()) {
+                channel.addOperator(mapped->second);
+            }
+        }
+        uint64_t invited_count = reader.getNumber();
+        for (uint64_t j = 0; j < invited_count; j++) {
+            std::map<int, int>::iterator mapped = fd_map.find(static_cast<int>(reader.getNumber()));
+            if (mapped != fd_map.end()) {
+                channel.inviteClient(mapped->second);
+            }
+        }
+        getMaskList(reader, channel.getBans());
+        getMaskList(reader, channel.getExceptions());
+        getMaskList(reader, channel.getInviteExceptions());
+        if (has_limit) {
+            channel.setUserLimit(limit);
+        }
+    }
+
+    // The users left behind quit from everyone's point of view
+    for (std::map<int, DepartedUser>::iterator it = departed.begin(); it != departed.end(); ++it) {
+        Client& user = it->second.user;
+        if (it->second.announce) {
+            broadcastToCommonChannels(user, ":" + user.getPrefix() + " QUIT :" + it->second.reason, false);
+            notifyMonitors(user, false);
+        }
+    }
+    cleanupEmptyChannels();
+}
+
+bool Server::upgrade() {
+    char exe[PATH_MAX];
+    ssize_t exe_len = readlink("/proc/self/exe", exe, sizeof(exe) - 1);
+    if (exe_len < 0) {
+        perror("readlink");
+        return false;
+    }
+    std::string exe_path(exe, exe_len);
+    // A deploy that replaced the binary leaves the old inode marked as deleted;
+    // the path itself now names the new binary, which is what we want to run
+    const std::string deleted = " (deleted)";
+    if (exe_path.length() > deleted.length() && exe_path.compare(exe_path.length() - deleted.length(), deleted.length(), deleted) == 0) {
+        exe_path.erase(exe_path.length() - deleted.length());
+    }
+
+    // Get as much pending output as possible onto the sockets first
+    flushPendingOutput();
+
+    int handoff[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, handoff) < 0) {
+        perror("socketpair");
+        return false;
+    }
+
+    // The worker threads may hold locks at fork time, so the child only
+    // calls async-signal-safe functions: everything exec needs is built here
+    std::ostringstream fd_str, port_str, tls_port_str;
+    fd_str << handoff[1];
+    port_str << port;
+    tls_port_str << tls_port;
+    std::string arg_port = port_str.str();
+    std::string arg_password = default_password;
+    std::string arg_tls_port = tls_port_str.str();
+    char* argv[] = { &exe_path[0], &arg_port[0], &arg_password[0], tls_port ? &arg_tls_port[0] : NULL, NULL };
+
+    const std::string env_prefix = std::string(UPGRADE_ENV) + "=";
+    std::vector<std::string> env_strings;
+    for (char** entry = environ; *entry; entry++) {
+        if (std::strncmp(*entry, env_prefix.c_str(), env_prefix.length()) != 0) {
+            env_strings.push_back(*entry);
+        }
+    }
+    env_strings.push_back(env_prefix + fd_str.str());
+    std::vector<char*> envp;
+    for (size_t i = 0; i < env_strings.size(); i++) {
+        envp.push_back(&env_strings[i][0]);
+    }
+    envp.push_back(NULL);
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        close(handoff[0]);
+        close(handoff[1]);
+        return false;
+    }
+    if (pid == 0) {
+        // Child: only the handoff socket survives exec
+        close(handoff[0]);
+        fcntl(handoff[1], F_SETFD, 0);
+        execve(exe_path.c_str(), argv, &envp[0]);
+        const char message[] = "execve: could not start the new binary\n";
+        ssize_t written = write(STDERR_FILENO, message, sizeof(message) - 1);
+        _exit(written < 0 ? 2 : 1);
+    }
+    close(handoff[1]);
+
+    // Nothing is changed until the new process has accepted the state format
+    std::string hello;
+    putNumber(hello, UPGRADE_MAGIC);
+    putNumber(hello, UPGRADE_VERSION);
+    bool ok = writeAll(handoff[0], hello.data(), hello.length())
+        && awaitReply(handoff[0], 'R', UPGRADE_TIMEOUT_MS);
+
+    if (ok) {
+        // Lookups and logins still running are given up; those clients register without them
+        resolver.abandonAll();
+        completeHostLookups();
+        completeLogins();
+        failPendingLogins();
+        // The new process appends to the capture file as soon as it runs
+        capture.drain();
+        std::string state = serializeState();
+        std::vector<int> fds;
+        fds.push_back(server_fd);
+        if (tls_fd >= 0) {
+            fds.push_back(tls_fd);
+        }
+        for (std::map<int, int>::iterator it = extra_listeners.begin(); it != extra_listeners.end(); ++it) {
+            fds.push_back(it->second);
+        }
+        for (size_t i = 0; i < clients.size(); i++) {
+            if (isHandedOver(clients[i])) {
+                fds.push_back(clients[i].fd);
+            }
+        }
+
+        std::string header;
+        putNumber(header, state.length());
+        putNumber(header, fds.size());
+
+        // Wait for the new process to confirm it has taken over
+        ok = writeAll(handoff[0], header.data(), header.length())
+            && writeAll(handoff[0], state.data(), state.length())
+            && sendFds(handoff[0], fds)
+            && awaitReply(handoff[0], 'K', UPGRADE_TIMEOUT_MS);
+    }
+    close(handoff[0]);
+
+    if (!ok) {
+        std::cerr << "Upgrade failed, continuing with the current process" << std::endl;
+        kill(pid, SIGKILL);
+        waitpid(pid, NULL, 0);
+        return false;
+    }
+    // Only now that the new process serves everyone else are the rest let go
+    capture.detach();
+    dropLinks();
+    dropTlsClients();
+    std::cout << "Handed over to new process " << pid << std::endl;
+    return true;
+}
+
+void Server::resumeFromUpgrade(int handoff_fd) {
+    char hello[16];
+    if (!readAll(handoff_fd, hello, sizeof(hello))) {
+        close(handoff_fd);
+        throw std::runtime_error("upgrade handoff: missing header");
+    }
+    const std::string hello_data(hello, sizeof(hello));
+    StateReader hello_reader(hello_data);
+    uint64_t magic = hello_reader.getNumber();
+    uint64_t version = hello_reader.getNumber();
+    // Refused before the old process gives anything up, so it keeps serving
+    const char answer = magic == UPGRADE_MAGIC && version == UPGRADE_VERSION ? 'R' : 'V';
+    writeAll(handoff_fd, &answer, 1);
+    if (answer != 'R') {
+        close(handoff_fd);
+        throw std::runtime_error("upgrade handoff: unsupported state format");
+    }
+
+    char header[16];
+    if (!readAll(handoff_fd, header, sizeof(header))) {
+        close(handoff_fd);
+        throw std::runtime_error("upgrade handoff: missing header");
+    }
+    const std::string header_data(header, sizeof(header));
+    StateReader header_reader(header_data);
+    uint64_t state_length = header_reader.getNumber();
+    uint64_t fd_count = header_reader.getNumber();
+
+    std::string state(state_length, '\0');
+    std::vector<int> fds;
+    if ((state_length && !readAll(handoff_fd, &state[0], state_length)) || fd_count == 0
+        || !recvFds(handoff_fd, fds, fd_count)) {
+        close(handoff_fd);
+        throw std::runtime_error("upgrade handoff: incomplete transfer");
+    }
+
+    restoreState(state, fds);
+
+    const char ack = 'K';
+    writeAll(handoff_fd, &ack, 1);
+    close(handoff_fd);
+    std::cout << "Resumed " << clients.size() << " clients and " << channels.size()
+              << " channels from previous process" << std::endl;
+}
@@ -0,0 +1,371 @@
+#include "Server.hpp"
+
+// io_uring event loop, selected with IRCSERV_IO_BACKEND=io_uring.
+//
+// Listeners use multishot accept and plaintext clients multishot recv into
+// the ring's provided buffers, so a steady stream of input costs no
+// syscalls beyond the one io_uring_enter() per tick. All replies queued
+// during a tick are submitted as sends in that same io_uring_enter().
+// TLS clients keep going through OpenSSL and only use io_uring for readiness
+// (multishot POLLIN, one-shot POLLOUT while output or a handshake waits),
+// and so do the resolver's socket, the account workers' eventfd and the
+// configuration reload descriptors.
+//
+// Every request is tagged with its operation, the descriptor and the
+// descriptor's generation; the generation changes when a client is closed so
+// late completions for a reused descriptor number are recognized and dropped.
+
+enum UringOp {
+    URING_ACCEPT = 1,
+    URING_RECV,
+    URING_POLL_IN,
+    URING_POLL_OUT,
+    URING_SEND,
+    URING_CANCEL,
+    URING_SERVICE
+};
+
+static long long monotonicMs() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return static_cast<long long>(now.tv_sec) * 1000 + now.tv_nsec / 1000000;
+}
+
+static uint64_t uringTag(UringOp op, uint32_t generation, int fd) {
+    return (static_cast<uint64_t>(op) << 56) | (static_cast<uint64_t>(generation & 0xffffff) << 32)
+        | static_cast<uint32_t>(fd);
+}
+
+bool Server::startIoUring() {
+    uring = new IoUring();
+    if (!uring->setup(URING_ENTRIES, URING_BUFFERS, URING_BUFFER_SIZE)) {
+        int error = errno;
+        delete uring;
+        uring = NULL;
+        errno = error;
+        return false;
+    }
+    std::cout << "Using the io_uring event loop" << std::endl;
+    return true;
+}
+
+Server::UringSlot& Server::uringSlot(int fd) {
+    if (static_cast<size_t>(fd) >= uring_slots.size()) {
+        uring_slots.resize(fd + 1);
+    }
+    return uring_slots[fd];
+}
+
+bool Server::ioUringSendInFlight(int client_fd) const {
+    return static_cast<size_t>(client_fd) < uring_slots.size() && !uring_slots[client_fd].inflight.empty();
+}
+
+void Server::armIoUring() {
+    UringSlot& listener = uringSlot(server_fd);
+    if (!listener.armed) {
+        uring->prepAccept(server_fd, uringTag(URING_ACCEPT, listener.generation, server_fd));
+        listener.armed = true;
+    }
+    if (tls_fd >= 0) {
+        UringSlot& tls_listener = uringSlot(tls_fd);
+        if (!tls_listener.armed) {
+            uring->prepAccept(tls_fd, uringTag(URING_ACCEPT, tls_listener.generation, tls_fd));
+            tls_listener.armed = true;
+        }
+    }
+    for (std::map<int, int>::iterator it = extra_listeners.begin(); it != extra_listeners.end(); ++it) {
+        UringSlot& extra_listener = uringSlot(it->second);
+        if (!extra_listener.armed) {
+            uring->prepAccept(it->second, uringTag(URING_ACCEPT, extra_listener.generation, it->second));
+            extra_listener.armed = true;
+        }
+    }
+
+    const int service_fds[] = { resolver.getFd(), accounts.getFd(), config_loader.getSignalFd(), config_loader.getEventFd() };
+    for (size_t i = 0; i < sizeof(service_fds) / sizeof(service_fds[0]); i++) {
+        if (service_fds[i] < 0) {
+            continue;
+        }
+        UringSlot& service = uringSlot(service_fds[i]);
+        if (!service.armed) {
+            uring->prepPoll(service_fds[i], POLLIN, true, uringTag(URING_SERVICE, service.generation, service_fds[i]));
+            service.armed = true;
+        }
+    }
+
+    // New clients, and clients whose multishot request ended, get (re)armed here
+    for (size_t i = 0; i < clients.size(); i++) {
+        const Client& client = clients[i];
+        if (client.isRemote()) {
+            continue;
+        }
+        UringSlot& slot = uringSlot(client.fd);
+        if (!slot.armed) {
+            if (client.tls) {
+                uring->prepPoll(client.fd, POLLIN, true, uringTag(URING_POLL_IN, slot.generation, client.fd));
+            } else {
+                uring->prepRecv(client.fd, uringTag(URING_RECV, slot.generation, client.fd));
+            }
+            slot.armed = true;
+        }
+        bool wants_write = client.tls_handshaking ? client.tls_want_write
+                                                  : send_queues.find(client.fd) != send_queues.end();
+        if (client.tls && wants_write && !slot.pollout_armed) {
+            uring->prepPoll(client.fd, POLLOUT, false, uringTag(URING_POLL_OUT, slot.generation, client.fd));
+            slot.pollout_armed = true;
+        }
+    }
+}
+
+bool Server::queueIoUringSend(int client_fd) {
+    int client_index = findClientByFd(client_fd);
+    if (client_index == -1 || clients[client_index].tls || uring_quiescing) {
+        return false; // Written directly by flushClient()
+    }
+    UringSlot& slot = uringSlot(client_fd);
+    if (!slot.inflight.empty()) {
+        return true; // Queued data follows once the current send completes
+    }
+    // The kernel owns the buffer until completion, so it moves out of the queue
+    std::map<int, std::string>::iterator queue = send_queues.find(client_fd);
+    slot.inflight.swap(queue->second);
+    send_queues.erase(queue);
+    uring->prepSend(client_fd, slot.inflight.data(), slot.inflight.length(), uringTag(URING_SEND, slot.generation, client_fd));
+    return true;
+}
+
+void Server::detachIoUringClient(int client_fd) {
+    UringSlot& slot = uringSlot(client_fd);
+    // Ends the multishot requests still holding the socket; the kernel keeps
+    // its own reference, so close() alone would leave them running
+    shutdown(client_fd, SHUT_RDWR);
+    if (!slot.inflight.empty()) {
+        orphaned_sends[uringTag(URING_SEND, slot.generation, client_fd)].swap(slot.inflight);
+    }
+    slot.generation++;
+    slot.armed = false;
+    slot.pollout_armed = false;
+}
+
+void Server::handleIoUringCompletion(const IoUring::Completion& completion) {
+    UringOp op = static_cast<UringOp>(completion.user_data >> 56);
+    uint32_t generation = static_cast<uint32_t>(completion.user_data >> 32) & 0xffffff;
+    int fd = static_cast<int>(static_cast<uint32_t>(completion.user_data));
+    bool more = completion.flags & IORING_CQE_F_MORE;
+
+    if (op == URING_CANCEL) {
+        return;
+    }
+    // Received data sits in a ring buffer that must be returned in every case
+    const char* data = NULL;
+    uint16_t buffer_id = 0;
+    if (completion.flags & IORING_CQE_F_BUFFER) {
+        buffer_id = static_cast<uint16_t>(completion.flags >> IORING_CQE_BUFFER_SHIFT);
+        data = uring->bufferData(buffer_id);
+    }
+
+    UringSlot& slot = uringSlot(fd);
+    if ((slot.generation & 0xffffff) != generation) {
+        // Completion for a descriptor that has been closed since
+        if (op == URING_SEND) {
+            orphaned_sends.erase(completion.user_data);
+        }
+        if (data) {
+            uring->recycleBuffer(buffer_id);
+        }
+        return;
+    }
+
+    switch (op) {
+        case URING_ACCEPT:
+            if (!more) {
+                slot.armed = false;
+            }
+            if (completion.res >= 0) {
+                struct sockaddr_storage client_addr;
+                socklen_t client_len = sizeof(client_addr);
+                if (getpeername(completion.res, (struct sockaddr*)&client_addr, &client_len) < 0) {
+                    close(completion.res);
+                } else {
+                    registerConnection(completion.res, client_addr, fd);
+                }
+            } else if (completion.res != -ECANCELED) {
+                errno = -completion.res;
+                perror("accept");
+            }
+            break;
+
+        case URING_RECV: {
+            if (!more) {
+                slot.armed = false;
+            }
+            int client_index = findClientByFd(fd);
+            if (client_index == -1) {
+                break;
+            }
+            if (completion.res > 0) {
+                appendInput(clients[client_index], data, completion.res);
+                uring->recycleBuffer(buffer_id);
+                data = NULL;
+                if (!uring_quiescing) {
+                    processClientInput(client_index);
+                }
+            } else if (completion.res == 0) {
+                std::cout << "Client " << fd << " disconnected" << std::endl;
+                removeClient(client_index, "Connection closed");
+            } else if (completion.res != -ENOBUFS && completion.res != -ECANCELED && completion.res != -EINTR) {
+                // Out of buffers or cancelled just means re-arming next tick
+                errno = -completion.res;
+                perror("recv");
+                std::cout << "Client " << fd << " disconnected due to error" << std::endl;
+                removeClient(client_index, "Read error");
+            }
+            break;
+        }
+
+        case URING_POLL_IN:
+        case URING_POLL_OUT: {
+            if (op == URING_POLL_OUT) {
+                slot.pollout_armed = false;
+            } else if (!more) {
+                slot.armed = false;
+            }
+            int client_index = findClientByFd(fd);
+            if (client_index == -1 || completion.res < 0 || uring_quiescing) {
+                break;
+            }
+            // Pending output is written by the end of the tick; only a handshake needs POLLOUT here
+            if (op == URING_POLL_IN || clients[client_index].tls_handshaking) {
+                handleClientMessage(client_index);
+            }
+            break;
+        }
+
+        case URING_SERVICE:
+            if (!more) {
+                slot.armed = false;
+            }
+            if (completion.res >= 0 && !uring_quiescing) {
+                handleServiceEvent(fd);
+            }
+            break;
+
+        case URING_SEND:
+            if (completion.res >= 0) {
+                if (static_cast<size_t>(completion.res) < slot.inflight.length()) {
+                    notePartialSend(fd, slot.inflight, completion.res);
+                } else {
+                    send_heads.erase(fd);
+                }
+                slot.inflight.erase(0, completion.res);
+            } else if (completion.res != -EAGAIN && completion.res != -ECANCELED && completion.res != -EINTR) {
+                errno = -completion.res;
+                perror("send");
+                slot.inflight.clear();
+                send_queues.erase(fd);
+                send_heads.erase(fd);
+                disconnectClient(fd, "Write error");
+            }
+            // Whatever is left goes back in front of replies queued since
+            if (!slot.inflight.empty()) {
+                send_queues[fd].insert(0, slot.inflight);
+            }
+            // The buffer is only held while a send is in flight
+            std::string().swap(slot.inflight);
+            break;
+
+        default:
+            break;
+    }
+    if (data) {
+        uring->recycleBuffer(buffer_id);
+    }
+}
+
+bool Server::quiesceIoUring() {
+    // Stop every request and collect what they already produced, so the
+    // sockets and all buffered input/output can be handed to a new process.
+    // Only the cancel request's own completion says the ring is idle; what
+    // submitAndWait() returns counts submissions, not completions.
+    uring_quiescing = true;
+    uring->prepCancelAll(uringTag(URING_CANCEL, 0, 0));
+    const long long deadline = monotonicMs() + UPGRADE_TIMEOUT_MS;
+    bool cancelled = false;
+    while (!cancelled) {
+        long long remaining = deadline - monotonicMs();
+        if (remaining <= 0 || (uring->submitAndWait(static_cast<int>(remaining)) < 0 && errno != EINTR)) {
+            break;
+        }
+        IoUring::Completion completion;
+        while (uring->nextCompletion(completion)) {
+            if ((completion.user_data >> 56) == URING_CANCEL) {
+                cancelled = true;
+            }
+            handleIoUringCompletion(completion);
+        }
+    }
+    for (size_t i = 0; i < uring_slots.size(); i++) {
+        uring_slots[i].armed = false;
+        uring_slots[i].pollout_armed = false;
+    }
+    if (!cancelled) {
+        std::cerr << "io_uring requests could not be cancelled in time" << std::endl;
+    }
+    return cancelled;
+}
+
+void Server::resumeIoUring() {
+    uring_quiescing = false;
+    // Input that arrived while quiescing has not been looked at yet
+    std::vector<int> fds;
+    for (size_t i = 0; i < clients.size(); i++) {
+        if (!clients[i].isRemote()) {
+            fds.push_back(clients[i].fd);
+        }
+    }
+    for (size_t i = 0; i < fds.size(); i++) {
+        int client_index = findClientByFd(fds[i]);
+        if (client_index != -1) {
+            processClientInput(client_index);
+        }
+    }
+}
+
+void Server::runIoUring() {
+    while (true) {
+        if (upgrade_requested) {
+            upgrade_requested = 0;
+            // A ring still busy could take input from sockets the new process owns
+            if (quiesceIoUring() && upgrade()) {
+                return;
+            }
+            resumeIoUring();
+        }
+
+        armIoUring();
+
+        int timeout_ms = tickTimeout();
+        // A LIST whose client is not waiting on a send keeps streaming right away
+        for (std::map<int, ListRequest>::const_iterator it = list_requests.begin(); it != list_requests.end(); ++it) {
+            if (!ioUringSendInFlight(it->first)) {
+                timeout_ms = 0;
+                break;
+            }
+        }
+
+        if (uring->submitAndWait(timeout_ms) < 0) {
+            if (errno == EINTR) {
+                continue; // Interrupted by a signal, re-check the flags
+            }
+            perror("io_uring_enter");
+            break;
+        }
+
+        IoUring::Completion completion;
+        while (uring->nextCompletion(completion)) {
+            handleIoUringCompletion(completion);
+        }
+
+        finishTick();
+    }
+}
@@ -0,0 +1,384 @@
+#include "Server.hpp"
+#include "WebSocket.hpp"
+#include <cctype> // For std::tolower
+#include <sstream> // For std::istringstream
+#include <openssl/evp.h> // For EVP_Digest, EVP_EncodeBlock
+
+static const char WEBSOCKET_GUID[] = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+
+// ---- Handshake ----
+
+static std::string lowercase(const std::string& text) {
+    std::string lower = text;
+    for (size_t i = 0; i < lower.length(); i++) {
+        lower[i] = std::tolower(static_cast<unsigned char>(lower[i]));
+    }
+    return lower;
+}
+
+static std::string trimSpaces(const std::string& text) {
+    size_t start = text.find_first_not_of(" \t");
+    if (start == std::string::npos) {
+        return "";
+    }
+    return text.substr(start, text.find_last_not_of(" \t") - start + 1);
+}
+
+// True if the comma separated header value lists the token
+static bool hasToken(const std::string& value, const std::string& token) {
+    std::istringstream items(value);
+    std::string item;
+    while (std::getline(items, item, ',')) {
+        if (lowercase(trimSpaces(item)) == token) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static std::string acceptKey(const std::string& key) {
+    const std::string input = key + WEBSOCKET_GUID;
+    unsigned char digest[EVP_MAX_MD_SIZE];
+    unsigned int digest_length = 0;
+    EVP_Digest(input.data(), input.length(), digest, &digest_length, EVP_sha1(), NULL);
+    unsigned char encoded[4 * ((EVP_MAX_MD_SIZE + 2) / 3) + 1];
+    int encoded_length = EVP_EncodeBlock(encoded, digest, static_cast<int>(digest_length));
+    return std::string(reinterpret_cast<char*>(encoded), encoded_length);
+}
+
+static bool isBase64Key(const std::string& key) {
+    // 16 random bytes in base64
+    if (key.length() != 24 || key.compare(22, 2, "==") != 0) {
+        return false;
+    }
+    for (size_t i = 0; i < 22; i++) {
+        unsigned char c = static_cast<unsigned char>(key[i]);
+        if (!std::isalnum(c) && c != '+' && c != '/') {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool answerWebSocketHandshake(const std::string& request, std::string& response, bool& text_frames) {
+    static const char BAD_REQUEST[] = "HTTP/1.1 400 Bad Request\r\nConnection: close\r\nContent-Length: 0\r\n\r\n";
+    std::istringstream lines(request);
+    std::string line;
+    std::getline(lines, line);
+    std::istringstream request_line(line);
+    std::string method, target, version;
+    request_line >> method >> target >> version;
+    if (method != "GET" || target.empty() || version.compare(0, 5, "HTTP/") != 0 || version < "HTTP/1.1") {
+        response = BAD_REQUEST;
+        return false;
+    }
+
+    std::string upgrade, connection, key, websocket_version, protocols;
+    while (std::getline(lines, line)) {
+        if (!line.empty() && line[line.length() - 1] == '\r') {
+            line.erase(line.length() - 1);
+        }
+        size_t colon = line.find(':');
+        if (colon == std::string::npos) {
+            continue;
+        }
+        const std::string name = lowercase(trimSpaces(line.substr(0, colon)));
+        const std::string value = trimSpaces(line.substr(colon + 1));
+        if (name == "upgrade") {
+            upgrade = value;
+        } else if (name == "connection") {
+            connection = value;
+        } else if (name == "sec-websocket-key") {
+            key = value;
+        } else if (name == "sec-websocket-version") {
+            websocket_version = value;
+        } else if (name == "sec-websocket-protocol") {
+            // May be split over several header lines
+            protocols += (protocols.empty() ? "" : ",") + value;
+        }
+    }
+    if (!hasToken(upgrade, "websocket") || !hasToken(connection, "upgrade") || !isBase64Key(key)) {
+        response = BAD_REQUEST;
+        return false;
+    }
+    if (websocket_version != "13") {
+        response = "HTTP/1.1 426 Upgrade Required\r\nSec-WebSocket-Version: 13\r\nConnection: close\r\nContent-Length: 0\r\n\r\n";
+        return false;
+    }
+
+    // The client's first supported choice wins
+    std::string protocol;
+    std::istringstream offered(protocols);
+    std::string item;
+    while (protocol.empty() && std::getline(offered, item, ',')) {
+        item = lowercase(trimSpaces(item));
+        if (item == "text.ircv3.net" || item == "binary.ircv3.net") {
+            protocol = item;
+        }
+    }
+    text_frames = protocol != "binary.ircv3.net";
+
+    response = "HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n"
+               "Sec-WebSocket-Accept: " + acceptKey(key) + "\r\n";
+    if (!protocol.empty()) {
+        response += "Sec-WebSocket-Protocol: " + protocol + "\r\n";
+    }
+    response += "\r\n";
+    return true;
+}
+
+// ---- Framing ----
+
+WebSocketDecode decodeWebSocketFrame(const std::string& input, size_t& pos, size_t payload_limit, WebSocketFrame& frame) {
+    const size_t available = input.length() - pos;
+    if (available < 2) {
+        return WS_FRAME_INCOMPLETE;
+    }
+    const unsigned char* data = reinterpret_cast<const unsigned char*>(input.data()) + pos;
+    frame.fin = (data[0] & 0x80) != 0;
+    frame.opcode = data[0] & 0x0f;
+    // No extension was negotiated, and clients must mask what they send
+    if ((data[0] & 0x70) || !(data[1] & 0x80)) {
+        return WS_FRAME_INVALID;
+    }
+    if (frame.opcode & 0x8) {
+        if (frame.opcode > WS_PONG || !frame.fin || (data[1] & 0x7f) > 125) {
+            return WS_FRAME_INVALID;
+        }
+    } else if (frame.opcode > WS_BINARY) {
+        return WS_FRAME_INVALID;
+    }
+
+    uint64_t length = data[1] & 0x7f;
+    size_t header = 2;
+    if (length == 126) {
+        if (available < 4) {
+            return WS_FRAME_INCOMPLETE;
+        }
+        length = (static_cast<uint64_t>(data[2]) << 8) | data[3];
+        header = 4;
+    } else if (length == 127) {
+        if (available < 10) {
+            return WS_FRAME_INCOMPLETE;
+        }
+        length = 0;
+        for (size_t i = 2; i < 10; i++) {
+            length = (length << 8) | data[i];
+        }
+        header = 10;
+    }
+    if (length > payload_limit) {
+        return WS_FRAME_TOO_BIG;
+    }
+    if (available < header + 4 + length) {
+        return WS_FRAME_INCOMPLETE;
+    }
+
+    const unsigned char* mask = data + header;
+    frame.payload.assign(reinterpret_cast<const char*>(mask + 4), static_cast<size_t>(length));
+    for (size_t i = 0; i < frame.payload.length(); i++) {
+        frame.payload[i] ^= mask[i % 4];
+    }
+    pos += header + 4 + static_cast<size_t>(length);
+    return WS_FRAME_OK;
+}
+
+std::string encodeWebSocketFrame(unsigned char opcode, const std::string& payload) {
+    std::string frame;
+    frame.reserve(payload.length() + 10);
+    frame += static_cast<char>(0x80 | opcode);
+    if (payload.length() < 126) {
+        frame += static_cast<char>(payload.length());
+    } else if (payload.length() <= 0xffff) {
+        frame += static_cast<char>(126);
+        frame += static_cast<char>(payload.length() >> 8);
+        frame += static_cast<char>(payload.length() & 0xff);
+    } else {
+        frame += static_cast<char>(127);
+        for (int shift = 56; shift >= 0; shift -= 8) {
+            frame += static_cast<char>((static_cast<uint64_t>(payload.length()) >> shift) & 0xff);
+        }
+    }
+    frame += payload;
+    return frame;
+}
+
+// ---- UTF-8 ----
+
+// Length of the well-formed sequence at text[pos], 0 if there is none
+static size_t utf8SequenceLength(const std::string& text, size_t pos) {
+    const unsigned char lead = static_cast<unsigned char>(text[pos]);
+    if (lead < 0x80) {
+        return 1;
+    }
+    size_t length;
+    unsigned char min_second = 0x80, max_second = 0xbf; // Excludes overlongs, surrogates and > U+10FFFF
+    if (lead >= 0xc2 && lead <= 0xdf) {
+        length = 2;
+    } else if (lead >= 0xe0 && lead <= 0xef) {
+        length = 3;
+        if (lead == 0xe0) min_second = 0xa0;
+        if (lead == 0xed) max_second = 0x9f;
+    } else if (lead >= 0xf0 && lead <= 0xf4) {
+        length = 4;
+        if (lead == 0xf0) min_second = 0x90;
+        if (lead == 0xf4) max_second = 0x8f;
+    } else {
+        return 0;
+    }
+    if (pos + length > text.length()) {
+        return 0;
+    }
+    const unsigned char second = static_cast<unsigned char>(text[pos + 1]);
+    if (second < min_second || second > max_second) {
+        return 0;
+    }
+    for (size_t i = 2; i < length; i++) {
+        if ((static_cast<unsigned char>(text[pos + i]) & 0xc0) != 0x80) {
+            return 0;
+        }
+    }
+    return length;
+}
+
+bool isValidUtf8(const std::string& text) {
+    for (size_t pos = 0; pos < text.length(); ) {
+        size_t length = utf8SequenceLength(text, pos);
+        if (length == 0) {
+            return false;
+        }
+        pos += length;
+    }
+    return true;
+}
+
+std::string toValidUtf8(const std::string& text) {
+    if (isValidUtf8(text)) {
+        return text;
+    }
+    std::string valid;
+    for (size_t pos = 0; pos < text.length(); ) {
+        size_t length = utf8SequenceLength(text, pos);
+        if (length == 0) {
+            valid += "\xef\xbf\xbd";
+            pos++;
+        } else {
+            valid.append(text, pos, length);
+            pos += length;
+        }
+    }
+    return valid;
+}
+
+// ---- Server side ----
+
+void Server::appendInput(Client& client, const char* data, size_t length) {
+    // WebSocket clients' bytes are frames, decoded into lines by readWebSocket()
+    ReceiveQueue& queue = receive_queues[client.fd];
+    if (client.websocket != WS_NONE) {
+        queue.websocket_input.append(data, length);
+    } else {
+        queue.lines.append(data, length);
+    }
+}
+
+void Server::readWebSocket(int client_index) {
+    Client& client = clients[client_index];
+    ReceiveQueue& queue = receive_queues[client.fd];
+    if (client.websocket == WS_HANDSHAKE) {
+        size_t end = queue.websocket_input.find("\r\n\r\n");
+        if (end == std::string::npos) {
+            if (queue.websocket_input.length() > WEBSOCKET_HANDSHAKE_LIMIT) {
+                send_queues[client.fd] += "HTTP/1.1 431 Request Header Fields Too Large\r\nConnection: close\r\nContent-Length: 0\r\n\r\n";
+                queue.websocket_input.clear();
+                disconnectClient(client.fd, "Bad WebSocket handshake");
+            }
+            return;
+        }
+        std::string response;
+        bool accepted = answerWebSocketHandshake(queue.websocket_input.substr(0, end + 4), response, client.websocket_text);
+        send_queues[client.fd] += response;
+        queue.websocket_input.erase(0, end + 4);
+        if (!accepted) {
+            queue.websocket_input.clear();
+            disconnectClient(client.fd, "Bad WebSocket handshake");
+            return;
+        }
+        client.websocket = WS_OPEN;
+        startHostLookup(client_index);
+    }
+    if (client.websocket != WS_OPEN) {
+        queue.websocket_input.clear(); // Nothing is read after a close
+        return;
+    }
+
+    size_t pos = 0;
+    WebSocketFrame frame;
+    WebSocketDecode result;
+    while ((result = decodeWebSocketFrame(queue.websocket_input, pos, WEBSOCKET_MESSAGE_LIMIT, frame)) == WS_FRAME_OK) {
+        if (frame.opcode == WS_PING) {
+            std::string& output = send_queues[client.fd];
+            output += encodeWebSocketFrame(WS_PONG, frame.payload);
+            checkSendQueue(client.fd, output);
+            continue;
+        }
+        if (frame.opcode == WS_PONG) {
+            continue;
+        }
+        if (frame.opcode == WS_CLOSE) {
+            closeWebSocket(client_index, 1000, "WebSocket closed");
+            return;
+        }
+
+        // Data frames: a message may arrive in fragments, interleaved with control frames
+        bool continuation = frame.opcode == WS_CONTINUATION;
+        if (continuation != client.websocket_fragmented) {
+            closeWebSocket(client_index, 1002, "WebSocket protocol error");
+            return;
+        }
+        if (!continuation) {
+            queue.websocket_message.clear();
+            client.websocket_message_text = frame.opcode == WS_TEXT;
+        }
+        queue.websocket_message += frame.payload;
+        client.websocket_fragmented = !frame.fin;
+        if (queue.websocket_message.length() > WEBSOCKET_MESSAGE_LIMIT) {
+            closeWebSocket(client_index, 1009, "WebSocket message too big");
+            return;
+        }
+        if (!frame.fin) {
+            continue;
+        }
+        if (client.websocket_message_text && !isValidUtf8(queue.websocket_message)) {
+            closeWebSocket(client_index, 1007, "Invalid UTF-8");
+            return;
+        }
+        // One line per message; a trailing CR LF is tolerated
+        queue.lines += queue.websocket_message;
+        queue.lines += '\n';
+        queue.websocket_message.clear();
+    }
+    queue.websocket_input.erase(0, pos);
+    if (result == WS_FRAME_INVALID) {
+        closeWebSocket(client_index, 1002, "WebSocket protocol error");
+    } else if (result == WS_FRAME_TOO_BIG) {
+        closeWebSocket(client_index, 1009, "WebSocket message too big");
+    }
+}
+
+void Server::closeWebSocket(int client_index, unsigned short status, const std::string& reason) {
+    Client& client = clients[client_index];
+    if (client.websocket != WS_OPEN) {
+        return;
+    }
+    disconnectClient(client.fd, reason);
+    std::string payload;
+    payload += static_cast<char>(status >> 8);
+    payload += static_cast<char>(status & 0xff);
+    send_queues[client.fd] += encodeWebSocketFrame(WS_CLOSE, payload);
+    client.websocket = WS_CLOSING;
+    std::map<int, ReceiveQueue>::iterator queue = receive_queues.find(client.fd);
+    if (queue != receive_queues.end()) {
+        queue->second.websocket_input.clear();
+    }
+}
@@ -1,12 +1,25 @@
 #include "Server.hpp"
 
 int main(int ac, char **av) {
-    if (ac != 3) {
-        std::cerr << "Usage: " << av[0] << " <port> <password>" << std::endl;
+    // Prints an ircserv.accounts hash for the password read from stdin
+    if (ac == 2 && std::string(av[1]) == "--hash-password") {
+        std::string password;
+        std::getline(std::cin, password);
+        std::string hash = Accounts::hashPassword(password);
+        if (hash.empty()) {
+            std::cerr << "Error: could not hash the password" << std::endl;
+            return 1;
+        }
+        std::cout << hash << std::endl;
+        return 0;
+    }
+    if (ac != 3 && ac != 4) {
+        std::cerr << "Usage: " << av[0] << " <port> <password> [tls_port]" << std::endl;
+        std::cerr << "       " << av[0] << " --hash-password < password" << std::endl;
         return 1;
     }
     try {
-        Server server(av[1], av[2]);
+        Server server(av[1], av[2], ac == 4 ? av[3] : "");
         server.run();
     }
     catch (const std::exception& e) {